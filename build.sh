@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Harmony Build Script
-# Usage: ./build.sh [run|test]
+# Usage: ./build.sh [run|test|relay]
 
 mkdir -p build
 
@@ -19,6 +19,21 @@ LIBS="-lavcodec -lavformat -lavutil -lswscale -lwayland-client -lwayland-cursor
 # Includes
 INCLUDES="-Isrc $(pkg-config --cflags libpipewire-0.3 dbus-1 opus)"
 
+# Headless relay (harmony-relay): no Wayland, EGL, PipeWire or FFmpeg, so it
+# builds on a bare server with ./build.sh relay
+RELAY_SOURCES="src/relay_main.c src/platform/linux_threading.c src/platform/linux_time.c src/net/network_udp.c src/net/websocket.c src/net/web_assets.c src/net/aes.c"
+RELAY_LIBS="-lm -lpthread"
+
+if [ "$1" == "relay" ]; then
+    echo "Building Harmony Relay..."
+    if gcc $FLAGS -Isrc $RELAY_SOURCES -o build/harmony-relay $RELAY_LIBS; then
+        echo "Build Successful."
+        exit 0
+    fi
+    echo "Build Failed."
+    exit 1
+fi
+
 # Wayland Protocols
 PROTO_DIR="/usr/share/wayland-protocols/stable/xdg-shell"
 GEN_DIR="src/platform/generated"
@@ -40,7 +55,7 @@ fi
 # Source Files
 # We use a Unity Build (Single Translation Unit) approach for fast builds
 # main.c includes everything else
-SOURCES="src/main.c src/platform/generated/xdg-shell-protocol.c src/platform/generated/xdg-decoration-protocol.c src/platform/linux_threading.c src/platform/linux_wayland.c src/platform/linux_portal.c src/platform/capture_pipewire.c src/platform/audio_pipewire.c src/platform/config_linux.c src/codec/codec_ffmpeg.c src/codec/codec_ffmpeg_decode.c src/codec/audio_opus.c src/net/network_udp.c src/net/websocket.c src/net/aes.c src/ui/render_gl.c src/ui/ui_simple.c"
+SOURCES="src/main.c src/platform/generated/xdg-shell-protocol.c src/platform/generated/xdg-decoration-protocol.c src/platform/linux_threading.c src/platform/linux_time.c src/platform/linux_random.c src/platform/linux_wayland.c src/platform/linux_portal.c src/platform/capture_pipewire.c src/platform/audio_pipewire.c src/platform/config_linux.c src/codec/codec_ffmpeg.c src/codec/codec_ffmpeg_decode.c src/codec/audio_opus.c src/codec/yuv_scale.c src/net/network_udp.c src/net/websocket.c src/net/web_assets.c src/net/aes.c src/ui/render_gl.c src/ui/ui_simple.c"
 
 echo "Building Harmony..."
 gcc $FLAGS $INCLUDES $SOURCES -o build/harmony $LIBS
@@ -61,6 +76,22 @@ if [ $? -eq 0 ]; then
         echo -e "\nRunning Network Test..."
         gcc $TEST_FLAGS $INCLUDES tests/test_net_runner.c -o build/test_net $LIBS
         ./build/test_net
+
+        echo -e "\nRunning Send Scheduler Test..."
+        gcc $TEST_FLAGS $INCLUDES tests/test_sched_runner.c -o build/test_sched $LIBS
+        ./build/test_sched
+
+        echo -e "\nRunning AES Test..."
+        gcc $TEST_FLAGS $INCLUDES tests/test_aes_runner.c -o build/test_aes $LIBS
+        ./build/test_aes
+
+        echo -e "\nRunning Relay Test..."
+        gcc $TEST_FLAGS -Isrc tests/test_relay_runner.c -o build/test_relay $RELAY_LIBS
+        ./build/test_relay
+
+        echo -e "\nRunning WebSocket Test..."
+        gcc $TEST_FLAGS -Isrc tests/test_ws_runner.c -o build/test_ws $RELAY_LIBS
+        ./build/test_ws
     fi
 else
     echo "Build Failed."
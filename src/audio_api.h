@@ -8,15 +8,38 @@
 // Audio format constants
 #define AUDIO_SAMPLE_RATE 48000
 #define AUDIO_CHANNELS 2
-#define AUDIO_FRAME_SIZE 960  // 20ms at 48kHz (Opus standard frame size)
+#define AUDIO_FRAME_SIZE 960  // 20ms at 48kHz: the default Opus frame
+#define AUDIO_MAX_PACKET_SIZE 5760 // 120ms: the longest Opus packet
+
+// The host picks its Opus framing (config) and advertises it in the stream
+// metadata: 2.5, 5 or 10 ms frames (120, 240, 480 samples) cut latency, and
+// several 20 ms frames per packet cut the packet rate on constrained links.
+// A packet is frame size x frames per packet samples (per channel).
+#define AUDIO_MAX_FRAMES_PER_PACKET 6
 
 // Raw PCM audio frame (before encoding)
 typedef struct AudioFrame {
     int16_t *samples;       // Interleaved S16LE samples
     int sample_count;       // Number of samples per channel
     int channels;
+    double timestamp;       // Capture time of the first sample (OS_GetTime), 0 if unknown
 } AudioFrame;
 
+// Health of the ring between PipeWire's realtime thread and ours, counted
+// since init
+typedef struct AudioBufferStats {
+    uint32_t buffered;  // Samples waiting (all channels)
+    uint32_t overflows; // Writes dropped in full or in part: ring full
+    uint32_t underruns; // Reads that found too few samples
+
+    // Playback jitter buffer (zero for capture)
+    float depth_ms;  // Audio queued for playout
+    float target_ms; // Depth the arrival jitter needs
+    float sync_ms;   // Depth A/V sync asked for (0 = none); the larger one wins
+    float jitter_ms; // Smoothed packet arrival jitter
+    float drift_ppm; // Playout rate correction: the host's clock against ours
+} AudioBufferStats;
+
 // Encoded audio packet
 typedef struct EncodedAudio {
     uint8_t *data;
@@ -42,16 +65,24 @@ void Audio_EnumerateNodes(MemoryArena *arena, AudioNodeList *out_list);
 // --- Audio Capture (Host) ---
 typedef struct AudioCaptureContext AudioCaptureContext;
 
-AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_id);
-void Audio_PollCapture(AudioCaptureContext *ctx);
+// Capture runs on its own PipeWire thread from init on. Captured frames are
+// `packet_size` samples (per channel) long: one packet's worth.
+AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_id, uint32_t packet_size);
+// Blocks until a whole packet is buffered (true) or `timeout_ms` passes
+bool Audio_WaitCapture(AudioCaptureContext *ctx, int timeout_ms);
 AudioFrame* Audio_GetCapturedFrame(AudioCaptureContext *ctx);
+void Audio_GetCaptureStats(AudioCaptureContext *ctx, AudioBufferStats *out);
 void Audio_CloseCapture(AudioCaptureContext *ctx);
 
 // --- Audio Encoder (Opus) ---
 typedef struct AudioEncoder AudioEncoder;
 
-AudioEncoder* Audio_InitEncoder(MemoryArena *arena);
+// `frame_size`: samples per Opus frame (120, 240, 480 or 960)
+AudioEncoder* Audio_InitEncoder(MemoryArena *arena, uint32_t frame_size);
+// Encodes one packet: a frame, or several 20 ms frames packed together
 void Audio_Encode(AudioEncoder *enc, AudioFrame *frame, EncodedAudio *out);
+// Loss the viewers report, in percent: how much in-band FEC to spend
+void Audio_SetPacketLoss(AudioEncoder *enc, int percent);
 void Audio_CloseEncoder(AudioEncoder *enc);
 
 // --- Audio Decoder (Opus) ---
@@ -59,6 +90,9 @@ typedef struct AudioDecoder AudioDecoder;
 
 AudioDecoder* Audio_InitDecoder(MemoryArena *arena);
 void Audio_Decode(AudioDecoder *dec, void *data, size_t size, AudioFrame *out);
+// Conceals one lost packet: from the in-band FEC of `next` (the packet after
+// it) if given and present, else by packet loss concealment (next = NULL)
+void Audio_DecodeLost(AudioDecoder *dec, void *next, size_t next_size, AudioFrame *out);
 void Audio_CloseDecoder(AudioDecoder *dec);
 
 // --- Audio Playback (Viewer) ---
@@ -67,6 +101,16 @@ typedef struct AudioPlaybackContext AudioPlaybackContext;
 AudioPlaybackContext* Audio_InitPlayback(MemoryArena *arena);
 void Audio_PollPlayback(AudioPlaybackContext *ctx);
 void Audio_WritePlayback(AudioPlaybackContext *ctx, AudioFrame *frame);
+// Audio made up for a lost packet (concealment or FEC): played like any
+// other, but not an arrival, so loss doesn't count as jitter
+void Audio_WriteConcealed(AudioPlaybackContext *ctx, AudioFrame *frame);
+// Buffer at least `ms` of audio (A/V sync: audio plays when its video is
+// shown); the depth changes gradually, by resampling
+void Audio_SetPlaybackDelay(AudioPlaybackContext *ctx, float ms);
+// Samples per packet (per channel) the host advertises: sizes the jitter
+// buffer until arrivals have been measured
+void Audio_SetPlaybackPacket(AudioPlaybackContext *ctx, uint32_t packet_size);
+void Audio_GetPlaybackStats(AudioPlaybackContext *ctx, AudioBufferStats *out);
 void Audio_ClosePlayback(AudioPlaybackContext *ctx);
 
 #endif // HARMONY_AUDIO_API_H
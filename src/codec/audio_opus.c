@@ -12,17 +12,24 @@ struct AudioEncoder {
   MemoryArena *arena;
   uint8_t *encode_buffer;
   int encode_buffer_size;
+  int frame_size;
 };
 
-AudioEncoder *Audio_InitEncoder(MemoryArena *arena) {
+AudioEncoder *Audio_InitEncoder(MemoryArena *arena, uint32_t frame_size) {
   AudioEncoder *enc = PushStructZero(arena, AudioEncoder);
   enc->arena = arena;
+  enc->frame_size = (int)frame_size;
+
+  // Frames under 10 ms are CELT-only anyway, and were picked for latency:
+  // the low-delay application also drops SILK's extra 4 ms of lookahead
+  // (and with SILK, in-band FEC)
+  int application = frame_size < AUDIO_SAMPLE_RATE / 100
+                        ? OPUS_APPLICATION_RESTRICTED_LOWDELAY
+                        : OPUS_APPLICATION_AUDIO; // Optimized for music/audio
 
   int error;
-  enc->encoder =
-      opus_encoder_create(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS,
-                          OPUS_APPLICATION_AUDIO, // Optimized for music/audio
-                          &error);
+  enc->encoder = opus_encoder_create(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS,
+                                     application, &error);
 
   if (error != OPUS_OK) {
     fprintf(stderr, "Audio: Opus encoder create failed: %s\n",
@@ -33,12 +40,20 @@ AudioEncoder *Audio_InitEncoder(MemoryArena *arena) {
   // Configure encoder
   opus_encoder_ctl(enc->encoder, OPUS_SET_BITRATE(128000)); // 128 kbps
   opus_encoder_ctl(enc->encoder, OPUS_SET_COMPLEXITY(5)); // Balance quality/CPU
-
-  // Max encoded size (Opus recommends 4000 bytes for safety)
-  enc->encode_buffer_size = 4000;
+  // In-band FEC: each packet carries a low-bitrate copy of the previous one,
+  // sized by the loss viewers report (none until they do). libopus puts it
+  // in SILK/hybrid frames and leans towards those as loss rises.
+  opus_encoder_ctl(enc->encoder, OPUS_SET_INBAND_FEC(1));
+  opus_encoder_ctl(enc->encoder, OPUS_SET_PACKET_LOSS_PERC(0));
+
+  // Max encoded size (Opus recommends 4000 bytes for safety), per 20 ms
+  // frame of the longest packet
+  enc->encode_buffer_size =
+      4000 * AUDIO_MAX_PACKET_SIZE / AUDIO_FRAME_SIZE;
   enc->encode_buffer = ArenaPush(arena, enc->encode_buffer_size);
 
-  printf("Audio: Opus encoder initialized (128kbps stereo)\n");
+  printf("Audio: Opus encoder initialized (128kbps stereo, %.1f ms frames)\n",
+         frame_size * 1000.0 / AUDIO_SAMPLE_RATE);
   return enc;
 }
 
@@ -46,9 +61,18 @@ void Audio_Encode(AudioEncoder *enc, AudioFrame *frame, EncodedAudio *out) {
   if (!enc || !frame || !out)
     return;
 
-  int encoded_bytes =
-      opus_encode(enc->encoder, frame->samples, frame->sample_count,
-                  enc->encode_buffer, enc->encode_buffer_size);
+  // A packet of several 20 ms frames (40-120 ms) is a single call: libopus
+  // builds the multi-frame packet itself, keeping its frames' mode and
+  // bandwidth consistent. Shorter frames always go one per packet.
+  int encoded_bytes = OPUS_BAD_ARG;
+  if (frame->sample_count == enc->frame_size ||
+      (enc->frame_size == AUDIO_FRAME_SIZE &&
+       frame->sample_count % AUDIO_FRAME_SIZE == 0 &&
+       frame->sample_count <= AUDIO_MAX_PACKET_SIZE)) {
+    encoded_bytes =
+        opus_encode(enc->encoder, frame->samples, frame->sample_count,
+                    enc->encode_buffer, enc->encode_buffer_size);
+  }
 
   if (encoded_bytes < 0) {
     fprintf(stderr, "Audio: Opus encode error: %s\n",
@@ -62,6 +86,16 @@ void Audio_Encode(AudioEncoder *enc, AudioFrame *frame, EncodedAudio *out) {
   out->size = encoded_bytes;
 }
 
+void Audio_SetPacketLoss(AudioEncoder *enc, int percent) {
+  if (!enc)
+    return;
+  if (percent < 0)
+    percent = 0;
+  if (percent > 100)
+    percent = 100;
+  opus_encoder_ctl(enc->encoder, OPUS_SET_PACKET_LOSS_PERC(percent));
+}
+
 void Audio_CloseEncoder(AudioEncoder *enc) {
   if (enc && enc->encoder) {
     opus_encoder_destroy(enc->encoder);
@@ -121,6 +155,33 @@ void Audio_Decode(AudioDecoder *dec, void *data, size_t size, AudioFrame *out) {
   out->channels = AUDIO_CHANNELS;
 }
 
+void Audio_DecodeLost(AudioDecoder *dec, void *next, size_t next_size,
+                      AudioFrame *out) {
+  if (!dec || !out)
+    return;
+
+  // The lost packet most likely lasted as long as the last one decoded
+  opus_int32 duration = 0;
+  opus_decoder_ctl(dec->decoder, OPUS_GET_LAST_PACKET_DURATION(&duration));
+  if (duration <= 0 || duration > 5760)
+    duration = AUDIO_FRAME_SIZE;
+
+  // With FEC requested, a packet without FEC data falls back to concealment
+  int decoded_samples = opus_decode(
+      dec->decoder, (const unsigned char *)next, next ? (opus_int32)next_size : 0,
+      dec->decode_buffer, duration, next ? 1 : 0);
+
+  if (decoded_samples < 0) {
+    out->samples = NULL;
+    out->sample_count = 0;
+    return;
+  }
+
+  out->samples = dec->decode_buffer;
+  out->sample_count = decoded_samples;
+  out->channels = AUDIO_CHANNELS;
+}
+
 void Audio_CloseDecoder(AudioDecoder *dec) {
   if (dec && dec->decoder) {
     opus_decoder_destroy(dec->decoder);
@@ -4,47 +4,86 @@
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 
+// Number of YUV frames kept alive across reconfigurations. Two covers the common
+// case of a window bouncing between two sizes without reallocating either.
+#define ENCODER_FRAME_POOL_SIZE 2
+
+// Periodic IDR interval. Viewers ask for keyframes when they join or lose data
+// (Codec_RequestKeyframe), so the periodic IDR is only a safety net.
+#define ENCODER_KEYFRAME_INTERVAL_SECONDS 10
+
+// Intra-refresh: one rolling column sweep per second. A viewer joining at the
+// start of a sweep has a clean picture after this many frames.
+#define ENCODER_REFRESH_PERIOD_SECONDS 1
+
+// Capture times of frames inside the encoder, by pts. Output can trail input
+// (temporal-layer mode holds a B frame back), so packets look theirs up.
+#define ENCODER_CAPTURE_HISTORY 16
+
 struct EncoderContext {
     AVCodecContext *codec_ctx;
-    AVFrame *frame_yuv;
+    AVFrame *frame_yuv; // Points into frame_pool, matches the current resolution
+    AVFrame *frame_pool[ENCODER_FRAME_POOL_SIZE];
+    int frame_pool_next; // Round-robin slot to evict when no frame matches
     struct SwsContext *sws_ctx;
+    VideoFormat format;
     int pts_counter;
+    double capture_times[ENCODER_CAPTURE_HISTORY]; // Indexed by pts
+    bool keyframe_requested; // Force an IDR on the next encoded frame
+    int refresh_frames_left; // Intra-refresh: frames until the current sweep completes
 };
 
-EncoderContext* Codec_InitEncoder(MemoryArena *arena, VideoFormat format) {
-    // Note: We use the arena for our context, but FFmpeg manages its own memory internally.
-    EncoderContext *ctx = PushStructZero(arena, EncoderContext);
+// VBR Rate Control: Allow short bursts for high-motion scenes
+// rc_max_rate at 1.5x allows encoder headroom for complex frames
+// rc_buffer_size (1s buffer) allows encoder to "borrow" bits for complex frames
+// libx264 compares these against its live parameters before every frame and
+// applies changes through x264_encoder_reconfig, so updating them is free.
+static void Codec_ApplyRateControl(AVCodecContext *codec_ctx, int bitrate) {
+    codec_ctx->bit_rate = bitrate;
+    codec_ctx->rc_max_rate = (int64_t)bitrate * 3 / 2; // 1.5x burst capacity
+    codec_ctx->rc_buffer_size = bitrate; // 1 second buffer
+}
+
+static bool Codec_OpenContext(EncoderContext *ctx) {
+    VideoFormat *format = &ctx->format;
 
     const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
     if (!codec) {
         fprintf(stderr, "Codec_InitEncoder: H.264 codec not found\n");
-        return NULL;
+        return false;
     }
 
     ctx->codec_ctx = avcodec_alloc_context3(codec);
     if (!ctx->codec_ctx) {
         fprintf(stderr, "Codec_InitEncoder: Could not allocate video codec context\n");
-        return NULL;
+        return false;
     }
 
     // Set Codec Parameters
-    ctx->codec_ctx->bit_rate = format.bitrate;
-    ctx->codec_ctx->width = format.width;
-    ctx->codec_ctx->height = format.height;
-    ctx->codec_ctx->time_base = (AVRational){1, format.fps};
-    ctx->codec_ctx->framerate = (AVRational){format.fps, 1};
-    ctx->codec_ctx->gop_size = 10; // Frequent keyframes for low latency recovery
+    ctx->codec_ctx->width = format->width;
+    ctx->codec_ctx->height = format->height;
+    ctx->codec_ctx->time_base = (AVRational){1, format->fps};
+    ctx->codec_ctx->framerate = (AVRational){format->fps, 1};
+    ctx->codec_ctx->gop_size = format->fps * ENCODER_KEYFRAME_INTERVAL_SECONDS; // Long GOP, IDRs on demand
+    if (format->intra_refresh) {
+        // With intra-refresh the GOP length is the refresh sweep length
+        ctx->codec_ctx->gop_size = format->fps * ENCODER_REFRESH_PERIOD_SECONDS;
+    }
     ctx->codec_ctx->max_b_frames = 0; // No B-frames for low latency
+    if (format->temporal_layers) {
+        // Temporal scalability: x264 cannot make a P frame non-reference, so
+        // every other frame is a B frame that nothing refers to (P b P b).
+        // Fixed pattern, no pyramid: each B is droppable on its own. Costs one
+        // frame of reorder delay at both ends.
+        ctx->codec_ctx->max_b_frames = 1;
+        av_opt_set_int(ctx->codec_ctx->priv_data, "b_strategy", 0, 0);
+        av_opt_set(ctx->codec_ctx->priv_data, "b-pyramid", "none", 0);
+    }
     ctx->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    
-    // VBR Rate Control: Allow short bursts for high-motion scenes
-    // rc_max_rate at 1.5x allows encoder headroom for complex frames
-    // rc_buffer_size (1s buffer) allows encoder to "borrow" bits for complex frames
-    ctx->codec_ctx->rc_max_rate = format.bitrate * 3 / 2; // 1.5x burst capacity
-    ctx->codec_ctx->rc_buffer_size = format.bitrate; // 1 second buffer
+    Codec_ApplyRateControl(ctx->codec_ctx, format->bitrate);
 
     // Encoder preset from config (default: 'faster' for good quality/speed balance)
-    const char *preset = (format.preset[0] != '\0') ? format.preset : "faster";
+    const char *preset = (format->preset[0] != '\0') ? format->preset : "faster";
     av_opt_set(ctx->codec_ctx->priv_data, "preset", preset, 0);
     av_opt_set(ctx->codec_ctx->priv_data, "tune", "zerolatency", 0);
     
@@ -53,43 +92,194 @@ EncoderContext* Codec_InitEncoder(MemoryArena *arena, VideoFormat format) {
     // (common when viewer connects mid-stream or packets are lost over network)
     av_opt_set_int(ctx->codec_ctx->priv_data, "repeat_headers", 1, 0);
 
+    // Frames forced to AV_PICTURE_TYPE_I become IDRs, so a requested keyframe
+    // is a real recovery point for a viewer that lost references.
+    av_opt_set_int(ctx->codec_ctx->priv_data, "forced-idr", 1, 0);
+
+    // Periodic Intra Refresh: spreads intra blocks over gop_size frames instead
+    // of emitting IDRs, so frame sizes stay nearly constant. Only the first
+    // frame (and forced keyframes) are IDRs; every sweep start is a keyframe
+    // with a recovery point SEI.
+    if (format->intra_refresh) {
+        av_opt_set_int(ctx->codec_ctx->priv_data, "intra-refresh", 1, 0);
+    }
+
+    // Sliced mode: many small independently decodable slices, sized to fit a
+    // network chunk, so a lost chunk costs one slice and the viewer can start
+    // decoding before the whole frame has arrived.
+    if (format->slice_max_size > 0) {
+        char x264_params[64];
+        snprintf(x264_params, sizeof(x264_params), "slice-max-size=%d", format->slice_max_size);
+        av_opt_set(ctx->codec_ctx->priv_data, "x264-params", x264_params, 0);
+    }
+
     if (avcodec_open2(ctx->codec_ctx, codec, NULL) < 0) {
         fprintf(stderr, "Codec_InitEncoder: Could not open codec\n");
-        return NULL;
+        avcodec_free_context(&ctx->codec_ctx);
+        return false;
     }
 
-    // Allocate Reusable YUV Frame
-    ctx->frame_yuv = av_frame_alloc();
-    ctx->frame_yuv->format = ctx->codec_ctx->pix_fmt;
-    ctx->frame_yuv->width = ctx->codec_ctx->width;
-    ctx->frame_yuv->height = ctx->codec_ctx->height;
+    return true;
+}
+
+// Picks a pooled YUV frame for the current resolution, allocating (or evicting
+// the oldest slot) only when no pooled frame has matching dimensions.
+static bool Codec_AcquireFrame(EncoderContext *ctx) {
+    for (int i = 0; i < ENCODER_FRAME_POOL_SIZE; ++i) {
+        AVFrame *f = ctx->frame_pool[i];
+        if (f && f->width == ctx->format.width && f->height == ctx->format.height) {
+            ctx->frame_yuv = f;
+            return true;
+        }
+    }
+
+    int slot = ctx->frame_pool_next;
+    ctx->frame_pool_next = (slot + 1) % ENCODER_FRAME_POOL_SIZE;
+    if (ctx->frame_pool[slot]) {
+        av_frame_free(&ctx->frame_pool[slot]);
+    }
+
+    AVFrame *f = av_frame_alloc();
+    f->format = AV_PIX_FMT_YUV420P;
+    f->width = ctx->format.width;
+    f->height = ctx->format.height;
     
-    if (av_frame_get_buffer(ctx->frame_yuv, 32) < 0) {
+    if (av_frame_get_buffer(f, 32) < 0) {
         fprintf(stderr, "Codec_InitEncoder: Could not allocate frame data\n");
-        return NULL;
+        av_frame_free(&f);
+        ctx->frame_yuv = NULL;
+        return false;
     }
 
-    // Initialize SWS Context for RGB -> YUV conversion
-    // Assuming input is RGB24 or RGBA. We'll decide standard input format: likely RGBA from OpenGL/Wayland
-    // UPDATE: Capture provides BGRx (BGRA), so we must tell SWS to expect BGRA.
-    ctx->sws_ctx = sws_getContext(
-        format.width, format.height, AV_PIX_FMT_BGRA, // Changed from RGBA
-        format.width, format.height, AV_PIX_FMT_YUV420P,
+    ctx->frame_pool[slot] = f;
+    ctx->frame_yuv = f;
+    return true;
+}
+
+// Initialize SWS Context for RGB -> YUV conversion
+// Capture provides BGRx (BGRA), so we must tell SWS to expect BGRA.
+// sws_getCachedContext keeps the existing context when the geometry is unchanged.
+static bool Codec_PrepareScaler(EncoderContext *ctx) {
+    ctx->sws_ctx = sws_getCachedContext(
+        ctx->sws_ctx,
+        ctx->format.width, ctx->format.height, AV_PIX_FMT_BGRA,
+        ctx->format.width, ctx->format.height, AV_PIX_FMT_YUV420P,
         SWS_BILINEAR, NULL, NULL, NULL
     );
+    return ctx->sws_ctx != NULL;
+}
+
+EncoderContext* Codec_InitEncoder(MemoryArena *arena, VideoFormat format) {
+    // Note: We use the arena for our context, but FFmpeg manages its own memory internally.
+    // The context is reconfigured in place (Codec_Reconfigure) so it is pushed only once.
+    EncoderContext *ctx = PushStructZero(arena, EncoderContext);
+    ctx->format = format;
+
+    if (!Codec_OpenContext(ctx) || !Codec_AcquireFrame(ctx) || !Codec_PrepareScaler(ctx)) {
+        Codec_CloseEncoder(ctx);
+        return NULL;
+    }
 
     return ctx;
 }
 
+void Codec_SetBitrate(EncoderContext *ctx, int bitrate) {
+    if (!ctx || bitrate <= 0) return;
+    ctx->format.bitrate = bitrate;
+    if (ctx->codec_ctx) {
+        Codec_ApplyRateControl(ctx->codec_ctx, bitrate);
+    }
+}
+
+bool Codec_Reconfigure(EncoderContext *ctx, VideoFormat format) {
+    if (!ctx) return false;
+
+    bool needs_reopen = !ctx->codec_ctx ||
+                        format.width != ctx->format.width ||
+                        format.height != ctx->format.height ||
+                        format.fps != ctx->format.fps ||
+                        format.intra_refresh != ctx->format.intra_refresh ||
+                        format.slice_max_size != ctx->format.slice_max_size ||
+                        format.temporal_layers != ctx->format.temporal_layers ||
+                        strcmp(format.preset, ctx->format.preset) != 0;
+
+    if (!needs_reopen) {
+        // Rate-only change: applied by libx264 on the next frame, no IDR.
+        Codec_SetBitrate(ctx, format.bitrate);
+        return true;
+    }
+
+    // Geometry/timebase changes need a new SPS, so the x264 instance is reopened.
+    // The EncoderContext itself, the frame pool and the scaler are reused.
+    if (ctx->codec_ctx) {
+        avcodec_free_context(&ctx->codec_ctx);
+    }
+    ctx->format = format;
+    ctx->pts_counter = 0;
+
+    if (!Codec_OpenContext(ctx) || !Codec_AcquireFrame(ctx) || !Codec_PrepareScaler(ctx)) {
+        fprintf(stderr, "Codec_Reconfigure: Failed to reconfigure encoder to %dx%d@%d\n",
+                format.width, format.height, format.fps);
+        return false;
+    }
+    return true;
+}
+
+// Returns the NAL header byte of the first slice in an Annex-B access unit,
+// or -1. Only walks the headers in front of the first VCL NAL, not the slice
+// data.
+static int Codec_FirstSliceHeader(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i + 3 < size; i++) {
+        if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1) {
+            int nal_type = data[i+3] & 0x1F;
+            if (nal_type >= 1 && nal_type <= 5) return data[i+3];
+            i += 3;
+        }
+    }
+    return -1;
+}
+
+static int Codec_FirstSliceType(const uint8_t *data, size_t size) {
+    int header = Codec_FirstSliceHeader(data, size);
+    return header < 0 ? -1 : (header & 0x1F);
+}
+
+void Codec_RequestKeyframe(EncoderContext *ctx) {
+    if (ctx) ctx->keyframe_requested = true;
+}
+
 void Codec_EncodeFrame(EncoderContext *ctx, VideoFrame *frame, MemoryArena *packet_arena, EncodedPacket *out_packet) {
+    out_packet->size = 0;
+    if (!ctx->codec_ctx || !ctx->frame_yuv) return;
+
     // 1. Convert Input Frame (RGBA) to YUV
-    // Note: frame->data and frame->linesize match the signature expected by sws_scale
-    sws_scale(ctx->sws_ctx, 
-              (const uint8_t * const *)frame->data, frame->linesize, 
-              0, ctx->codec_ctx->height,
-              ctx->frame_yuv->data, ctx->frame_yuv->linesize);
+    if (frame->pixel_format == VIDEO_PIXEL_I420) {
+        // Simulcast layer: already converted (and downscaled) upstream
+        if (frame->width != ctx->codec_ctx->width || frame->height != ctx->codec_ctx->height) {
+            fprintf(stderr, "Codec_EncodeFrame: I420 frame is %dx%d, encoder is %dx%d\n",
+                    frame->width, frame->height, ctx->codec_ctx->width, ctx->codec_ctx->height);
+            return;
+        }
+        for (int p = 0; p < 3; ++p) {
+            int rows = p ? (frame->height + 1) / 2 : frame->height;
+            int bytes = p ? (frame->width + 1) / 2 : frame->width;
+            for (int y = 0; y < rows; ++y) {
+                memcpy(ctx->frame_yuv->data[p] + (size_t)y * ctx->frame_yuv->linesize[p],
+                       frame->data[p] + (size_t)y * frame->linesize[p], bytes);
+            }
+        }
+    } else {
+        // Note: frame->data and frame->linesize match the signature expected by sws_scale
+        sws_scale(ctx->sws_ctx, 
+                  (const uint8_t * const *)frame->data, frame->linesize, 
+                  0, ctx->codec_ctx->height,
+                  ctx->frame_yuv->data, ctx->frame_yuv->linesize);
+    }
 
+    ctx->capture_times[ctx->pts_counter % ENCODER_CAPTURE_HISTORY] = frame->timestamp;
     ctx->frame_yuv->pts = ctx->pts_counter++;
+    ctx->frame_yuv->pict_type = ctx->keyframe_requested ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    ctx->keyframe_requested = false;
 
     // 2. Send Frame to Encoder
     int ret = avcodec_send_frame(ctx->codec_ctx, ctx->frame_yuv);
@@ -99,9 +289,12 @@ void Codec_EncodeFrame(EncoderContext *ctx, VideoFrame *frame, MemoryArena *pack
     }
 
     // 3. Receive Packets
-    // In low latency mode, we expect 1 packet out per frame usually.
-    // However, the API allows multiple packets. For simplicity in this loop, we just grab one.
-    // TODO: Handle multiple packets if needed (rare with 0 B-frames and consistent size)
+    // One receive is enough: libx264 is a frame-callback encoder in FFmpeg,
+    // each send_frame runs x264_encoder_encode once, which returns at most
+    // one access unit (all slices of a frame in one packet). Only the flush
+    // at end of stream, which we never do, yields several per call.
+    // With B frames (temporal-layer mode) the packet is usually not the frame
+    // just sent: output runs a frame behind input, in decode order.
     AVPacket *av_pkt = av_packet_alloc();
     ret = avcodec_receive_packet(ctx->codec_ctx, av_pkt);
     if (ret == 0) {
@@ -113,7 +306,29 @@ void Codec_EncodeFrame(EncoderContext *ctx, VideoFrame *frame, MemoryArena *pack
 
         out_packet->pts = av_pkt->pts;
         out_packet->dts = av_pkt->dts;
+        out_packet->timestamp_us = (uint32_t)(uint64_t)(
+            ctx->capture_times[av_pkt->pts % ENCODER_CAPTURE_HISTORY] * 1e6);
         out_packet->keyframe = (av_pkt->flags & AV_PKT_FLAG_KEY);
+
+        // nal_ref_idc 0: nothing refers to this frame (the B frames of
+        // temporal-layer mode), so dropping it costs no decode errors
+        out_packet->temporal_layer = 0;
+        if (ctx->format.temporal_layers) {
+            int header = Codec_FirstSliceHeader(out_packet->data, out_packet->size);
+            out_packet->temporal_layer = (header >= 0 && (header & 0x60) == 0) ? 1 : 0;
+        }
+
+        // Recovery points: an IDR is clean immediately. An intra-refresh
+        // keyframe only starts a sweep, which is clean gop_size frames later.
+        out_packet->recovery_point = false;
+        if (out_packet->keyframe) {
+            bool is_idr = !ctx->format.intra_refresh ||
+                          Codec_FirstSliceType(out_packet->data, out_packet->size) == 5;
+            ctx->refresh_frames_left = is_idr ? 0 : ctx->codec_ctx->gop_size;
+            out_packet->recovery_point = is_idr;
+        } else if (ctx->refresh_frames_left > 0 && --ctx->refresh_frames_left == 0) {
+            out_packet->recovery_point = true;
+        }
         
         av_packet_unref(av_pkt);
     } else if (ret == AVERROR(EAGAIN)) {
@@ -132,8 +347,10 @@ void Codec_CloseEncoder(EncoderContext *ctx) {
     if (ctx->codec_ctx) {
         avcodec_free_context(&ctx->codec_ctx);
     }
-    if (ctx->frame_yuv) {
-        av_frame_free(&ctx->frame_yuv);
+    for (int i = 0; i < ENCODER_FRAME_POOL_SIZE; ++i) {
+        if (ctx->frame_pool[i]) {
+            av_frame_free(&ctx->frame_pool[i]);
+        }
     }
     if (ctx->sws_ctx) {
         sws_freeContext(ctx->sws_ctx);
@@ -142,3 +359,44 @@ void Codec_CloseEncoder(EncoderContext *ctx) {
     // Arena-allocated struct remains "allocated" until arena reset, but we zero it to define it as closed.
     memset(ctx, 0, sizeof(EncoderContext));
 }
+
+// --- Simulcast frame conversion ---
+
+struct FrameConverter {
+    struct SwsContext *sws_ctx;
+};
+
+FrameConverter* Codec_InitConverter(MemoryArena *arena) {
+    return PushStructZero(arena, FrameConverter);
+}
+
+bool Codec_ConvertToI420(FrameConverter *ctx, const VideoFrame *in, uint8_t *buffer, VideoFrame *out) {
+    // Same conversion the encoder does for BGRx input; the cached context
+    // follows capture resolution changes
+    ctx->sws_ctx = sws_getCachedContext(
+        ctx->sws_ctx,
+        in->width, in->height, AV_PIX_FMT_BGRA,
+        in->width, in->height, AV_PIX_FMT_YUV420P,
+        SWS_BILINEAR, NULL, NULL, NULL
+    );
+    if (!ctx->sws_ctx) {
+        fprintf(stderr, "Codec_ConvertToI420: Could not create scaler for %dx%d\n", in->width, in->height);
+        return false;
+    }
+
+    Codec_LayoutI420(buffer, in->width, in->height, out);
+    sws_scale(ctx->sws_ctx,
+              (const uint8_t * const *)in->data, in->linesize,
+              0, in->height,
+              out->data, out->linesize);
+    out->timestamp = in->timestamp;
+    return true;
+}
+
+void Codec_CloseConverter(FrameConverter *ctx) {
+    if (!ctx) return;
+    if (ctx->sws_ctx) {
+        sws_freeContext(ctx->sws_ctx);
+        ctx->sws_ctx = NULL;
+    }
+}
@@ -1,11 +1,32 @@
 #include "codec_api.h"
 #include "os_api.h"
 #include <libavcodec/avcodec.h>
+#include <string.h>
+
+#define DECODER_PTS_HISTORY 16
+
+// What was sent to the decoder under a pts (all slices of the frame). With
+// B frames pictures come out in display order, not in the order their
+// packets went in, so a picture's flags are looked up by its own pts.
+typedef struct DecoderSent {
+    int64_t pts;
+    uint32_t timestamp_us;
+    bool recovery_point;
+    bool incomplete; // Lost data: the picture is concealed
+} DecoderSent;
 
 struct DecoderContext {
     AVCodecContext *codec_ctx;
-    AVFrame *frame_yuv;
+    AVFrame *frame_yuv;          // Presented picture, out_frame points into it
+    AVFrame *held;               // Decoded, waiting for Codec_PresentFrame
+    bool has_held;
+    bool held_damaged;
+    DecoderSent sent[DECODER_PTS_HISTORY]; // Indexed by pts
     bool has_received_keyframe;  // Track if we've seen a keyframe with SPS/PPS
+    bool needs_keyframe;         // Decode error / missing reference since last keyframe
+    bool awaiting_recovery;      // Synced on an intra-refresh keyframe, picture not clean yet
+    uint8_t *salvage;            // Surviving NAL units of an incomplete frame
+    unsigned int salvage_capacity;
 };
 
 DecoderContext* Codec_InitDecoder(MemoryArena *arena) {
@@ -22,12 +43,25 @@ DecoderContext* Codec_InitDecoder(MemoryArena *arena) {
         return NULL;
     }
 
+    // Accept partial access units (runs of whole slices from sliced hosts).
+    // A picture is output as soon as its last macroblock row is decoded, so
+    // complete frames behave exactly as before.
+    ctx->codec_ctx->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+
+    // Incomplete frames: detect bitstream damage without aborting the frame,
+    // conceal lost macroblocks from neighbours/motion, and still output the
+    // picture. A smeared region beats a frozen screen.
+    ctx->codec_ctx->err_recognition = AV_EF_CRCCHECK | AV_EF_BITSTREAM;
+    ctx->codec_ctx->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK | FF_EC_FAVOR_INTER;
+    ctx->codec_ctx->flags |= AV_CODEC_FLAG_OUTPUT_CORRUPT;
+
     if (avcodec_open2(ctx->codec_ctx, codec, NULL) < 0) {
         fprintf(stderr, "Codec_InitDecoder: Could not open codec\n");
         return NULL;
     }
 
     ctx->frame_yuv = av_frame_alloc();
+    ctx->held = av_frame_alloc();
 
     return ctx;
 }
@@ -77,15 +111,74 @@ static bool Codec_IsKeyframe(uint8_t *data, size_t size) {
     return false;
 }
 
-void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *out_frame) {
-    // Check if this packet contains a keyframe (SPS/PPS/IDR)
-    bool is_keyframe = Codec_IsKeyframe(packet->data, packet->size);
+static bool Codec_OverlapsMissing(const EncodedPacket *packet, size_t start, size_t end) {
+    for (int i = 0; i < packet->missing_count; ++i) {
+        const ByteRange *m = &packet->missing[i];
+        if (start < m->offset + m->size && m->offset < end) return true;
+    }
+    return false;
+}
+
+// Copies the usable part of an incomplete frame into ctx->salvage. NAL units
+// whose start code was lost are dropped; NAL units cut by a hole are truncated
+// at the hole, so FFmpeg decodes the macroblocks that arrived and conceals the
+// rest. Returns the salvaged size.
+static size_t Codec_SalvageNals(DecoderContext *ctx, const EncodedPacket *packet) {
+    av_fast_padded_malloc(&ctx->salvage, &ctx->salvage_capacity, packet->size);
+    if (!ctx->salvage) return 0;
+
+    const uint8_t *data = packet->data;
+    size_t out = 0;
+    size_t nal_start = SIZE_MAX; // Start code position of the NAL being copied
+
+    for (size_t i = 0; i <= packet->size; ++i) {
+        bool at_end = (i == packet->size);
+        size_t sc = i;
+        if (!at_end) {
+            if (i + 3 > packet->size || data[i] != 0 || data[i+1] != 0 || data[i+2] != 1) continue;
+            if (i > 0 && data[i-1] == 0) sc = i - 1; // 4-byte start code
+            // A start code touching a hole may be made up of zero fill
+            if (Codec_OverlapsMissing(packet, sc, i + 3)) continue;
+        }
+
+        if (nal_start != SIZE_MAX) {
+            size_t nal_end = sc;
+            for (int m = 0; m < packet->missing_count; ++m) {
+                size_t hole = packet->missing[m].offset;
+                if (hole > nal_start && hole < nal_end) nal_end = hole;
+            }
+            // Keep it if more than start code + NAL header survived
+            if (nal_end - nal_start > 5) {
+                memcpy(ctx->salvage + out, data + nal_start, nal_end - nal_start);
+                out += nal_end - nal_start;
+            }
+        }
+        nal_start = sc;
+        i += 2;
+    }
+
+    return out;
+}
+
+bool Codec_DecodeHeld(DecoderContext *ctx, EncodedPacket *packet, uint32_t *out_timestamp_us) {
+    // Check if this packet contains a keyframe (SPS/PPS/IDR). v2 hosts flag it
+    // in the header; slices and incomplete frames may lack the parameter sets.
+    bool is_keyframe = (packet->keyframe_known && !packet->partial && packet->missing_count == 0)
+                           ? packet->keyframe
+                           : Codec_IsKeyframe(packet->data, packet->size);
     
     if (is_keyframe) {
         if (!ctx->has_received_keyframe) {
             printf("Decoder: First keyframe received! Enabling decoding.\n");
+            // Hosts that flag keyframes also flag recovery points; an
+            // intra-refresh keyframe without one is not displayable yet.
+            ctx->awaiting_recovery = packet->keyframe && !packet->recovery_point;
         }
         ctx->has_received_keyframe = true;
+        ctx->needs_keyframe = false;
+    }
+    if (packet->recovery_point) {
+        ctx->needs_keyframe = false;
     }
     
 // Don't decode until we've received a keyframe - prevents "non-existing PPS" errors
@@ -97,7 +190,7 @@ void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *
                    ctx->has_received_keyframe, is_keyframe);
             last_log_time = current_time;
         }
-        return;
+        return false;
     }
     
     AVPacket *av_pkt = av_packet_alloc();
@@ -107,8 +200,24 @@ void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *
     // We just reference it.
     av_pkt->data = packet->data;
     av_pkt->size = packet->size;
+    if (packet->missing_count > 0) {
+        av_pkt->size = (int)Codec_SalvageNals(ctx, packet);
+        av_pkt->data = ctx->salvage;
+        if (av_pkt->size == 0) {
+            av_pkt->data = NULL;
+            av_packet_free(&av_pkt);
+            ctx->needs_keyframe = true;
+            return false;
+        }
+    }
     av_pkt->pts = packet->pts;
     av_pkt->dts = packet->dts;
+    DecoderSent *sent = &ctx->sent[(uint64_t)packet->pts % DECODER_PTS_HISTORY];
+    if (sent->pts != packet->pts) {
+        *sent = (DecoderSent){.pts = packet->pts, .timestamp_us = packet->timestamp_us};
+    }
+    sent->recovery_point |= packet->recovery_point;
+    sent->incomplete |= packet->missing_count > 0;
 
     int ret = avcodec_send_packet(ctx->codec_ctx, av_pkt);
     if (ret < 0) {
@@ -118,21 +227,44 @@ void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *
             fprintf(stderr, "Codec_DecodePacket: Error sending packet for decoding\n");
             last_send_error = now;
         }
+        ctx->needs_keyframe = true;
         av_packet_free(&av_pkt);
-        return;
+        return false;
     }
 
-    ret = avcodec_receive_frame(ctx->codec_ctx, ctx->frame_yuv);
+    ctx->has_held = false;
+    ret = avcodec_receive_frame(ctx->codec_ctx, ctx->held);
     if (ret == 0) {
-        // Success
-        // For the output, we just point to the internal FFmpeg frame data for now
-        // If we want to render it, we might need to convert YUV->RGB or upload YUV textures.
-        // For Verification: we leave it as YUV420P
-        out_frame->width = ctx->frame_yuv->width;
-        out_frame->height = ctx->frame_yuv->height;
-        for (int i = 0; i < 3; ++i) { // Y, U, V
-            out_frame->data[i] = ctx->frame_yuv->data[i];
-            out_frame->linesize[i] = ctx->frame_yuv->linesize[i];
+        // Flags of the picture that came out, sent under its own pts: with
+        // B frames usually not the packet just sent
+        int64_t pts = ctx->held->pts != AV_NOPTS_VALUE ? ctx->held->pts : packet->pts;
+        DecoderSent unknown = {.pts = pts};
+        const DecoderSent *own = &ctx->sent[(uint64_t)pts % DECODER_PTS_HISTORY];
+        if (own->pts != pts) {
+            own = &unknown; // Overwritten: no flags, no capture time
+        }
+
+        if (ctx->awaiting_recovery && own->recovery_point) {
+            printf("Decoder: Intra-refresh cycle complete. Displaying.\n");
+            ctx->awaiting_recovery = false;
+        }
+        // While the refresh sweep is in progress, frames decode fine but
+        // aren't clean yet: keep decoding, don't display
+        if (!ctx->awaiting_recovery) {
+            // Concealed/corrupt output means a reference was missing
+            ctx->held_damaged = own->incomplete ||
+                                (ctx->held->flags & AV_FRAME_FLAG_CORRUPT) ||
+                                ctx->held->decode_error_flags;
+            if (ctx->held_damaged) {
+                ctx->needs_keyframe = true;
+            }
+
+            if (out_timestamp_us) {
+                *out_timestamp_us = own->timestamp_us;
+            }
+            ctx->has_held = true;
+        } else {
+            av_frame_unref(ctx->held);
         }
     } else if (ret != AVERROR(EAGAIN)) {
         static double last_decode_error = 0;
@@ -141,6 +273,7 @@ void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *
             fprintf(stderr, "Codec_DecodePacket: Error during decoding\n");
             last_decode_error = now;
         }
+        ctx->needs_keyframe = true;
     }
 
     // Do not free packet data since it belongs to us/arena, but free the wrapper structure
@@ -148,6 +281,38 @@ void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *
     // Ensure we reset pointers so it doesn't try to free our buffer if it thinks it owns it.
     av_pkt->data = NULL;
     av_packet_free(&av_pkt);
+    return ctx->has_held;
+}
+
+void Codec_PresentFrame(DecoderContext *ctx, VideoFrame *out_frame) {
+    if (!ctx->has_held) return;
+    // The previous picture stays referenced until now, so its planes are
+    // valid for whoever draws out_frame in the meantime
+    av_frame_unref(ctx->frame_yuv);
+    av_frame_move_ref(ctx->frame_yuv, ctx->held);
+    ctx->has_held = false;
+
+    // For the output, we just point to the internal FFmpeg frame data for now
+    // If we want to render it, we might need to convert YUV->RGB or upload YUV textures.
+    // For Verification: we leave it as YUV420P
+    out_frame->width = ctx->frame_yuv->width;
+    out_frame->height = ctx->frame_yuv->height;
+    for (int i = 0; i < 3; ++i) { // Y, U, V
+        out_frame->data[i] = ctx->frame_yuv->data[i];
+        out_frame->linesize[i] = ctx->frame_yuv->linesize[i];
+    }
+    out_frame->damaged = ctx->held_damaged;
+}
+
+void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *out_frame) {
+    if (Codec_DecodeHeld(ctx, packet, NULL)) {
+        Codec_PresentFrame(ctx, out_frame);
+    }
+}
+
+bool Codec_NeedsKeyframe(DecoderContext *ctx) {
+    if (!ctx) return false;
+    return !ctx->has_received_keyframe || ctx->needs_keyframe;
 }
 
 void Codec_CloseDecoder(DecoderContext *ctx) {
@@ -158,5 +323,9 @@ void Codec_CloseDecoder(DecoderContext *ctx) {
     if (ctx->frame_yuv) {
         av_frame_free(&ctx->frame_yuv);
     }
+    if (ctx->held) {
+        av_frame_free(&ctx->held);
+    }
+    av_freep(&ctx->salvage);
 }
 
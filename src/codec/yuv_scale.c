@@ -0,0 +1,83 @@
+#include "codec_api.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// I420 helpers for simulcast. Plain C (no FFmpeg) so layer downscales stay
+// cheap and run on whichever thread has the frame.
+
+// Rows padded to 32 bytes so every plane row starts vector aligned
+#define I420_ROW_ALIGN 32
+
+static int Codec_AlignRow(int bytes) {
+    return (bytes + I420_ROW_ALIGN - 1) & ~(I420_ROW_ALIGN - 1);
+}
+
+size_t Codec_I420Size(int width, int height) {
+    size_t luma = (size_t)Codec_AlignRow(width) * height;
+    size_t chroma = (size_t)Codec_AlignRow((width + 1) / 2) * ((height + 1) / 2);
+    return luma + 2 * chroma;
+}
+
+void Codec_LayoutI420(uint8_t *buffer, int width, int height, VideoFrame *out) {
+    memset(out, 0, sizeof(*out));
+    out->width = width;
+    out->height = height;
+    out->pixel_format = VIDEO_PIXEL_I420;
+    out->linesize[0] = Codec_AlignRow(width);
+    out->linesize[1] = out->linesize[2] = Codec_AlignRow((width + 1) / 2);
+    out->data[0] = buffer;
+    out->data[1] = out->data[0] + (size_t)out->linesize[0] * height;
+    out->data[2] = out->data[1] + (size_t)out->linesize[1] * ((height + 1) / 2);
+}
+
+void Codec_HalfSize(int width, int height, int *out_width, int *out_height) {
+    // 4:2:0 needs even dimensions
+    *out_width = (width / 2) & ~1;
+    *out_height = (height / 2) & ~1;
+    if (*out_width < 2) *out_width = 2;
+    if (*out_height < 2) *out_height = 2;
+}
+
+// Each output pixel is the rounded average of a 2x2 block: rows first, then
+// columns, which is what _mm_avg_epu8/_mm_avg_epu16 compute, so the vector
+// and scalar paths give identical results.
+static void Codec_HalvePlane(const uint8_t *src, int src_stride,
+                             uint8_t *dst, int dst_stride,
+                             int dst_width, int dst_height) {
+    for (int y = 0; y < dst_height; ++y) {
+        const uint8_t *r0 = src + (size_t)(2 * y) * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+        uint8_t *out = dst + (size_t)y * dst_stride;
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+        for (; x + 16 <= dst_width; x += 16) {
+            __m128i v0 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r0 + 2 * x)),
+                                      _mm_loadu_si128((const __m128i *)(r1 + 2 * x)));
+            __m128i v1 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r0 + 2 * x + 16)),
+                                      _mm_loadu_si128((const __m128i *)(r1 + 2 * x + 16)));
+            __m128i h0 = _mm_avg_epu16(_mm_and_si128(v0, low_bytes), _mm_srli_epi16(v0, 8));
+            __m128i h1 = _mm_avg_epu16(_mm_and_si128(v1, low_bytes), _mm_srli_epi16(v1, 8));
+            _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(h0, h1));
+        }
+#endif
+        for (; x < dst_width; ++x) {
+            int left = (r0[2 * x] + r1[2 * x] + 1) >> 1;
+            int right = (r0[2 * x + 1] + r1[2 * x + 1] + 1) >> 1;
+            out[x] = (uint8_t)((left + right + 1) >> 1);
+        }
+    }
+}
+
+void Codec_DownscaleI420(const VideoFrame *in, VideoFrame *out) {
+    Codec_HalvePlane(in->data[0], in->linesize[0], out->data[0], out->linesize[0],
+                     out->width, out->height);
+    for (int p = 1; p < 3; ++p) {
+        Codec_HalvePlane(in->data[p], in->linesize[p], out->data[p], out->linesize[p],
+                         out->width / 2, out->height / 2);
+    }
+    out->timestamp = in->timestamp;
+    out->damaged = in->damaged;
+}
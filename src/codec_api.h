@@ -3,6 +3,7 @@
 
 #include "memory_arena.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 // Video Format
 typedef struct VideoFormat {
@@ -11,38 +12,105 @@ typedef struct VideoFormat {
     int fps;
     int bitrate;
     char preset[32]; // x264 preset: ultrafast, superfast, veryfast, faster, fast, medium
+    bool intra_refresh; // Rolling intra column instead of periodic IDRs (constant frame size)
+    int slice_max_size; // Cap each slice NAL at this many bytes (0 = one slice per frame)
+    bool temporal_layers; // Every other frame is a non-reference B frame (costs one frame of delay)
 } VideoFormat;
 
+// Pixel layout of a VideoFrame
+typedef enum VideoPixelFormat {
+    VIDEO_PIXEL_BGRX = 0, // Capture output, one packed plane
+    VIDEO_PIXEL_I420,     // Planar Y, U, V at 4:2:0, what the encoder consumes
+} VideoPixelFormat;
+
 // Raw Video Frame (RGB/YUV)
 typedef struct VideoFrame {
     uint8_t *data[4]; // Plane pointers
     int linesize[4];  // Plane strides
     int width;
     int height;
-    // timestamp?
+    VideoPixelFormat pixel_format;
+    bool damaged; // Decoded from incomplete data, parts of the picture are concealed
+    double timestamp; // Capture time (OS_GetTime), 0 if unknown
 } VideoFrame;
 
+// Byte range inside an EncodedPacket
+typedef struct ByteRange {
+    size_t offset;
+    size_t size;
+} ByteRange;
+
 // Encoded Packet
 typedef struct EncodedPacket {
     uint8_t *data;
     size_t size;
     int64_t pts;
     int64_t dts;
-    bool keyframe;
+    bool keyframe;       // IDR, or the first frame of an intra-refresh cycle
+    bool keyframe_known; // keyframe came from the wire header (v2), no bitstream scan needed
+    bool recovery_point; // Decoding from the last keyframe up to here gives a clean picture
+    bool partial;        // Holds some whole slices of a frame rather than the full access unit
+    ByteRange *missing;  // Lost byte ranges of data, for incomplete frames
+    int missing_count;
+    uint32_t timestamp_us; // Capture time of this frame (encoder), or from the wire header (v2); 0 if unknown
+    uint8_t temporal_layer; // 1: no other frame refers to this one, it can be dropped
 } EncodedPacket;
 
 // Encoder
 typedef struct EncoderContext EncoderContext;
 
 EncoderContext* Codec_InitEncoder(MemoryArena *arena, VideoFormat format);
+// Accepts BGRx frames (converted and scaled by the encoder) or I420 frames of
+// exactly the encoder's size (copied as is, see simulcast below).
 void Codec_EncodeFrame(EncoderContext *ctx, VideoFrame *frame, MemoryArena *packet_arena, EncodedPacket *out_packet);
+
+// Force the next encoded frame to be an IDR (keyframe-on-demand / PLI).
+// In intra-refresh mode this is still a full IDR, so callers should only use it
+// for decoders that cannot sync on recovery points (e.g. browsers joining).
+void Codec_RequestKeyframe(EncoderContext *ctx);
+
+// Change bitrate, VBV buffer and max rate on the live encoder (no IDR, no stall).
+void Codec_SetBitrate(EncoderContext *ctx, int bitrate);
+
+// Apply a new format in place. Rate-only changes go through Codec_SetBitrate;
+// resolution/fps/preset changes reopen x264 but reuse the context, pooled YUV
+// frames and the SWS scaler. Returns false if the encoder could not be reopened.
+bool Codec_Reconfigure(EncoderContext *ctx, VideoFormat format);
 void Codec_CloseEncoder(EncoderContext *ctx);
 
+// Simulcast: several encoders fed from one capture. The frame is converted
+// to I420 once and every lower layer is a 2:1 downscale of the layer above,
+// so an extra layer costs an encode of a quarter of the pixels, not another
+// colour conversion.
+typedef struct FrameConverter FrameConverter;
+
+FrameConverter* Codec_InitConverter(MemoryArena *arena);
+// BGRx -> I420 into `buffer` (Codec_I420Size bytes), described by `out`
+bool Codec_ConvertToI420(FrameConverter *ctx, const VideoFrame *in, uint8_t *buffer, VideoFrame *out);
+void Codec_CloseConverter(FrameConverter *ctx);
+
+// Bytes of an I420 frame laid out by Codec_LayoutI420 (planes back to back)
+size_t Codec_I420Size(int width, int height);
+void Codec_LayoutI420(uint8_t *buffer, int width, int height, VideoFrame *out);
+// Size of the next simulcast layer down: half, rounded down to even
+void Codec_HalfSize(int width, int height, int *out_width, int *out_height);
+// 2x2 box filter into `out`, laid out for Codec_HalfSize of `in` (SSE2 on x86)
+void Codec_DownscaleI420(const VideoFrame *in, VideoFrame *out);
+
 // Decoder
 typedef struct DecoderContext DecoderContext;
 
 DecoderContext* Codec_InitDecoder(MemoryArena *arena);
 void Codec_DecodePacket(DecoderContext *ctx, EncodedPacket *packet, VideoFrame *out_frame);
+// Codec_DecodePacket in two steps, to present a picture when it is due:
+// decode and hold what comes out, returning true and its capture time
+// (timestamp_us of its own packet, which with B frames is usually an
+// earlier one than `packet`); then point out_frame at the held picture.
+bool Codec_DecodeHeld(DecoderContext *ctx, EncodedPacket *packet, uint32_t *out_timestamp_us);
+void Codec_PresentFrame(DecoderContext *ctx, VideoFrame *out_frame);
+// True while the decoder cannot produce a clean picture without a new IDR:
+// before the first keyframe and after errors/missing references.
+bool Codec_NeedsKeyframe(DecoderContext *ctx);
 void Codec_CloseDecoder(DecoderContext *ctx);
 
 #endif // HARMONY_CODEC_API_H
@@ -13,6 +13,13 @@ typedef struct PersistentConfig {
     bool use_portal_audio;
     char encoder_preset[32]; // x264 preset: ultrafast, superfast, veryfast, faster, fast, medium
     uint32_t fps;
+    bool intra_refresh;      // Rolling intra refresh instead of IDR keyframes (smoother bitrate)
+    bool sliced_encoding;    // One slice per network chunk; viewer decodes slices as they arrive
+    uint32_t simulcast_layers; // Encoded renditions (1-3), each half the size of the one above
+    bool temporal_layers;    // Every other frame droppable, so congested links can halve the frame rate
+    uint32_t audio_frame_size;        // Samples per Opus frame: 120, 240, 480 or 960 (2.5-20 ms)
+    uint32_t audio_frames_per_packet; // 1-6; more than one with 20 ms frames only
+    uint32_t playout_smoothness; // Viewer, 0-100: 0 shows late frames late (lowest latency), 100 delays all to the worst recent one
 } PersistentConfig;
 
 // Load config from OS-specific location. Returns false if file doesn't exist.
@@ -0,0 +1,243 @@
+#ifndef HARMONY_AUDIO_JITTER_H
+#define HARMONY_AUDIO_JITTER_H
+
+#include "../audio_api.h"
+#include "audio_ring.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Viewer-side audio jitter buffer on top of the playback ring. The decoder
+// thread times packet arrivals and sizes the buffer from their jitter: a LAN
+// settles at 20-30 ms, a bad link grows it until playout stops running dry.
+// The realtime callback plays slightly faster or slower (linear-interpolation
+// resampling, at most AUDIO_DRIFT_MAX_PPM off) to hold the buffer at that
+// depth, which also absorbs the drift between the host's and our sound-card
+// clocks; the long-term rate correction is that drift. A/V sync can ask for
+// a deeper buffer than the jitter needs (sync_frames). Frames below are per
+// channel.
+
+#define AUDIO_JITTER_MIN_MS 5.0    // And never less than one packet
+#define AUDIO_JITTER_MAX_MS 300.0
+#define AUDIO_JITTER_START_MS 20.0 // On top of two packets, until arrivals have been measured
+#define AUDIO_JITTER_MARGIN_MS 5.0
+#define AUDIO_JITTER_PEAK_HALFLIFE 5.0 // Seconds for a jitter spike to be half forgotten
+// The target shrinks no faster than the rate correction can drain the buffer,
+// so a shrinking target never costs a skip
+#define AUDIO_JITTER_SHRINK_MS_PER_S 4.0
+#define AUDIO_JITTER_SKIP_MS 100.0 // Excess dropped outright (a burst after a stall)
+
+#define AUDIO_DRIFT_GAIN_PPM_PER_MS 200.0  // Rate correction per ms off target
+#define AUDIO_DRIFT_MAX_PPM 5000.0       // 0.5%: a 9 cent pitch shift at most
+#define AUDIO_DEPTH_SMOOTHING 0.02       // Per callback: rides out packet-sized steps
+#define AUDIO_DRIFT_SMOOTHING 0.0002     // Per callback: ~50 s at 10 ms quanta
+
+#define AUDIO_RESAMPLER_MAX_QUANTUM 8192 // Frames per callback we produce at most
+
+typedef struct AudioJitter {
+    // Decoder thread
+    double last_arrival;
+    uint32_t concealed_frames; // Played in place of lost packets since then
+    double jitter_ms; // Smoothed |interval - packet duration| (RFC 3550 style)
+    double peak_ms;   // Largest recent deviation, decaying
+    double target_ms;
+    uint32_t packet_frames; // The host's advertised packet size
+    uint32_t seen_underruns;
+
+    // Realtime thread
+    bool buffering;   // Silent until the target depth is queued
+    double depth_avg; // Frames
+    double drift_avg; // ppm
+
+    // Shared
+    atomic_uint target_frames;
+    atomic_uint sync_frames;    // Depth the playout clock wants, 0 = none
+    atomic_uint quantum_frames; // Last callback's size, sizes the target
+    atomic_uint jitter_us;
+    atomic_int drift_ppm;
+} AudioJitter;
+
+// Frames read from the ring but not played yet, with a fractional read
+// position: what resampling needs beyond the ring (realtime thread only)
+typedef struct AudioResampler {
+    int16_t *staged; // Interleaved
+    uint32_t count;  // Frames staged
+    double pos;      // Next output's position within `staged`
+} AudioResampler;
+
+static inline void AudioJitter_Init(AudioJitter *j) {
+    memset(j, 0, sizeof(*j));
+    j->packet_frames = AUDIO_FRAME_SIZE;
+    j->target_ms = 2.0 * AUDIO_FRAME_SIZE * 1000.0 / AUDIO_SAMPLE_RATE + AUDIO_JITTER_START_MS;
+    j->buffering = true;
+    atomic_init(&j->target_frames, (uint32_t)(j->target_ms * AUDIO_SAMPLE_RATE / 1000));
+    atomic_init(&j->sync_frames, 0);
+    atomic_init(&j->quantum_frames, 0);
+    atomic_init(&j->jitter_us, 0);
+    atomic_init(&j->drift_ppm, 0);
+}
+
+// Decoder thread: a packet of `frames` arrived at `now` (seconds). Underruns
+// counted since init mean the target was too small: each adds a packet.
+static void AudioJitter_OnArrival(AudioJitter *j, double now, uint32_t frames, uint32_t underruns) {
+    double packet_ms = frames * 1000.0 / AUDIO_SAMPLE_RATE;
+    double elapsed = 0.0;
+    if (j->last_arrival > 0.0) {
+        // Lost packets in between stretch the interval, they aren't jitter
+        double expected_ms = packet_ms + j->concealed_frames * 1000.0 / AUDIO_SAMPLE_RATE;
+        elapsed = now - j->last_arrival;
+        double deviation = fabs(elapsed * 1000.0 - expected_ms);
+        j->jitter_ms += (deviation - j->jitter_ms) / 16.0;
+        j->peak_ms *= pow(0.5, elapsed / AUDIO_JITTER_PEAK_HALFLIFE);
+        if (deviation > j->peak_ms) j->peak_ms = deviation;
+    }
+    j->last_arrival = now;
+    j->concealed_frames = 0;
+    if (underruns != j->seen_underruns) {
+        j->peak_ms += packet_ms;
+        j->seen_underruns = underruns;
+    }
+
+    // The buffer saw-tooths by half a packet around its average, and a
+    // callback needs a whole quantum on top of the worst recent lateness
+    double quantum_ms = atomic_load_explicit(&j->quantum_frames, memory_order_relaxed) * 1000.0 / AUDIO_SAMPLE_RATE;
+    double want = packet_ms / 2.0 + quantum_ms + j->peak_ms + AUDIO_JITTER_MARGIN_MS;
+    if (want < packet_ms) want = packet_ms;
+    if (want < AUDIO_JITTER_MIN_MS) want = AUDIO_JITTER_MIN_MS;
+    if (want > AUDIO_JITTER_MAX_MS) want = AUDIO_JITTER_MAX_MS;
+    if (want < j->target_ms) {
+        double floor = j->target_ms - AUDIO_JITTER_SHRINK_MS_PER_S * elapsed;
+        if (want < floor) want = floor;
+    }
+    j->target_ms = want;
+
+    atomic_store_explicit(&j->target_frames, (uint32_t)(want * AUDIO_SAMPLE_RATE / 1000.0), memory_order_relaxed);
+    atomic_store_explicit(&j->jitter_us, (uint32_t)(j->jitter_ms * 1000.0), memory_order_relaxed);
+}
+
+// Decoder thread: `frames` were concealed (or restored from FEC) in place of
+// a lost packet. Not an arrival: the next real one is timed against both.
+static inline void AudioJitter_OnConcealed(AudioJitter *j, uint32_t frames) {
+    j->concealed_frames += frames;
+}
+
+// Decoder thread: the host advertised packets of `frames` (stream metadata).
+// A new size restarts the target from two packets plus AUDIO_JITTER_START_MS,
+// so 2.5 ms packets do not start behind a buffer sized for 20 ms ones; the
+// arrivals measured so far still count.
+static void AudioJitter_SetPacket(AudioJitter *j, uint32_t frames) {
+    if (frames == 0 || frames == j->packet_frames) return;
+    j->packet_frames = frames;
+    double want = 2.0 * frames * 1000.0 / AUDIO_SAMPLE_RATE + AUDIO_JITTER_START_MS;
+    j->target_ms = want < AUDIO_JITTER_MAX_MS ? want : AUDIO_JITTER_MAX_MS;
+    atomic_store_explicit(&j->target_frames, (uint32_t)(j->target_ms * AUDIO_SAMPLE_RATE / 1000.0), memory_order_relaxed);
+}
+
+// Depth playout aims for: what the jitter needs, or more for A/V sync
+static inline uint32_t AudioJitter_Target(AudioJitter *j) {
+    uint32_t target = atomic_load_explicit(&j->target_frames, memory_order_relaxed);
+    uint32_t sync = atomic_load_explicit(&j->sync_frames, memory_order_relaxed);
+    return sync > target ? sync : target;
+}
+
+// Realtime thread: returns the playout rate (input frames per output frame)
+// for a callback of `quantum` frames with `depth` frames queued
+static double AudioJitter_PlayoutRatio(AudioJitter *j, uint32_t depth, uint32_t quantum) {
+    atomic_store_explicit(&j->quantum_frames, quantum, memory_order_relaxed);
+    uint32_t target = AudioJitter_Target(j);
+    j->depth_avg += (depth - j->depth_avg) * AUDIO_DEPTH_SMOOTHING;
+
+    double error_ms = (j->depth_avg - target) * 1000.0 / AUDIO_SAMPLE_RATE;
+    double ppm = AUDIO_DRIFT_GAIN_PPM_PER_MS * error_ms;
+    if (ppm > AUDIO_DRIFT_MAX_PPM) ppm = AUDIO_DRIFT_MAX_PPM;
+    if (ppm < -AUDIO_DRIFT_MAX_PPM) ppm = -AUDIO_DRIFT_MAX_PPM;
+    j->drift_avg += (ppm - j->drift_avg) * AUDIO_DRIFT_SMOOTHING;
+    atomic_store_explicit(&j->drift_ppm, (int)lrint(j->drift_avg), memory_order_relaxed);
+    return 1.0 + ppm * 1e-6;
+}
+
+static inline void AudioResampler_Init(AudioResampler *rs, MemoryArena *arena) {
+    memset(rs, 0, sizeof(*rs));
+    // A callback at the fastest rate, plus the frame interpolated towards
+    uint32_t frames = AUDIO_RESAMPLER_MAX_QUANTUM + AUDIO_RESAMPLER_MAX_QUANTUM / 128 + 2;
+    rs->staged = (int16_t *)ArenaPush(arena, frames * AUDIO_CHANNELS * sizeof(int16_t));
+}
+
+// Frames queued for playout: the ring plus what is staged
+static inline uint32_t AudioResampler_Depth(const AudioResampler *rs, AudioRing *ring) {
+    uint32_t staged = rs->count - (uint32_t)rs->pos;
+    return AudioRing_Available(ring) / AUDIO_CHANNELS + staged;
+}
+
+// Fills `dst` with up to `frames` frames (at most AUDIO_RESAMPLER_MAX_QUANTUM)
+// played at `ratio`, pulling from the ring in bulk. Returns the frames
+// produced: fewer if the ring ran dry (counted there as an underrun).
+static uint32_t AudioResampler_Pull(AudioResampler *rs, AudioRing *ring, double ratio, int16_t *dst, uint32_t frames) {
+    uint32_t needed = (uint32_t)(rs->pos + frames * ratio) + 2;
+    if (needed > rs->count) {
+        uint32_t got = AudioRing_Read(ring, rs->staged + rs->count * AUDIO_CHANNELS, (needed - rs->count) * AUDIO_CHANNELS);
+        rs->count += got / AUDIO_CHANNELS;
+    }
+
+    uint32_t produced = 0;
+    double pos = rs->pos;
+    for (; produced < frames; ++produced) {
+        uint32_t i = (uint32_t)pos;
+        if (i + 1 >= rs->count) break;
+        double frac = pos - i;
+        const int16_t *a = rs->staged + i * AUDIO_CHANNELS;
+        const int16_t *b = a + AUDIO_CHANNELS;
+        for (int ch = 0; ch < AUDIO_CHANNELS; ++ch) {
+            dst[produced * AUDIO_CHANNELS + ch] = (int16_t)lrint(a[ch] + (b[ch] - a[ch]) * frac);
+        }
+        pos += ratio;
+    }
+
+    // Keep the frames still ahead of (or under) the read position
+    uint32_t consumed = (uint32_t)pos;
+    if (consumed > rs->count) consumed = rs->count;
+    memmove(rs->staged, rs->staged + consumed * AUDIO_CHANNELS, (rs->count - consumed) * AUDIO_CHANNELS * sizeof(int16_t));
+    rs->count -= consumed;
+    rs->pos = pos - consumed;
+    return produced;
+}
+
+// Drops `frames` of the oldest queued audio
+static inline void AudioResampler_Skip(AudioResampler *rs, AudioRing *ring, uint32_t frames) {
+    uint32_t staged = rs->count - (uint32_t)rs->pos;
+    rs->count = 0;
+    rs->pos = 0.0;
+    if (frames <= staged) return;
+    uint32_t available = AudioRing_Available(ring);
+    uint32_t count = (frames - staged) * AUDIO_CHANNELS;
+    AudioRing_Read(ring, NULL, count < available ? count : available);
+}
+
+// Realtime thread: one callback's worth of playout. Writes up to `quantum`
+// frames to `dst` and returns how many; the caller pads with silence.
+static uint32_t AudioJitter_Play(AudioJitter *j, AudioResampler *rs, AudioRing *ring, int16_t *dst, uint32_t quantum) {
+    uint32_t depth = AudioResampler_Depth(rs, ring);
+    uint32_t target = AudioJitter_Target(j);
+    if (j->buffering) {
+        if (depth < target) return 0;
+        j->buffering = false;
+        j->depth_avg = depth;
+    }
+
+    // A burst after a stall: one skip beats seconds of extra latency
+    if (depth > target + (uint32_t)(AUDIO_JITTER_SKIP_MS * AUDIO_SAMPLE_RATE / 1000)) {
+        AudioResampler_Skip(rs, ring, depth - target);
+        depth = target;
+        j->depth_avg = depth;
+    }
+
+    double ratio = AudioJitter_PlayoutRatio(j, depth, quantum);
+    // Running dry (a short read, counted as an underrun) means buffering again
+    uint32_t frames = AudioResampler_Pull(rs, ring, ratio, dst, quantum);
+    if (frames < quantum) j->buffering = true;
+    return frames;
+}
+
+#endif // HARMONY_AUDIO_JITTER_H
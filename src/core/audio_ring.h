@@ -0,0 +1,92 @@
+#ifndef HARMONY_AUDIO_RING_H
+#define HARMONY_AUDIO_RING_H
+
+#include "../memory_arena.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+// Single-producer single-consumer ring of interleaved samples. No locks: the
+// producer only advances write_index and the consumer only read_index, so a
+// realtime audio callback on either side never waits for the other thread.
+// The indices run freely and wrap through the power-of-two mask, so a
+// transfer is at most two memcpy calls. Callers move whole frames
+// (multiples of the channel count), which keeps channels aligned.
+
+typedef struct AudioRing {
+    int16_t *data;
+    uint32_t capacity; // Samples, a power of two
+    uint32_t mask;
+
+    // Producer and consumer state a cache line apart (padding, since arena
+    // allocations are not aligned). The counters may be read by any thread.
+    atomic_uint write_index;
+    atomic_uint overflows; // Writes that did not fit, in full or in part
+    uint8_t pad[64];
+    atomic_uint read_index;
+    atomic_uint underruns; // Reads that came up short
+} AudioRing;
+
+// Capacity is `min_samples` rounded up to a power of two
+static inline void AudioRing_Init(AudioRing *r, MemoryArena *arena, uint32_t min_samples) {
+    uint32_t capacity = 1;
+    while (capacity < min_samples) capacity <<= 1;
+    r->data = (int16_t *)ArenaPush(arena, capacity * sizeof(int16_t));
+    r->capacity = capacity;
+    r->mask = capacity - 1;
+    atomic_init(&r->write_index, 0);
+    atomic_init(&r->read_index, 0);
+    atomic_init(&r->overflows, 0);
+    atomic_init(&r->underruns, 0);
+}
+
+// Samples waiting (exact for the consumer, a lower bound for the producer)
+static inline uint32_t AudioRing_Available(AudioRing *r) {
+    uint32_t write = atomic_load_explicit(&r->write_index, memory_order_acquire);
+    uint32_t read = atomic_load_explicit(&r->read_index, memory_order_relaxed);
+    return write - read;
+}
+
+// Producer: copies what fits of `count` samples and returns how many that
+// was. The rest is dropped and counted as an overflow.
+static inline uint32_t AudioRing_Write(AudioRing *r, const int16_t *src, uint32_t count) {
+    uint32_t write = atomic_load_explicit(&r->write_index, memory_order_relaxed);
+    uint32_t read = atomic_load_explicit(&r->read_index, memory_order_acquire);
+    uint32_t space = r->capacity - (write - read);
+    if (count > space) {
+        count = space;
+        atomic_fetch_add_explicit(&r->overflows, 1, memory_order_relaxed);
+    }
+
+    uint32_t start = write & r->mask;
+    uint32_t first = r->capacity - start;
+    if (first > count) first = count;
+    memcpy(r->data + start, src, first * sizeof(int16_t));
+    memcpy(r->data, src + first, (count - first) * sizeof(int16_t));
+    atomic_store_explicit(&r->write_index, write + count, memory_order_release);
+    return count;
+}
+
+// Consumer: copies up to `count` samples into `dst` (NULL discards them) and
+// returns how many. A short read is counted as an underrun.
+static inline uint32_t AudioRing_Read(AudioRing *r, int16_t *dst, uint32_t count) {
+    uint32_t read = atomic_load_explicit(&r->read_index, memory_order_relaxed);
+    uint32_t write = atomic_load_explicit(&r->write_index, memory_order_acquire);
+    uint32_t available = write - read;
+    if (count > available) {
+        count = available;
+        atomic_fetch_add_explicit(&r->underruns, 1, memory_order_relaxed);
+    }
+
+    if (dst) {
+        uint32_t start = read & r->mask;
+        uint32_t first = r->capacity - start;
+        if (first > count) first = count;
+        memcpy(dst, r->data + start, first * sizeof(int16_t));
+        memcpy(dst + first, r->data, (count - first) * sizeof(int16_t));
+    }
+    atomic_store_explicit(&r->read_index, read + count, memory_order_release);
+    return count;
+}
+
+#endif // HARMONY_AUDIO_RING_H
@@ -0,0 +1,157 @@
+#ifndef HARMONY_PLAYOUT_CLOCK_H
+#define HARMONY_PLAYOUT_CLOCK_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Viewer-side playout clock shared by audio and video. Both streams carry the
+// host's capture time (wire v2 timestamp_us); the fastest recent arrival maps
+// it onto our clock (the base), and every unit is due a common delay after
+// that: present_at = capture time + base + delay. The delay is what the
+// slower stream needs: video its arrival spread (scaled between lowest
+// latency and smoothest) plus decode time, audio its jitter buffer. Video is
+// held until it is due; audio is buffered to the same point, so the two
+// stay in sync. Times are in seconds.
+
+#define PLAYOUT_MAX_DELAY 0.5 // Past the base: later units are shown late instead
+#define PLAYOUT_BASE_CREEP 0.0005 // s/s: the base rises unless arrivals hold it down (clock drift, route changes)
+#define PLAYOUT_PEAK_HOLD 3.0     // Seconds a late spike is remembered in full
+#define PLAYOUT_PEAK_HALFLIFE 5.0 // Then seconds for it to be half forgotten
+#define PLAYOUT_SLEW 0.004 // s/s: no faster than the audio rate correction can follow
+#define PLAYOUT_MARGIN 0.002
+#define PLAYOUT_VIDEO_BACKLOG 16 // Queued units (frames or slices): decode at once to catch up
+#define PLAYOUT_REORDER_HALFLIFE 5.0 // Seconds for a reorder hold no longer seen to be half forgotten
+
+typedef enum PlayoutStreamId {
+  PLAYOUT_VIDEO = 0,
+  PLAYOUT_AUDIO = 1,
+  PLAYOUT_STREAMS
+} PlayoutStreamId;
+
+typedef struct PlayoutStream {
+  bool active;
+  double lateness; // Smoothed arrival time past the base
+  double peak;     // Recent worst lateness, decaying
+  double peak_at;
+  double last_at;
+  double latency;  // Between arrival and output: decode, or the audio jitter buffer
+} PlayoutStream;
+
+typedef struct PlayoutClock {
+  bool started;
+  uint32_t last_media_us; // Unwrapping: the 32-bit timestamps wrap every 71 minutes
+  int64_t media_us;
+  double base;       // Our time minus capture time of the fastest recent arrival
+  double updated_at;
+  double smoothness; // 0: lowest latency (late frames shown late) .. 1: smoothest
+  double delay;      // Common delay past the base
+  PlayoutStream streams[PLAYOUT_STREAMS];
+} PlayoutClock;
+
+static inline void PlayoutClock_Init(PlayoutClock *c, double smoothness) {
+  memset(c, 0, sizeof(*c));
+  c->smoothness = smoothness < 0.0 ? 0.0 : (smoothness > 1.0 ? 1.0 : smoothness);
+}
+
+// Capture time of a timestamp, unwrapped around the last one seen
+static inline double PlayoutClock_MediaTime(PlayoutClock *c, uint32_t timestamp_us) {
+  if (!c->started) {
+    c->last_media_us = timestamp_us;
+    c->media_us = timestamp_us;
+  }
+  int64_t media_us = c->media_us + (int32_t)(timestamp_us - c->last_media_us);
+  if (media_us > c->media_us) {
+    c->media_us = media_us;
+    c->last_media_us = timestamp_us;
+  }
+  return media_us / 1e6;
+}
+
+// Delay past the base each stream needs. Audio's spread is its jitter
+// buffer's business, already part of its latency.
+static double PlayoutClock_Needed(const PlayoutClock *c) {
+  double needed = 0.0;
+  for (int i = 0; i < PLAYOUT_STREAMS; ++i) {
+    const PlayoutStream *s = &c->streams[i];
+    if (!s->active)
+      continue;
+    double spread = (i == PLAYOUT_VIDEO) ? c->smoothness * (s->peak - s->lateness) : 0.0;
+    double want = s->lateness + spread + s->latency + PLAYOUT_MARGIN;
+    if (want > needed)
+      needed = want;
+  }
+  return needed > PLAYOUT_MAX_DELAY ? PLAYOUT_MAX_DELAY : needed;
+}
+
+// A unit of `stream` captured at `timestamp_us` (host clock) arrived `now`
+static void PlayoutClock_OnArrival(PlayoutClock *c, PlayoutStreamId stream, uint32_t timestamp_us, double now) {
+  double transit = now - PlayoutClock_MediaTime(c, timestamp_us);
+  if (!c->started) {
+    c->started = true;
+    c->base = transit;
+    c->updated_at = now;
+  }
+  double elapsed = now - c->updated_at;
+  c->base += PLAYOUT_BASE_CREEP * elapsed;
+  if (transit < c->base)
+    c->base = transit;
+
+  PlayoutStream *s = &c->streams[stream];
+  double late = transit - c->base;
+  if (!s->active) {
+    s->active = true;
+    s->lateness = s->peak = late;
+    s->peak_at = now;
+  } else {
+    s->lateness += (late - s->lateness) / 16.0;
+    if (now - s->peak_at > PLAYOUT_PEAK_HOLD)
+      s->peak *= pow(0.5, (now - s->last_at) / PLAYOUT_PEAK_HALFLIFE);
+    if (late > s->peak) {
+      s->peak = late;
+      s->peak_at = now;
+    }
+  }
+  s->last_at = now;
+
+  // The first estimate applies at once, later ones slewed
+  double needed = PlayoutClock_Needed(c);
+  double step = PLAYOUT_SLEW * elapsed;
+  if (c->delay == 0.0 || fabs(needed - c->delay) <= step)
+    c->delay = needed;
+  else
+    c->delay += (needed > c->delay) ? step : -step;
+  c->updated_at = now;
+}
+
+static inline void PlayoutClock_SetLatency(PlayoutClock *c, PlayoutStreamId stream, double latency) {
+  c->streams[stream].latency = latency;
+}
+
+// When the unit captured at `timestamp_us` is due, on our clock
+static inline double PlayoutClock_DueAt(PlayoutClock *c, uint32_t timestamp_us) {
+  return PlayoutClock_MediaTime(c, timestamp_us) + c->base + c->delay;
+}
+
+// A decoder with B frames outputs a picture only once a later-captured one
+// has been sent to it, so pictures come out past their own arrival by the
+// capture time between the two. Part of video's latency: the recent worst,
+// slowly forgotten once the host stops sending B frames.
+typedef struct PlayoutReorder {
+  double hold;
+  double updated_at;
+} PlayoutReorder;
+
+// `sent_us` was just sent to the decoder, `out_us` came out. Returns the hold.
+static inline double PlayoutReorder_Update(PlayoutReorder *r, uint32_t sent_us, uint32_t out_us, double now) {
+  double ahead = (int32_t)(sent_us - out_us) / 1e6;
+  if (r->updated_at > 0.0)
+    r->hold *= pow(0.5, (now - r->updated_at) / PLAYOUT_REORDER_HALFLIFE);
+  if (ahead > r->hold)
+    r->hold = ahead > PLAYOUT_MAX_DELAY ? PLAYOUT_MAX_DELAY : ahead;
+  r->updated_at = now;
+  return r->hold;
+}
+
+#endif // HARMONY_PLAYOUT_CLOCK_H
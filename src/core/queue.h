@@ -73,6 +73,14 @@ static inline void* Queue_Pop(Queue *q) {
     return data;
 }
 
+// Items waiting (a snapshot: producers and consumers may race it)
+static inline int Queue_Count(Queue *q) {
+    OS_MutexLock(q->mutex);
+    int count = q->count;
+    OS_MutexUnlock(q->mutex);
+    return count;
+}
+
 // Signal shutdown and wake all waiting threads
 static inline void Queue_Shutdown(Queue *q) {
     if (!q) return;
@@ -8,12 +8,19 @@
 #include "ui/render_api.h"
 #include "ui_api.h"
 #include <netinet/in.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h> // For getenv
 #include <unistd.h>
 
+#include "core/playout_clock.h"
 #include "core/queue.h"
 #include "net/aes.h"
+#include "net/audio_loss.h"
+#include "net/mtu_probe.h"
+#include "net/send_scheduler.h"
+#include "net/unit_cache.h"
+#include "net/viewer_table.h"
 #include "net/websocket.h"
 
 // Forward Declaration (should be in a header)
@@ -24,20 +31,38 @@
 void Portal_RequestScreenCast(uint32_t *out_video_node,
                               uint32_t *out_audio_node);
 
+// Sliced encoding: slices stay this far below the chunk size, leaving room
+// for the start code and x264's slice size estimate
+#define SLICE_SIZE_MARGIN 32
+
+// Simulcast: layer L is encoded at 1/2^L of the capture size as stream L.
+// A layer encoder this many frames behind skips frames instead of queueing.
+#define SIMULCAST_MAX_LAYERS 3
+#define SIMULCAST_MAX_BACKLOG 2
+
+// Late joiners are replayed their layer's GOP cache at up to this rate,
+// ahead of live video, so they start on a picture within about one RTT
+#define HOST_CATCHUP_RATE (8.0 * 1024 * 1024) // Bytes/s per joining viewer
+#define HOST_CATCHUP_BURST (256 * 1024)
+
 // --- THREADING CONTEXTS ---
 
 typedef struct EncoderThreadContext {
-  Queue *frame_queue; // Queue of VideoFrame* (must be copies)
+  // Layer 0: VideoFrame* copies from capture. Other layers: SimulcastFrame*
+  // from layer 0, which converts and downscales for everyone.
+  Queue *frame_queue;
   VideoFormat vfmt;
   MemoryArena *arena;
 
+  // Simulcast (one thread per layer)
+  int layer;
+  int layer_count;
+  struct EncoderThreadContext *layers; // All layers, for layer 0 to feed
+
   // Communication with Network
-  NetworkContext *net;
-  char viewer_ip[16];
-  int viewer_port;
-  bool has_viewer;
+  SendScheduler *scheduler;
+  ViewerTable *viewers; // Guarded by viewer_mutex
   OS_Mutex *viewer_mutex;
-  OS_Mutex *packetizer_mutex;
 
   // WebSocket
   WebSocketContext *ws;
@@ -46,7 +71,14 @@ typedef struct EncoderThreadContext {
   AES_Ctx aes_ctx;
   bool encryption_enabled;
 
-  Packetizer packetizer;
+  Packetizer packetizer; // Video stream sequence (stream id = layer)
+  UnitCache gop;         // Units since the last keyframe; guarded by viewer_mutex
+
+  // Set by the main thread (already rate-limited) to force an IDR
+  atomic_bool force_keyframe;
+
+  double reconfigure_after; // A failed reopen is retried no sooner than this
+  bool encoder_lost;        // Could not reopen even the old format
 
   bool running;
 } EncoderThreadContext;
@@ -56,10 +88,8 @@ typedef struct AudioThreadContext {
   AudioEncoder *encoder;
 
   // Communication with Network
-  NetworkContext *net;
-  char viewer_ip[16];
-  int viewer_port;
-  bool has_viewer;
+  SendScheduler *scheduler;
+  ViewerTable *viewers; // Guarded by viewer_mutex
   OS_Mutex *viewer_mutex;
 
   // WebSocket
@@ -69,10 +99,8 @@ typedef struct AudioThreadContext {
   AES_Ctx aes_ctx;
   bool encryption_enabled;
 
-  Packetizer *packetizer; // Shared with Video for ID sequence?
-  // Actually, Protocol_SendAudio uses the packetizer's frame_id_counter.
-  // If they share it, it must be protected.
-  OS_Mutex *packetizer_mutex;
+  Packetizer packetizer; // Audio stream sequence
+  uint8_t loss_percent;  // Worst viewer audio loss the encoder is set for
 
   bool running;
 } AudioThreadContext;
@@ -85,10 +113,26 @@ typedef struct NetReceiverContext {
   // Shared State
   StreamMetadata *stream_meta;
   OS_Mutex *meta_mutex;
+  atomic_uint *audio_packet_size; // From PACKET_TYPE_AUDIO_CONFIG
 
   size_t *bytes_received;
   OS_Mutex *stats_mutex;
 
+  // Raised when a video frame is lost; main thread sends KEYFRAME_REQUEST
+  atomic_bool *keyframe_needed;
+
+  // Arrivals feed the A/V playout clock
+  PlayoutClock *playout;
+  OS_Mutex *playout_mutex;
+
+  // Encryption (chunks are authenticated and decrypted on arrival). The key
+  // needs the host's session salt: nothing is accepted before it arrived.
+  AES_Ctx aes_ctx;
+  bool encryption_enabled;
+  const char *password;
+  bool session_known;
+  uint8_t session_salt[AES_SALT_SIZE];
+
   bool running;
 } NetReceiverContext;
 
@@ -99,10 +143,16 @@ typedef struct DecoderThreadContext {
   OS_Mutex *frame_mutex;
   MemoryArena *arena;
 
-  // Encryption
-  AES_Ctx aes_ctx;
+  // Data arrives decrypted; only used to spot a wrong password
   bool encryption_enabled;
 
+  // Raised while the decoder is missing references
+  atomic_bool *keyframe_needed;
+
+  // Frames are decoded when due on the playout clock
+  PlayoutClock *playout;
+  OS_Mutex *playout_mutex;
+
   bool running;
 } DecoderThreadContext;
 
@@ -111,9 +161,15 @@ typedef struct AudioDecoderThreadContext {
   AudioDecoder *decoder;
   AudioPlaybackContext *playback;
 
-  // Encryption
-  AES_Ctx aes_ctx;
-  bool encryption_enabled;
+  // Audio loss measured here, reported to the host in our punches
+  atomic_uint *audio_loss_percent;
+
+  // Samples per packet the host advertises (set by the receiver thread)
+  atomic_uint *audio_packet_size;
+
+  // Audio is buffered to play when its video is shown
+  PlayoutClock *playout;
+  OS_Mutex *playout_mutex;
 
   bool running;
 } AudioDecoderThreadContext;
@@ -131,11 +187,363 @@ static void Net_SendPacketCallback(void *user_data, void *packet_data,
   Net_Send(d->net, d->dest_ip, d->dest_port, packet_data, packet_size);
 }
 
+// SendScheduler sink (runs on the scheduler thread)
+static void Net_SchedulerSend(void *user_data, const char *dest_ip,
+                              int dest_port, const void *data, size_t size) {
+  Net_Send((NetworkContext *)user_data, dest_ip, dest_port, (void *)data,
+           size);
+}
+
+static void Net_SchedulerSendBatch(void *user_data,
+                                   const SchedulerDatagram *datagrams,
+                                   int count) {
+  NetDatagram batch[SCHEDULER_MAX_BATCH];
+  for (int i = 0; i < count; ++i) {
+    batch[i] = (NetDatagram){.ip = datagrams[i].dest->ip,
+                             .port = datagrams[i].dest->port,
+                             .data = datagrams[i].data,
+                             .size = datagrams[i].size};
+  }
+  Net_SendBatch((NetworkContext *)user_data, batch, count);
+}
+
+// Viewer fan-out: a unit is packetized once per viewer group (wire version)
+// and every group gets the same frame ID. Switches `pz` to the group's
+// format; the caller restores the counter to `frame_id_base + 1` afterwards,
+// which also keeps IDs in step with the WebSocket stream when nobody watches.
+static void Host_SelectViewerGroup(Packetizer *pz, const ViewerGroup *group,
+                                   uint32_t frame_id_base, AES_Ctx *auth) {
+  pz->frame_id_counter = frame_id_base;
+  pz->wire_version = group->wire_version;
+  // v2 viewers check a Poly1305-AES tag on every packet
+  pz->auth = (auth && group->wire_version >= PROTOCOL_WIRE_V2) ? auth : NULL;
+}
+
 // --- THREAD PROCEDURES ---
 
+// One captured frame as I420 at every simulcast layer size. Layer 0's
+// thread converts and downscales it once; each layer thread encodes its own
+// size and the last one done frees it.
+typedef struct SimulcastFrame {
+  atomic_int refs;
+  uint32_t sequence; // Capture sequence number, the frame ID on every layer
+  VideoFrame layers[SIMULCAST_MAX_LAYERS];
+  uint8_t *buffer;
+} SimulcastFrame;
+
+static SimulcastFrame *SimulcastFrame_Create(FrameConverter *converter,
+                                             const VideoFrame *frame,
+                                             int layer_count,
+                                             uint32_t sequence) {
+  int widths[SIMULCAST_MAX_LAYERS], heights[SIMULCAST_MAX_LAYERS];
+  size_t offsets[SIMULCAST_MAX_LAYERS], total = 0;
+  widths[0] = frame->width;
+  heights[0] = frame->height;
+  for (int l = 0; l < layer_count; ++l) {
+    if (l > 0)
+      Codec_HalfSize(widths[l - 1], heights[l - 1], &widths[l], &heights[l]);
+    offsets[l] = total;
+    total += Codec_I420Size(widths[l], heights[l]);
+  }
+
+  SimulcastFrame *sf = calloc(1, sizeof(SimulcastFrame));
+  sf->buffer = malloc(total);
+  if (!Codec_ConvertToI420(converter, frame, sf->buffer, &sf->layers[0])) {
+    free(sf->buffer);
+    free(sf);
+    return NULL;
+  }
+  for (int l = 1; l < layer_count; ++l) {
+    Codec_LayoutI420(sf->buffer + offsets[l], widths[l], heights[l],
+                     &sf->layers[l]);
+    Codec_DownscaleI420(&sf->layers[l - 1], &sf->layers[l]);
+  }
+  atomic_init(&sf->refs, 1);
+  sf->sequence = sequence;
+  return sf;
+}
+
+static void SimulcastFrame_Release(SimulcastFrame *sf) {
+  if (atomic_fetch_sub(&sf->refs, 1) == 1) {
+    free(sf->buffer);
+    free(sf);
+  }
+}
+
+// Replays the GOP cache to viewers of this layer that joined mid-GOP, as
+// much as each one's pacing budget allows. Discardable frames are skipped:
+// nothing needs them to reach the live picture. A viewer that reaches the
+// end of the cache gets live video from the next frame on. v2 viewers get the
+// datagrams exactly as first sent; v1 viewers the unit packetized again
+// (unsliced, untagged). Call with viewer_mutex held.
+static void EncoderThread_PumpCatchUp(EncoderThreadContext *ctx, double now) {
+  UnitCache *c = &ctx->gop;
+  Packetizer pz = ctx->packetizer; // Stream id and chunk size
+  pz.temporal_layer = 0;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    Viewer *v = &ctx->viewers->viewers[i];
+    if (!v->active || !v->catching_up || v->layer != ctx->layer)
+      continue;
+    if (!c->valid) {
+      // Cache overflowed mid-replay: back to waiting for an IDR
+      v->catching_up = false;
+      v->keyframe_needed = true;
+      continue;
+    }
+
+    v->catchup_tokens += (now - v->catchup_last_refill) * HOST_CATCHUP_RATE;
+    if (v->catchup_tokens > HOST_CATCHUP_BURST)
+      v->catchup_tokens = HOST_CATCHUP_BURST;
+    v->catchup_last_refill = now;
+
+    ViewerGroup group = {.wire_version = v->wire_version < PROTOCOL_WIRE_V1
+                                             ? PROTOCOL_WIRE_V1
+                                             : v->wire_version};
+    SchedulerTarget target = {.scheduler = ctx->scheduler,
+                              .priority = SEND_PRIORITY_VIDEO,
+                              .dest_ip = v->ip,
+                              .dest_port = v->port};
+    int u = UnitCache_Find(c, v->catchup_next_id);
+    // A unit may overdraw the budget: an IDR can be larger than the burst
+    for (; u < c->count && v->catchup_tokens > 0; ++u) {
+      const CachedUnit *unit = &c->units[u];
+      v->catchup_next_id = unit->frame_id + 1;
+      if (unit->temporal_layer > 0)
+        continue;
+      if (group.wire_version < PROTOCOL_WIRE_V2) {
+        Host_SelectViewerGroup(&pz, &group, unit->frame_id - 1, NULL);
+        pz.timestamp_us = unit->timestamp_us;
+        Protocol_SendFrame(&pz, c->data + unit->offset, unit->size,
+                           unit->flags, Scheduler_SendPacketCallback, &target);
+        v->catchup_tokens -= unit->size;
+      } else if (unit->datagram_size > 0) {
+        DatagramLog_Replay(c->data + unit->datagram_offset,
+                           unit->datagram_size, Scheduler_SendPacketCallback,
+                           &target);
+        v->catchup_tokens -= unit->datagram_size;
+      } else {
+        // Never went out as v2 (too large to log): wait for an IDR
+        v->keyframe_needed = true;
+        u = c->count;
+        break;
+      }
+    }
+    if (u >= c->count) {
+      v->catching_up = false;
+      printf("Host: Viewer %s:%d caught up (%.2f s after joining)\n", v->ip,
+             v->port, now - v->joined_at);
+    }
+  }
+}
+
+// Reopens the layer's encoder for `format`. On failure (the old x264
+// instance is already gone) the old format is reopened and the new one
+// retried a second later; if even that fails the layer stops sending.
+static bool EncoderThread_Reconfigure(EncoderThreadContext *ctx,
+                                      EncoderContext *encoder,
+                                      VideoFormat format) {
+  if (Codec_Reconfigure(encoder, format)) {
+    ctx->vfmt = format;
+    return true;
+  }
+  ctx->reconfigure_after = OS_GetTime() + 1.0;
+  if (Codec_Reconfigure(encoder, ctx->vfmt)) {
+    printf("EncoderThread: Layer %d could not switch to %dx%d, keeping "
+           "%dx%d and retrying.\n",
+           ctx->layer, format.width, format.height, ctx->vfmt.width,
+           ctx->vfmt.height);
+  } else {
+    printf("EncoderThread: Layer %d encoder could not be reopened, layer "
+           "stopped.\n",
+           ctx->layer);
+    ctx->encoder_lost = true;
+  }
+  return false;
+}
+
+// Encodes one frame of this thread's layer and queues it for the layer's
+// viewers. `frame_id` is the capture sequence number, shared by all layers
+// so a viewer can switch layers without its frame IDs going backwards.
+static void EncoderThread_EncodeLayer(EncoderThreadContext *ctx,
+                                      EncoderContext *encoder,
+                                      VideoFrame *frame, uint32_t frame_id,
+                                      MemoryArena *packet_arena) {
+  if (ctx->encoder_lost)
+    return;
+
+  // Handle resolution change in place: the encoder context, its pooled YUV
+  // frames and the scaler are reused instead of pushing a new context.
+  if (frame->width != ctx->vfmt.width || frame->height != ctx->vfmt.height) {
+    if (OS_GetTime() >= ctx->reconfigure_after) {
+      printf("EncoderThread: Resolution change detected in queue (%dx%d, "
+             "layer %d). Reconfiguring encoder.\n",
+             frame->width, frame->height, ctx->layer);
+      VideoFormat format = ctx->vfmt;
+      format.width = frame->width;
+      format.height = frame->height;
+      EncoderThread_Reconfigure(ctx, encoder, format);
+      if (ctx->encoder_lost)
+        return;
+    }
+    // Still the old size: captures are scaled to it, I420 layers can't be
+    if (frame->width != ctx->vfmt.width || frame->height != ctx->vfmt.height) {
+      if (frame->pixel_format == VIDEO_PIXEL_I420)
+        return;
+    }
+  }
+
+  // Chunk size follows path MTU probing (set by the main thread)
+  OS_MutexLock(ctx->viewer_mutex);
+  ctx->packetizer.chunk_size = ctx->viewers->chunk_size;
+  OS_MutexUnlock(ctx->viewer_mutex);
+  uint16_t chunk_size = Protocol_ChunkSize(&ctx->packetizer);
+  if (ctx->vfmt.slice_max_size > 0 &&
+      ctx->vfmt.slice_max_size != chunk_size - SLICE_SIZE_MARGIN &&
+      OS_GetTime() >= ctx->reconfigure_after) {
+    printf("EncoderThread: Chunk size now %u, resizing slices.\n",
+           chunk_size);
+    VideoFormat format = ctx->vfmt;
+    format.slice_max_size = chunk_size - SLICE_SIZE_MARGIN;
+    EncoderThread_Reconfigure(ctx, encoder, format);
+    if (ctx->encoder_lost)
+      return;
+  }
+
+  if (atomic_exchange(&ctx->force_keyframe, false)) {
+    Codec_RequestKeyframe(encoder);
+  }
+
+  ArenaClear(packet_arena);
+  EncodedPacket pkt = {0};
+  Codec_EncodeFrame(encoder, frame, packet_arena, &pkt);
+  if (pkt.size == 0)
+    return;
+
+  // The capture time of the frame in the packet, which need not be `frame`
+  ctx->packetizer.timestamp_us = pkt.timestamp_us;
+
+  // Sliced mode: lay the frame out so chunks cut on slice boundaries
+  SliceLayout *layout = NULL;
+  uint8_t *sparse = NULL;
+  if (ctx->vfmt.slice_max_size > 0) {
+    layout = PushStruct(packet_arena, SliceLayout);
+    sparse = ArenaPush(packet_arena, REASSEMBLY_BUFFER_SIZE);
+    size_t sparse_size =
+        Protocol_LayoutSlices(pkt.data, pkt.size, chunk_size, sparse, layout);
+
+    // Encrypt if enabled (keystream offsets follow the sparse layout). The
+    // contiguous copy below goes out too, so this one gets its own IV.
+    if (sparse_size == 0) {
+      layout = NULL;
+    } else if (ctx->encryption_enabled) {
+      uint8_t iv[16];
+      Protocol_MakeSlicedIV(iv, frame_id, PACKET_TYPE_VIDEO,
+                            ctx->packetizer.stream_id);
+      AES_CTR_Xcrypt(&ctx->aes_ctx, iv, sparse, sparse_size);
+    }
+  }
+
+  // Encrypt if enabled
+  if (ctx->encryption_enabled) {
+    uint8_t iv[16];
+    Protocol_MakeIV(iv, frame_id, PACKET_TYPE_VIDEO,
+                    ctx->packetizer.stream_id);
+    AES_CTR_Xcrypt(&ctx->aes_ctx, iv, pkt.data, pkt.size);
+  }
+
+  // Queue for every UDP viewer of this layer (the scheduler paces it out).
+  // An IDR is where viewers waiting for this layer join it.
+  ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX];
+  OS_MutexLock(ctx->viewer_mutex);
+  if (pkt.keyframe && pkt.recovery_point)
+    ViewerTable_OnLayerIDR(ctx->viewers, ctx->layer);
+  int group_count = ViewerTable_Groups(ctx->viewers, ctx->layer, groups);
+  OS_MutexUnlock(ctx->viewer_mutex);
+
+  // Temporal-layer mode: a frame nothing refers to is dropped whole while
+  // the pacer is behind, halving the frame rate until it catches up
+  if (pkt.temporal_layer > 0 && Scheduler_ShouldShed(ctx->scheduler)) {
+    static double last_shed_log = 0;
+    double now = OS_GetTime();
+    if (now - last_shed_log >= 5.0) {
+      printf("EncoderThread: Send queue backed up, dropping temporal layer 1 "
+             "(layer %d)\n",
+             ctx->layer);
+      last_shed_log = now;
+    }
+    group_count = 0;
+  }
+
+  uint32_t frame_id_base = frame_id - 1;
+  uint8_t flags = (pkt.keyframe ? PACKET_FLAG_KEYFRAME : 0) |
+                  (pkt.recovery_point ? PACKET_FLAG_RECOVERY_POINT : 0);
+  ctx->packetizer.temporal_layer = pkt.temporal_layer;
+  AES_Ctx *auth = ctx->encryption_enabled ? &ctx->aes_ctx : NULL;
+  for (int g = 0; g < group_count; ++g) {
+    if (groups[g].wire_version >= PROTOCOL_WIRE_V2)
+      continue; // Below, with the datagrams the GOP cache keeps
+    // v1 viewers predate the sliced IV: they get the unit contiguous
+    Host_SelectViewerGroup(&ctx->packetizer, &groups[g], frame_id_base, auth);
+    SchedulerTarget target = {.scheduler = ctx->scheduler,
+                              .priority = SEND_PRIORITY_VIDEO,
+                              .dests = groups[g].dests,
+                              .dest_count = groups[g].count};
+    Protocol_SendFrame(&ctx->packetizer, pkt.data, pkt.size, flags,
+                       Scheduler_SendPacketCallback, &target);
+  }
+
+  // The v2 datagrams are built once per unit, watched or not, and logged as
+  // they go out: joiners are replayed these bytes, never a second
+  // packetization under the same IVs and nonces
+  static const ViewerGroup unwatched = {.wire_version = PROTOCOL_WIRE_V2};
+  const ViewerGroup *v2_group = &unwatched;
+  for (int g = 0; g < group_count; ++g) {
+    if (groups[g].wire_version >= PROTOCOL_WIRE_V2)
+      v2_group = &groups[g];
+  }
+  SchedulerTarget v2_target = {.scheduler = ctx->scheduler,
+                               .priority = SEND_PRIORITY_VIDEO,
+                               .dests = v2_group->dests,
+                               .dest_count = v2_group->count};
+  DatagramLog log = {.data = ArenaPush(packet_arena, DATAGRAM_LOG_SIZE),
+                     .next_fn = v2_group->count > 0
+                                    ? Scheduler_SendPacketCallback
+                                    : NULL,
+                     .next_user = &v2_target};
+  Host_SelectViewerGroup(&ctx->packetizer, v2_group, frame_id_base, auth);
+  if (layout) {
+    Protocol_SendFrameSliced(&ctx->packetizer, sparse, layout, flags,
+                             DatagramLog_SendCallback, &log);
+  } else {
+    Protocol_SendFrame(&ctx->packetizer, pkt.data, pkt.size, flags,
+                       DatagramLog_SendCallback, &log);
+  }
+  ctx->packetizer.frame_id_counter = frame_id;
+
+  // Cache the unit as sent (encrypted), then catch up joiners; they were
+  // left out of the groups above, so nobody gets it twice
+  OS_MutexLock(ctx->viewer_mutex);
+  UnitCache_Add(&ctx->gop, frame_id, ctx->packetizer.timestamp_us, flags,
+                pkt.temporal_layer, pkt.data, pkt.size, log.data,
+                log.overflow ? 0 : log.used);
+  EncoderThread_PumpCatchUp(ctx, OS_GetTime());
+  OS_MutexUnlock(ctx->viewer_mutex);
+
+  // Broadcast WebSocket (browsers get the full-size layer). The flags tell
+  // a browser that fell behind what it may skip.
+  if (ctx->layer == 0) {
+    uint8_t ws_flags = WS_MESSAGE_VIDEO |
+                       (pkt.keyframe ? WS_MESSAGE_KEYFRAME : 0) |
+                       (pkt.temporal_layer > 0 ? WS_MESSAGE_DISCARDABLE : 0);
+    WS_Broadcast(ctx->ws, PACKET_TYPE_VIDEO, frame_id, ws_flags, pkt.data,
+                 pkt.size);
+  }
+}
+
 static void EncoderThreadProc(void *data) {
   EncoderThreadContext *ctx = (EncoderThreadContext *)data;
-  printf("EncoderThread: Started\n");
+  printf("EncoderThread: Started (layer %d, %dx%d)\n", ctx->layer,
+         ctx->vfmt.width, ctx->vfmt.height);
 
   EncoderContext *encoder = Codec_InitEncoder(ctx->arena, ctx->vfmt);
   if (!encoder) {
@@ -146,56 +554,54 @@ static void EncoderThreadProc(void *data) {
   MemoryArena packet_arena;
   ArenaInit(&packet_arena, 16 * 1024 * 1024);
 
+  // Layer 0 converts every capture to I420 once for all layers
+  FrameConverter *converter =
+      (ctx->layer == 0 && ctx->layer_count > 1) ? Codec_InitConverter(ctx->arena)
+                                                : NULL;
+  uint32_t capture_sequence = 0;
+
   while (ctx->running) {
-    VideoFrame *frame = (VideoFrame *)Queue_Pop(ctx->frame_queue);
-    if (!frame)
+    void *item = Queue_Pop(ctx->frame_queue);
+    if (!item)
       break; // Shutdown signal
 
-    // Handle resolution change?
-    // For now we assume vfmt is constant or thread manages it.
-    // Actually, if main thread changes vfmt, it should restart the thread.
-    // But let's check if dimensions match.
-    if (frame->width != ctx->vfmt.width || frame->height != ctx->vfmt.height) {
-      printf("EncoderThread: Resolution change detected in queue! Restarting "
-             "encoder.\n");
-      Codec_CloseEncoder(encoder);
-      ctx->vfmt.width = frame->width;
-      ctx->vfmt.height = frame->height;
-      encoder = Codec_InitEncoder(ctx->arena, ctx->vfmt);
+    if (ctx->layer > 0) {
+      SimulcastFrame *sf = (SimulcastFrame *)item;
+      EncoderThread_EncodeLayer(ctx, encoder, &sf->layers[ctx->layer],
+                                sf->sequence, &packet_arena);
+      SimulcastFrame_Release(sf);
+      continue;
     }
 
-    if (encoder) {
-      ArenaClear(&packet_arena);
-      EncodedPacket pkt = {0};
-      Codec_EncodeFrame(encoder, frame, &packet_arena, &pkt);
-
-      if (pkt.size > 0) {
-        OS_MutexLock(ctx->packetizer_mutex);
-        uint32_t current_frame_id = ctx->packetizer.frame_id_counter + 1;
-
-        // Encrypt if enabled
-        if (ctx->encryption_enabled) {
-          uint8_t iv[16] = {0};
-          uint32_t net_id = htonl(current_frame_id);
-          memcpy(iv, &net_id, 4);
-          AES_CTR_Xcrypt(&ctx->aes_ctx, iv, pkt.data, pkt.size);
-        }
-
-        // Send UDP if viewer exists
-        OS_MutexLock(ctx->viewer_mutex);
-        if (ctx->has_viewer) {
-          NetCallbackData net_cb = {.net = ctx->net,
-                                    .dest_ip = ctx->viewer_ip,
-                                    .dest_port = ctx->viewer_port};
-          Protocol_SendFrame(&ctx->packetizer, pkt.data, pkt.size,
-                             Net_SendPacketCallback, &net_cb);
+    VideoFrame *frame = (VideoFrame *)item;
+    uint32_t sequence = ++capture_sequence;
+    if (!converter) {
+      EncoderThread_EncodeLayer(ctx, encoder, frame, sequence, &packet_arena);
+    } else {
+      SimulcastFrame *sf =
+          SimulcastFrame_Create(converter, frame, ctx->layer_count, sequence);
+      if (sf) {
+        // Hand the smaller layers to their threads, then encode ours, so the
+        // encodes run in parallel
+        for (int l = 1; l < ctx->layer_count; ++l) {
+          EncoderThreadContext *layer = &ctx->layers[l];
+          if (Queue_Count(layer->frame_queue) >= SIMULCAST_MAX_BACKLOG) {
+            static double last_skip_log = 0;
+            double now = OS_GetTime();
+            if (now - last_skip_log >= 5.0) {
+              printf("EncoderThread: Layer %d falling behind, skipping "
+                     "frames\n",
+                     l);
+              last_skip_log = now;
+            }
+            continue;
+          }
+          atomic_fetch_add(&sf->refs, 1);
+          Queue_Push(layer->frame_queue, sf);
         }
-        OS_MutexUnlock(ctx->viewer_mutex);
-        OS_MutexUnlock(ctx->packetizer_mutex);
-
-        // Broadcast WebSocket
-        WS_Broadcast(ctx->ws, PACKET_TYPE_VIDEO, current_frame_id, pkt.data,
-                     pkt.size);
+        EncoderThread_EncodeLayer(ctx, encoder, &sf->layers[0], sequence,
+                                  &packet_arena);
+        SimulcastFrame_Release(sf);
       }
     }
 
@@ -205,8 +611,8 @@ static void EncoderThreadProc(void *data) {
     free(frame);
   }
 
-  if (encoder)
-    Codec_CloseEncoder(encoder);
+  Codec_CloseConverter(converter);
+  Codec_CloseEncoder(encoder);
   Queue_Destroy(ctx->frame_queue);
   printf("EncoderThread: Finished\n");
 }
@@ -216,10 +622,10 @@ static void AudioThreadProc(void *data) {
   printf("AudioThread: Started\n");
 
   while (ctx->running) {
-    // Poll multiple times to ensure we get all buffered audio
-    for (int poll = 0; poll < 5; poll++) {
-      Audio_PollCapture(ctx->capture);
-    }
+    // Woken as soon as a frame is captured; the timeout only bounds how
+    // long shutdown waits while nothing plays
+    if (!Audio_WaitCapture(ctx->capture, 100))
+      continue;
 
     AudioFrame *aframe;
     while ((aframe = Audio_GetCapturedFrame(ctx->capture)) != NULL) {
@@ -227,46 +633,145 @@ static void AudioThreadProc(void *data) {
       Audio_Encode(ctx->encoder, aframe, &encoded_audio);
 
       if (encoded_audio.size > 0) {
-        OS_MutexLock(ctx->packetizer_mutex);
-        uint32_t current_audio_id = ctx->packetizer->frame_id_counter + 1;
+        uint32_t current_audio_id = ctx->packetizer.frame_id_counter + 1;
+        // Capture time, so viewers can line it up with video
+        double captured_at = aframe->timestamp > 0.0 ? aframe->timestamp : OS_GetTime();
+        ctx->packetizer.timestamp_us = (uint32_t)(uint64_t)(captured_at * 1e6);
 
         // Encrypt audio if enabled
         if (ctx->encryption_enabled) {
-          uint8_t iv[16] = {0};
-          uint32_t net_id = htonl(current_audio_id);
-          memcpy(iv, &net_id, 4);
+          uint8_t iv[16];
+          Protocol_MakeIV(iv, current_audio_id, PACKET_TYPE_AUDIO,
+                          ctx->packetizer.stream_id);
           AES_CTR_Xcrypt(&ctx->aes_ctx, iv, encoded_audio.data,
                          encoded_audio.size);
         }
 
+        ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX];
         OS_MutexLock(ctx->viewer_mutex);
-        if (ctx->has_viewer) {
-          NetCallbackData net_cb = {.net = ctx->net,
-                                    .dest_ip = ctx->viewer_ip,
-                                    .dest_port = ctx->viewer_port};
-          Protocol_SendAudio(ctx->packetizer, encoded_audio.data,
-                             encoded_audio.size, Net_SendPacketCallback,
-                             &net_cb);
-        }
+        int group_count =
+            ViewerTable_Groups(ctx->viewers, VIEWER_ALL_LAYERS, groups);
+        ctx->packetizer.chunk_size = ctx->viewers->chunk_size;
+        uint8_t loss_percent = ViewerTable_AudioLoss(ctx->viewers);
         OS_MutexUnlock(ctx->viewer_mutex);
 
-        WS_Broadcast(ctx->ws, PACKET_TYPE_AUDIO, current_audio_id,
+        // FEC for the next packets, sized by the worst viewer's loss
+        if (loss_percent != ctx->loss_percent) {
+          Audio_SetPacketLoss(ctx->encoder, loss_percent);
+          static double last_loss_log = 0;
+          double now = OS_GetTime();
+          if (now - last_loss_log >= 5.0) {
+            printf("AudioThread: Viewers lose %u%% of audio, FEC adjusted\n",
+                   loss_percent);
+            last_loss_log = now;
+          }
+          ctx->loss_percent = loss_percent;
+        }
+
+        uint32_t frame_id_base = ctx->packetizer.frame_id_counter;
+        for (int g = 0; g < group_count; ++g) {
+          Host_SelectViewerGroup(&ctx->packetizer, &groups[g], frame_id_base,
+                                 ctx->encryption_enabled ? &ctx->aes_ctx
+                                                         : NULL);
+          SchedulerTarget target = {.scheduler = ctx->scheduler,
+                                    .priority = SEND_PRIORITY_AUDIO,
+                                    .dests = groups[g].dests,
+                                    .dest_count = groups[g].count};
+          Protocol_SendAudio(&ctx->packetizer, encoded_audio.data,
+                             encoded_audio.size, Scheduler_SendPacketCallback,
+                             &target);
+        }
+        ctx->packetizer.frame_id_counter = frame_id_base + 1;
+
+        WS_Broadcast(ctx->ws, PACKET_TYPE_AUDIO, current_audio_id, 0,
                      encoded_audio.data, encoded_audio.size);
-        OS_MutexUnlock(ctx->packetizer_mutex);
       }
     }
+  }
 
-    usleep(5000); // 5ms sleep
+  AudioBufferStats stats;
+  Audio_GetCaptureStats(ctx->capture, &stats);
+  printf("AudioThread: Finished (%u capture overflows)\n", stats.overflows);
+}
+
+// Loss-tolerant video: hands a frame that missed its deadline (or is about to
+// be replaced by a newer one) to the decoder together with its holes.
+static void NetReceiver_FlushPartialVideo(NetReceiverContext *ctx,
+                                          Reassembler *r, bool force) {
+  void *frame_data = NULL;
+  size_t frame_size = 0;
+  uint8_t flags = 0;
+  MissingRange missing[MAX_MISSING_RANGES];
+  int missing_count = 0;
+  uint32_t frame_id = r->active_buffer.frame_id;
+  uint32_t timestamp_us = r->active_buffer.timestamp_us;
+  uint32_t lost_before = r->frames_lost;
+
+  bool has_data = Reassembler_TakePartial(r, OS_GetTime(), force, &frame_data,
+                                          &frame_size, &flags, missing,
+                                          &missing_count);
+  if (r->frames_lost != lost_before) {
+    atomic_store(ctx->keyframe_needed, true);
   }
+  if (!has_data)
+    return;
 
-  printf("AudioThread: Finished\n");
+  EncodedPacket *pkt = calloc(1, sizeof(EncodedPacket));
+  pkt->data = malloc(frame_size);
+  memcpy(pkt->data, frame_data, frame_size);
+  pkt->size = frame_size;
+  pkt->pts = (int64_t)frame_id;
+  pkt->keyframe = (flags & PACKET_FLAG_KEYFRAME) != 0;
+  pkt->keyframe_known = r->wire_version >= PROTOCOL_WIRE_V2;
+  pkt->recovery_point = (flags & PACKET_FLAG_RECOVERY_POINT) != 0;
+  pkt->partial = (flags & PACKET_FLAG_SLICED) != 0;
+  pkt->timestamp_us = timestamp_us;
+  if (missing_count > 0) {
+    pkt->missing = malloc(missing_count * sizeof(ByteRange));
+    for (int i = 0; i < missing_count; ++i) {
+      pkt->missing[i].offset = missing[i].offset;
+      pkt->missing[i].size = missing[i].size;
+    }
+    pkt->missing_count = missing_count;
+  }
+  Queue_Push(ctx->video_queue, pkt);
+}
+
+// Takes the key salt of a (new) host session. The packet's own tag, under
+// the key the salt gives, shows the sender knows the password.
+static void NetReceiver_OnSession(NetReceiverContext *ctx, const void *packet,
+                                  const PacketInfo *info) {
+  uint8_t salt[AES_SALT_SIZE];
+  if (!Protocol_SessionSalt(info, salt) ||
+      (ctx->session_known &&
+       memcmp(salt, ctx->session_salt, AES_SALT_SIZE) == 0))
+    return;
+
+  uint8_t key[16];
+  AES_Ctx candidate;
+  AES_DeriveSessionKey(ctx->password, salt, key);
+  AES_Init(&candidate, key);
+  if (!Protocol_VerifyPacket(&candidate, packet, info)) {
+    static double last_session_warn = 0;
+    double now = OS_GetTime();
+    if (now - last_session_warn > 2.0) {
+      printf("Viewer: Host session fails authentication. Wrong password?\n");
+      last_session_warn = now;
+    }
+    return;
+  }
+  AES_Init(&ctx->aes_ctx, key);
+  memcpy(ctx->session_salt, salt, AES_SALT_SIZE);
+  ctx->session_known = true;
+  printf("NetReceiverThread: Host session key established\n");
 }
 
 static void NetReceiverProc(void *data) {
   NetReceiverContext *ctx = (NetReceiverContext *)data;
   printf("NetReceiverThread: Started\n");
 
-  uint8_t buf[2048];
+  uint8_t buf[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  Packetizer ack_packetizer = {0};
   char sender_ip[16];
   int sender_port;
 
@@ -277,57 +782,148 @@ static void NetReceiverProc(void *data) {
   Reassembler_Init(&video_reassembler, &reasm_arena);
   Reassembler_Init(&audio_reassembler, &reasm_arena);
 
+  // Give up waiting for lost chunks after this long and decode what arrived.
+  // A newer frame starting flushes the current one immediately.
+  video_reassembler.partial_deadline = 0.050;
+
   while (ctx->running) {
+    NetReceiver_FlushPartialVideo(ctx, &video_reassembler, false);
+
     int n = Net_Recv(ctx->net, buf, sizeof(buf), sender_ip, &sender_port);
     if (n > 0) {
       OS_MutexLock(ctx->stats_mutex);
       *(ctx->bytes_received) += n;
       OS_MutexUnlock(ctx->stats_mutex);
 
-      if (n < (int)sizeof(PacketHeader))
+      // Parse once (v1 or v2); the host switches to v2 after our punch.
+      // The video reassembler remembers the version for ambiguous packets.
+      PacketInfo info;
+      if (!Protocol_ParseHeader(buf, n, video_reassembler.wire_version, &info))
         continue;
-      PacketHeader *peek_header = (PacketHeader *)buf;
-      uint8_t ptype = peek_header->packet_type;
+
+      // With a password, every packet must carry a valid tag under the
+      // session key: drop forged (or unauthenticated) ones before any
+      // reassembly work
+      if (ctx->encryption_enabled) {
+        if (info.packet_type == PACKET_TYPE_SESSION) {
+          NetReceiver_OnSession(ctx, buf, &info);
+          continue;
+        }
+        if (!ctx->session_known ||
+            !Protocol_VerifyPacket(&ctx->aes_ctx, buf, &info)) {
+          static double last_auth_warn = 0;
+          double now = OS_GetTime();
+          if (now - last_auth_warn > 2.0) {
+            printf("Viewer: Dropping packets that fail authentication from "
+                   "%s%s\n",
+                   sender_ip,
+                   ctx->session_known ? ". Wrong password?"
+                                      : " (no session key yet)");
+            last_auth_warn = now;
+          }
+          continue;
+        }
+      }
+
+      if (info.version != video_reassembler.wire_version) {
+        printf("NetReceiverThread: Host speaks wire format v%d\n", info.version);
+        video_reassembler.wire_version = info.version;
+        audio_reassembler.wire_version = info.version;
+      }
+      uint8_t ptype = info.packet_type;
 
       if (ptype == PACKET_TYPE_KEEPALIVE)
         continue;
 
+      if (ptype == PACKET_TYPE_MTU_PROBE) {
+        uint16_t probed = Protocol_MtuProbeSize(&info);
+        if (probed > 0) {
+          NetCallbackData ack_cb = {
+              .net = ctx->net, .dest_ip = sender_ip, .dest_port = sender_port};
+          Protocol_SendMtuAck(&ack_packetizer, probed, Net_SendPacketCallback,
+                              &ack_cb);
+        }
+        continue;
+      }
+
       if (ptype == PACKET_TYPE_METADATA) {
-        uint8_t *payload = buf + sizeof(PacketHeader);
-        size_t payload_size = peek_header->payload_size;
-        if (payload_size >= sizeof(StreamMetadata) - sizeof(uint32_t) &&
-            payload_size <= sizeof(StreamMetadata)) {
+        if (info.payload_size >= sizeof(StreamMetadata) - sizeof(uint32_t) &&
+            info.payload_size <= sizeof(StreamMetadata)) {
           OS_MutexLock(ctx->meta_mutex);
           memset(ctx->stream_meta, 0, sizeof(StreamMetadata));
-          memcpy(ctx->stream_meta, payload, payload_size);
+          memcpy(ctx->stream_meta, info.payload, info.payload_size);
           OS_MutexUnlock(ctx->meta_mutex);
         }
         continue;
       }
 
+      if (ptype == PACKET_TYPE_AUDIO_CONFIG) {
+        uint32_t packet_size = Protocol_AudioPacketSize(&info);
+        if (packet_size > 0)
+          atomic_store(ctx->audio_packet_size, packet_size);
+        continue;
+      }
+
       void *frame_data = NULL;
       size_t frame_size = 0;
       uint8_t packet_type = 0;
       ReassemblyResult res;
 
+      // Decrypt each chunk as it arrives: the unit is one CTR stream and a
+      // chunk sits chunk_id * chunk_size bytes into it. Units come out of
+      // the reassembler as plaintext, complete or not.
+      if (ctx->encryption_enabled &&
+          (ptype == PACKET_TYPE_VIDEO || ptype == PACKET_TYPE_AUDIO)) {
+        uint8_t iv[16];
+        Protocol_MakeChunkIV(iv, &info);
+        AES_CTR_XcryptAt(&ctx->aes_ctx, iv,
+                         (uint64_t)info.chunk_id * info.chunk_size,
+                         info.payload, info.payload_size);
+      }
+
       if (ptype == PACKET_TYPE_VIDEO) {
-        res = Protocol_HandlePacket(&video_reassembler, buf, n, &frame_data,
-                                    &frame_size, &packet_type);
+        if (Reassembler_StartsNewUnit(&video_reassembler, &info)) {
+          NetReceiver_FlushPartialVideo(ctx, &video_reassembler, true);
+        }
+
+        uint32_t lost_before = video_reassembler.frames_lost;
+        res = Protocol_HandlePacketInfo(&video_reassembler, &info, &frame_data,
+                                        &frame_size, &packet_type);
+        if (video_reassembler.frames_lost != lost_before) {
+          atomic_store(ctx->keyframe_needed, true);
+        }
       } else if (ptype == PACKET_TYPE_AUDIO) {
-        res = Protocol_HandlePacket(&audio_reassembler, buf, n, &frame_data,
-                                    &frame_size, &packet_type);
+        res = Protocol_HandlePacketInfo(&audio_reassembler, &info, &frame_data,
+                                        &frame_size, &packet_type);
       } else {
         continue;
       }
 
-      if (res == RESULT_COMPLETE) {
+      if (res == RESULT_COMPLETE || res == RESULT_SLICE) {
         uint8_t *qdata = malloc(frame_size);
         memcpy(qdata, frame_data, frame_size);
 
-        EncodedPacket *pkt = malloc(sizeof(EncodedPacket));
+        EncodedPacket *pkt = calloc(1, sizeof(EncodedPacket));
         pkt->data = qdata;
         pkt->size = frame_size;
-        pkt->pts = (int64_t)peek_header->frame_id;
+        pkt->pts = (int64_t)info.frame_id;
+        pkt->keyframe = (info.flags & PACKET_FLAG_KEYFRAME) != 0;
+        pkt->keyframe_known = info.version >= PROTOCOL_WIRE_V2;
+        pkt->recovery_point = (info.flags & PACKET_FLAG_RECOVERY_POINT) != 0;
+        pkt->partial = (info.flags & PACKET_FLAG_SLICED) != 0;
+        pkt->timestamp_us = info.timestamp_us;
+
+        // Capture time against arrival sets the playout clock (v2 hosts)
+        if (info.timestamp_us != 0 && (packet_type == PACKET_TYPE_VIDEO ||
+                                       packet_type == PACKET_TYPE_AUDIO)) {
+          OS_MutexLock(ctx->playout_mutex);
+          PlayoutClock_OnArrival(ctx->playout,
+                                 packet_type == PACKET_TYPE_VIDEO
+                                     ? PLAYOUT_VIDEO
+                                     : PLAYOUT_AUDIO,
+                                 info.timestamp_us, OS_GetTime());
+          OS_MutexUnlock(ctx->playout_mutex);
+        }
 
         if (packet_type == PACKET_TYPE_VIDEO) {
           Queue_Push(ctx->video_queue, pkt);
@@ -348,6 +944,8 @@ static void NetReceiverProc(void *data) {
 static void DecoderThreadProc(void *data) {
   DecoderThreadContext *ctx = (DecoderThreadContext *)data;
   printf("DecoderThread: Started\n");
+  double decode_time = 0.0; // Smoothed, seconds
+  PlayoutReorder reorder = {0};
 
   while (ctx->running) {
     EncodedPacket *pkt = (EncodedPacket *)Queue_Pop(ctx->video_queue);
@@ -355,14 +953,13 @@ static void DecoderThreadProc(void *data) {
       break;
 
     if (ctx->encryption_enabled) {
-      uint8_t iv[16] = {0};
-      uint32_t net_id = htonl((uint32_t)pkt->pts);
-      memcpy(iv, &net_id, 4);
-      AES_CTR_Xcrypt(&ctx->aes_ctx, iv, pkt->data, pkt->size);
-
+      // Already decrypted chunk by chunk in NetReceiverProc (authenticated,
+      // so this is a last line of defence)
       uint8_t *d = pkt->data;
       bool valid = false;
-      if (pkt->size >= 3) {
+      if (pkt->missing_count > 0 && pkt->missing[0].offset == 0) {
+        valid = true; // Lost its first chunk, nothing to check against
+      } else if (pkt->size >= 3) {
         if (d[0] == 0 && d[1] == 0 && d[2] == 1)
           valid = true;
         else if (pkt->size >= 4 && d[0] == 0 && d[1] == 0 && d[2] == 0 &&
@@ -379,16 +976,47 @@ static void DecoderThreadProc(void *data) {
           last_warn_time = now;
         }
         free(pkt->data);
+        free(pkt->missing);
         free(pkt);
         continue;
       }
     }
 
-    OS_MutexLock(ctx->frame_mutex);
-    Codec_DecodePacket(ctx->decoder, pkt, ctx->out_frame);
-    OS_MutexUnlock(ctx->frame_mutex);
+    // Decode at once, then present at the source's cadence: hold the
+    // picture until its own capture time is due on the playout clock. With
+    // B frames that is an earlier packet's, pictures come out reordered.
+    // Pictures from hosts without timestamps, and a backlog, show at once.
+    double decode_start = OS_GetTime();
+    uint32_t frame_us = 0;
+    bool decoded = Codec_DecodeHeld(ctx->decoder, pkt, &frame_us);
+    double now = OS_GetTime();
+    decode_time += (now - decode_start - decode_time) / 16.0;
+    if (decoded) {
+      double hold = (pkt->timestamp_us != 0 && frame_us != 0)
+                        ? PlayoutReorder_Update(&reorder, pkt->timestamp_us, frame_us, now)
+                        : 0.0;
+      OS_MutexLock(ctx->playout_mutex);
+      PlayoutClock_SetLatency(ctx->playout, PLAYOUT_VIDEO, decode_time + hold);
+      double due = frame_us != 0 ? PlayoutClock_DueAt(ctx->playout, frame_us) : now;
+      OS_MutexUnlock(ctx->playout_mutex);
+      if (Queue_Count(ctx->video_queue) < PLAYOUT_VIDEO_BACKLOG) {
+        double wait = due - now;
+        if (wait > PLAYOUT_MAX_DELAY)
+          wait = PLAYOUT_MAX_DELAY;
+        if (wait > 0.0)
+          usleep((useconds_t)(wait * 1e6));
+      }
+      OS_MutexLock(ctx->frame_mutex);
+      Codec_PresentFrame(ctx->decoder, ctx->out_frame);
+      OS_MutexUnlock(ctx->frame_mutex);
+    }
+
+    if (Codec_NeedsKeyframe(ctx->decoder)) {
+      atomic_store(ctx->keyframe_needed, true);
+    }
 
     free(pkt->data);
+    free(pkt->missing);
     free(pkt);
   }
   printf("DecoderThread: Finished\n");
@@ -397,17 +1025,45 @@ static void DecoderThreadProc(void *data) {
 static void AudioDecoderThreadProc(void *data) {
   AudioDecoderThreadContext *ctx = (AudioDecoderThreadContext *)data;
   printf("AudioDecoderThread: Started\n");
+  AudioLossTracker loss;
+  AudioLoss_Init(&loss, AUDIO_FRAME_SIZE * 1000.0 / AUDIO_SAMPLE_RATE);
+  uint32_t packet_size = AUDIO_FRAME_SIZE;
+  double sync_depth_ms = 0.0; // Smoothed buffer depth that meets the video
+  double av_offset_ms = 0.0;  // Smoothed: audio heard after its video (+)
 
   while (ctx->running) {
     EncodedPacket *pkt = (EncodedPacket *)Queue_Pop(ctx->audio_queue);
     if (!pkt)
       break;
 
-    if (ctx->encryption_enabled) {
-      uint8_t iv[16] = {0};
-      uint32_t net_id = htonl((uint32_t)pkt->pts);
-      memcpy(iv, &net_id, 4);
-      AES_CTR_Xcrypt(&ctx->aes_ctx, iv, pkt->data, pkt->size);
+    // The host's framing sizes loss tracking and the jitter buffer's start
+    uint32_t advertised = atomic_load(ctx->audio_packet_size);
+    if (advertised != packet_size) {
+      packet_size = advertised;
+      double packet_ms = packet_size * 1000.0 / AUDIO_SAMPLE_RATE;
+      AudioLoss_SetPacket(&loss, packet_ms);
+      Audio_SetPlaybackPacket(ctx->playback, packet_size);
+      printf("AudioDecoderThread: Host sends %.1f ms audio packets\n",
+             packet_ms);
+    }
+
+    // Fill the gap before this packet: concealment for all but the last
+    // lost one, which this packet's in-band FEC restores. Nothing waits for
+    // a retransmission. A packet whose slot was already concealed is late.
+    int missing = AudioLoss_OnPacket(&loss, (uint32_t)pkt->pts);
+    atomic_store(ctx->audio_loss_percent, loss.loss_percent);
+    if (missing < 0) {
+      free(pkt->data);
+      free(pkt);
+      continue;
+    }
+    for (int i = 0; i < missing; ++i) {
+      bool fec = (i == missing - 1);
+      AudioFrame concealed = {0};
+      Audio_DecodeLost(ctx->decoder, fec ? pkt->data : NULL,
+                       fec ? pkt->size : 0, &concealed);
+      if (concealed.sample_count > 0)
+        Audio_WriteConcealed(ctx->playback, &concealed);
     }
 
     AudioFrame aframe = {0};
@@ -416,10 +1072,55 @@ static void AudioDecoderThreadProc(void *data) {
       Audio_WritePlayback(ctx->playback, &aframe);
     }
 
+    // A/V sync: this packet starts playing once the audio buffered ahead of
+    // it has, and should when its capture time is due on the playout clock.
+    // Buffer deep enough for that; the jitter buffer's own needs set the
+    // clock's audio latency, so video waits for audio when audio is slower.
+    if (pkt->timestamp_us != 0 && aframe.sample_count > 0) {
+      AudioBufferStats stats;
+      Audio_GetPlaybackStats(ctx->playback, &stats);
+      double packet_ms = aframe.sample_count * 1000.0 / AUDIO_SAMPLE_RATE;
+      double now = OS_GetTime();
+      OS_MutexLock(ctx->playout_mutex);
+      PlayoutClock_SetLatency(ctx->playout, PLAYOUT_AUDIO,
+                              stats.target_ms / 1000.0);
+      double due = PlayoutClock_DueAt(ctx->playout, pkt->timestamp_us);
+      OS_MutexUnlock(ctx->playout_mutex);
+
+      double want_ms = (due - now) * 1000.0 + packet_ms;
+      sync_depth_ms += (want_ms - sync_depth_ms) / 16.0;
+      Audio_SetPlaybackDelay(ctx->playback, (float)sync_depth_ms);
+      av_offset_ms += (stats.depth_ms - want_ms - av_offset_ms) / 16.0;
+    }
+
+    // Glitches the playback ring saw, at most every 5 s, and the jitter
+    // buffer's state every 30 s
+    static double last_glitch_log = 0;
+    static double last_jitter_log = 0;
+    static uint32_t logged_glitches = 0;
+    double now = OS_GetTime();
+    if (now - last_glitch_log >= 5.0) {
+      AudioBufferStats stats;
+      Audio_GetPlaybackStats(ctx->playback, &stats);
+      bool glitched = stats.overflows + stats.underruns != logged_glitches;
+      if (glitched || now - last_jitter_log >= 30.0) {
+        printf("Audio: %u playback underruns, %u overflows, %u%% loss "
+               "(%.0f ms buffered, target %.0f ms, jitter %.1f ms, drift "
+               "%+.0f ppm, A/V %+.0f ms)\n",
+               stats.underruns, stats.overflows, loss.loss_percent,
+               stats.depth_ms, stats.target_ms, stats.jitter_ms,
+               stats.drift_ppm, av_offset_ms);
+        logged_glitches = stats.overflows + stats.underruns;
+        last_jitter_log = now;
+      }
+      last_glitch_log = now;
+    }
+
     free(pkt->data);
     free(pkt);
   }
-  printf("AudioDecoderThread: Finished\n");
+  printf("AudioDecoderThread: Finished (%u packets, %u concealed, %u late)\n",
+         loss.received, loss.concealed, loss.late);
 }
 
 // --- HOST MODE ---
@@ -533,14 +1234,24 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
   if (!capture)
     return 1;
 
-  AudioCaptureContext *audio_capture = Audio_InitCapture(arena, audio_node_id);
-  AudioEncoder *audio_encoder = Audio_InitEncoder(arena);
+  // Opus framing (validated by Config_Load), advertised with the metadata
+  uint32_t audio_frame_size =
+      (config && config->audio_frame_size) ? config->audio_frame_size
+                                           : AUDIO_FRAME_SIZE;
+  uint32_t audio_frames_per_packet =
+      (config && config->audio_frames_per_packet)
+          ? config->audio_frames_per_packet
+          : 1;
+  AudioCaptureContext *audio_capture = Audio_InitCapture(
+      arena, audio_node_id, audio_frame_size * audio_frames_per_packet);
+  AudioEncoder *audio_encoder = Audio_InitEncoder(arena, audio_frame_size);
 
   // Main thread Network Setup (shared by worker threads)
   NetworkContext *net = Net_Init(arena, 9999, true);
   if (!net)
     return 1;
 
+  // Browsers open http://<host>:8080/ for the viewer and its stream
   WebSocketContext *ws = WS_Init(arena, 8080);
 
   // Video Format Setup
@@ -551,56 +1262,100 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
                       .fps = target_fps,
                       .bitrate = initial_bitrate};
   strncpy(vfmt.preset, encoder_preset, sizeof(vfmt.preset) - 1);
+  vfmt.intra_refresh = config && config->intra_refresh;
+  vfmt.temporal_layers = config && config->temporal_layers;
+  if (config && config->sliced_encoding) {
+    vfmt.slice_max_size = MAX_PACKET_PAYLOAD - SLICE_SIZE_MARGIN;
+  }
 
-  // Encryption Setup
+  // Encryption Setup: a fresh salt per session, so IVs and nonces (frame and
+  // chunk IDs restart every session) never repeat under one key
   bool encryption_enabled = (password && password[0] != '\0');
   uint8_t master_key[16] = {0};
+  uint8_t session_salt[AES_SALT_SIZE] = {0};
   if (encryption_enabled) {
-    AES_DeriveKey(password, master_key);
+    if (!OS_GetRandomBytes(session_salt, sizeof(session_salt))) {
+      printf("Host: No random source for the session key\n");
+      return 1;
+    }
+    AES_DeriveSessionKey(password, session_salt, master_key);
   }
 
   // Threading Synchronization
   OS_Mutex *viewer_mutex = OS_MutexCreate();
-  OS_Mutex *packetizer_mutex = OS_MutexCreate();
-
-  // Start Encoder Thread
-  EncoderThreadContext encoder_ctx = {0};
-  encoder_ctx.frame_queue = Queue_Create();
-  encoder_ctx.vfmt = vfmt;
-  encoder_ctx.arena = PushStruct(arena, MemoryArena);
-  ArenaInit(encoder_ctx.arena, 32 * 1024 * 1024);
-  encoder_ctx.net = net;
-  strncpy(encoder_ctx.viewer_ip, target_ip, 15);
-  encoder_ctx.viewer_port = 9999;
-  encoder_ctx.has_viewer = false;
-  encoder_ctx.viewer_mutex = viewer_mutex;
-  encoder_ctx.packetizer_mutex = packetizer_mutex;
-  encoder_ctx.ws = ws;
-  encoder_ctx.encryption_enabled = encryption_enabled;
-  if (encryption_enabled)
-    AES_Init(&encoder_ctx.aes_ctx, master_key);
-  encoder_ctx.running = true;
-  OS_Thread *encoder_thread = OS_ThreadCreate(EncoderThreadProc, &encoder_ctx);
+  ViewerTable *viewers = PushStructZero(arena, ViewerTable);
+
+  // All UDP sends go through one prioritized, paced sender thread, which
+  // hands each pacing burst (for all viewers) to the kernel in one call
+  SendScheduler *scheduler = Scheduler_Create(Net_SchedulerSend, net);
+  Scheduler_SetBatchSend(scheduler, Net_SchedulerSendBatch);
+
+  // Start Encoder Threads, one per simulcast layer so the encodes spread
+  // across cores. Each layer is half the size of the one above, at the
+  // bitrate that size would get on its own.
+  int layer_count = (config && config->simulcast_layers > 1)
+                        ? (int)config->simulcast_layers
+                        : 1;
+  if (layer_count > SIMULCAST_MAX_LAYERS)
+    layer_count = SIMULCAST_MAX_LAYERS;
+  viewers->layer_count = layer_count;
+
+  EncoderThreadContext encoder_ctx[SIMULCAST_MAX_LAYERS] = {0};
+  OS_Thread *encoder_threads[SIMULCAST_MAX_LAYERS] = {0};
+  for (int l = 0; l < layer_count; ++l) {
+    EncoderThreadContext *ectx = &encoder_ctx[l];
+    ectx->frame_queue = Queue_Create();
+    ectx->vfmt = vfmt;
+    if (l > 0) {
+      Codec_HalfSize(encoder_ctx[l - 1].vfmt.width,
+                     encoder_ctx[l - 1].vfmt.height, &ectx->vfmt.width,
+                     &ectx->vfmt.height);
+      ectx->vfmt.bitrate = CalculateTargetBitrate(
+          ectx->vfmt.width, ectx->vfmt.height, ectx->vfmt.fps);
+    }
+    ectx->layer = l;
+    ectx->layer_count = layer_count;
+    ectx->layers = encoder_ctx;
+    ectx->packetizer.stream_id = (uint8_t)l;
+    UnitCache_Init(&ectx->gop, arena);
+    ectx->arena = PushStruct(arena, MemoryArena);
+    ArenaInit(ectx->arena, 32 * 1024 * 1024);
+    ectx->scheduler = scheduler;
+    ectx->viewers = viewers;
+    ectx->viewer_mutex = viewer_mutex;
+    ectx->ws = ws;
+    ectx->encryption_enabled = encryption_enabled;
+    if (encryption_enabled)
+      AES_Init(&ectx->aes_ctx, master_key);
+    ectx->running = true;
+  }
+  // Smaller layers first: their queues must exist before layer 0 feeds them
+  for (int l = layer_count - 1; l >= 0; --l) {
+    encoder_threads[l] = OS_ThreadCreate(EncoderThreadProc, &encoder_ctx[l]);
+  }
+  if (layer_count > 1) {
+    printf("Host: Simulcast with %d layers\n", layer_count);
+  }
 
   // Start Audio Thread
   AudioThreadContext audio_ctx = {0};
   audio_ctx.capture = audio_capture;
   audio_ctx.encoder = audio_encoder;
-  audio_ctx.net = net;
-  strncpy(audio_ctx.viewer_ip, target_ip, 15);
-  audio_ctx.viewer_port = 9999;
-  audio_ctx.has_viewer = false;
+  audio_ctx.scheduler = scheduler;
+  audio_ctx.viewers = viewers;
   audio_ctx.viewer_mutex = viewer_mutex;
   audio_ctx.ws = ws;
   audio_ctx.encryption_enabled = encryption_enabled;
   if (encryption_enabled)
     AES_Init(&audio_ctx.aes_ctx, master_key);
-  audio_ctx.packetizer = &encoder_ctx.packetizer; // Interleave IDs
-  audio_ctx.packetizer_mutex = packetizer_mutex;
   audio_ctx.running = true;
   OS_Thread *audio_thread = OS_ThreadCreate(AudioThreadProc, &audio_ctx);
 
   // Metadata & Packetizer for Main Thread (Metadata/Punches)
+  Packetizer control_packetizer = {0};
+  AES_Ctx control_aes;
+  if (encryption_enabled)
+    AES_Init(&control_aes, master_key);
   StreamMetadata metadata = {0};
   strcpy(metadata.os_name, "Linux");
   const char *env_de = getenv("XDG_CURRENT_DESKTOP");
@@ -613,6 +1368,17 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
   float time_since_host_punch = 0.0f;
   const float HOST_PUNCH_INTERVAL = 0.5f;
 
+  // Keyframe-on-demand: requests (viewer PLI, new viewers) are coalesced and
+  // rate-limited, overall and per viewer (see viewer_table.h), so a lossy
+  // viewer cannot turn the stream into all-IDR.
+  const double KEYFRAME_MIN_INTERVAL = 0.5;
+  double last_forced_keyframe[SIMULCAST_MAX_LAYERS] = {0};
+  bool keyframe_pending = false; // Browser viewers (layer 0)
+
+  // Path MTU probing, only while every viewer can answer the probes (v2)
+  bool mtu_probing = false;
+  uint16_t session_chunk_size = 0;
+
   int result = 0;
   while (OS_ProcessEvents(window)) {
     if (OS_IsEscapePressed()) {
@@ -620,7 +1386,27 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
       break;
     }
 
-    WS_Poll(ws);
+    if (WS_Poll(ws) > 0) {
+      keyframe_pending = true; // New or resyncing browser needs an IDR
+      if (encryption_enabled) // ...and the key salt to decrypt it
+        WS_Broadcast(ws, PACKET_TYPE_SESSION, 0, 0, session_salt,
+                     sizeof(session_salt));
+    }
+
+    // Worst browser playback stats (web viewers report them every second)
+    {
+      static double last_ws_stats_log = 0;
+      WSViewerStats ws_stats;
+      int reporting = WS_GetViewerStats(ws, &ws_stats);
+      if (reporting > 0 && OS_GetTime() - last_ws_stats_log >= 10.0) {
+        printf("Host: %d browser(s), worst: %.1f fps, decode %.1f ms, "
+               "queue %d, latency %d ms, audio %d ms, %u dropped\n",
+               reporting, ws_stats.fps, ws_stats.decode_ms,
+               ws_stats.decode_queue, ws_stats.latency_ms,
+               ws_stats.audio_buffer_ms, ws_stats.frames_dropped);
+        last_ws_stats_log = OS_GetTime();
+      }
+    }
 
     int w, h;
     OS_GetWindowSize(window, &w, &h);
@@ -629,16 +1415,27 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
     elapsed_time += 1.0f / (float)vfmt.fps;
     time_since_host_punch += 1.0f / (float)vfmt.fps;
 
-    // Periodic Punches (Main Thread)
+    double now = OS_GetTime();
+    OS_MutexLock(viewer_mutex);
+
+    // Periodic Punches (Main Thread), in the format the target speaks
     if (time_since_host_punch >= HOST_PUNCH_INTERVAL) {
-      OS_MutexLock(packetizer_mutex);
-      Protocol_SendPunch(&encoder_ctx.packetizer, Net_SendPacketCallback,
-                         &(NetCallbackData){net, target_ip, 9999});
-      OS_MutexUnlock(packetizer_mutex);
+      Viewer *target_viewer = ViewerTable_Find(viewers, target_ip, 9999);
+      ViewerGroup target_group = {
+          .wire_version = target_viewer ? target_viewer->wire_version
+                                        : PROTOCOL_WIRE_V1};
+      Host_SelectViewerGroup(&control_packetizer, &target_group,
+                             control_packetizer.frame_id_counter,
+                             encryption_enabled ? &control_aes : NULL);
+      Protocol_SendPunch(&control_packetizer, Scheduler_SendPacketCallback,
+                         &(SchedulerTarget){.scheduler = scheduler,
+                                            .priority = SEND_PRIORITY_CONTROL,
+                                            .dest_ip = target_ip,
+                                            .dest_port = 9999});
       time_since_host_punch = 0.0f;
     }
 
-    // Receive Punch / Update Viewer (Main Thread)
+    // Receive Punches / Update Viewers (Main Thread)
     {
       uint8_t punch_buf[64];
       char incoming_ip[16];
@@ -646,24 +1443,132 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
       int n;
       while ((n = Net_Recv(net, punch_buf, sizeof(punch_buf), incoming_ip,
                            &incoming_port)) > 0) {
-        if (n >= (int)sizeof(PacketHeader)) {
-          PacketHeader *hdr = (PacketHeader *)punch_buf;
-          if (hdr->packet_type == PACKET_TYPE_PUNCH) {
-            OS_MutexLock(viewer_mutex);
-            if (!encoder_ctx.has_viewer ||
-                strcmp(encoder_ctx.viewer_ip, incoming_ip) != 0) {
-              strncpy(encoder_ctx.viewer_ip, incoming_ip, 15);
-              strncpy(audio_ctx.viewer_ip, incoming_ip, 15);
-              encoder_ctx.has_viewer = true;
-              audio_ctx.has_viewer = true;
-              printf("Host: Viewer connected from %s:%d\n", incoming_ip,
+        PacketInfo hdr;
+        if (!Protocol_ParseHeader(punch_buf, n, PROTOCOL_WIRE_V1, &hdr))
+          continue;
+        // Replies go to the port the viewer punched from
+        Viewer *v = ViewerTable_Find(viewers, incoming_ip, incoming_port);
+
+        if (hdr.packet_type == PACKET_TYPE_PUNCH) {
+          // Older viewers don't advertise a version and stay on v1
+          uint8_t wire_version = Protocol_PunchWireVersion(&hdr);
+          bool joined;
+          v = ViewerTable_OnPunch(viewers, incoming_ip, incoming_port,
+                                  wire_version, now, &joined);
+          if (v) {
+            v->audio_loss_percent = Protocol_PunchAudioLoss(&hdr);
+            uint8_t layer = v->requested_layer;
+            ViewerTable_RequestLayer(viewers, v, Protocol_PunchLayer(&hdr),
+                                     joined);
+            if (!joined && v->requested_layer != layer) {
+              printf("Host: Viewer %s:%d switching to layer %d\n",
+                     incoming_ip, incoming_port, v->requested_layer);
+            }
+          }
+          if (joined) {
+            // Nothing decrypts before the viewer has the key salt, and its
+            // jitter buffer wants the audio framing before the first packet
+            ViewerGroup group = {.wire_version = wire_version};
+            Host_SelectViewerGroup(&control_packetizer, &group,
+                                   control_packetizer.frame_id_counter,
+                                   encryption_enabled ? &control_aes : NULL);
+            SchedulerTarget target = {.scheduler = scheduler,
+                                      .priority = SEND_PRIORITY_CONTROL,
+                                      .dest_ip = incoming_ip,
+                                      .dest_port = incoming_port};
+            if (encryption_enabled)
+              Protocol_SendSession(&control_packetizer, session_salt,
+                                   Scheduler_SendPacketCallback, &target);
+            Protocol_SendAudioConfig(&control_packetizer,
+                                     (uint16_t)audio_frame_size,
+                                     (uint8_t)audio_frames_per_packet,
+                                     Scheduler_SendPacketCallback, &target);
+          }
+          if (joined) {
+            // Start from the layer's cached keyframe instead of forcing one
+            UnitCache *gop = &encoder_ctx[v->layer].gop;
+            if (gop->valid && gop->count > 0) {
+              v->catching_up = true;
+              v->catchup_next_id = gop->units[0].frame_id;
+              v->catchup_tokens = HOST_CATCHUP_BURST;
+              v->catchup_last_refill = now;
+              v->keyframe_needed = false;
+            }
+            printf("Host: Viewer connected from %s:%d (wire format v%d, layer "
+                   "%d, %d watching%s)\n",
+                   incoming_ip, incoming_port, wire_version, v->layer,
+                   viewers->count,
+                   v->catching_up ? ", replaying cached GOP" : "");
+          } else if (!v) {
+            static double last_full_log = 0;
+            if (now - last_full_log >= 5.0) {
+              printf("Host: Viewer table full, ignoring %s:%d\n", incoming_ip,
                      incoming_port);
+              last_full_log = now;
             }
-            OS_MutexUnlock(viewer_mutex);
           }
+        } else if (hdr.packet_type == PACKET_TYPE_KEYFRAME_REQUEST && v) {
+          // A viewer replaying the cache has a keyframe on the way
+          if (!v->catching_up)
+            ViewerTable_OnKeyframeRequest(v);
+        } else if (hdr.packet_type == PACKET_TYPE_MTU_ACK && v) {
+          MtuProbe_OnAck(&v->mtu, Protocol_MtuAckSize(&hdr));
         }
       }
     }
+    ViewerTable_Expire(viewers, now);
+
+    // Path MTU probing towards each viewer; the session uses the smallest
+    bool can_probe = ViewerTable_CanProbe(viewers);
+    if (can_probe != mtu_probing) {
+      Net_SetPathMtuProbing(net, can_probe);
+      mtu_probing = can_probe;
+    }
+    if (mtu_probing) {
+      ViewerGroup v2_group = {.wire_version = PROTOCOL_WIRE_V2};
+      for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+        Viewer *v = &viewers->viewers[i];
+        if (!v->active)
+          continue;
+        Host_SelectViewerGroup(&control_packetizer, &v2_group,
+                               control_packetizer.frame_id_counter,
+                               encryption_enabled ? &control_aes : NULL);
+        SchedulerTarget target = {.scheduler = scheduler,
+                                  .priority = SEND_PRIORITY_CONTROL,
+                                  .dest_ip = v->ip,
+                                  .dest_port = v->port};
+        if (MtuProbe_Poll(&v->mtu, now, &control_packetizer,
+                          Scheduler_SendPacketCallback, &target)) {
+          printf("Host: Path MTU probing to %s:%d done, chunk size %u bytes\n",
+                 v->ip, v->port,
+                 v->mtu.chunk_size ? v->mtu.chunk_size : MAX_PACKET_PAYLOAD);
+          ViewerTable_UpdateChunkSize(viewers);
+        }
+      }
+    }
+    if (viewers->chunk_size != session_chunk_size) {
+      session_chunk_size = viewers->chunk_size;
+      printf("Host: Session chunk size now %u bytes\n",
+             session_chunk_size ? session_chunk_size : MAX_PACKET_PAYLOAD);
+    }
+    control_packetizer.chunk_size = viewers->chunk_size;
+
+    // In intra-refresh mode native viewers sync on the next refresh cycle,
+    // no IDR burst needed, but a viewer changing layers needs an IDR of the
+    // new one
+    for (int l = 0; l < layer_count; ++l) {
+      if (now - last_forced_keyframe[l] >= KEYFRAME_MIN_INTERVAL &&
+          ((l == 0 && keyframe_pending) ||
+           ViewerTable_SwitchPending(viewers, l) ||
+           (!vfmt.intra_refresh && ViewerTable_KeyframeDue(viewers, l, now)))) {
+        ViewerTable_OnKeyframeForced(viewers, l, now);
+        atomic_store(&encoder_ctx[l].force_keyframe, true);
+        last_forced_keyframe[l] = now;
+        if (l == 0)
+          keyframe_pending = false;
+      }
+    }
+    OS_MutexUnlock(viewer_mutex);
 
     // Capture Loop
     Capture_Poll(capture);
@@ -675,16 +1580,36 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
       if (frame_count % vfmt.fps == 0) {
         metadata.screen_width = frame->width;
         metadata.screen_height = frame->height;
-        OS_MutexLock(packetizer_mutex);
+        ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX];
         OS_MutexLock(viewer_mutex);
-        if (encoder_ctx.has_viewer) {
-          NetCallbackData net_cb = {
-              .net = net, .dest_ip = encoder_ctx.viewer_ip, .dest_port = 9999};
-          Protocol_SendMetadata(&encoder_ctx.packetizer, &metadata,
-                                Net_SendPacketCallback, &net_cb);
-        }
+        int group_count =
+            ViewerTable_Groups(viewers, VIEWER_ALL_LAYERS, groups);
         OS_MutexUnlock(viewer_mutex);
-        OS_MutexUnlock(packetizer_mutex);
+
+        uint32_t frame_id_base = control_packetizer.frame_id_counter;
+        for (int g = 0; g < group_count; ++g) {
+          Host_SelectViewerGroup(&control_packetizer, &groups[g],
+                                 frame_id_base,
+                                 encryption_enabled ? &control_aes : NULL);
+          SchedulerTarget target = {.scheduler = scheduler,
+                                    .priority = SEND_PRIORITY_CONTROL,
+                                    .dests = groups[g].dests,
+                                    .dest_count = groups[g].count};
+          Protocol_SendMetadata(&control_packetizer, &metadata,
+                                Scheduler_SendPacketCallback, &target);
+          Protocol_SendAudioConfig(&control_packetizer,
+                                   (uint16_t)audio_frame_size,
+                                   (uint8_t)audio_frames_per_packet,
+                                   Scheduler_SendPacketCallback, &target);
+          if (encryption_enabled)
+            Protocol_SendSession(&control_packetizer, session_salt,
+                                 Scheduler_SendPacketCallback, &target);
+        }
+        control_packetizer.frame_id_counter =
+            frame_id_base + (encryption_enabled ? 3 : 2);
+        if (encryption_enabled)
+          WS_Broadcast(ws, PACKET_TYPE_SESSION, 0, 0, session_salt,
+                       sizeof(session_salt));
       }
 
       // Copy frame and push to worker queue
@@ -693,7 +1618,9 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
       size_t data_size = frame->height * frame->linesize[0];
       qframe->data[0] = malloc(data_size);
       memcpy(qframe->data[0], frame->data[0], data_size);
-      Queue_Push(encoder_ctx.frame_queue, qframe);
+      if (qframe->timestamp == 0.0)
+        qframe->timestamp = now;
+      Queue_Push(encoder_ctx[0].frame_queue, qframe);
     }
 
     // Status UI
@@ -705,18 +1632,21 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
   }
 
   // Stop Worker Threads
-  encoder_ctx.running = false;
+  for (int l = 0; l < layer_count; ++l)
+    encoder_ctx[l].running = false;
   audio_ctx.running = false;
   
-  // Signal encoder queue to shutdown - unblocks encoder thread waiting on Queue_Pop
-  Queue_Shutdown(encoder_ctx.frame_queue);
-
-  OS_ThreadJoin(encoder_thread);
+  // Signal encoder queues to shutdown - unblocks encoder threads waiting on
+  // Queue_Pop. Layer 0 feeds the others, so it stops first.
+  for (int l = 0; l < layer_count; ++l) {
+    Queue_Shutdown(encoder_ctx[l].frame_queue);
+    OS_ThreadJoin(encoder_threads[l]);
+  }
   OS_ThreadJoin(audio_thread);
+  Scheduler_Destroy(scheduler);
 
   // Cleanup
   OS_MutexDestroy(viewer_mutex);
-  OS_MutexDestroy(packetizer_mutex);
   if (audio_capture)
     Audio_CloseCapture(audio_capture);
   if (audio_encoder)
@@ -733,7 +1663,7 @@ int RunHost(MemoryArena *arena, WindowContext *window, const char *target_ip,
 
 // --- VIEWER MODE ---
 int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
-              bool verbose, const char *password) {
+              bool verbose, const char *password, uint32_t playout_smoothness) {
   (void)verbose;
   printf("Starting Multi-Threaded VIEWER Mode...\n");
 
@@ -749,17 +1679,17 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   AudioDecoder *audio_decoder = Audio_InitDecoder(arena);
   AudioPlaybackContext *audio_playback = Audio_InitPlayback(arena);
 
+  // The key also needs the host's session salt (NetReceiver_OnSession)
   bool encryption_enabled = (password && password[0] != '\0');
-  uint8_t master_key[16] = {0};
-  if (encryption_enabled) {
-    AES_DeriveKey(password, master_key);
-  }
 
   // Shared State
   VideoFrame decoded_frame = {0};
   StreamMetadata stream_meta = {0};
   size_t bytes_received_window = 0;
   float current_mbps = 0.0f;
+  atomic_bool keyframe_needed = true; // Ask for an IDR as soon as we connect
+  atomic_uint audio_loss_percent = 0;
+  atomic_uint audio_packet_size = AUDIO_FRAME_SIZE;
 
   // Threading Synchronization
   Queue *video_queue = Queue_Create();
@@ -768,6 +1698,11 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   OS_Mutex *stats_mutex = OS_MutexCreate();
   OS_Mutex *frame_mutex = OS_MutexCreate();
 
+  // A/V sync: video and audio play out against one clock
+  PlayoutClock playout;
+  PlayoutClock_Init(&playout, playout_smoothness / 100.0);
+  OS_Mutex *playout_mutex = OS_MutexCreate();
+
   // Worker Threads
   NetReceiverContext net_ctx = {0};
   net_ctx.net = net;
@@ -775,8 +1710,14 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   net_ctx.audio_queue = audio_queue;
   net_ctx.stream_meta = &stream_meta;
   net_ctx.meta_mutex = meta_mutex;
+  net_ctx.audio_packet_size = &audio_packet_size;
   net_ctx.bytes_received = &bytes_received_window;
   net_ctx.stats_mutex = stats_mutex;
+  net_ctx.keyframe_needed = &keyframe_needed;
+  net_ctx.playout = &playout;
+  net_ctx.playout_mutex = playout_mutex;
+  net_ctx.encryption_enabled = encryption_enabled;
+  net_ctx.password = password;
   net_ctx.running = true;
   OS_Thread *net_thread = OS_ThreadCreate(NetReceiverProc, &net_ctx);
 
@@ -788,8 +1729,9 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   decoder_ctx.arena = PushStruct(arena, MemoryArena);
   ArenaInit(decoder_ctx.arena, 32 * 1024 * 1024);
   decoder_ctx.encryption_enabled = encryption_enabled;
-  if (encryption_enabled)
-    AES_Init(&decoder_ctx.aes_ctx, master_key);
+  decoder_ctx.keyframe_needed = &keyframe_needed;
+  decoder_ctx.playout = &playout;
+  decoder_ctx.playout_mutex = playout_mutex;
   decoder_ctx.running = true;
   OS_Thread *decoder_thread = OS_ThreadCreate(DecoderThreadProc, &decoder_ctx);
 
@@ -797,16 +1739,29 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   audio_decoder_ctx.audio_queue = audio_queue;
   audio_decoder_ctx.decoder = audio_decoder;
   audio_decoder_ctx.playback = audio_playback;
-  audio_decoder_ctx.encryption_enabled = encryption_enabled;
-  if (encryption_enabled)
-    AES_Init(&audio_decoder_ctx.aes_ctx, master_key);
+  audio_decoder_ctx.audio_loss_percent = &audio_loss_percent;
+  audio_decoder_ctx.audio_packet_size = &audio_packet_size;
+  audio_decoder_ctx.playout = &playout;
+  audio_decoder_ctx.playout_mutex = playout_mutex;
   audio_decoder_ctx.running = true;
   OS_Thread *audio_decoder_thread =
       OS_ThreadCreate(AudioDecoderThreadProc, &audio_decoder_ctx);
 
   float time_since_last_punch = 0.0f;
   const float PUNCH_INTERVAL = 0.5f;
+  double last_keyframe_request = 0.0;
+  const double KEYFRAME_REQUEST_INTERVAL = 0.25;
   float bandwidth_window_time = 0.0f;
+
+  // Simulcast: ask for a smaller layer after repeated picture loss, and try
+  // the next larger one after a clean spell (hosts with fewer layers clamp)
+  uint8_t layer = 0;
+  const int LAYER_DOWN_LOSSES = 3;        // Lost pictures within...
+  const double LAYER_LOSS_WINDOW = 2.0;   // ...this many seconds
+  const double LAYER_UP_AFTER = 15.0;     // Seconds without loss
+  int window_losses = 0;
+  double loss_window_start = 0.0;
+  double last_loss = OS_GetTime();
   const float BANDWIDTH_WINDOW = 1.0f;
 
   int result = 0;
@@ -819,10 +1774,45 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
     // Punch Loop (Main Thread)
     time_since_last_punch += 1.0f / 60.0f;
     if (time_since_last_punch >= PUNCH_INTERVAL) {
-      Protocol_SendPunch(&punch_packetizer, Net_SendPacketCallback, &punch_cb);
+      Protocol_SendLayerPunch(&punch_packetizer, layer,
+                              (uint8_t)atomic_load(&audio_loss_percent),
+                              Net_SendPacketCallback, &punch_cb);
       time_since_last_punch = 0.0f;
     }
 
+    // Keyframe Request (PLI) when we join or lose a frame / reference
+    double now = OS_GetTime();
+    if (atomic_load(&keyframe_needed) &&
+        now - last_keyframe_request >= KEYFRAME_REQUEST_INTERVAL) {
+      atomic_store(&keyframe_needed, false);
+      Protocol_SendKeyframeRequest(&punch_packetizer, Net_SendPacketCallback,
+                                   &punch_cb);
+
+      if (last_keyframe_request > 0.0) { // Not the request we join with
+        if (now - loss_window_start > LAYER_LOSS_WINDOW) {
+          loss_window_start = now;
+          window_losses = 0;
+        }
+        last_loss = now;
+        if (++window_losses >= LAYER_DOWN_LOSSES &&
+            layer + 1 < SIMULCAST_MAX_LAYERS) {
+          layer++;
+          window_losses = 0;
+          time_since_last_punch = PUNCH_INTERVAL; // Tell the host right away
+          printf("Viewer: Repeated loss, asking for simulcast layer %d\n",
+                 layer);
+        }
+      }
+      last_keyframe_request = now;
+    }
+    if (layer > 0 && now - last_loss >= LAYER_UP_AFTER) {
+      layer--;
+      last_loss = now;
+      time_since_last_punch = PUNCH_INTERVAL;
+      printf("Viewer: No loss for %.0f s, asking for simulcast layer %d\n",
+             LAYER_UP_AFTER, layer);
+    }
+
     // Bandwidth Measurement (Main Thread)
     bandwidth_window_time += 1.0f / 60.0f;
     if (bandwidth_window_time >= BANDWIDTH_WINDOW) {
@@ -881,6 +1871,7 @@ int RunViewer(MemoryArena *arena, WindowContext *window, const char *host_ip,
   OS_MutexDestroy(meta_mutex);
   OS_MutexDestroy(stats_mutex);
   OS_MutexDestroy(frame_mutex);
+  OS_MutexDestroy(playout_mutex);
   if (decoder)
     Codec_CloseDecoder(decoder);
   if (audio_decoder)
@@ -1163,7 +2154,8 @@ int main(int argc, char **argv) {
                     config.stream_password, &saved_config);
       } else {
         result = RunViewer(&main_arena, window, config.target_ip,
-                           config.verbose, config.stream_password);
+                           config.verbose, config.stream_password,
+                           saved_config.playout_smoothness);
       }
 
       // result == 2 means return to menu (ESC pressed)
@@ -1,6 +1,7 @@
 #include "aes.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 // --- SHA1 Implementation for Key Derivation ---
 #define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
@@ -61,8 +62,20 @@ void AES_DeriveKey(const char *password, uint8_t key[16]) {
     memcpy(key, hash, 16); // Use first 16 bytes as AES-128 key
 }
 
+void AES_DeriveSessionKey(const char *password, const uint8_t salt[AES_SALT_SIZE], uint8_t key[16]) {
+    size_t len = strlen(password);
+    uint8_t *input = malloc(len + AES_SALT_SIZE);
+    memcpy(input, password, len);
+    memcpy(input + len, salt, AES_SALT_SIZE);
+    uint8_t hash[20];
+    sha1(input, len + AES_SALT_SIZE, hash);
+    memcpy(key, hash, 16);
+    free(input);
+}
+
 // Tiny AES implementation based on public domain code
-// Optimized for simplicity and size.
+// Optimized for simplicity and size. Kept as the reference the faster
+// implementations below are checked against (AES_IMPL_REFERENCE).
 
 static const uint8_t sbox[256] = {
     0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
@@ -91,6 +104,8 @@ static uint32_t rot_word(uint32_t w) {
     return (w << 8) | (w >> 24);
 }
 
+static void aes_encrypt_block(AES_Ctx *ctx, uint8_t *block);
+
 void AES_Init(AES_Ctx *ctx, const uint8_t key[16]) {
     uint32_t rcon[] = {0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000,
                        0x20000000, 0x40000000, 0x80000000, 0x1B000000, 0x36000000};
@@ -106,6 +121,21 @@ void AES_Init(AES_Ctx *ctx, const uint8_t key[16]) {
         }
         ctx->round_keys[i] = ctx->round_keys[i - 4] ^ temp;
     }
+    for (i = 0; i < 44; i++) {
+        ctx->round_key_bytes[i * 4]     = (uint8_t)(ctx->round_keys[i] >> 24);
+        ctx->round_key_bytes[i * 4 + 1] = (uint8_t)(ctx->round_keys[i] >> 16);
+        ctx->round_key_bytes[i * 4 + 2] = (uint8_t)(ctx->round_keys[i] >> 8);
+        ctx->round_key_bytes[i * 4 + 3] = (uint8_t)ctx->round_keys[i];
+    }
+
+    // Fastest implementation this CPU supports
+    ctx->impl = AES_IsImplSupported(AES_IMPL_AESNI) ? AES_IMPL_AESNI : AES_IMPL_TTABLE;
+
+    // Poly1305 key: encryption of a block outside every CTR/nonce domain
+    // (byte 5 is 0 in CTR IVs and 0x8x in packet nonces)
+    memset(ctx->poly_key, 0, 16);
+    ctx->poly_key[5] = 0x01;
+    aes_encrypt_block(ctx, ctx->poly_key);
 }
 
 // I'll rewrite the AES block encryption to be more robust.
@@ -156,20 +186,353 @@ static void aes_encrypt_block_v2(AES_Ctx *ctx, uint8_t *s) {
     AddRoundKey(s, &ctx->round_keys[40]);
 }
 
+// --- T-table AES (portable fast path) ---
+// Te0[x] = column (2*S[x], S[x], S[x], 3*S[x]); the other three tables are
+// byte rotations of it, so a round is 16 lookups and XORs on 32-bit words.
+
+static const uint32_t Te0[256] = {
+    0xc66363a5, 0xf87c7c84, 0xee777799, 0xf67b7b8d, 0xfff2f20d, 0xd66b6bbd, 0xde6f6fb1, 0x91c5c554,
+    0x60303050, 0x02010103, 0xce6767a9, 0x562b2b7d, 0xe7fefe19, 0xb5d7d762, 0x4dababe6, 0xec76769a,
+    0x8fcaca45, 0x1f82829d, 0x89c9c940, 0xfa7d7d87, 0xeffafa15, 0xb25959eb, 0x8e4747c9, 0xfbf0f00b,
+    0x41adadec, 0xb3d4d467, 0x5fa2a2fd, 0x45afafea, 0x239c9cbf, 0x53a4a4f7, 0xe4727296, 0x9bc0c05b,
+    0x75b7b7c2, 0xe1fdfd1c, 0x3d9393ae, 0x4c26266a, 0x6c36365a, 0x7e3f3f41, 0xf5f7f702, 0x83cccc4f,
+    0x6834345c, 0x51a5a5f4, 0xd1e5e534, 0xf9f1f108, 0xe2717193, 0xabd8d873, 0x62313153, 0x2a15153f,
+    0x0804040c, 0x95c7c752, 0x46232365, 0x9dc3c35e, 0x30181828, 0x379696a1, 0x0a05050f, 0x2f9a9ab5,
+    0x0e070709, 0x24121236, 0x1b80809b, 0xdfe2e23d, 0xcdebeb26, 0x4e272769, 0x7fb2b2cd, 0xea75759f,
+    0x1209091b, 0x1d83839e, 0x582c2c74, 0x341a1a2e, 0x361b1b2d, 0xdc6e6eb2, 0xb45a5aee, 0x5ba0a0fb,
+    0xa45252f6, 0x763b3b4d, 0xb7d6d661, 0x7db3b3ce, 0x5229297b, 0xdde3e33e, 0x5e2f2f71, 0x13848497,
+    0xa65353f5, 0xb9d1d168, 0x00000000, 0xc1eded2c, 0x40202060, 0xe3fcfc1f, 0x79b1b1c8, 0xb65b5bed,
+    0xd46a6abe, 0x8dcbcb46, 0x67bebed9, 0x7239394b, 0x944a4ade, 0x984c4cd4, 0xb05858e8, 0x85cfcf4a,
+    0xbbd0d06b, 0xc5efef2a, 0x4faaaae5, 0xedfbfb16, 0x864343c5, 0x9a4d4dd7, 0x66333355, 0x11858594,
+    0x8a4545cf, 0xe9f9f910, 0x04020206, 0xfe7f7f81, 0xa05050f0, 0x783c3c44, 0x259f9fba, 0x4ba8a8e3,
+    0xa25151f3, 0x5da3a3fe, 0x804040c0, 0x058f8f8a, 0x3f9292ad, 0x219d9dbc, 0x70383848, 0xf1f5f504,
+    0x63bcbcdf, 0x77b6b6c1, 0xafdada75, 0x42212163, 0x20101030, 0xe5ffff1a, 0xfdf3f30e, 0xbfd2d26d,
+    0x81cdcd4c, 0x180c0c14, 0x26131335, 0xc3ecec2f, 0xbe5f5fe1, 0x359797a2, 0x884444cc, 0x2e171739,
+    0x93c4c457, 0x55a7a7f2, 0xfc7e7e82, 0x7a3d3d47, 0xc86464ac, 0xba5d5de7, 0x3219192b, 0xe6737395,
+    0xc06060a0, 0x19818198, 0x9e4f4fd1, 0xa3dcdc7f, 0x44222266, 0x542a2a7e, 0x3b9090ab, 0x0b888883,
+    0x8c4646ca, 0xc7eeee29, 0x6bb8b8d3, 0x2814143c, 0xa7dede79, 0xbc5e5ee2, 0x160b0b1d, 0xaddbdb76,
+    0xdbe0e03b, 0x64323256, 0x743a3a4e, 0x140a0a1e, 0x924949db, 0x0c06060a, 0x4824246c, 0xb85c5ce4,
+    0x9fc2c25d, 0xbdd3d36e, 0x43acacef, 0xc46262a6, 0x399191a8, 0x319595a4, 0xd3e4e437, 0xf279798b,
+    0xd5e7e732, 0x8bc8c843, 0x6e373759, 0xda6d6db7, 0x018d8d8c, 0xb1d5d564, 0x9c4e4ed2, 0x49a9a9e0,
+    0xd86c6cb4, 0xac5656fa, 0xf3f4f407, 0xcfeaea25, 0xca6565af, 0xf47a7a8e, 0x47aeaee9, 0x10080818,
+    0x6fbabad5, 0xf0787888, 0x4a25256f, 0x5c2e2e72, 0x381c1c24, 0x57a6a6f1, 0x73b4b4c7, 0x97c6c651,
+    0xcbe8e823, 0xa1dddd7c, 0xe874749c, 0x3e1f1f21, 0x964b4bdd, 0x61bdbddc, 0x0d8b8b86, 0x0f8a8a85,
+    0xe0707090, 0x7c3e3e42, 0x71b5b5c4, 0xcc6666aa, 0x904848d8, 0x06030305, 0xf7f6f601, 0x1c0e0e12,
+    0xc26161a3, 0x6a35355f, 0xae5757f9, 0x69b9b9d0, 0x17868691, 0x99c1c158, 0x3a1d1d27, 0x279e9eb9,
+    0xd9e1e138, 0xebf8f813, 0x2b9898b3, 0x22111133, 0xd26969bb, 0xa9d9d970, 0x078e8e89, 0x339494a7,
+    0x2d9b9bb6, 0x3c1e1e22, 0x15878792, 0xc9e9e920, 0x87cece49, 0xaa5555ff, 0x50282878, 0xa5dfdf7a,
+    0x038c8c8f, 0x59a1a1f8, 0x09898980, 0x1a0d0d17, 0x65bfbfda, 0xd7e6e631, 0x844242c6, 0xd06868b8,
+    0x824141c3, 0x299999b0, 0x5a2d2d77, 0x1e0f0f11, 0x7bb0b0cb, 0xa85454fc, 0x6dbbbbd6, 0x2c16163a,
+};
+
+#define TE_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define TE1(x) TE_ROTR(Te0[x], 8)
+#define TE2(x) TE_ROTR(Te0[x], 16)
+#define TE3(x) TE_ROTR(Te0[x], 24)
+
+static uint32_t Load32BE(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void Store32BE(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static void aes_encrypt_block_ttable(const AES_Ctx *ctx, uint8_t *block) {
+    const uint32_t *rk = ctx->round_keys;
+    uint32_t s0 = Load32BE(block) ^ rk[0];
+    uint32_t s1 = Load32BE(block + 4) ^ rk[1];
+    uint32_t s2 = Load32BE(block + 8) ^ rk[2];
+    uint32_t s3 = Load32BE(block + 12) ^ rk[3];
+
+    for (int r = 1; r < 10; r++) {
+        rk += 4;
+        uint32_t t0 = Te0[s0 >> 24] ^ TE1((s1 >> 16) & 0xFF) ^ TE2((s2 >> 8) & 0xFF) ^ TE3(s3 & 0xFF) ^ rk[0];
+        uint32_t t1 = Te0[s1 >> 24] ^ TE1((s2 >> 16) & 0xFF) ^ TE2((s3 >> 8) & 0xFF) ^ TE3(s0 & 0xFF) ^ rk[1];
+        uint32_t t2 = Te0[s2 >> 24] ^ TE1((s3 >> 16) & 0xFF) ^ TE2((s0 >> 8) & 0xFF) ^ TE3(s1 & 0xFF) ^ rk[2];
+        uint32_t t3 = Te0[s3 >> 24] ^ TE1((s0 >> 16) & 0xFF) ^ TE2((s1 >> 8) & 0xFF) ^ TE3(s2 & 0xFF) ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    // Final round: SubBytes + ShiftRows only
+    rk += 4;
+    Store32BE(block,      ((uint32_t)sbox[s0 >> 24] << 24) ^ ((uint32_t)sbox[(s1 >> 16) & 0xFF] << 16) ^
+                          ((uint32_t)sbox[(s2 >> 8) & 0xFF] << 8) ^ sbox[s3 & 0xFF] ^ rk[0]);
+    Store32BE(block + 4,  ((uint32_t)sbox[s1 >> 24] << 24) ^ ((uint32_t)sbox[(s2 >> 16) & 0xFF] << 16) ^
+                          ((uint32_t)sbox[(s3 >> 8) & 0xFF] << 8) ^ sbox[s0 & 0xFF] ^ rk[1]);
+    Store32BE(block + 8,  ((uint32_t)sbox[s2 >> 24] << 24) ^ ((uint32_t)sbox[(s3 >> 16) & 0xFF] << 16) ^
+                          ((uint32_t)sbox[(s0 >> 8) & 0xFF] << 8) ^ sbox[s1 & 0xFF] ^ rk[2]);
+    Store32BE(block + 12, ((uint32_t)sbox[s3 >> 24] << 24) ^ ((uint32_t)sbox[(s0 >> 16) & 0xFF] << 16) ^
+                          ((uint32_t)sbox[(s1 >> 8) & 0xFF] << 8) ^ sbox[s2 & 0xFF] ^ rk[3]);
+}
+
+// --- AES-NI (x86) ---
+// Compiled with a target attribute, so the build needs no -maes; only used
+// when the CPU reports the instructions.
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_HAVE_NI 1
+#include <wmmintrin.h>
+
+#define AES_NI_LANES 8 // Counter blocks in flight (hides aesenc latency)
+
+__attribute__((target("aes,sse2")))
+static void aes_encrypt_block_ni(const AES_Ctx *ctx, uint8_t *block) {
+    const __m128i *rk = (const __m128i *)ctx->round_key_bytes;
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)block), _mm_loadu_si128(rk));
+    for (int r = 1; r < 10; r++) b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + r));
+    b = _mm_aesenclast_si128(b, _mm_loadu_si128(rk + 10));
+    _mm_storeu_si128((__m128i *)block, b);
+}
+
+// XORs `blocks` whole keystream blocks into data, starting at the 128-bit
+// big-endian counter (hi:lo), which is advanced past them.
+__attribute__((target("aes,sse2")))
+static void aes_ctr_blocks_ni(const AES_Ctx *ctx, uint64_t *hi, uint64_t *lo, uint8_t *data, size_t blocks) {
+    __m128i rk[11];
+    for (int r = 0; r < 11; r++) rk[r] = _mm_loadu_si128((const __m128i *)ctx->round_key_bytes + r);
+
+    while (blocks > 0) {
+        int lanes = blocks >= AES_NI_LANES ? AES_NI_LANES : 1;
+        __m128i b[AES_NI_LANES];
+        for (int i = 0; i < lanes; i++) {
+            // Counter bytes are big endian: byte-swap each half into place
+            b[i] = _mm_set_epi64x((long long)__builtin_bswap64(*lo), (long long)__builtin_bswap64(*hi));
+            b[i] = _mm_xor_si128(b[i], rk[0]);
+            if (++*lo == 0) ++*hi;
+        }
+        for (int r = 1; r < 10; r++) {
+            for (int i = 0; i < lanes; i++) b[i] = _mm_aesenc_si128(b[i], rk[r]);
+        }
+        for (int i = 0; i < lanes; i++) {
+            b[i] = _mm_aesenclast_si128(b[i], rk[10]);
+            __m128i *p = (__m128i *)(data + 16 * i);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), b[i]));
+        }
+        data += 16 * lanes;
+        blocks -= lanes;
+    }
+}
+#endif
+
+// --- Implementation selection ---
+
+bool AES_IsImplSupported(AES_Impl impl) {
+    switch (impl) {
+    case AES_IMPL_REFERENCE:
+    case AES_IMPL_TTABLE:
+        return true;
+    case AES_IMPL_AESNI:
+#ifdef AES_HAVE_NI
+        return __builtin_cpu_supports("aes");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+bool AES_SetImpl(AES_Ctx *ctx, AES_Impl impl) {
+    if (!AES_IsImplSupported(impl)) return false;
+    ctx->impl = impl;
+    return true;
+}
+
+const char *AES_ImplName(AES_Impl impl) {
+    switch (impl) {
+    case AES_IMPL_REFERENCE: return "reference";
+    case AES_IMPL_TTABLE: return "T-table";
+    case AES_IMPL_AESNI: return "AES-NI";
+    }
+    return "unknown";
+}
+
+static void aes_encrypt_block(AES_Ctx *ctx, uint8_t *block) {
+    switch (ctx->impl) {
+#ifdef AES_HAVE_NI
+    case AES_IMPL_AESNI: aes_encrypt_block_ni(ctx, block); return;
+#endif
+    case AES_IMPL_TTABLE: aes_encrypt_block_ttable(ctx, block); return;
+    default: aes_encrypt_block_v2(ctx, block); return;
+    }
+}
+
+static uint64_t Load64BE(const uint8_t *p) {
+    return ((uint64_t)Load32BE(p) << 32) | Load32BE(p + 4);
+}
+
+static void Store64BE(uint8_t *p, uint64_t v) {
+    Store32BE(p, (uint32_t)(v >> 32));
+    Store32BE(p + 4, (uint32_t)v);
+}
+
+// Keystream block for counter (hi:lo), counter advanced
+static void aes_ctr_keystream(AES_Ctx *ctx, uint64_t *hi, uint64_t *lo, uint8_t stream[16]) {
+    Store64BE(stream, *hi);
+    Store64BE(stream + 8, *lo);
+    aes_encrypt_block(ctx, stream);
+    if (++*lo == 0) ++*hi;
+}
+
 void AES_CTR_Xcrypt(AES_Ctx *ctx, const uint8_t iv[16], uint8_t *data, size_t size) {
-    uint8_t counter[16];
+    AES_CTR_XcryptAt(ctx, iv, 0, data, size);
+}
+
+void AES_CTR_XcryptAt(AES_Ctx *ctx, const uint8_t iv[16], uint64_t offset, uint8_t *data, size_t size) {
     uint8_t stream[16];
-    memcpy(counter, iv, 16);
-    
-    for (size_t i = 0; i < size; i++) {
-        if (i % 16 == 0) {
-            memcpy(stream, counter, 16);
-            aes_encrypt_block_v2(ctx, stream);
-            // Increment counter (big endian)
-            for (int j = 15; j >= 0; j--) {
-                if (++counter[j] != 0) break;
-            }
+
+    // 128-bit big-endian counter, advanced by offset / 16 blocks
+    uint64_t hi = Load64BE(iv);
+    uint64_t lo = Load64BE(iv + 8);
+    uint64_t before = lo;
+    lo += offset / 16;
+    if (lo < before) hi++;
+
+    // Leading partial block
+    size_t skip = (size_t)(offset % 16);
+    if (size > 0 && skip) {
+        aes_ctr_keystream(ctx, &hi, &lo, stream);
+        size_t n = (size < 16 - skip) ? size : 16 - skip;
+        for (size_t i = 0; i < n; i++) data[i] ^= stream[skip + i];
+        data += n;
+        size -= n;
+    }
+
+    // Whole blocks
+    size_t blocks = size / 16;
+#ifdef AES_HAVE_NI
+    if (ctx->impl == AES_IMPL_AESNI) {
+        aes_ctr_blocks_ni(ctx, &hi, &lo, data, blocks);
+        data += blocks * 16;
+        size -= blocks * 16;
+        blocks = 0;
+    }
+#endif
+    for (; blocks > 0; blocks--) {
+        aes_ctr_keystream(ctx, &hi, &lo, stream);
+        uint64_t d[2], k[2];
+        memcpy(d, data, 16);
+        memcpy(k, stream, 16);
+        d[0] ^= k[0];
+        d[1] ^= k[1];
+        memcpy(data, d, 16);
+        data += 16;
+        size -= 16;
+    }
+
+    // Trailing partial block
+    if (size > 0) {
+        aes_ctr_keystream(ctx, &hi, &lo, stream);
+        for (size_t i = 0; i < size; i++) data[i] ^= stream[i];
+    }
+}
+
+// --- Poly1305 (32-bit limbs, after poly1305-donna) ---
+
+static uint32_t U8To32LE(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void U32To8LE(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+void Poly1305_Mac(const uint8_t key[32], const uint8_t *data, size_t size, uint8_t tag[AES_TAG_SIZE]) {
+    // r, clamped
+    const uint32_t r0 = (U8To32LE(key + 0)) & 0x3ffffff;
+    const uint32_t r1 = (U8To32LE(key + 3) >> 2) & 0x3ffff03;
+    const uint32_t r2 = (U8To32LE(key + 6) >> 4) & 0x3ffc0ff;
+    const uint32_t r3 = (U8To32LE(key + 9) >> 6) & 0x3f03fff;
+    const uint32_t r4 = (U8To32LE(key + 12) >> 8) & 0x00fffff;
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+
+    uint8_t last[16];
+    while (size > 0) {
+        const uint8_t *m = data;
+        uint32_t hibit = 1 << 24; // 2^128 for full blocks
+        if (size < 16) {
+            // Final partial block: append a 1 byte, zero pad, no high bit
+            memset(last, 0, sizeof(last));
+            memcpy(last, data, size);
+            last[size] = 1;
+            m = last;
+            hibit = 0;
         }
-        data[i] ^= stream[i % 16];
+
+        h0 += (U8To32LE(m + 0)) & 0x3ffffff;
+        h1 += (U8To32LE(m + 3) >> 2) & 0x3ffffff;
+        h2 += (U8To32LE(m + 6) >> 4) & 0x3ffffff;
+        h3 += (U8To32LE(m + 9) >> 6) & 0x3ffffff;
+        h4 += (U8To32LE(m + 12) >> 8) | hibit;
+
+        // h *= r (mod 2^130 - 5)
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        size_t consumed = size < 16 ? size : 16;
+        data += consumed;
+        size -= consumed;
     }
+
+    // Fully carry h
+    uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h + -p; select h if h < p, else g
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1 << 26);
+
+    uint32_t mask = (g4 >> 31) - 1;
+    g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    // h = (h + s) % 2^128
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    uint64_t f = (uint64_t)h0 + U8To32LE(key + 16);            U32To8LE(tag + 0, (uint32_t)f);
+    f = (uint64_t)h1 + U8To32LE(key + 20) + (f >> 32);         U32To8LE(tag + 4, (uint32_t)f);
+    f = (uint64_t)h2 + U8To32LE(key + 24) + (f >> 32);         U32To8LE(tag + 8, (uint32_t)f);
+    f = (uint64_t)h3 + U8To32LE(key + 28) + (f >> 32);         U32To8LE(tag + 12, (uint32_t)f);
+}
+
+void AES_Poly1305(AES_Ctx *ctx, const uint8_t nonce[16], const uint8_t *data, size_t size, uint8_t tag[AES_TAG_SIZE]) {
+    uint8_t key[32];
+    memcpy(key, ctx->poly_key, 16);
+    memcpy(key + 16, nonce, 16);
+    aes_encrypt_block(ctx, key + 16);
+    Poly1305_Mac(key, data, size, tag);
+}
+
+bool AES_Poly1305Verify(AES_Ctx *ctx, const uint8_t nonce[16], const uint8_t *data, size_t size, const uint8_t tag[AES_TAG_SIZE]) {
+    uint8_t expected[AES_TAG_SIZE];
+    AES_Poly1305(ctx, nonce, data, size, expected);
+    uint8_t diff = 0;
+    for (int i = 0; i < AES_TAG_SIZE; ++i) diff |= expected[i] ^ tag[i];
+    return diff == 0;
 }
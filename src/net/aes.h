@@ -1,22 +1,64 @@
 #ifndef HARMONY_AES_H
 #define HARMONY_AES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
+#define AES_TAG_SIZE 16
+
+// Block cipher implementations; AES_Init picks the fastest one available
+typedef enum AES_Impl {
+    AES_IMPL_REFERENCE, // Byte-wise, for cross-checking
+    AES_IMPL_TTABLE,    // Portable 32-bit table lookups
+    AES_IMPL_AESNI      // x86 AES instructions, 8 CTR blocks in flight
+} AES_Impl;
+
 typedef struct AES_Ctx {
     uint32_t round_keys[44];
+    uint8_t round_key_bytes[176]; // Same schedule in byte order (AES-NI)
+    AES_Impl impl;
+    uint8_t poly_key[16]; // Poly1305 'r', derived from the AES key in AES_Init
 } AES_Ctx;
 
 // Initialize AES context with 128-bit key
 void AES_Init(AES_Ctx *ctx, const uint8_t key[16]);
 
+bool AES_IsImplSupported(AES_Impl impl);
+
+// Forces an implementation (tests, benchmarks). Returns false if unsupported.
+bool AES_SetImpl(AES_Ctx *ctx, AES_Impl impl);
+
+const char *AES_ImplName(AES_Impl impl);
+
 // Derive a 128-bit key from a password string using SHA1
 void AES_DeriveKey(const char *password, uint8_t key[16]);
 
+// Session key: SHA1(password || salt). The host draws a random salt per
+// session (PACKET_TYPE_SESSION), so frame IDs and chunk IDs restarting with
+// every session don't repeat a keystream or a Poly1305 nonce.
+#define AES_SALT_SIZE 16
+void AES_DeriveSessionKey(const char *password,
+                          const uint8_t salt[AES_SALT_SIZE], uint8_t key[16]);
+
 // Encrypt/Decrypt data using AES-128-CTR mode.
 // Note: CTR is symmetric, so the same function is used for both.
 // iv must be 16 bytes.
 void AES_CTR_Xcrypt(AES_Ctx *ctx, const uint8_t iv[16], uint8_t *data, size_t size);
 
+// Same as AES_CTR_Xcrypt, but starts `offset` bytes into the keystream, so a
+// chunk of a CTR stream can be processed on its own.
+void AES_CTR_XcryptAt(AES_Ctx *ctx, const uint8_t iv[16], uint64_t offset, uint8_t *data, size_t size);
+
+// Poly1305-AES message authentication: tag = Poly1305_r(data) + AES_k(nonce).
+// The nonce must be unique per message and must never equal a CTR counter
+// block, so it cannot be reused as keystream.
+void AES_Poly1305(AES_Ctx *ctx, const uint8_t nonce[16], const uint8_t *data, size_t size, uint8_t tag[AES_TAG_SIZE]);
+
+// Constant-time check of a Poly1305-AES tag
+bool AES_Poly1305Verify(AES_Ctx *ctx, const uint8_t nonce[16], const uint8_t *data, size_t size, const uint8_t tag[AES_TAG_SIZE]);
+
+// Plain Poly1305 with a 32-byte one-time key (r || s), for test vectors
+void Poly1305_Mac(const uint8_t key[32], const uint8_t *data, size_t size, uint8_t tag[AES_TAG_SIZE]);
+
 #endif // HARMONY_AES_H
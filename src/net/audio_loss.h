@@ -0,0 +1,76 @@
+#ifndef HARMONY_AUDIO_LOSS_H
+#define HARMONY_AUDIO_LOSS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Viewer-side sequence tracking of the audio stream. Audio frame IDs are a
+// per-stream sequence (one per Opus packet), so a jump is loss: the decoder
+// conceals the missing packets, the last one from the in-band FEC of the
+// packet that revealed the gap, instead of leaving a hole in playout. A
+// packet arriving after its slot was concealed is dropped. The measured loss
+// goes back to the host in our punches and sets the encoder's FEC strength.
+
+#define AUDIO_LOSS_MAX_GAP_MS 500.0 // A longer jump is a restart, not loss
+#define AUDIO_LOSS_WINDOW_MS 1000.0 // Per loss measurement
+
+typedef struct AudioLossTracker {
+  // Packets, from their duration: the host picks it (2.5-120 ms)
+  uint32_t max_gap;
+  uint32_t window;
+
+  bool started;
+  uint32_t next_id; // Frame ID expected next
+
+  uint32_t window_expected;
+  uint32_t window_lost;
+  uint8_t loss_percent; // Recent loss: rises at once, falls over a few windows
+
+  // Totals
+  uint32_t received;
+  uint32_t concealed;
+  uint32_t late; // Arrived after being concealed, or duplicates
+} AudioLossTracker;
+
+// Sizes the gap limit and loss window for packets of `packet_ms`
+static inline void AudioLoss_SetPacket(AudioLossTracker *t, double packet_ms) {
+  t->max_gap = (uint32_t)(AUDIO_LOSS_MAX_GAP_MS / packet_ms);
+  t->window = (uint32_t)(AUDIO_LOSS_WINDOW_MS / packet_ms);
+}
+
+static inline void AudioLoss_Init(AudioLossTracker *t, double packet_ms) {
+  memset(t, 0, sizeof(*t));
+  AudioLoss_SetPacket(t, packet_ms);
+}
+
+// Records packet `frame_id` and returns how many packets are missing right
+// before it (to conceal first), or -1 if it is late and must be dropped.
+static int AudioLoss_OnPacket(AudioLossTracker *t, uint32_t frame_id) {
+  int32_t gap = (int32_t)(frame_id - t->next_id);
+  if (t->started && gap < 0) {
+    t->late++;
+    return -1;
+  }
+  if (!t->started || gap > (int32_t)t->max_gap) {
+    t->started = true;
+    gap = 0;
+  }
+  t->next_id = frame_id + 1;
+  t->received++;
+  t->concealed += (uint32_t)gap;
+
+  t->window_expected += (uint32_t)gap + 1;
+  t->window_lost += (uint32_t)gap;
+  if (t->window_expected >= t->window) {
+    uint32_t percent = t->window_lost * 100 / t->window_expected;
+    if (percent < t->loss_percent)
+      percent = (t->loss_percent * 3u + percent) / 4u;
+    t->loss_percent = (uint8_t)percent;
+    t->window_expected = 0;
+    t->window_lost = 0;
+  }
+  return gap;
+}
+
+#endif // HARMONY_AUDIO_LOSS_H
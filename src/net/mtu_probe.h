@@ -0,0 +1,98 @@
+#ifndef HARMONY_MTU_PROBE_H
+#define HARMONY_MTU_PROBE_H
+
+#include "protocol.h"
+#include <stdbool.h>
+#include <string.h>
+
+// Packetization-layer path MTU discovery (DPLPMTUD, RFC 8899 style) for the
+// host -> viewer path. The socket sends with DF set and never fragments
+// locally (Net_SetPathMtuProbing); the host sends padded probes for each
+// candidate chunk size and the viewer acks the ones that arrive. The largest
+// acked size becomes the session chunk size. A probe that is too large is
+// just lost, so a candidate fails after MTU_PROBE_MAX_ATTEMPTS unanswered
+// rounds. The search is repeated periodically to follow route changes.
+
+// Chunk sizes for common path MTUs (MTU - IP - UDP - v1 header - auth tag,
+// rounded down to a chunk size v2 can code): 1280 (IPv4 minimum),
+// 1420 (WireGuard), 1492/1500 (PPPoE, Ethernet), 9000 (jumbo frames).
+static const uint16_t mtu_probe_candidates[] = {1216, 1344, 1440, 8928};
+#define MTU_PROBE_CANDIDATE_COUNT                                              \
+  (int)(sizeof(mtu_probe_candidates) / sizeof(mtu_probe_candidates[0]))
+
+#define MTU_PROBE_MAX_ATTEMPTS 3
+#define MTU_PROBE_INTERVAL 0.2           // Seconds between probe rounds
+#define MTU_PROBE_RESEARCH_INTERVAL 30.0 // Seconds between searches
+
+typedef struct MtuProber {
+  uint16_t chunk_size; // Result of the last search (0 = none yet)
+  bool searching;
+  uint8_t attempts[MTU_PROBE_CANDIDATE_COUNT];
+  bool acked[MTU_PROBE_CANDIDATE_COUNT];
+  double last_round;
+  double search_done_at;
+} MtuProber;
+
+// Starts a new search, keeping the current result until it completes
+static inline void MtuProbe_Start(MtuProber *p) {
+  memset(p->attempts, 0, sizeof(p->attempts));
+  memset(p->acked, 0, sizeof(p->acked));
+  p->searching = true;
+  p->last_round = 0.0;
+}
+
+// Forgets everything (new viewer) and starts searching
+static inline void MtuProbe_Reset(MtuProber *p) {
+  memset(p, 0, sizeof(*p));
+  MtuProbe_Start(p);
+}
+
+static inline void MtuProbe_OnAck(MtuProber *p, uint16_t chunk_size) {
+  for (int i = 0; i < MTU_PROBE_CANDIDATE_COUNT; ++i) {
+    if (mtu_probe_candidates[i] == chunk_size)
+      p->acked[i] = true;
+  }
+}
+
+// Sends the next probe round when due. Returns true when a search finished
+// with a different chunk size (p->chunk_size), which the caller applies to
+// its packetizers.
+static bool MtuProbe_Poll(MtuProber *p, double now, Packetizer *pz,
+                          SendPacketCallback send_fn, void *user_data) {
+  if (!p->searching) {
+    if (now - p->search_done_at < MTU_PROBE_RESEARCH_INTERVAL)
+      return false;
+    MtuProbe_Start(p);
+  }
+  if (now - p->last_round < MTU_PROBE_INTERVAL)
+    return false;
+  p->last_round = now;
+
+  bool pending = false;
+  for (int i = 0; i < MTU_PROBE_CANDIDATE_COUNT; ++i) {
+    if (p->acked[i] || p->attempts[i] >= MTU_PROBE_MAX_ATTEMPTS)
+      continue;
+    Protocol_SendMtuProbe(pz, mtu_probe_candidates[i], send_fn, user_data);
+    p->attempts[i]++;
+    pending = true;
+  }
+  if (pending)
+    return false;
+
+  // Every candidate is acked or failed; the last round had time to answer.
+  // Nothing acked (probes lost, or a viewer that can't answer) falls back to
+  // the smallest candidate: with DF set, the default may not fit the path.
+  uint16_t best = mtu_probe_candidates[0];
+  for (int i = 0; i < MTU_PROBE_CANDIDATE_COUNT; ++i) {
+    if (p->acked[i] && mtu_probe_candidates[i] > best)
+      best = mtu_probe_candidates[i];
+  }
+  p->searching = false;
+  p->search_done_at = now;
+
+  uint16_t previous = p->chunk_size;
+  p->chunk_size = best;
+  return best != previous;
+}
+
+#endif // HARMONY_MTU_PROBE_H
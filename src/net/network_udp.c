@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // sendmmsg
 #include "../network_api.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -68,12 +69,61 @@ void Net_Send(NetworkContext *ctx, const char *ip, int port, void *data, size_t
 
     ssize_t sent = sendto(ctx->sockfd, data, size, 0, (struct sockaddr*)&dest, sizeof(dest));
     if (sent < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // EMSGSIZE: MTU probe larger than the local link while probing
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EMSGSIZE) {
             perror("Net_Send: sendto");
         }
     }
 }
 
+#define NET_MAX_BATCH 64
+
+void Net_SendBatch(NetworkContext *ctx, const NetDatagram *datagrams, int count) {
+    struct sockaddr_in dests[NET_MAX_BATCH];
+    struct iovec iov[NET_MAX_BATCH];
+    struct mmsghdr msgs[NET_MAX_BATCH];
+
+    while (count > 0) {
+        int n = count < NET_MAX_BATCH ? count : NET_MAX_BATCH;
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (int i = 0; i < n; i++) {
+            memset(&dests[i], 0, sizeof(dests[i]));
+            dests[i].sin_family = AF_INET;
+            dests[i].sin_port = htons(datagrams[i].port);
+            inet_pton(AF_INET, datagrams[i].ip, &dests[i].sin_addr);
+            iov[i].iov_base = (void *)datagrams[i].data;
+            iov[i].iov_len = datagrams[i].size;
+            msgs[i].msg_hdr.msg_name = &dests[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(dests[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // sendmmsg stops at the first datagram that fails; skip it and go on
+        int done = 0;
+        while (done < n) {
+            int sent = sendmmsg(ctx->sockfd, msgs + done, n - done, 0);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EMSGSIZE) {
+                    perror("Net_SendBatch: sendmmsg");
+                }
+                sent = 1;
+            }
+            done += sent;
+        }
+
+        datagrams += n;
+        count -= n;
+    }
+}
+
+void Net_SetPathMtuProbing(NetworkContext *ctx, bool enabled) {
+    int mode = enabled ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT;
+    if (setsockopt(ctx->sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+        perror("Net_SetPathMtuProbing: setsockopt IP_MTU_DISCOVER");
+    }
+}
+
 int Net_Recv(NetworkContext *ctx, void *buffer, size_t buffer_size, char *out_sender_ip, int *out_sender_port) {
     struct sockaddr_in src_addr = {0};
     socklen_t addr_len = sizeof(src_addr);
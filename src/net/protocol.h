@@ -2,32 +2,217 @@
 #define HARMONY_PROTOCOL_H
 
 #include "../memory_arena.h"
+#include "aes.h"
 #include <stdbool.h>
 #include <string.h>
-#include <unistd.h> // for usleep
 
-// Max UDP payload size (safe MTU - header)
+// Default chunk payload size (safe MTU - header)
 // MTU 1500 - IP(20) - UDP(8) = 1472. Let's stay safe with 1400.
 #define MAX_PACKET_PAYLOAD 1400
 
+// Chunk size is a per-session value: hosts raise or lower it once path MTU
+// probing (mtu_probe.h) confirms what the path carries. Every packet states
+// the chunk size of its unit. Non-default sizes are
+// PROTOCOL_CHUNK_BASE + n * PROTOCOL_CHUNK_UNIT so that v2 can code them in
+// one byte.
+#define PROTOCOL_CHUNK_BASE 1024
+#define PROTOCOL_CHUNK_UNIT 32
+#define PROTOCOL_MIN_CHUNK_SIZE 1216 // IPv4 MTU 1280
+#define PROTOCOL_MAX_CHUNK_SIZE 8928 // Jumbo frames, MTU 9000
+
+// One logical unit is reassembled into a fixed buffer, which also bounds the
+// number of chunks a unit may be split into.
+#define REASSEMBLY_BUFFER_SIZE (2 * 1024 * 1024)
+#define MAX_FRAME_CHUNKS (REASSEMBLY_BUFFER_SIZE / PROTOCOL_MIN_CHUNK_SIZE)
+
 // Packet Types
 typedef enum PacketType {
   PACKET_TYPE_VIDEO = 0,
   PACKET_TYPE_METADATA = 1,
   PACKET_TYPE_KEEPALIVE = 2,
   PACKET_TYPE_PUNCH = 3, // UDP hole punch packet
-  PACKET_TYPE_AUDIO = 4  // Opus-encoded audio
+  PACKET_TYPE_AUDIO = 4, // Opus-encoded audio
+  PACKET_TYPE_KEYFRAME_REQUEST = 5, // Viewer -> Host: picture lost, send an IDR
+  PACKET_TYPE_MTU_PROBE = 6, // Host -> Viewer: padded to the chunk size probed
+  PACKET_TYPE_MTU_ACK = 7,   // Viewer -> Host: probe of this chunk size arrived
+  PACKET_TYPE_VIEWER_STATS = 8, // Browser -> Host, WebSocket only (websocket.h)
+  PACKET_TYPE_SESSION = 9, // Host -> Viewer: salt of this session's key (aes.h)
+  PACKET_TYPE_AUDIO_CONFIG = 10 // Host -> Viewer: Opus framing (audio_api.h)
 } PacketType;
 
+// Per-frame flags (carried in every chunk of the frame)
+#define PACKET_FLAG_KEYFRAME (1 << 0)       // IDR or start of an intra-refresh cycle
+#define PACKET_FLAG_RECOVERY_POINT (1 << 1) // Picture is clean once this frame is decoded
+#define PACKET_FLAG_SLICED (1 << 2)         // Chunks are cut at NAL boundaries (Protocol_LayoutSlices)
+
+// Per-chunk flags of sliced frames
+#define PACKET_FLAG_SLICE_START (1 << 3) // Payload begins with a NAL start code
+#define PACKET_FLAG_SLICE_END (1 << 4)   // Payload ends on a NAL boundary
+
+#define PACKET_FLAG_FEC (1 << 5)          // Payload is redundancy, not media
+#define PACKET_FLAG_END_OF_FRAME (1 << 6) // Last chunk of the unit
+#define PACKET_FLAG_AUTHENTICATED (1 << 7) // Poly1305-AES tag follows the payload
+
+// --- Wire formats ---
+// v1: PacketHeader below, 16 bytes, host byte order.
+// v2: 15 bytes, big endian, payload size implied by the datagram length:
+//   [0]     magic (high nibble) | version (low nibble)
+//   [1]     packet type (high nibble) | temporal layer (bit 3) | stream id (bits 0..2)
+//   [2]     flags (PACKET_FLAG_*)
+//   [3..6]  per-stream sequence number (frame_id)
+//   [7..9]  chunk index (12 bits) | chunk count (12 bits)
+//   [10..13] media timestamp, microseconds (wraps)
+//   [14]    chunk size code (Protocol_ChunkSizeCode)
+// Viewers advertise the highest version they understand in their punch
+// payload; hosts keep sending v1 until they see it, and older hosts ignore it.
+#define PROTOCOL_WIRE_V1 1
+#define PROTOCOL_WIRE_V2 2
+#define PROTOCOL_WIRE_VERSION_MAX PROTOCOL_WIRE_V2
+#define PROTOCOL_V2_MAGIC 0xA0
+#define PROTOCOL_V2_HEADER_SIZE 15
+#define PROTOCOL_MAX_HEADER_SIZE 16
+#define PROTOCOL_MAX_PACKET_SIZE (PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_MAX_CHUNK_SIZE)
+
+// v2 temporal layer bit: set on frames nothing else refers to, which any hop
+// may drop whole without breaking decoding. Viewers that predate it read it
+// as another stream id and skip those frames, which is just as safe.
+#define PROTOCOL_V2_TEMPORAL_BIT 0x08
+#define PROTOCOL_V2_STREAM_MASK 0x07
+
 typedef struct PacketHeader {
   uint32_t frame_id; // Unique ID for the logical unit (monotonic)
   uint16_t chunk_id; // 0 to total_chunks-1
   uint16_t total_chunks;
   uint32_t payload_size; // Size of data in this chunk
   uint8_t packet_type;   // PacketType
-  uint8_t padding[3];    // Alignment
+  uint8_t flags;         // PACKET_FLAG_* (0 from hosts that predate flags)
+  uint16_t chunk_size;   // Chunk size of the unit (0 = MAX_PACKET_PAYLOAD)
 } PacketHeader;
 
+// v2 chunk size byte: 0 = MAX_PACKET_PAYLOAD, n = BASE + n * UNIT
+static inline uint8_t Protocol_ChunkSizeCode(uint16_t chunk_size) {
+  if (chunk_size == 0 || chunk_size == MAX_PACKET_PAYLOAD)
+    return 0;
+  return (uint8_t)((chunk_size - PROTOCOL_CHUNK_BASE) / PROTOCOL_CHUNK_UNIT);
+}
+
+static inline uint16_t Protocol_ChunkSizeFromCode(uint8_t code) {
+  if (code == 0)
+    return MAX_PACKET_PAYLOAD;
+  return (uint16_t)(PROTOCOL_CHUNK_BASE + code * PROTOCOL_CHUNK_UNIT);
+}
+
+static inline bool Protocol_IsValidChunkSize(uint16_t chunk_size) {
+  return chunk_size == MAX_PACKET_PAYLOAD ||
+         (chunk_size >= PROTOCOL_MIN_CHUNK_SIZE &&
+          chunk_size <= PROTOCOL_MAX_CHUNK_SIZE &&
+          (chunk_size - PROTOCOL_CHUNK_BASE) % PROTOCOL_CHUNK_UNIT == 0);
+}
+
+// Version-independent view of a received packet (Protocol_ParseHeader)
+typedef struct PacketInfo {
+  uint8_t version; // PROTOCOL_WIRE_V1 / V2
+  uint8_t packet_type;
+  uint8_t stream_id;
+  uint8_t temporal_layer; // 1: discardable frame (v2 only)
+  uint8_t flags;
+  uint32_t frame_id;
+  uint16_t chunk_id;
+  uint16_t total_chunks;
+  uint32_t timestamp_us; // 0 for v1
+  uint16_t chunk_size;   // Chunk size of the unit (offset of chunk i = i * chunk_size)
+  uint8_t *payload;
+  size_t payload_size;
+  uint8_t *tag; // PACKET_FLAG_AUTHENTICATED: AES_TAG_SIZE bytes after the payload
+} PacketInfo;
+
+static inline bool Protocol_ParseHeaderV1(uint8_t *bytes, size_t size,
+                                          PacketInfo *out) {
+  if (size < sizeof(PacketHeader))
+    return false;
+  PacketHeader header;
+  memcpy(&header, bytes, sizeof(header));
+  size_t tag_size = (header.flags & PACKET_FLAG_AUTHENTICATED) ? AES_TAG_SIZE : 0;
+  // Safety check: Ensure the packet actually contains the claimed payload
+  if (header.payload_size + tag_size > size - sizeof(PacketHeader))
+    return false;
+
+  out->version = PROTOCOL_WIRE_V1;
+  out->packet_type = header.packet_type;
+  out->stream_id = 0;
+  out->temporal_layer = 0;
+  out->flags = header.flags;
+  out->frame_id = header.frame_id;
+  out->chunk_id = header.chunk_id;
+  out->total_chunks = header.total_chunks;
+  out->timestamp_us = 0;
+  out->chunk_size = header.chunk_size ? header.chunk_size : MAX_PACKET_PAYLOAD;
+  out->payload = bytes + sizeof(PacketHeader);
+  out->payload_size = header.payload_size;
+  out->tag = tag_size ? out->payload + out->payload_size : NULL;
+  return true;
+}
+
+static inline bool Protocol_ParseHeaderV2(uint8_t *bytes, size_t size,
+                                          PacketInfo *out) {
+  if (size < PROTOCOL_V2_HEADER_SIZE ||
+      bytes[0] != (PROTOCOL_V2_MAGIC | PROTOCOL_WIRE_V2))
+    return false;
+
+  out->version = PROTOCOL_WIRE_V2;
+  out->packet_type = bytes[1] >> 4;
+  out->stream_id = bytes[1] & PROTOCOL_V2_STREAM_MASK;
+  out->temporal_layer = (bytes[1] & PROTOCOL_V2_TEMPORAL_BIT) ? 1 : 0;
+  out->flags = bytes[2];
+  out->frame_id = ((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[4] << 16) |
+                  ((uint32_t)bytes[5] << 8) | bytes[6];
+  uint32_t chunks = ((uint32_t)bytes[7] << 16) | ((uint32_t)bytes[8] << 8) |
+                    bytes[9];
+  out->chunk_id = (uint16_t)(chunks >> 12);
+  out->total_chunks = (uint16_t)(chunks & 0xFFF);
+  out->timestamp_us = ((uint32_t)bytes[10] << 24) |
+                      ((uint32_t)bytes[11] << 16) |
+                      ((uint32_t)bytes[12] << 8) | bytes[13];
+  out->chunk_size = Protocol_ChunkSizeFromCode(bytes[14]);
+  out->payload = bytes + PROTOCOL_V2_HEADER_SIZE;
+  out->payload_size = size - PROTOCOL_V2_HEADER_SIZE;
+  out->tag = NULL;
+  if (out->flags & PACKET_FLAG_AUTHENTICATED) {
+    if (out->payload_size < AES_TAG_SIZE)
+      return false;
+    out->payload_size -= AES_TAG_SIZE;
+    out->tag = out->payload + out->payload_size;
+  }
+  return true;
+}
+
+// Parses a v1 or v2 packet. A v1 packet always has an exact length match,
+// a v2 one starts with the magic byte; if a packet happens to look like both,
+// `preferred_version` (the version last seen from this peer) decides.
+static inline bool Protocol_ParseHeader(void *packet, size_t size,
+                                        uint8_t preferred_version,
+                                        PacketInfo *out) {
+  uint8_t *bytes = (uint8_t *)packet;
+  PacketInfo v1, v2;
+  bool v1_ok = Protocol_ParseHeaderV1(bytes, size, &v1) &&
+               sizeof(PacketHeader) + v1.payload_size +
+                       (v1.tag ? AES_TAG_SIZE : 0) ==
+                   size;
+  bool v2_ok = Protocol_ParseHeaderV2(bytes, size, &v2);
+
+  if (v1_ok && v2_ok) {
+    *out = (preferred_version == PROTOCOL_WIRE_V2) ? v2 : v1;
+  } else if (v2_ok) {
+    *out = v2;
+  } else if (v1_ok || Protocol_ParseHeaderV1(bytes, size, &v1)) {
+    *out = v1; // Also accepts v1 packets with trailing bytes
+  } else {
+    return false;
+  }
+  return Protocol_IsValidChunkSize(out->chunk_size) &&
+         out->payload_size <= out->chunk_size;
+}
+
 typedef struct StreamMetadata {
   char os_name[32];
   char de_name[32];
@@ -40,134 +225,491 @@ typedef struct StreamMetadata {
 
 // --- Packetizer (Sender) ---
 
+// One Packetizer per stream (video, audio, control): frame_id is a per-stream
+// sequence number, so media threads never share a counter or a lock.
 typedef struct Packetizer {
   uint32_t frame_id_counter;
+  uint8_t wire_version; // PROTOCOL_WIRE_V2 once the peer advertised it (0/1 = v1)
+  uint8_t stream_id;    // v2 only
+  uint8_t temporal_layer; // v2 only: 1 marks the next units discardable
+  uint32_t timestamp_us; // v2 only: media timestamp stamped on the next units
+  uint16_t chunk_size;   // Confirmed by path MTU probing (0 = MAX_PACKET_PAYLOAD)
+  AES_Ctx *auth;         // Set: every packet carries a Poly1305-AES tag
 } Packetizer;
 
+static inline uint16_t Protocol_ChunkSize(const Packetizer *pz) {
+  return pz->chunk_size ? pz->chunk_size : MAX_PACKET_PAYLOAD;
+}
+
+// CTR IV for a logical unit:
+// [frame_id BE (4)][packet_type (1)][stream_id (1)][0 ...].
+// Frame IDs repeat across streams (simulcast layers even share them), so the
+// packet type and stream id keep keystreams apart. Stream 0 (and every v1
+// unit) keeps the IV of hosts that predate stream ids. The low 64 bits are
+// the block counter.
+static inline void Protocol_MakeIV(uint8_t iv[16], uint32_t frame_id,
+                                   uint8_t packet_type, uint8_t stream_id) {
+  memset(iv, 0, 16);
+  iv[0] = (uint8_t)(frame_id >> 24);
+  iv[1] = (uint8_t)(frame_id >> 16);
+  iv[2] = (uint8_t)(frame_id >> 8);
+  iv[3] = (uint8_t)frame_id;
+  iv[4] = packet_type;
+  iv[5] = stream_id & 0x0F;
+}
+
+// Sliced units get their own keystream: the host also sends each unit
+// contiguous (WebSocket, GOP cache, v1 viewers), and the two layouts put
+// different bytes at the same offsets. Bit 6 of byte 5 is free in both the
+// CTR IV and the auth nonce.
+#define PROTOCOL_IV_SLICED 0x40
+
+static inline void Protocol_MakeSlicedIV(uint8_t iv[16], uint32_t frame_id,
+                                         uint8_t packet_type,
+                                         uint8_t stream_id) {
+  Protocol_MakeIV(iv, frame_id, packet_type, stream_id);
+  iv[5] |= PROTOCOL_IV_SLICED;
+}
+
+// CTR IV of the unit a received chunk belongs to
+static inline void Protocol_MakeChunkIV(uint8_t iv[16],
+                                        const PacketInfo *info) {
+  if (info->flags & PACKET_FLAG_SLICED)
+    Protocol_MakeSlicedIV(iv, info->frame_id, info->packet_type,
+                          info->stream_id);
+  else
+    Protocol_MakeIV(iv, info->frame_id, info->packet_type, info->stream_id);
+}
+
+// Poly1305-AES nonce of one packet:
+// [frame_id BE (4)][packet_type (1)][0x80 | stream_id (1)][chunk_id BE (2)][0 ...]
+// Byte 5 always has the top bit set, so a nonce can't collide with a CTR
+// counter block.
+static inline void Protocol_MakeAuthNonce(uint8_t nonce[16], uint32_t frame_id,
+                                          uint8_t packet_type,
+                                          uint8_t stream_id,
+                                          uint16_t chunk_id) {
+  Protocol_MakeIV(nonce, frame_id, packet_type, 0);
+  nonce[5] = 0x80 | (stream_id & 0x0F);
+  nonce[6] = (uint8_t)(chunk_id >> 8);
+  nonce[7] = (uint8_t)chunk_id;
+}
+
+// Checks the tag of a parsed packet (Encrypt-then-MAC: covers the header and
+// the payload as sent). Unauthenticated packets fail.
+static inline bool Protocol_VerifyPacket(AES_Ctx *ctx, const void *packet,
+                                         const PacketInfo *info) {
+  if (!info->tag)
+    return false;
+  uint8_t nonce[16];
+  Protocol_MakeAuthNonce(nonce, info->frame_id, info->packet_type,
+                         info->stream_id, info->chunk_id);
+  return AES_Poly1305Verify(ctx, nonce, (const uint8_t *)packet,
+                            (size_t)(info->tag - (const uint8_t *)packet),
+                            info->tag);
+}
+
 // Callback function type for sending packets
 typedef void (*SendPacketCallback)(void *user_data, void *packet_data,
                                    size_t packet_size);
 
-static void Protocol_SendData(Packetizer *pz, uint8_t type, void *data,
-                              size_t size, SendPacketCallback send_fn,
-                              void *user_data) {
+// Writes the header for one chunk of the packetizer's current unit and
+// returns its size.
+static size_t Protocol_WriteHeader(const Packetizer *pz, uint8_t *buffer,
+                                   uint16_t chunk_id, uint16_t total_chunks,
+                                   uint16_t chunk_size, uint8_t type,
+                                   uint8_t flags, size_t payload_size) {
+  if (chunk_id == total_chunks - 1)
+    flags |= PACKET_FLAG_END_OF_FRAME;
+
+  if (pz->wire_version == PROTOCOL_WIRE_V2) {
+    uint32_t id = pz->frame_id_counter;
+    uint32_t chunks = ((uint32_t)chunk_id << 12) | (total_chunks & 0xFFF);
+    uint32_t ts = pz->timestamp_us;
+    buffer[0] = PROTOCOL_V2_MAGIC | PROTOCOL_WIRE_V2;
+    buffer[1] = (uint8_t)((type << 4) |
+                          (pz->temporal_layer ? PROTOCOL_V2_TEMPORAL_BIT : 0) |
+                          (pz->stream_id & PROTOCOL_V2_STREAM_MASK));
+    buffer[2] = flags;
+    buffer[3] = (uint8_t)(id >> 24);
+    buffer[4] = (uint8_t)(id >> 16);
+    buffer[5] = (uint8_t)(id >> 8);
+    buffer[6] = (uint8_t)id;
+    buffer[7] = (uint8_t)(chunks >> 16);
+    buffer[8] = (uint8_t)(chunks >> 8);
+    buffer[9] = (uint8_t)chunks;
+    buffer[10] = (uint8_t)(ts >> 24);
+    buffer[11] = (uint8_t)(ts >> 16);
+    buffer[12] = (uint8_t)(ts >> 8);
+    buffer[13] = (uint8_t)ts;
+    buffer[14] = Protocol_ChunkSizeCode(chunk_size);
+    return PROTOCOL_V2_HEADER_SIZE;
+  }
+
+  PacketHeader *header = (PacketHeader *)buffer;
+  header->frame_id = pz->frame_id_counter;
+  header->chunk_id = chunk_id;
+  header->total_chunks = total_chunks;
+  header->payload_size = (uint32_t)payload_size;
+  header->packet_type = type;
+  header->flags = flags;
+  header->chunk_size = (chunk_size == MAX_PACKET_PAYLOAD) ? 0 : chunk_size;
+  return sizeof(PacketHeader);
+}
+
+static void Protocol_SendChunk(const Packetizer *pz, uint16_t chunk_id,
+                               uint16_t total_chunks, uint16_t chunk_size,
+                               uint8_t type, uint8_t flags,
+                               const uint8_t *payload, size_t payload_size,
+                               SendPacketCallback send_fn, void *user_data) {
+  // Construct Packet
+  uint8_t buffer[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  if (pz->auth)
+    flags |= PACKET_FLAG_AUTHENTICATED;
+  size_t header_size =
+      Protocol_WriteHeader(pz, buffer, chunk_id, total_chunks, chunk_size,
+                           type, flags, payload_size);
+  if (payload_size > 0)
+    memcpy(buffer + header_size, payload, payload_size);
+  size_t packet_size = header_size + payload_size;
+
+  if (pz->auth) {
+    uint8_t nonce[16];
+    uint8_t stream_id =
+        (pz->wire_version == PROTOCOL_WIRE_V2) ? pz->stream_id : 0;
+    Protocol_MakeAuthNonce(nonce, pz->frame_id_counter, type, stream_id,
+                           chunk_id);
+    AES_Poly1305(pz->auth, nonce, buffer, packet_size, buffer + packet_size);
+    packet_size += AES_TAG_SIZE;
+  }
+
+  // Send (pacing is up to the sink, see send_scheduler.h)
+  send_fn(user_data, buffer, packet_size);
+}
+
+static void Protocol_SendData(Packetizer *pz, uint8_t type, uint8_t flags,
+                              void *data, size_t size,
+                              SendPacketCallback send_fn, void *user_data) {
   pz->frame_id_counter++;
-  uint32_t current_frame_id = pz->frame_id_counter;
 
-  uint16_t total_chunks =
-      (uint16_t)((size + MAX_PACKET_PAYLOAD - 1) / MAX_PACKET_PAYLOAD);
+  uint16_t max_chunk = Protocol_ChunkSize(pz);
+  uint16_t total_chunks = (uint16_t)((size + max_chunk - 1) / max_chunk);
   uint8_t *data_bytes = (uint8_t *)data;
   size_t bytes_remaining = size;
   size_t offset = 0;
 
   for (uint16_t i = 0; i < total_chunks; ++i) {
-    size_t chunk_size = (bytes_remaining > MAX_PACKET_PAYLOAD)
-                            ? MAX_PACKET_PAYLOAD
-                            : bytes_remaining;
-
-    // Construct Packet
-    uint8_t buffer[sizeof(PacketHeader) + MAX_PACKET_PAYLOAD];
-    PacketHeader *header = (PacketHeader *)buffer;
+    size_t chunk_size =
+        (bytes_remaining > max_chunk) ? max_chunk : bytes_remaining;
 
-    header->frame_id = current_frame_id;
-    header->chunk_id = i;
-    header->total_chunks = total_chunks;
-    header->payload_size = (uint32_t)chunk_size;
-    header->packet_type = type;
-    memset(header->padding, 0, 3);
-
-    memcpy(buffer + sizeof(PacketHeader), data_bytes + offset, chunk_size);
-
-    // Send
-    send_fn(user_data, buffer, sizeof(PacketHeader) + chunk_size);
+    Protocol_SendChunk(pz, i, total_chunks, max_chunk, type, flags,
+                       data_bytes + offset, chunk_size, send_fn, user_data);
 
     offset += chunk_size;
     bytes_remaining -= chunk_size;
+  }
+}
+
+// --- Sliced frames ---
+// A sliced frame uses a sparse layout: chunk i always sits at offset
+// i * chunk_size but may be shorter, and every cut falls on a NAL boundary
+// whenever the NAL fits in a chunk. The gaps are zero, which Annex B allows
+// between NAL units, so the receiver can hand any run of whole slices to the
+// decoder as soon as it arrives. Encryption runs over the sparse buffer, so a
+// chunk's keystream offset is also chunk_id * chunk_size.
+
+typedef struct SliceLayout {
+  uint16_t chunk_count;
+  uint16_t slot_size; // Chunk size the layout was made for
+  uint16_t chunk_size[MAX_FRAME_CHUNKS];
+  uint8_t chunk_flags[MAX_FRAME_CHUNKS]; // PACKET_FLAG_SLICE_START/END
+} SliceLayout;
+
+// Lays an Annex-B access unit out into `out` (at least REASSEMBLY_BUFFER_SIZE
+// bytes) in slots of `slot_size` (Protocol_ChunkSize). Returns the sparse
+// size, or 0 if the unit does not fit.
+static size_t Protocol_LayoutSlices(const uint8_t *au, size_t size,
+                                    uint16_t slot_size, uint8_t *out,
+                                    SliceLayout *layout) {
+  layout->slot_size = slot_size;
+  size_t pos = 0;
+  uint16_t n = 0;
+  uint8_t next_flags = PACKET_FLAG_SLICE_START;
+
+  while (pos < size) {
+    if (n == MAX_FRAME_CHUNKS)
+      return 0;
+
+    size_t limit = (size - pos > slot_size) ? pos + slot_size : size;
+    size_t end = limit;
+    uint8_t flags = next_flags;
+
+    if (limit < size) {
+      // Cut before the last start code that begins inside this chunk (not
+      // the one the chunk itself starts with)
+      end = pos;
+      for (size_t b = limit; b > pos + 1; --b) {
+        if (b + 2 < size && au[b] == 0 && au[b + 1] == 0 && au[b + 2] == 1) {
+          end = (b - 1 > pos && au[b - 1] == 0) ? b - 1 : b;
+          break;
+        }
+      }
+    }
+
+    if (end == pos) {
+      end = limit; // NAL larger than a chunk: continues in the next one
+      next_flags = 0;
+    } else {
+      flags |= PACKET_FLAG_SLICE_END;
+      next_flags = PACKET_FLAG_SLICE_START;
+    }
 
-    // PACING: Sleep every few packets to prevent flooding UDP buffer
-    // 192KB frame = ~137 packets.
-    // Sending all back-to-back causes drops.
-    if (i > 0 && i % 10 == 0) {
-      usleep(200); // 0.2ms pause every 10 packets
+    uint8_t *slot = out + (size_t)n * slot_size;
+    memcpy(slot, au + pos, end - pos);
+    if (end < size) {
+      memset(slot + (end - pos), 0, slot_size - (end - pos));
     }
+    layout->chunk_size[n] = (uint16_t)(end - pos);
+    layout->chunk_flags[n] = flags;
+    n++;
+    pos = end;
+  }
+
+  layout->chunk_count = n;
+  if (n == 0)
+    return 0;
+  return (size_t)(n - 1) * slot_size + layout->chunk_size[n - 1];
+}
+
+static void Protocol_SendSlices(Packetizer *pz, uint8_t type, uint8_t flags,
+                                const uint8_t *sparse, const SliceLayout *layout,
+                                SendPacketCallback send_fn, void *user_data) {
+  pz->frame_id_counter++;
+
+  for (uint16_t i = 0; i < layout->chunk_count; ++i) {
+    Protocol_SendChunk(pz, i, layout->chunk_count, layout->slot_size, type,
+                       flags | PACKET_FLAG_SLICED | layout->chunk_flags[i],
+                       sparse + (size_t)i * layout->slot_size,
+                       layout->chunk_size[i], send_fn, user_data);
   }
 }
 
 static void Protocol_SendFrame(Packetizer *pz, void *frame_data,
-                               size_t frame_size, SendPacketCallback send_fn,
-                               void *user_data) {
-  Protocol_SendData(pz, PACKET_TYPE_VIDEO, frame_data, frame_size, send_fn,
-                    user_data);
+                               size_t frame_size, uint8_t flags,
+                               SendPacketCallback send_fn, void *user_data) {
+  Protocol_SendData(pz, PACKET_TYPE_VIDEO, flags, frame_data, frame_size,
+                    send_fn, user_data);
+}
+
+static void Protocol_SendFrameSliced(Packetizer *pz, const uint8_t *sparse,
+                                     const SliceLayout *layout, uint8_t flags,
+                                     SendPacketCallback send_fn,
+                                     void *user_data) {
+  Protocol_SendSlices(pz, PACKET_TYPE_VIDEO, flags, sparse, layout, send_fn,
+                      user_data);
 }
 
 static void Protocol_SendMetadata(Packetizer *pz, StreamMetadata *meta,
                                   SendPacketCallback send_fn, void *user_data) {
-  Protocol_SendData(pz, PACKET_TYPE_METADATA, meta, sizeof(StreamMetadata),
+  Protocol_SendData(pz, PACKET_TYPE_METADATA, 0, meta, sizeof(StreamMetadata),
                     send_fn, user_data);
 }
 
 static void Protocol_SendAudio(Packetizer *pz, void *audio_data,
                                size_t audio_size, SendPacketCallback send_fn,
                                void *user_data) {
-  Protocol_SendData(pz, PACKET_TYPE_AUDIO, audio_data, audio_size, send_fn,
+  Protocol_SendData(pz, PACKET_TYPE_AUDIO, 0, audio_data, audio_size, send_fn,
                     user_data);
 }
 
+// Send a single-chunk control packet (usually header only)
+static void Protocol_SendControl(Packetizer *pz, uint8_t type,
+                                 const uint8_t *payload, size_t payload_size,
+                                 SendPacketCallback send_fn, void *user_data) {
+  pz->frame_id_counter++;
+  Protocol_SendChunk(pz, 0, 1, Protocol_ChunkSize(pz), type, 0, payload,
+                     payload_size, send_fn, user_data);
+}
+
 // Send a minimal keepalive packet (header only, no payload)
 static void Protocol_SendKeepalive(Packetizer *pz, SendPacketCallback send_fn,
                                    void *user_data) {
-  pz->frame_id_counter++;
-
-  uint8_t buffer[sizeof(PacketHeader)];
-  PacketHeader *header = (PacketHeader *)buffer;
-
-  header->frame_id = pz->frame_id_counter;
-  header->chunk_id = 0;
-  header->total_chunks = 1;
-  header->payload_size = 0; // No payload
-  header->packet_type = PACKET_TYPE_KEEPALIVE;
-  memset(header->padding, 0, 3);
+  Protocol_SendControl(pz, PACKET_TYPE_KEEPALIVE, NULL, 0, send_fn, user_data);
+}
 
-  send_fn(user_data, buffer, sizeof(PacketHeader));
+// Send a UDP hole punch packet (opens firewall for return traffic). The
+// payload advertises the highest wire version we can receive, then the
+// simulcast layer we want (0 = full resolution), then the percentage of
+// audio packets we lost lately (the host's Opus FEC strength); hosts only
+// read as far as they understand.
+static void Protocol_SendLayerPunch(Packetizer *pz, uint8_t layer,
+                                    uint8_t audio_loss_percent,
+                                    SendPacketCallback send_fn,
+                                    void *user_data) {
+  const uint8_t payload[3] = {PROTOCOL_WIRE_VERSION_MAX, layer,
+                              audio_loss_percent};
+  Protocol_SendControl(pz, PACKET_TYPE_PUNCH, payload, sizeof(payload),
+                       send_fn, user_data);
 }
 
-// Send a UDP hole punch packet (opens firewall for return traffic)
 static void Protocol_SendPunch(Packetizer *pz, SendPacketCallback send_fn,
                                void *user_data) {
+  Protocol_SendLayerPunch(pz, 0, 0, send_fn, user_data);
+}
+
+// Wire version to use towards a peer, from its punch (v1 if not advertised)
+static inline uint8_t Protocol_PunchWireVersion(const PacketInfo *punch) {
+  if (punch->payload_size < 1 || punch->payload[0] < PROTOCOL_WIRE_V2)
+    return PROTOCOL_WIRE_V1;
+  return PROTOCOL_WIRE_VERSION_MAX;
+}
+
+// Simulcast layer a peer asked for in its punch (0 if not stated)
+static inline uint8_t Protocol_PunchLayer(const PacketInfo *punch) {
+  if (punch->payload_size < 2 || Protocol_PunchWireVersion(punch) < PROTOCOL_WIRE_V2)
+    return 0;
+  return punch->payload[1];
+}
+
+// Audio loss a peer reported in its punch, in percent (0 if not stated)
+static inline uint8_t Protocol_PunchAudioLoss(const PacketInfo *punch) {
+  if (punch->payload_size < 3 || Protocol_PunchWireVersion(punch) < PROTOCOL_WIRE_V2)
+    return 0;
+  return punch->payload[2] > 100 ? 100 : punch->payload[2];
+}
+
+// Ask the host for an IDR (PLI). Sent by the viewer on first connect and
+// whenever it loses a frame or the decoder reports missing references.
+// The host rate-limits these, so resending while still broken is harmless.
+static void Protocol_SendKeyframeRequest(Packetizer *pz,
+                                         SendPacketCallback send_fn,
+                                         void *user_data) {
+  Protocol_SendControl(pz, PACKET_TYPE_KEYFRAME_REQUEST, NULL, 0, send_fn,
+                      user_data);
+}
+
+// Path MTU probe (see mtu_probe.h): a control packet padded so the datagram
+// is exactly as large as a data chunk of `chunk_size`. The payload starts
+// with the probed size (BE) so the viewer can check nothing was truncated.
+static void Protocol_SendMtuProbe(Packetizer *pz, uint16_t chunk_size,
+                                  SendPacketCallback send_fn, void *user_data) {
+  uint8_t payload[PROTOCOL_MAX_CHUNK_SIZE];
+  memset(payload, 0, chunk_size);
+  payload[0] = (uint8_t)(chunk_size >> 8);
+  payload[1] = (uint8_t)chunk_size;
+
   pz->frame_id_counter++;
+  Protocol_SendChunk(pz, 0, 1, chunk_size, PACKET_TYPE_MTU_PROBE, 0, payload,
+                     chunk_size, send_fn, user_data);
+}
 
-  uint8_t buffer[sizeof(PacketHeader)];
-  PacketHeader *header = (PacketHeader *)buffer;
+// Chunk size proven by a received probe, or 0 if it is not a complete probe
+static inline uint16_t Protocol_MtuProbeSize(const PacketInfo *probe) {
+  if (probe->packet_type != PACKET_TYPE_MTU_PROBE || probe->payload_size < 2)
+    return 0;
+  uint16_t size = (uint16_t)((probe->payload[0] << 8) | probe->payload[1]);
+  return (size == probe->payload_size) ? size : 0;
+}
 
-  header->frame_id = pz->frame_id_counter;
-  header->chunk_id = 0;
-  header->total_chunks = 1;
-  header->payload_size = 0; // No payload
-  header->packet_type = PACKET_TYPE_PUNCH;
-  memset(header->padding, 0, 3);
+// Chunk size confirmed by an MTU ack, or 0
+static inline uint16_t Protocol_MtuAckSize(const PacketInfo *ack) {
+  if (ack->packet_type != PACKET_TYPE_MTU_ACK || ack->payload_size < 2)
+    return 0;
+  return (uint16_t)((ack->payload[0] << 8) | ack->payload[1]);
+}
+
+static void Protocol_SendMtuAck(Packetizer *pz, uint16_t chunk_size,
+                                SendPacketCallback send_fn, void *user_data) {
+  const uint8_t payload[2] = {(uint8_t)(chunk_size >> 8), (uint8_t)chunk_size};
+  Protocol_SendControl(pz, PACKET_TYPE_MTU_ACK, payload, sizeof(payload),
+                       send_fn, user_data);
+}
+
+// Advertises the salt the host mixed into its key (AES_DeriveSessionKey).
+// Tagged under that key like everything else: a viewer derives the key from
+// the salt and keeps it only if the packet's own tag checks out.
+static void Protocol_SendSession(Packetizer *pz,
+                                 const uint8_t salt[AES_SALT_SIZE],
+                                 SendPacketCallback send_fn, void *user_data) {
+  Protocol_SendControl(pz, PACKET_TYPE_SESSION, salt, AES_SALT_SIZE, send_fn,
+                       user_data);
+}
+
+static inline bool Protocol_SessionSalt(const PacketInfo *session,
+                                        uint8_t salt[AES_SALT_SIZE]) {
+  if (session->packet_type != PACKET_TYPE_SESSION ||
+      session->payload_size < AES_SALT_SIZE)
+    return false;
+  memcpy(salt, session->payload, AES_SALT_SIZE);
+  return true;
+}
 
-  send_fn(user_data, buffer, sizeof(PacketHeader));
+// Opus framing of the audio stream: [samples per frame BE (2)][frames per
+// packet (1)]. Its own packet rather than more StreamMetadata, which viewers
+// reject when it grows; hosts that don't send it use 20 ms, one per packet.
+static void Protocol_SendAudioConfig(Packetizer *pz, uint16_t frame_size,
+                                     uint8_t frames_per_packet,
+                                     SendPacketCallback send_fn,
+                                     void *user_data) {
+  const uint8_t payload[3] = {(uint8_t)(frame_size >> 8), (uint8_t)frame_size,
+                              frames_per_packet};
+  Protocol_SendControl(pz, PACKET_TYPE_AUDIO_CONFIG, payload, sizeof(payload),
+                       send_fn, user_data);
+}
+
+// Samples per audio packet (per channel) from an audio config, or 0
+static inline uint32_t Protocol_AudioPacketSize(const PacketInfo *config) {
+  if (config->packet_type != PACKET_TYPE_AUDIO_CONFIG ||
+      config->payload_size < 3)
+    return 0;
+  uint32_t frame_size = (uint32_t)((config->payload[0] << 8) |
+                                   config->payload[1]);
+  return frame_size * config->payload[2];
 }
 
 // --- Reassembler (Receiver) ---
 
+#define CHUNK_RECEIVED (1 << 7) // chunk_state bit; low bits keep the slice flags
+
 typedef struct ReassemblyBuffer {
   uint32_t frame_id;
+  uint8_t stream_id; // Simulcast layer being followed
   uint8_t *data;
   size_t total_size;
   size_t received_bytes;
   uint8_t packet_type;
+  uint8_t flags;  // Frame-level PACKET_FLAG_* of this unit
+  uint32_t timestamp_us; // v2 media timestamp (0 for v1)
+  bool completed; // Already handed out (RESULT_COMPLETE or partial)
+  double started_at; // First seen by Reassembler_TakePartial (0 = not yet)
+  bool damaged;   // Sliced: some slices were skipped (already counted as lost)
+  uint16_t total_chunks;
+  uint16_t chunk_size; // Offset of chunk i is i * chunk_size
+  uint16_t next_chunk; // Sliced: first chunk not yet handed out
+  uint8_t chunk_state[MAX_FRAME_CHUNKS];
 } ReassemblyBuffer;
 
 typedef struct Reassembler {
   ReassemblyBuffer active_buffer; // Supports 1 active frame reassembly
   MemoryArena *arena;             // To allocate the large frame buffer
+  uint32_t frames_lost; // Units abandoned incomplete or missing slices
+  double partial_deadline; // >0: Reassembler_TakePartial hands out incomplete
+                           // units after this many seconds
+  uint8_t wire_version; // Version last seen from the peer (parse hint)
 } Reassembler;
 
+// Byte range of a partially delivered unit that never arrived
+#define MAX_MISSING_RANGES 64
+typedef struct MissingRange {
+  uint32_t offset;
+  uint32_t size;
+} MissingRange;
+
 // Result of processing a packet
 typedef enum ReassemblyResult {
   RESULT_PARTIAL,
-  RESULT_COMPLETE,
+  RESULT_COMPLETE, // Whole unit (or, for sliced frames, its final slices)
+  RESULT_SLICE,    // Sliced frame: whole NAL units ready, more will follow
   RESULT_IGNORED
 } ReassemblyResult;
 
@@ -175,56 +717,161 @@ static void Reassembler_Init(Reassembler *r, MemoryArena *arena) {
   r->arena = arena;
   r->active_buffer.frame_id = 0;
   r->active_buffer.data = NULL;
+  r->active_buffer.completed = false;
+  r->frames_lost = 0;
+  r->partial_deadline = 0.0;
+  r->wire_version = PROTOCOL_WIRE_V1;
 }
 
-static ReassemblyResult Protocol_HandlePacket(Reassembler *r, void *packet_data,
-                                              size_t packet_size,
-                                              void **out_data, size_t *out_size,
-                                              uint8_t *out_type) {
-  if (packet_size < sizeof(PacketHeader))
-    return RESULT_IGNORED;
+// Hands out the next run of whole slices of a sliced frame. Slices are only
+// delivered in order: if a later slice is ready while an earlier chunk is
+// still missing, the earlier one is treated as lost and skipped.
+static ReassemblyResult Reassembler_DeliverSlices(Reassembler *r,
+                                                  void **out_data,
+                                                  size_t *out_size,
+                                                  uint8_t *out_type) {
+  ReassemblyBuffer *b = &r->active_buffer;
+
+  uint16_t first = b->next_chunk;
+  while (first < b->total_chunks &&
+         (b->chunk_state[first] & (CHUNK_RECEIVED | PACKET_FLAG_SLICE_START)) !=
+             (CHUNK_RECEIVED | PACKET_FLAG_SLICE_START)) {
+    first++;
+  }
 
-  PacketHeader *header = (PacketHeader *)packet_data;
+  uint16_t end = first;
+  for (uint16_t i = first;
+       i < b->total_chunks && (b->chunk_state[i] & CHUNK_RECEIVED); ++i) {
+    if (b->chunk_state[i] & PACKET_FLAG_SLICE_END)
+      end = i + 1;
+  }
+  if (end == first)
+    return RESULT_PARTIAL;
 
-  // Safety check: Ensure the packet actually contains the claimed payload
-  if (packet_size < sizeof(PacketHeader) + header->payload_size) {
+  if (first != b->next_chunk && !b->damaged) {
+    b->damaged = true;
+    r->frames_lost++;
+  }
+
+  size_t start = (size_t)first * b->chunk_size;
+  *out_data = b->data + start;
+  *out_size = (end == b->total_chunks)
+                  ? b->total_size - start
+                  : (size_t)(end - first) * b->chunk_size;
+  if (out_type)
+    *out_type = b->packet_type;
+
+  b->next_chunk = end;
+  if (end == b->total_chunks) {
+    b->completed = true;
+    return RESULT_COMPLETE;
+  }
+  return RESULT_SLICE;
+}
+
+// Simulcast: a reassembler follows one stream id and moves to another only
+// at an IDR, whatever its frame ID (layers share frame IDs, and the old layer
+// may already be a few frames ahead). Anything else from other streams is
+// in-flight data of the previous layer.
+#define REASSEMBLER_LAYER_ENTRY (PACKET_FLAG_KEYFRAME | PACKET_FLAG_RECOVERY_POINT)
+
+// True if `header` starts a new unit: a newer frame of the stream being
+// followed, or a switch to another layer. Callers flush the active unit first.
+static inline bool Reassembler_StartsNewUnit(const Reassembler *r,
+                                             const PacketInfo *header) {
+  const ReassemblyBuffer *b = &r->active_buffer;
+  if (b->data && header->stream_id != b->stream_id)
+    return (header->flags & REASSEMBLER_LAYER_ENTRY) == REASSEMBLER_LAYER_ENTRY;
+  return header->frame_id > b->frame_id;
+}
+
+// Feeds one parsed packet (see Protocol_ParseHeader) into the reassembler
+static ReassemblyResult Protocol_HandlePacketInfo(Reassembler *r,
+                                                  const PacketInfo *header,
+                                                  void **out_data,
+                                                  size_t *out_size,
+                                                  uint8_t *out_type) {
+  if (header->total_chunks == 0 || header->total_chunks > MAX_FRAME_CHUNKS ||
+      header->chunk_id >= header->total_chunks ||
+      !Protocol_IsValidChunkSize(header->chunk_size) ||
+      header->payload_size > header->chunk_size) {
     return RESULT_IGNORED;
   }
-  uint8_t *payload = (uint8_t *)packet_data + sizeof(PacketHeader);
+  uint8_t *payload = header->payload;
 
   // Check if this is a new frame (or metadata unit)
-  if (header->frame_id > r->active_buffer.frame_id) {
-    // New logical unit started
+  bool new_unit = Reassembler_StartsNewUnit(r, header);
+  if (!new_unit && header->stream_id != r->active_buffer.stream_id)
+    return RESULT_IGNORED; // Another simulcast layer
+  if (new_unit) {
+    // New logical unit started. If the previous one never completed, a chunk
+    // was lost and the decoder will be missing a reference.
+    if (r->active_buffer.data && r->active_buffer.received_bytes > 0 &&
+        !r->active_buffer.completed && !r->active_buffer.damaged) {
+      r->frames_lost++;
+    }
     r->active_buffer.frame_id = header->frame_id;
+    r->active_buffer.stream_id = header->stream_id;
     r->active_buffer.received_bytes = 0;
     r->active_buffer.packet_type = header->packet_type;
+    r->active_buffer.flags = header->flags & (PACKET_FLAG_KEYFRAME |
+                                              PACKET_FLAG_RECOVERY_POINT |
+                                              PACKET_FLAG_SLICED);
+    r->active_buffer.timestamp_us = header->timestamp_us;
+    r->active_buffer.completed = false;
+    r->active_buffer.started_at = 0.0;
+    r->active_buffer.damaged = false;
+    r->active_buffer.total_chunks = header->total_chunks;
+    r->active_buffer.chunk_size = header->chunk_size;
+    r->active_buffer.next_chunk = 0;
+    memset(r->active_buffer.chunk_state, 0, header->total_chunks);
 
     // Ensure buffer exists.
     // We always use a 2MB buffer for simplicity, which covers both Video and
     // Metadata.
     if (!r->active_buffer.data) {
-      r->active_buffer.data = ArenaPush(r->arena, 2 * 1024 * 1024);
+      r->active_buffer.data = ArenaPush(r->arena, REASSEMBLY_BUFFER_SIZE);
     }
 
     r->active_buffer.total_size = 0;
   }
 
   if (header->frame_id == r->active_buffer.frame_id) {
-    size_t offset = header->chunk_id * MAX_PACKET_PAYLOAD;
-    if (offset + header->payload_size > 2 * 1024 * 1024)
-      return RESULT_IGNORED;
+    if (header->total_chunks != r->active_buffer.total_chunks ||
+        header->chunk_size != r->active_buffer.chunk_size ||
+        (r->active_buffer.chunk_state[header->chunk_id] & CHUNK_RECEIVED))
+      return RESULT_IGNORED; // Inconsistent or duplicate chunk
 
+    size_t offset = (size_t)header->chunk_id * header->chunk_size;
+    if (offset + header->payload_size > REASSEMBLY_BUFFER_SIZE)
+      return RESULT_IGNORED;
     memcpy(r->active_buffer.data + offset, payload, header->payload_size);
     r->active_buffer.received_bytes += header->payload_size;
+    r->active_buffer.chunk_state[header->chunk_id] =
+        CHUNK_RECEIVED |
+        (header->flags & (PACKET_FLAG_SLICE_START | PACKET_FLAG_SLICE_END));
 
     if (header->chunk_id == header->total_chunks - 1) {
-      size_t expected_size = (header->total_chunks - 1) * MAX_PACKET_PAYLOAD +
-                             header->payload_size;
+      size_t expected_size =
+          (size_t)(header->total_chunks - 1) * header->chunk_size +
+          header->payload_size;
       r->active_buffer.total_size = expected_size;
     }
 
-    if (r->active_buffer.total_size > 0 &&
+    if (header->flags & PACKET_FLAG_SLICED) {
+      if (header->chunk_id != header->total_chunks - 1) {
+        // Zero the gap up to the next chunk slot (stale data from older units)
+        memset(r->active_buffer.data + offset + header->payload_size, 0,
+               header->chunk_size - header->payload_size);
+      }
+      if (r->active_buffer.completed)
+        return RESULT_IGNORED;
+      return Reassembler_DeliverSlices(r, out_data, out_size, out_type);
+    }
+
+    if (!r->active_buffer.completed && r->active_buffer.total_size > 0 &&
         r->active_buffer.received_bytes >= r->active_buffer.total_size) {
+      r->active_buffer.completed = true;
       *out_data = r->active_buffer.data;
       *out_size = r->active_buffer.total_size;
       if (out_type)
@@ -238,4 +885,86 @@ static ReassemblyResult Protocol_HandlePacket(Reassembler *r, void *packet_data,
   return RESULT_IGNORED;
 }
 
+// Parses and reassembles a raw datagram. `r->wire_version` is updated to
+// the version of the last valid packet and used to resolve ambiguous ones.
+static ReassemblyResult Protocol_HandlePacket(Reassembler *r, void *packet_data,
+                                              size_t packet_size,
+                                              void **out_data, size_t *out_size,
+                                              uint8_t *out_type) {
+  PacketInfo info;
+  if (!Protocol_ParseHeader(packet_data, packet_size, r->wire_version, &info))
+    return RESULT_IGNORED;
+  r->wire_version = info.version;
+  return Protocol_HandlePacketInfo(r, &info, out_data, out_size, out_type);
+}
+
+// Loss-tolerant delivery: once the active unit is older than partial_deadline
+// (or `force`, e.g. because a newer unit is about to replace it), hands out
+// whatever arrived, with the holes listed in `missing` (offsets relative to
+// *out_data) and zeroed. Sliced units only return the slices not yet handed
+// out. Call regularly; the deadline clock starts at the first call that sees
+// the unit. Returns false if there is nothing to deliver.
+static bool Reassembler_TakePartial(Reassembler *r, double now, bool force,
+                                    void **out_data, size_t *out_size,
+                                    uint8_t *out_flags, MissingRange *missing,
+                                    int *missing_count) {
+  ReassemblyBuffer *b = &r->active_buffer;
+  if (r->partial_deadline <= 0.0 || !b->data || b->received_bytes == 0 ||
+      b->completed)
+    return false;
+
+  if (b->started_at == 0.0)
+    b->started_at = now;
+  if (!force && now - b->started_at < r->partial_deadline)
+    return false;
+
+  // The unit is given up on from here; late chunks are ignored
+  b->completed = true;
+  if (!b->damaged) {
+    b->damaged = true;
+    r->frames_lost++;
+  }
+
+  int last = -1;
+  for (int i = b->total_chunks - 1; i >= b->next_chunk; --i) {
+    if (b->chunk_state[i] & CHUNK_RECEIVED) {
+      last = i;
+      break;
+    }
+  }
+  if (last < 0)
+    return false;
+
+  size_t start = (size_t)b->next_chunk * b->chunk_size;
+  size_t end = (last == b->total_chunks - 1)
+                   ? b->total_size
+                   : (size_t)(last + 1) * b->chunk_size;
+
+  int count = 0;
+  for (int i = b->next_chunk; i < last; ++i) {
+    if (b->chunk_state[i] & CHUNK_RECEIVED)
+      continue;
+    size_t hole = (size_t)i * b->chunk_size;
+    memset(b->data + hole, 0, b->chunk_size);
+    if (count > 0 &&
+        missing[count - 1].offset + missing[count - 1].size == hole - start) {
+      missing[count - 1].size += b->chunk_size; // Extend the previous hole
+    } else if (count < MAX_MISSING_RANGES) {
+      missing[count].offset = (uint32_t)(hole - start);
+      missing[count].size = b->chunk_size;
+      count++;
+    } else {
+      // Out of ranges: everything from here on counts as missing
+      missing[count - 1].size = (uint32_t)(end - start) - missing[count - 1].offset;
+      break;
+    }
+  }
+
+  *out_data = b->data + start;
+  *out_size = end - start;
+  *out_flags = b->flags;
+  *missing_count = count;
+  return true;
+}
+
 #endif // HARMONY_PROTOCOL_H
@@ -0,0 +1,534 @@
+#ifndef HARMONY_RELAY_H
+#define HARMONY_RELAY_H
+
+// Headless relay (SFU) for broadcasts: the host streams to the relay as if it
+// were its only viewer, and the relay forwards every datagram unchanged to
+// many UDP viewers (and reassembled units to WebSocket viewers). Packets are
+// never re-packetized, so authentication tags and encryption stay end to end:
+// the relay does not need the stream password.
+//
+// - Late joiners are caught up from a GOP cache (everything since the last
+//   keyframe), each at its own paced rate, then switched to the live stream.
+// - Keyframe requests are rate-limited per viewer (viewer_table.h) and
+//   coalesced into one request upstream.
+// - MTU probes from the host are forwarded, and a size is acked upstream only
+//   once every viewer has acked it, so the host's chunk size fits all paths.
+// - Frames of temporal layer 1 are dropped whole while the send queue is
+//   backed up (see SCHEDULER_SHED_BACKLOG); viewers get half the frame rate
+//   rather than a growing delay.
+//
+// Viewers must speak wire format v2 (keyframe flags drive the GOP cache).
+// The relay takes one simulcast layer from the host (`layer`) for all of its
+// viewers; their own layer requests are not passed upstream.
+
+#ifndef VIEWER_TABLE_MAX
+#define VIEWER_TABLE_MAX 256
+#endif
+
+#include "../memory_arena.h"
+#include "../network_api.h"
+#include "../os_api.h"
+#include "mtu_probe.h"
+#include "protocol.h"
+#include "send_scheduler.h"
+#include "viewer_table.h"
+#include "websocket.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RELAY_GOP_CACHE_SIZE (16 * 1024 * 1024)
+#define RELAY_GOP_MAX_PACKETS 16384
+#define RELAY_CATCHUP_RATE (8.0 * 1024 * 1024) // Bytes/s per joining viewer
+#define RELAY_CATCHUP_BURST (64 * 1024)
+#define RELAY_PUNCH_INTERVAL 0.5
+#define RELAY_KEYFRAME_MIN_INTERVAL 0.25
+#define RELAY_PROBE_SEARCH_GAP 5.0 // Probe-free gap that ends a host MTU search
+#define RELAY_MAX_RECV_PER_POLL 256 // Keep timers and catch-up pacing running
+
+typedef struct GopCache {
+  bool valid; // Holds every video packet since keyframe `keyframe_id`
+  uint32_t keyframe_id;
+  uint8_t *data;
+  size_t used;
+  uint32_t *offsets;
+  uint16_t *sizes;
+  int count;
+} GopCache;
+
+// Relay-only state of a viewer, same index as in the ViewerTable
+typedef struct RelayViewer {
+  bool catching_up; // Still replaying the GOP cache, no live video yet
+  int cursor;       // Next GOP cache packet to send
+  double tokens;    // Catch-up pacing budget (bytes)
+  double last_refill;
+  uint8_t probes_acked; // Bit i: MTU probe candidate i reached this viewer
+} RelayViewer;
+
+typedef struct Relay {
+  NetworkContext *net;
+  WebSocketContext *ws; // NULL: UDP viewers only
+  SendScheduler *scheduler;
+
+  // Upstream (the host)
+  char host_ip[16];
+  int host_port;
+  uint8_t upstream_version;
+  double last_upstream;
+  double last_punch;
+  Packetizer upstream_pz; // Punches, keyframe requests, MTU acks
+  uint8_t layer;          // Simulcast layer asked for in punches
+
+  ViewerTable viewers;
+  RelayViewer state[VIEWER_TABLE_MAX];
+  SchedulerDest dests[VIEWER_TABLE_MAX]; // Fan-out scratch
+
+  GopCache gop;
+
+  uint8_t last_metadata[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  size_t last_metadata_size; // Sent to joiners right away
+  uint8_t last_session[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  size_t last_session_size; // Key salt: joiners decrypt nothing without it
+  uint8_t last_audio_config[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  size_t last_audio_config_size;
+
+  // MTU probes seen from the host in its current search (bit per candidate)
+  uint8_t probes_seen;
+  double last_probe;
+
+  bool keyframe_pending; // WebSocket viewer joined
+  double last_keyframe_request;
+
+  // WebSocket viewers get whole units
+  Reassembler video_reassembler;
+  Reassembler audio_reassembler;
+
+  // Load shedding: decided on the first chunk seen of each discardable frame
+  uint32_t shed_frame_id;
+  bool shed_frame;
+
+  // Stats
+  uint64_t bytes_in;
+  uint64_t packets_in;
+  uint64_t frames_shed;
+} Relay;
+
+static void Relay_SchedulerSend(void *user_data, const char *dest_ip,
+                                int dest_port, const void *data, size_t size) {
+  Net_Send((NetworkContext *)user_data, dest_ip, dest_port, (void *)data,
+           size);
+}
+
+static void Relay_SchedulerSendBatch(void *user_data,
+                                     const SchedulerDatagram *datagrams,
+                                     int count) {
+  NetDatagram batch[SCHEDULER_MAX_BATCH];
+  for (int i = 0; i < count; ++i) {
+    batch[i] = (NetDatagram){.ip = datagrams[i].dest->ip,
+                             .port = datagrams[i].dest->port,
+                             .data = datagrams[i].data,
+                             .size = datagrams[i].size};
+  }
+  Net_SendBatch((NetworkContext *)user_data, batch, count);
+}
+
+static Relay *Relay_Create(MemoryArena *arena, NetworkContext *net,
+                           WebSocketContext *ws, const char *host_ip,
+                           int host_port) {
+  Relay *r = PushStructZero(arena, Relay);
+  r->net = net;
+  r->ws = ws;
+  strncpy(r->host_ip, host_ip, sizeof(r->host_ip) - 1);
+  r->host_port = host_port;
+  r->upstream_version = PROTOCOL_WIRE_V1;
+
+  r->gop.data = ArenaPush(arena, RELAY_GOP_CACHE_SIZE);
+  r->gop.offsets =
+      (uint32_t *)ArenaPush(arena, RELAY_GOP_MAX_PACKETS * sizeof(uint32_t));
+  r->gop.sizes =
+      (uint16_t *)ArenaPush(arena, RELAY_GOP_MAX_PACKETS * sizeof(uint16_t));
+
+  if (ws) {
+    Reassembler_Init(&r->video_reassembler, arena);
+    Reassembler_Init(&r->audio_reassembler, arena);
+  }
+
+  r->scheduler = Scheduler_Create(Relay_SchedulerSend, net);
+  Scheduler_SetBatchSend(r->scheduler, Relay_SchedulerSendBatch);
+  return r;
+}
+
+static void Relay_Destroy(Relay *r) {
+  Scheduler_Destroy(r->scheduler);
+  r->scheduler = NULL;
+}
+
+static inline SchedulerTarget Relay_UpstreamTarget(Relay *r) {
+  return (SchedulerTarget){.scheduler = r->scheduler,
+                           .priority = SEND_PRIORITY_CONTROL,
+                           .dest_ip = r->host_ip,
+                           .dest_port = r->host_port};
+}
+
+static inline int Relay_ViewerIndex(Relay *r, const Viewer *v) {
+  return (int)(v - r->viewers.viewers);
+}
+
+// Queues one datagram for every viewer; viewers still replaying the GOP
+// cache get live video from the cache instead.
+static void Relay_Fanout(Relay *r, SendPriority priority, bool live_video,
+                         const void *data, size_t size) {
+  int n = 0;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &r->viewers.viewers[i];
+    if (!v->active || (live_video && r->state[i].catching_up))
+      continue;
+    memcpy(r->dests[n].ip, v->ip, sizeof(v->ip));
+    r->dests[n].port = v->port;
+    n++;
+  }
+  Scheduler_EnqueueFanout(r->scheduler, priority, r->dests, n, data, size);
+}
+
+static void Relay_CacheVideo(Relay *r, const PacketInfo *info,
+                             const uint8_t *packet, size_t size) {
+  GopCache *g = &r->gop;
+  if ((info->flags & PACKET_FLAG_KEYFRAME) && info->version >= PROTOCOL_WIRE_V2 &&
+      (!g->valid || info->frame_id > g->keyframe_id)) {
+    // New GOP: viewers still catching up restart from its keyframe
+    g->valid = true;
+    g->keyframe_id = info->frame_id;
+    g->used = 0;
+    g->count = 0;
+    for (int i = 0; i < VIEWER_TABLE_MAX; ++i)
+      r->state[i].cursor = 0;
+  }
+  if (!g->valid || info->frame_id < g->keyframe_id)
+    return;
+
+  if (g->count == RELAY_GOP_MAX_PACKETS || g->used + size > RELAY_GOP_CACHE_SIZE) {
+    // GOP too long (e.g. intra-refresh): cache again from the next keyframe.
+    // Viewers mid-replay go live and need a keyframe from the host.
+    printf("Relay: GOP cache full (%d packets), waiting for a keyframe\n",
+           g->count);
+    g->valid = false;
+    for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+      if (r->state[i].catching_up) {
+        r->state[i].catching_up = false;
+        r->viewers.viewers[i].keyframe_needed = true;
+      }
+    }
+    return;
+  }
+
+  g->offsets[g->count] = (uint32_t)g->used;
+  g->sizes[g->count] = (uint16_t)size;
+  memcpy(g->data + g->used, packet, size);
+  g->used += size;
+  g->count++;
+}
+
+// Sends each catching-up viewer as much of the GOP cache as its pacing budget
+// allows. A viewer that reaches the end of the cache is live from then on.
+static void Relay_PumpCatchUp(Relay *r, double now) {
+  GopCache *g = &r->gop;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    RelayViewer *s = &r->state[i];
+    const Viewer *v = &r->viewers.viewers[i];
+    if (!v->active || !s->catching_up)
+      continue;
+
+    s->tokens += (now - s->last_refill) * RELAY_CATCHUP_RATE;
+    if (s->tokens > RELAY_CATCHUP_BURST)
+      s->tokens = RELAY_CATCHUP_BURST;
+    s->last_refill = now;
+
+    while (s->cursor < g->count && s->tokens >= g->sizes[s->cursor]) {
+      Scheduler_Enqueue(r->scheduler, SEND_PRIORITY_VIDEO, v->ip, v->port,
+                        g->data + g->offsets[s->cursor], g->sizes[s->cursor]);
+      s->tokens -= g->sizes[s->cursor];
+      s->cursor++;
+    }
+    if (s->cursor >= g->count) {
+      s->catching_up = false;
+      printf("Relay: Viewer %s:%d caught up (%.2f s after joining)\n", v->ip,
+             v->port, now - v->joined_at);
+    }
+  }
+}
+
+static int Relay_ProbeIndex(uint16_t chunk_size) {
+  for (int i = 0; i < MTU_PROBE_CANDIDATE_COUNT; ++i) {
+    if (mtu_probe_candidates[i] == chunk_size)
+      return i;
+  }
+  return -1;
+}
+
+// Acks probe candidate `i` upstream if it reached the relay and every viewer
+static void Relay_AckProbeIfComplete(Relay *r, int i) {
+  if (!(r->probes_seen & (1u << i)))
+    return;
+  for (int v = 0; v < VIEWER_TABLE_MAX; ++v) {
+    if (r->viewers.viewers[v].active && !(r->state[v].probes_acked & (1u << i)))
+      return;
+  }
+  SchedulerTarget up = Relay_UpstreamTarget(r);
+  Protocol_SendMtuAck(&r->upstream_pz, mtu_probe_candidates[i],
+                      Scheduler_SendPacketCallback, &up);
+}
+
+static void Relay_OnMtuProbe(Relay *r, const PacketInfo *info,
+                             const uint8_t *packet, size_t size, double now) {
+  int i = Relay_ProbeIndex(Protocol_MtuProbeSize(info));
+  if (i < 0)
+    return;
+  if (now - r->last_probe > RELAY_PROBE_SEARCH_GAP) {
+    // The host started a new search: paths may have changed since
+    r->probes_seen = 0;
+    for (int v = 0; v < VIEWER_TABLE_MAX; ++v)
+      r->state[v].probes_acked = 0;
+  }
+  r->last_probe = now;
+  r->probes_seen |= (uint8_t)(1u << i);
+
+  Relay_Fanout(r, SEND_PRIORITY_CONTROL, false, packet, size);
+  Relay_AckProbeIfComplete(r, i); // Host retries until acked
+}
+
+// True if this video packet belongs to a discardable frame being dropped.
+// All chunks of a frame share the decision, so viewers never get half of one.
+static bool Relay_ShedVideo(Relay *r, const PacketInfo *info, double now) {
+  if (info->temporal_layer == 0)
+    return false;
+  if (info->frame_id != r->shed_frame_id) {
+    r->shed_frame_id = info->frame_id;
+    r->shed_frame = Scheduler_ShouldShed(r->scheduler);
+    if (r->shed_frame) {
+      static double last_shed_log = 0;
+      r->frames_shed++;
+      if (now - last_shed_log >= 5.0) {
+        printf("Relay: Send queue backed up, dropping temporal layer 1 "
+               "(%llu frames so far)\n",
+               (unsigned long long)r->frames_shed);
+        last_shed_log = now;
+      }
+    }
+  }
+  return r->shed_frame;
+}
+
+static void Relay_HandleUpstream(Relay *r, uint8_t *packet, size_t size,
+                                 double now) {
+  PacketInfo info;
+  if (!Protocol_ParseHeader(packet, size, r->upstream_version, &info))
+    return;
+  if (r->last_upstream == 0.0 || info.version != r->upstream_version) {
+    printf("Relay: Receiving from host %s:%d (wire format v%d)\n", r->host_ip,
+           r->host_port, info.version);
+  }
+  r->upstream_version = info.version;
+  r->last_upstream = now;
+  r->bytes_in += size;
+  r->packets_in++;
+
+  void *unit = NULL;
+  size_t unit_size = 0;
+  switch (info.packet_type) {
+  case PACKET_TYPE_PUNCH:
+  case PACKET_TYPE_KEEPALIVE:
+    break;
+
+  case PACKET_TYPE_MTU_PROBE:
+    Relay_OnMtuProbe(r, &info, packet, size, now);
+    break;
+
+  case PACKET_TYPE_VIDEO:
+    Relay_CacheVideo(r, &info, packet, size);
+    if (!Relay_ShedVideo(r, &info, now))
+      Relay_Fanout(r, SEND_PRIORITY_VIDEO, true, packet, size);
+    if (r->ws && Protocol_HandlePacketInfo(&r->video_reassembler, &info, &unit,
+                                           &unit_size, NULL) == RESULT_COMPLETE) {
+      // Sliced units come out in pieces; the buffer holds the whole unit
+      ReassemblyBuffer *b = &r->video_reassembler.active_buffer;
+      if (!b->damaged) {
+        uint8_t ws_flags =
+            WS_MESSAGE_VIDEO |
+            ((info.flags & PACKET_FLAG_KEYFRAME) ? WS_MESSAGE_KEYFRAME : 0) |
+            (info.temporal_layer ? WS_MESSAGE_DISCARDABLE : 0);
+        WS_Broadcast(r->ws, PACKET_TYPE_VIDEO, info.frame_id, ws_flags,
+                     b->data, b->total_size);
+      }
+    }
+    break;
+
+  case PACKET_TYPE_AUDIO:
+    Relay_Fanout(r, SEND_PRIORITY_AUDIO, false, packet, size);
+    if (r->ws && Protocol_HandlePacketInfo(&r->audio_reassembler, &info, &unit,
+                                           &unit_size, NULL) == RESULT_COMPLETE) {
+      WS_Broadcast(r->ws, PACKET_TYPE_AUDIO, info.frame_id, 0, unit,
+                   unit_size);
+    }
+    break;
+
+  case PACKET_TYPE_METADATA:
+    if (info.total_chunks == 1 && size <= sizeof(r->last_metadata)) {
+      memcpy(r->last_metadata, packet, size);
+      r->last_metadata_size = size;
+    }
+    Relay_Fanout(r, SEND_PRIORITY_CONTROL, false, packet, size);
+    break;
+
+  case PACKET_TYPE_AUDIO_CONFIG:
+    if (info.total_chunks == 1 && size <= sizeof(r->last_audio_config)) {
+      memcpy(r->last_audio_config, packet, size);
+      r->last_audio_config_size = size;
+    }
+    Relay_Fanout(r, SEND_PRIORITY_CONTROL, false, packet, size);
+    break;
+
+  case PACKET_TYPE_SESSION:
+    if (info.total_chunks == 1 && size <= sizeof(r->last_session)) {
+      memcpy(r->last_session, packet, size);
+      r->last_session_size = size;
+    }
+    Relay_Fanout(r, SEND_PRIORITY_CONTROL, false, packet, size);
+    if (r->ws)
+      WS_Broadcast(r->ws, PACKET_TYPE_SESSION, 0, 0, info.payload,
+                   info.payload_size);
+    break;
+
+  default:
+    Relay_Fanout(r, SEND_PRIORITY_CONTROL, false, packet, size);
+    break;
+  }
+}
+
+static void Relay_HandleViewer(Relay *r, uint8_t *packet, size_t size,
+                               const char *ip, int port, double now) {
+  PacketInfo info;
+  if (!Protocol_ParseHeader(packet, size, PROTOCOL_WIRE_V1, &info))
+    return;
+  Viewer *v = ViewerTable_Find(&r->viewers, ip, port);
+
+  if (info.packet_type == PACKET_TYPE_PUNCH) {
+    uint8_t wire_version = Protocol_PunchWireVersion(&info);
+    if (wire_version < PROTOCOL_WIRE_V2) {
+      static double last_v1_log = 0;
+      if (now - last_v1_log >= 5.0) {
+        printf("Relay: Ignoring %s:%d, viewers need wire format v2\n", ip,
+               port);
+        last_v1_log = now;
+      }
+      return;
+    }
+
+    bool joined;
+    v = ViewerTable_OnPunch(&r->viewers, ip, port, wire_version, now, &joined);
+    if (!v) {
+      static double last_full_log = 0;
+      if (now - last_full_log >= 5.0) {
+        printf("Relay: Viewer table full, ignoring %s:%d\n", ip, port);
+        last_full_log = now;
+      }
+      return;
+    }
+    v->audio_loss_percent = Protocol_PunchAudioLoss(&info);
+    if (joined) {
+      RelayViewer *s = &r->state[Relay_ViewerIndex(r, v)];
+      memset(s, 0, sizeof(*s));
+      if (r->gop.valid) {
+        // Start from the cached keyframe instead of asking the host for one
+        s->catching_up = true;
+        s->tokens = RELAY_CATCHUP_BURST;
+        s->last_refill = now;
+        v->keyframe_needed = false;
+      }
+      if (r->last_session_size > 0) {
+        Scheduler_Enqueue(r->scheduler, SEND_PRIORITY_CONTROL, ip, port,
+                          r->last_session, r->last_session_size);
+      }
+      if (r->last_metadata_size > 0) {
+        Scheduler_Enqueue(r->scheduler, SEND_PRIORITY_CONTROL, ip, port,
+                          r->last_metadata, r->last_metadata_size);
+      }
+      if (r->last_audio_config_size > 0) {
+        Scheduler_Enqueue(r->scheduler, SEND_PRIORITY_CONTROL, ip, port,
+                          r->last_audio_config, r->last_audio_config_size);
+      }
+      printf("Relay: Viewer connected from %s:%d (%d watching%s)\n", ip, port,
+             r->viewers.count,
+             r->gop.valid ? ", replaying cached GOP" : "");
+    }
+  } else if (info.packet_type == PACKET_TYPE_KEYFRAME_REQUEST && v) {
+    // A viewer replaying the cache has a keyframe on the way
+    if (!r->state[Relay_ViewerIndex(r, v)].catching_up)
+      ViewerTable_OnKeyframeRequest(v);
+  } else if (info.packet_type == PACKET_TYPE_MTU_ACK && v) {
+    int i = Relay_ProbeIndex(Protocol_MtuAckSize(&info));
+    if (i >= 0) {
+      r->state[Relay_ViewerIndex(r, v)].probes_acked |= (uint8_t)(1u << i);
+      Relay_AckProbeIfComplete(r, i);
+    }
+  }
+}
+
+static void Relay_Tick(Relay *r, double now) {
+  SchedulerTarget up = Relay_UpstreamTarget(r);
+  if (now - r->last_punch >= RELAY_PUNCH_INTERVAL) {
+    // Our viewers' loss includes the host-to-relay leg: pass on the worst
+    Protocol_SendLayerPunch(&r->upstream_pz, r->layer,
+                            ViewerTable_AudioLoss(&r->viewers),
+                            Scheduler_SendPacketCallback, &up);
+    r->last_punch = now;
+  }
+
+  ViewerTable_Expire(&r->viewers, now);
+
+  if (r->ws && WS_Poll(r->ws) > 0) {
+    r->keyframe_pending = true; // New or resyncing browser needs an IDR
+    PacketInfo session;         // ...and the key salt, if there is one
+    if (r->last_session_size > 0 &&
+        Protocol_ParseHeader(r->last_session, r->last_session_size,
+                             r->upstream_version, &session))
+      WS_Broadcast(r->ws, PACKET_TYPE_SESSION, 0, 0, session.payload,
+                   session.payload_size);
+  }
+
+  // One request upstream serves every viewer waiting for a keyframe
+  if (now - r->last_keyframe_request >= RELAY_KEYFRAME_MIN_INTERVAL &&
+      (r->keyframe_pending || ViewerTable_KeyframeDue(&r->viewers, 0, now))) {
+    ViewerTable_OnKeyframeForced(&r->viewers, 0, now);
+    Protocol_SendKeyframeRequest(&r->upstream_pz, Scheduler_SendPacketCallback,
+                                 &up);
+    r->last_keyframe_request = now;
+    r->keyframe_pending = false;
+  }
+
+  Relay_PumpCatchUp(r, now);
+}
+
+// Handles whatever arrived on the socket, then runs timers and catch-up
+// pacing. Returns the number of datagrams handled (0: caller may sleep).
+static int Relay_Poll(Relay *r) {
+  uint8_t buf[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+  char ip[16];
+  int port;
+  int handled = 0;
+  double now = OS_GetTime();
+
+  int n;
+  while (handled < RELAY_MAX_RECV_PER_POLL &&
+         (n = Net_Recv(r->net, buf, sizeof(buf), ip, &port)) > 0) {
+    if (port == r->host_port && strcmp(ip, r->host_ip) == 0) {
+      Relay_HandleUpstream(r, buf, (size_t)n, now);
+    } else {
+      Relay_HandleViewer(r, buf, (size_t)n, ip, port, now);
+    }
+    handled++;
+  }
+
+  Relay_Tick(r, now);
+  return handled;
+}
+
+#endif // HARMONY_RELAY_H
@@ -0,0 +1,316 @@
+#ifndef HARMONY_SEND_SCHEDULER_H
+#define HARMONY_SEND_SCHEDULER_H
+
+#include "../os_api.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // for usleep
+
+// Single sender thread for all outgoing host packets. Media threads only
+// enqueue (a copy + a short lock), so a keyframe being paced out never blocks
+// the audio thread. The sender always drains the highest non-empty class
+// first; video pacing sleeps happen here, between video packets only.
+typedef enum SendPriority {
+  SEND_PRIORITY_CONTROL = 0,     // Punches, metadata, keyframe requests
+  SEND_PRIORITY_AUDIO,           // Opus frames (small, latency critical)
+  SEND_PRIORITY_VIDEO_RETRANSMIT, // Resent video chunks (repair before new data)
+  SEND_PRIORITY_VIDEO,           // New video chunks (bulk, paced)
+  SEND_PRIORITY_COUNT
+} SendPriority;
+
+// Pacing: pause briefly after this many back-to-back video packets so a
+// large frame does not overflow socket/NIC buffers.
+#define SCHEDULER_VIDEO_BURST 10
+#define SCHEDULER_VIDEO_PAUSE_US 200
+
+// Load shedding: while this many video packets wait, senders skip frames of
+// temporal layer 1 (nothing refers to them), halving the frame rate instead
+// of letting the backlog grow into latency.
+#define SCHEDULER_SHED_BACKLOG 128
+
+// Most datagrams handed to the batch sink at once (packets x destinations)
+#define SCHEDULER_MAX_BATCH 64
+
+typedef struct SchedulerDest {
+  char ip[16];
+  int port;
+} SchedulerDest;
+
+typedef struct SchedulerDatagram {
+  const SchedulerDest *dest;
+  const void *data;
+  size_t size;
+} SchedulerDatagram;
+
+typedef void (*SchedulerSendFn)(void *user_data, const char *dest_ip,
+                                int dest_port, const void *data, size_t size);
+
+// Optional sink that sends several datagrams with one system call
+typedef void (*SchedulerSendBatchFn)(void *user_data,
+                                     const SchedulerDatagram *datagrams,
+                                     int count);
+
+// One payload, queued once and sent to every destination (viewer fan-out)
+typedef struct ScheduledPacket {
+  struct ScheduledPacket *next;
+  int dest_count;
+  SchedulerDest *dests;
+  size_t size;
+  uint8_t *data;
+} ScheduledPacket;
+
+typedef struct SendClass {
+  ScheduledPacket *head;
+  ScheduledPacket *tail;
+  int count;
+} SendClass;
+
+typedef struct SendScheduler {
+  SendClass classes[SEND_PRIORITY_COUNT];
+  OS_Mutex *mutex;
+  OS_Semaphore *sem;
+  OS_Thread *thread;
+  atomic_bool shutdown;
+
+  SchedulerSendFn send_fn;
+  SchedulerSendBatchFn send_batch_fn;
+  void *send_user_data;
+
+  // Stats (sender thread only)
+  uint64_t packets_sent[SEND_PRIORITY_COUNT];
+  int video_burst;
+} SendScheduler;
+
+static void Scheduler_ThreadProc(void *data);
+
+static inline SendScheduler *Scheduler_Create(SchedulerSendFn send_fn,
+                                              void *user_data) {
+  SendScheduler *s = (SendScheduler *)calloc(1, sizeof(SendScheduler));
+  s->mutex = OS_MutexCreate();
+  s->sem = OS_SemaphoreCreate(0);
+  s->send_fn = send_fn;
+  s->send_user_data = user_data;
+  atomic_store(&s->shutdown, false);
+  s->thread = OS_ThreadCreate(Scheduler_ThreadProc, s);
+  return s;
+}
+
+// Sends runs of packets through `fn` (one call per batch) instead of one
+// send_fn call per datagram. Set before the first packet is queued.
+static inline void Scheduler_SetBatchSend(SendScheduler *s,
+                                          SchedulerSendBatchFn fn) {
+  s->send_batch_fn = fn;
+}
+
+// Copies the packet and queues it once for all `dest_count` destinations in
+// class `priority`. A slow or lost destination costs the others nothing: the
+// payload is sent to all of them back to back.
+static inline void Scheduler_EnqueueFanout(SendScheduler *s,
+                                           SendPriority priority,
+                                           const SchedulerDest *dests,
+                                           int dest_count, const void *data,
+                                           size_t size) {
+  if (!s || dest_count <= 0 || atomic_load(&s->shutdown))
+    return;
+
+  size_t dests_size = (size_t)dest_count * sizeof(SchedulerDest);
+  ScheduledPacket *p =
+      (ScheduledPacket *)malloc(sizeof(ScheduledPacket) + dests_size + size);
+  p->next = NULL;
+  p->dest_count = dest_count;
+  p->dests = (SchedulerDest *)(p + 1);
+  p->size = size;
+  p->data = (uint8_t *)p->dests + dests_size;
+  memcpy(p->dests, dests, dests_size);
+  memcpy(p->data, data, size);
+
+  OS_MutexLock(s->mutex);
+  SendClass *c = &s->classes[priority];
+  if (c->tail) {
+    c->tail->next = p;
+    c->tail = p;
+  } else {
+    c->head = c->tail = p;
+  }
+  c->count++;
+  OS_MutexUnlock(s->mutex);
+  OS_SemaphorePost(s->sem);
+}
+
+// Copies the packet and queues it for `dest_ip:dest_port` in class `priority`.
+static inline void Scheduler_Enqueue(SendScheduler *s, SendPriority priority,
+                                     const char *dest_ip, int dest_port,
+                                     const void *data, size_t size) {
+  SchedulerDest dest = {.port = dest_port};
+  strncpy(dest.ip, dest_ip, sizeof(dest.ip) - 1);
+  Scheduler_EnqueueFanout(s, priority, &dest, 1, data, size);
+}
+
+// Video packets (new and resent) waiting to be sent
+static inline int Scheduler_VideoBacklog(SendScheduler *s) {
+  if (!s)
+    return 0;
+  OS_MutexLock(s->mutex);
+  int count = s->classes[SEND_PRIORITY_VIDEO_RETRANSMIT].count +
+              s->classes[SEND_PRIORITY_VIDEO].count;
+  OS_MutexUnlock(s->mutex);
+  return count;
+}
+
+// True if a discardable frame should be dropped rather than queued
+static inline bool Scheduler_ShouldShed(SendScheduler *s) {
+  return Scheduler_VideoBacklog(s) >= SCHEDULER_SHED_BACKLOG;
+}
+
+// Pops the oldest packets of the highest non-empty class: for video up to
+// `max_video` of them, as long as their destinations fit in `max_datagrams`;
+// one packet of any other class, so priorities stay exact. Returns the number
+// popped (linked through ->next).
+static inline int Scheduler_Next(SendScheduler *s, int max_video,
+                                 int max_datagrams, ScheduledPacket **out,
+                                 SendPriority *out_priority) {
+  int n = 0;
+  *out = NULL;
+  OS_MutexLock(s->mutex);
+  for (int i = 0; i < SEND_PRIORITY_COUNT; ++i) {
+    SendClass *c = &s->classes[i];
+    if (!c->head)
+      continue;
+
+    int max_packets = (i >= SEND_PRIORITY_VIDEO_RETRANSMIT) ? max_video : 1;
+    ScheduledPacket **tail = out;
+    int datagrams = 0;
+    while (c->head && n < max_packets &&
+           (n == 0 || datagrams + c->head->dest_count <= max_datagrams)) {
+      ScheduledPacket *p = c->head;
+      c->head = p->next;
+      c->count--;
+      datagrams += p->dest_count;
+      p->next = NULL;
+      *tail = p;
+      tail = &p->next;
+      n++;
+    }
+    if (!c->head)
+      c->tail = NULL;
+    *out_priority = (SendPriority)i;
+    break;
+  }
+  OS_MutexUnlock(s->mutex);
+  return n;
+}
+
+static void Scheduler_SendPackets(SendScheduler *s, ScheduledPacket *packets) {
+  if (!s->send_batch_fn) {
+    for (ScheduledPacket *p = packets; p; p = p->next) {
+      for (int d = 0; d < p->dest_count; ++d)
+        s->send_fn(s->send_user_data, p->dests[d].ip, p->dests[d].port,
+                   p->data, p->size);
+    }
+    return;
+  }
+
+  SchedulerDatagram batch[SCHEDULER_MAX_BATCH];
+  int count = 0;
+  for (ScheduledPacket *p = packets; p; p = p->next) {
+    for (int d = 0; d < p->dest_count; ++d) {
+      if (count == SCHEDULER_MAX_BATCH) {
+        s->send_batch_fn(s->send_user_data, batch, count);
+        count = 0;
+      }
+      batch[count++] = (SchedulerDatagram){&p->dests[d], p->data, p->size};
+    }
+  }
+  if (count > 0)
+    s->send_batch_fn(s->send_user_data, batch, count);
+}
+
+static void Scheduler_ThreadProc(void *data) {
+  SendScheduler *s = (SendScheduler *)data;
+
+  while (true) {
+    OS_SemaphoreWait(s->sem);
+    if (atomic_load(&s->shutdown))
+      break;
+
+    // Video goes out in runs up to the end of the current pacing burst
+    SendPriority priority;
+    ScheduledPacket *packets;
+    int n = Scheduler_Next(s, SCHEDULER_VIDEO_BURST - s->video_burst,
+                           SCHEDULER_MAX_BATCH, &packets, &priority);
+    if (n == 0)
+      continue;
+
+    Scheduler_SendPackets(s, packets);
+    s->packets_sent[priority] += n;
+    while (packets) {
+      ScheduledPacket *next = packets->next;
+      free(packets);
+      packets = next;
+    }
+
+    // Every popped packet had its own semaphore post
+    for (int i = 1; i < n; ++i)
+      OS_SemaphoreWait(s->sem);
+
+    // PACING: only video counts towards a burst; anything more urgent that
+    // arrives during the pause is sent right after it.
+    if (priority >= SEND_PRIORITY_VIDEO_RETRANSMIT) {
+      s->video_burst += n;
+      if (s->video_burst >= SCHEDULER_VIDEO_BURST) {
+        s->video_burst = 0;
+        usleep(SCHEDULER_VIDEO_PAUSE_US);
+      }
+    }
+  }
+}
+
+// Stops the sender thread. Packets still queued are dropped.
+static inline void Scheduler_Destroy(SendScheduler *s) {
+  if (!s)
+    return;
+  atomic_store(&s->shutdown, true);
+  OS_SemaphorePost(s->sem);
+  OS_ThreadJoin(s->thread);
+
+  for (int i = 0; i < SEND_PRIORITY_COUNT; ++i) {
+    ScheduledPacket *p = s->classes[i].head;
+    while (p) {
+      ScheduledPacket *next = p->next;
+      free(p);
+      p = next;
+    }
+  }
+  OS_MutexDestroy(s->mutex);
+  OS_SemaphoreDestroy(s->sem);
+  free(s);
+}
+
+// --- Protocol glue ---
+// SendPacketCallback adapter: Protocol_Send* on a per-stream Packetizer with
+// a SchedulerTarget as user_data queues every chunk on the scheduler, for
+// `dest_ip:dest_port` or, when `dest_count` is set, for all of `dests`.
+typedef struct SchedulerTarget {
+  SendScheduler *scheduler;
+  SendPriority priority;
+  const char *dest_ip;
+  int dest_port;
+  const SchedulerDest *dests;
+  int dest_count;
+} SchedulerTarget;
+
+static void Scheduler_SendPacketCallback(void *user_data, void *packet_data,
+                                         size_t packet_size) {
+  SchedulerTarget *t = (SchedulerTarget *)user_data;
+  if (t->dest_count > 0) {
+    Scheduler_EnqueueFanout(t->scheduler, t->priority, t->dests,
+                            t->dest_count, packet_data, packet_size);
+  } else {
+    Scheduler_Enqueue(t->scheduler, t->priority, t->dest_ip, t->dest_port,
+                      packet_data, packet_size);
+  }
+}
+
+#endif // HARMONY_SEND_SCHEDULER_H
@@ -0,0 +1,138 @@
+#ifndef HARMONY_UNIT_CACHE_H
+#define HARMONY_UNIT_CACHE_H
+
+#include "../memory_arena.h"
+#include "protocol.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Host-side GOP cache: the encoded units (as sent, encrypted if enabled) of
+// one layer since its last keyframe. A late joiner is replayed these instead
+// of waiting for the next IDR. Each unit is kept twice: contiguous, which is
+// packetized again for v1 joiners (no tags, nothing to reuse), and as the v2
+// datagrams first sent, which v2 joiners get byte for byte. Packetizing v2
+// again would reuse the live IVs and Poly1305 nonces over another layout.
+
+#define UNIT_CACHE_SIZE (32 * 1024 * 1024)
+#define UNIT_CACHE_MAX_UNITS 1024
+
+typedef struct CachedUnit {
+  uint32_t frame_id;
+  uint32_t timestamp_us;
+  uint8_t flags;          // PACKET_FLAG_KEYFRAME / PACKET_FLAG_RECOVERY_POINT
+  uint8_t temporal_layer; // 1: nothing refers to it
+  uint32_t offset;
+  uint32_t size;
+  uint32_t datagram_offset; // DatagramLog records of the v2 send
+  uint32_t datagram_size;   // 0: not sent as v2, can't be replayed to v2
+} CachedUnit;
+
+typedef struct UnitCache {
+  bool valid; // Holds every unit since keyframe units[0]
+  uint8_t *data;
+  size_t used;
+  CachedUnit *units;
+  int count;
+} UnitCache;
+
+// Datagrams of one unit as [size LE (2)][datagram] records, captured while
+// they are sent (a SendPacketCallback that passes each one on to `next_fn`)
+#define DATAGRAM_LOG_SIZE                                                      \
+  (REASSEMBLY_BUFFER_SIZE +                                                    \
+   (MAX_FRAME_CHUNKS + 1) * (2 + PROTOCOL_MAX_HEADER_SIZE + AES_TAG_SIZE))
+
+typedef struct DatagramLog {
+  uint8_t *data; // DATAGRAM_LOG_SIZE bytes
+  size_t used;
+  bool overflow; // A datagram didn't fit: the log is incomplete
+  SendPacketCallback next_fn; // NULL: capture only
+  void *next_user;
+} DatagramLog;
+
+static void DatagramLog_SendCallback(void *user_data, void *packet_data,
+                                     size_t packet_size) {
+  DatagramLog *log = (DatagramLog *)user_data;
+  if (log->used + 2 + packet_size <= DATAGRAM_LOG_SIZE) {
+    log->data[log->used] = (uint8_t)packet_size;
+    log->data[log->used + 1] = (uint8_t)(packet_size >> 8);
+    memcpy(log->data + log->used + 2, packet_data, packet_size);
+    log->used += 2 + packet_size;
+  } else {
+    log->overflow = true;
+  }
+  if (log->next_fn)
+    log->next_fn(log->next_user, packet_data, packet_size);
+}
+
+// Sends logged records again, unchanged
+static void DatagramLog_Replay(const uint8_t *records, size_t size,
+                               SendPacketCallback send_fn, void *user_data) {
+  size_t pos = 0;
+  while (pos + 2 <= size) {
+    size_t packet_size = records[pos] | ((size_t)records[pos + 1] << 8);
+    send_fn(user_data, (void *)(records + pos + 2), packet_size);
+    pos += 2 + packet_size;
+  }
+}
+
+static inline void UnitCache_Init(UnitCache *c, MemoryArena *arena) {
+  memset(c, 0, sizeof(*c));
+  c->data = (uint8_t *)ArenaPush(arena, UNIT_CACHE_SIZE);
+  c->units =
+      (CachedUnit *)ArenaPush(arena, UNIT_CACHE_MAX_UNITS * sizeof(CachedUnit));
+}
+
+// Appends a unit and its v2 datagrams (DatagramLog records, may be empty); a
+// keyframe starts a new GOP. Returns false if the GOP no longer fits (e.g. a
+// long intra-refresh cycle): the cache stays empty until the next keyframe
+// and replays in progress must end.
+static bool UnitCache_Add(UnitCache *c, uint32_t frame_id,
+                          uint32_t timestamp_us, uint8_t flags,
+                          uint8_t temporal_layer, const void *data,
+                          size_t size, const void *datagrams,
+                          size_t datagram_size) {
+  if (flags & PACKET_FLAG_KEYFRAME) {
+    c->valid = true;
+    c->used = 0;
+    c->count = 0;
+  }
+  if (!c->valid)
+    return true;
+
+  if (c->count == UNIT_CACHE_MAX_UNITS || c->used + size + datagram_size > UNIT_CACHE_SIZE) {
+    printf("Host: GOP cache full (%d units), waiting for a keyframe\n",
+           c->count);
+    c->valid = false;
+    return false;
+  }
+
+  c->units[c->count] = (CachedUnit){.frame_id = frame_id,
+                                    .timestamp_us = timestamp_us,
+                                    .flags = flags,
+                                    .temporal_layer = temporal_layer,
+                                    .offset = (uint32_t)c->used,
+                                    .size = (uint32_t)size,
+                                    .datagram_offset =
+                                        (uint32_t)(c->used + size),
+                                    .datagram_size = (uint32_t)datagram_size};
+  memcpy(c->data + c->used, data, size);
+  c->used += size;
+  if (datagram_size > 0)
+    memcpy(c->data + c->used, datagrams, datagram_size);
+  c->used += datagram_size;
+  c->count++;
+  return true;
+}
+
+// Index of the first cached unit at or after `frame_id` (count if none). A
+// joiner whose position predates the cached GOP restarts at its keyframe.
+static inline int UnitCache_Find(const UnitCache *c, uint32_t frame_id) {
+  for (int i = 0; i < c->count; ++i) {
+    if ((int32_t)(c->units[i].frame_id - frame_id) >= 0)
+      return i;
+  }
+  return c->count;
+}
+
+#endif // HARMONY_UNIT_CACHE_H
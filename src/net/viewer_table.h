@@ -0,0 +1,298 @@
+#ifndef HARMONY_VIEWER_TABLE_H
+#define HARMONY_VIEWER_TABLE_H
+
+#include "mtu_probe.h"
+#include "protocol.h"
+#include "send_scheduler.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// UDP viewers of one host. Every encoded unit is packetized once per wire
+// version in use and queued once for all viewers speaking it, so an extra
+// viewer costs a few datagrams per chunk instead of a second encode.
+// Viewers are keyed by source address and port (several can sit behind one
+// NAT) and are dropped when their punches stop. With simulcast each viewer
+// watches one layer and moves to another only at that layer's next IDR.
+// On the host a joiner can start from its layer's GOP cache (unit_cache.h)
+// instead of waiting for that IDR.
+
+#ifndef VIEWER_TABLE_MAX
+#define VIEWER_TABLE_MAX 16 // Host: every viewer costs upload bandwidth
+#endif
+#define VIEWER_TIMEOUT 5.0 // Seconds without a punch (viewers punch every 0.5 s)
+
+// Keyframe requests: each viewer is honoured at most once per backoff. A
+// viewer that keeps asking (lossy link) has its backoff doubled, so it cannot
+// turn everyone's stream into back-to-back IDRs; a quiet spell resets it.
+#define VIEWER_KEYFRAME_BACKOFF_MIN 0.5
+#define VIEWER_KEYFRAME_BACKOFF_MAX 8.0
+
+#define VIEWER_ALL_LAYERS -1 // ViewerTable_Groups: audio and control
+
+typedef struct Viewer {
+  bool active;
+  char ip[16];
+  int port;
+  uint8_t wire_version; // From its punch (PROTOCOL_WIRE_V1 / V2)
+  double joined_at;
+  double last_seen;
+
+  // Simulcast
+  uint8_t layer;           // Layer being sent to this viewer
+  uint8_t requested_layer; // From its punches; != layer while switching
+
+  MtuProber mtu; // Path MTU towards this viewer (v2 only)
+
+  uint8_t audio_loss_percent; // From its punches: sets the Opus FEC strength
+
+  // Keyframe-on-demand
+  bool keyframe_needed; // Joined or lost a picture, not served yet
+  double keyframe_backoff;
+  double last_keyframe_served;
+
+  // Host GOP cache replay (unit_cache.h): a joiner gets the units since the
+  // last keyframe, paced, and no live video until it has caught up
+  bool catching_up;
+  uint32_t catchup_next_id; // Next frame ID to replay
+  double catchup_tokens;    // Pacing budget (bytes)
+  double catchup_last_refill;
+
+  // Loss stats
+  uint32_t keyframe_requests; // Each one is a lost picture or reference
+  uint32_t keyframes_served;
+} Viewer;
+
+typedef struct ViewerTable {
+  Viewer viewers[VIEWER_TABLE_MAX];
+  int count;
+  uint16_t chunk_size; // Session chunk size for all viewers (0 = default)
+  int layer_count;     // Simulcast layers the host encodes (0 = 1)
+} ViewerTable;
+
+// All viewers speaking one wire version, as scheduler destinations
+typedef struct ViewerGroup {
+  uint8_t wire_version;
+  int count;
+  SchedulerDest dests[VIEWER_TABLE_MAX];
+} ViewerGroup;
+
+static inline Viewer *ViewerTable_Find(ViewerTable *t, const char *ip,
+                                       int port) {
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    Viewer *v = &t->viewers[i];
+    if (v->active && v->port == port && strcmp(v->ip, ip) == 0)
+      return v;
+  }
+  return NULL;
+}
+
+// One chunk size for everyone, since a unit is packetized once: the smallest
+// path MTU among viewers. v1 viewers cannot be probed and pin the default.
+static inline void ViewerTable_UpdateChunkSize(ViewerTable *t) {
+  uint16_t size = MAX_PACKET_PAYLOAD;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &t->viewers[i];
+    if (!v->active)
+      continue;
+    if (v->wire_version < PROTOCOL_WIRE_V2) {
+      size = MAX_PACKET_PAYLOAD;
+      break;
+    }
+    uint16_t probed = v->mtu.chunk_size ? v->mtu.chunk_size : MAX_PACKET_PAYLOAD;
+    if (probed < size)
+      size = probed;
+  }
+  t->chunk_size = (size == MAX_PACKET_PAYLOAD) ? 0 : size;
+}
+
+// True while every viewer can answer MTU probes (see Net_SetPathMtuProbing)
+static inline bool ViewerTable_CanProbe(const ViewerTable *t) {
+  if (t->count == 0)
+    return false;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &t->viewers[i];
+    if (v->active && v->wire_version < PROTOCOL_WIRE_V2)
+      return false;
+  }
+  return true;
+}
+
+// Adds the sender of a punch or refreshes it. Returns NULL if the table is
+// full; *out_joined is set for a new viewer.
+static Viewer *ViewerTable_OnPunch(ViewerTable *t, const char *ip, int port,
+                                   uint8_t wire_version, double now,
+                                   bool *out_joined) {
+  *out_joined = false;
+  Viewer *v = ViewerTable_Find(t, ip, port);
+  if (!v) {
+    for (int i = 0; i < VIEWER_TABLE_MAX && !v; ++i) {
+      if (!t->viewers[i].active)
+        v = &t->viewers[i];
+    }
+    if (!v)
+      return NULL;
+
+    memset(v, 0, sizeof(*v));
+    v->active = true;
+    strncpy(v->ip, ip, sizeof(v->ip) - 1);
+    v->port = port;
+    v->wire_version = wire_version;
+    v->joined_at = now;
+    v->keyframe_needed = true;
+    v->keyframe_backoff = VIEWER_KEYFRAME_BACKOFF_MIN;
+    if (wire_version >= PROTOCOL_WIRE_V2)
+      MtuProbe_Reset(&v->mtu);
+    t->count++;
+    *out_joined = true;
+  } else if (v->wire_version != wire_version) {
+    // Restarted with a different build: start over on the default size
+    v->wire_version = wire_version;
+    memset(&v->mtu, 0, sizeof(v->mtu));
+    if (wire_version >= PROTOCOL_WIRE_V2)
+      MtuProbe_Reset(&v->mtu);
+  }
+  v->last_seen = now;
+  ViewerTable_UpdateChunkSize(t);
+  return v;
+}
+
+// Drops viewers that stopped punching. Returns how many left.
+static int ViewerTable_Expire(ViewerTable *t, double now) {
+  int removed = 0;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    Viewer *v = &t->viewers[i];
+    if (!v->active || now - v->last_seen < VIEWER_TIMEOUT)
+      continue;
+    printf("Net: Viewer %s:%d timed out (%u keyframe requests in %.0f s)\n",
+           v->ip, v->port, v->keyframe_requests, now - v->joined_at);
+    v->active = false;
+    t->count--;
+    removed++;
+  }
+  if (removed > 0)
+    ViewerTable_UpdateChunkSize(t);
+  return removed;
+}
+
+static inline void ViewerTable_OnKeyframeRequest(Viewer *v) {
+  v->keyframe_requests++;
+  v->keyframe_needed = true;
+}
+
+// Applies the layer a viewer asked for in its punch, clamped to the layers
+// the host encodes. A new viewer starts on it right away (it waits for a
+// keyframe anyway); a watching one needs an IDR of the new layer first.
+static void ViewerTable_RequestLayer(ViewerTable *t, Viewer *v, uint8_t layer,
+                                     bool joined) {
+  int max_layer = (t->layer_count > 1) ? t->layer_count - 1 : 0;
+  if (layer > max_layer)
+    layer = (uint8_t)max_layer;
+  if (joined) {
+    v->layer = v->requested_layer = layer;
+  } else if (layer != v->requested_layer) {
+    v->requested_layer = layer;
+    v->keyframe_needed = (layer != v->layer) || v->keyframe_needed;
+  }
+}
+
+// Worst audio loss any viewer reported, in percent: the audio stream is
+// encoded once for everyone
+static inline uint8_t ViewerTable_AudioLoss(const ViewerTable *t) {
+  uint8_t worst = 0;
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &t->viewers[i];
+    if (v->active && v->audio_loss_percent > worst)
+      worst = v->audio_loss_percent;
+  }
+  return worst;
+}
+
+// True if some viewer of `layer` (or moving to it) needs a keyframe and its
+// backoff allows one now
+static bool ViewerTable_KeyframeDue(const ViewerTable *t, int layer,
+                                    double now) {
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &t->viewers[i];
+    if (v->active && v->requested_layer == layer && v->keyframe_needed &&
+        now - v->last_keyframe_served >= v->keyframe_backoff)
+      return true;
+  }
+  return false;
+}
+
+// True if a viewer waits for an IDR of `layer` to switch to it. Needed even
+// in intra-refresh mode: a new layer means a new resolution.
+static bool ViewerTable_SwitchPending(const ViewerTable *t, int layer) {
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    const Viewer *v = &t->viewers[i];
+    if (v->active && v->requested_layer == layer && v->layer != layer)
+      return true;
+  }
+  return false;
+}
+
+// `layer` produced an IDR: viewers waiting for it switch before it is sent
+// (one still replaying its old layer's cache starts live on the new one)
+static void ViewerTable_OnLayerIDR(ViewerTable *t, int layer) {
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    Viewer *v = &t->viewers[i];
+    if (v->active && v->requested_layer == layer && v->layer != layer) {
+      v->layer = (uint8_t)layer;
+      v->catching_up = false;
+    }
+  }
+}
+
+// A keyframe is being forced on `layer`: it serves every viewer of it waiting
+// for one. Viewers that were served recently asked again, so their backoff
+// doubles.
+static void ViewerTable_OnKeyframeForced(ViewerTable *t, int layer,
+                                         double now) {
+  for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+    Viewer *v = &t->viewers[i];
+    if (!v->active || !v->keyframe_needed || v->requested_layer != layer)
+      continue;
+    if (v->keyframes_served > 0 &&
+        now - v->last_keyframe_served < 2.0 * v->keyframe_backoff) {
+      v->keyframe_backoff *= 2.0;
+      if (v->keyframe_backoff > VIEWER_KEYFRAME_BACKOFF_MAX)
+        v->keyframe_backoff = VIEWER_KEYFRAME_BACKOFF_MAX;
+    } else {
+      v->keyframe_backoff = VIEWER_KEYFRAME_BACKOFF_MIN;
+    }
+    v->keyframe_needed = false;
+    v->last_keyframe_served = now;
+    v->keyframes_served++;
+  }
+}
+
+// Splits the viewers of `layer` (or VIEWER_ALL_LAYERS) by wire version.
+// Viewers replaying a GOP cache are left out of a layer's live video.
+// Returns the number of groups.
+static int ViewerTable_Groups(const ViewerTable *t, int layer,
+                              ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX]) {
+  int n = 0;
+  for (uint8_t version = PROTOCOL_WIRE_V1; version <= PROTOCOL_WIRE_VERSION_MAX;
+       ++version) {
+    ViewerGroup *g = &groups[n];
+    g->wire_version = version;
+    g->count = 0;
+    for (int i = 0; i < VIEWER_TABLE_MAX; ++i) {
+      const Viewer *v = &t->viewers[i];
+      uint8_t vv = v->wire_version < PROTOCOL_WIRE_V1 ? PROTOCOL_WIRE_V1
+                                                      : v->wire_version;
+      if (!v->active || vv != version ||
+          (layer != VIEWER_ALL_LAYERS && (v->layer != layer || v->catching_up)))
+        continue;
+      memcpy(g->dests[g->count].ip, v->ip, sizeof(v->ip));
+      g->dests[g->count].port = v->port;
+      g->count++;
+    }
+    if (g->count > 0)
+      n++;
+  }
+  return n;
+}
+
+#endif // HARMONY_VIEWER_TABLE_H
@@ -0,0 +1,11 @@
+// The web viewer, embedded at build time so the binaries serve it without
+// any files next to them. .incbin paths are relative to the directory gcc
+// runs in: build from the repository root (build.sh does).
+__asm__(".pushsection .rodata\n"
+        ".global web_index_html\n"
+        ".global web_index_html_end\n"
+        ".balign 64\n"
+        "web_index_html:\n"
+        ".incbin \"web/index.html\"\n"
+        "web_index_html_end:\n"
+        ".popsection\n");
@@ -1,32 +1,175 @@
+#define _GNU_SOURCE // memmem, strcasestr, accept4
 #include "websocket.h"
 #include "../os_api.h"
 #include "../memory_arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <stdatomic.h>
 #include <errno.h>
 
-#define MAX_CLIENTS 10
-#define WS_BUFFER_SIZE 4096
+// A small HTTP/1.1 server on one port: it serves the embedded web viewer on
+// / and upgrades /ws to WebSocket, so a browser needs nothing but the URL.
+// It runs on its own thread around one epoll instance: accepts, requests,
+// control frames, timeouts and every socket write happen there.
+// WS_Broadcast frames a message once, appends it to the outbox and returns;
+// the server thread fans it out into per-client queues, so a slow browser
+// never stalls the encoder or the other viewers. The server thread also
+// keeps the video since the last keyframe, so a new client is replayed that
+// and starts on a picture right away instead of waiting for an IDR.
+
+#define WS_MAX_CLIENTS 1024        // Browser viewers (each costs upload bandwidth)
+#define WS_INITIAL_CLIENTS 16      // Client table grows by doubling
+#define WS_MAX_REQUEST 8192        // HTTP request, headers included
+#define WS_MAX_MESSAGE (64 * 1024) // Largest frame accepted from a browser
+#define WS_MAX_FRAME_HEADER 14
+#define WS_HANDSHAKE_TIMEOUT 10.0  // Seconds to send a complete request
+#define WS_PING_INTERVAL 10.0
+#define WS_PING_TIMEOUT 30.0       // Seconds without a byte (pongs included) before dropping
+#define WS_CLOSE_TIMEOUT 2.0       // Seconds to answer our close frame
+#define WS_TICK_MS 250             // Timer resolution of the server thread
+#define WS_EPOLL_EVENTS 64
+#define WS_OUTBOX_MAX 512          // Broadcasts not yet fanned out (server thread stuck)
+#define WS_WRITE_IOV 16            // Queued messages per sendmsg
+#define WS_MAX_PATH 256
+
+// Per-client send queue. Past WS_QUEUE_SHED_BYTES the client stops getting
+// discardable frames; past WS_QUEUE_MAX_BYTES it has fallen behind: queued
+// video that hasn't started going out is dropped and the client skips ahead
+// to the next keyframe (asking the host for one, with backoff). Audio and
+// control frames are kept, so sound keeps playing through a video resync.
+#define WS_QUEUE_MAX_MESSAGES 256
+#define WS_QUEUE_SHED_BYTES (256 * 1024)
+#define WS_QUEUE_MAX_BYTES (2 * 1024 * 1024)
+#define WS_RESYNC_BACKOFF_MIN 0.5
+#define WS_RESYNC_BACKOFF_MAX 8.0
+#define WS_GOP_MAX_BYTES (WS_QUEUE_MAX_BYTES / 2) // Replay leaves room for live frames
+#define WS_STATS_SIZE 14      // WS_CLIENT_STATS payload (longer ones are newer viewers)
+#define WS_STATS_TIMEOUT 5.0  // Seconds a browser's stats count towards WS_GetViewerStats
+
+// Opcodes (RFC 6455 5.2)
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+// Close codes
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG 1009
+
+#define WS_MESSAGE_CONTROL (1 << 7) // Server control frame: never dropped
+
+// One framed message, shared by every client queue it sits in. Reference
+// counts are only touched by the server thread.
+typedef struct WSMessage {
+    struct WSMessage *next; // Outbox link
+    int refs;
+    uint8_t flags; // WS_MESSAGE_*
+    size_t size;
+    uint8_t data[];
+} WSMessage;
+
+typedef enum WSClientState {
+    WS_STATE_HTTP,    // Reading the upgrade request
+    WS_STATE_OPEN,    // Handshake done, receiving broadcasts
+    WS_STATE_CLOSING, // Sent a close frame, waiting for the reply
+} WSClientState;
 
 typedef struct WSClient {
     int sockfd;
-    bool active;
-    bool handshake_complete;
+    char name[24]; // "ip:port" for logs
+    WSClientState state;
+    uint32_t requests; // HTTP requests answered (keep-alive)
+    bool dead; // Reaped at the end of the current server loop iteration
+    bool hangup_after_flush; // Close the socket once the queue is sent
+    bool want_write; // EPOLLOUT registered (kernel buffer was full)
+    double connected_at;
+    double last_heard; // Last byte received
+    double last_ping;
+    double close_sent_at;
+
+    // Received bytes not parsed yet (request, then frames)
+    uint8_t *in;
+    size_t in_used;
+    size_t in_capacity;
+
+    // Send queue (ring); the head may be partly written
+    WSMessage *queue[WS_QUEUE_MAX_MESSAGES];
+    int queue_head;
+    int queue_count;
+    size_t queue_bytes;
+    size_t head_offset;
+
+    // HTTP body still to send after the queue, from the embedded asset
+    const uint8_t *body;
+    size_t body_remaining;
+
+    // Resync: video is skipped until a keyframe
+    bool awaiting_keyframe;
+    bool keyframe_requested;
+    double last_keyframe_request;
+    double keyframe_backoff;
+
+    // Stats
+    uint32_t frames_shed; // Discardable frames not sent
+    uint32_t resyncs;
+    uint32_t decoder_resyncs; // Keyframe requests from the browser
+    WSViewerStats viewer_stats; // Last reported
+    double viewer_stats_at;
 } WSClient;
 
 struct WebSocketContext {
     int server_fd;
-    WSClient clients[MAX_CLIENTS];
+    int epoll_fd;
+    int wake_fd; // eventfd: new broadcasts, WS_Shutdown
+    OS_Thread *thread;
+    atomic_bool running;
+
+    // Outbox (any thread -> server thread)
     OS_Mutex *mutex;
+    WSMessage *outbox_head;
+    WSMessage *outbox_tail;
+    int outbox_count;
+
+    // Server thread only
+    WSClient **clients;
+    int client_count;
+    int client_capacity;
+    bool reap_pending; // Some client is dead
+
+    // GOP cache: the last keyframe and the reference frames since. A GOP
+    // too long to replay into a client queue is dropped.
+    WSMessage *gop[WS_QUEUE_MAX_MESSAGES / 2];
+    int gop_count;
+    size_t gop_bytes;
+
+    atomic_int keyframe_requests; // New or resyncing clients since the last WS_Poll
+
+    // Worst recent browser stats, refreshed every tick (guarded by mutex)
+    WSViewerStats viewer_stats;
+    int viewer_stats_count;
+
+    char web_etag[24]; // Of the embedded viewer, quoted
 };
 
+// Embedded by web_assets.c
+extern const uint8_t web_index_html[];
+extern const uint8_t web_index_html_end[];
+
 // --- Minimal SHA1 Implementation (Public Domain style) ---
 #define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 
@@ -98,194 +241,937 @@ static void base64_encode(const uint8_t *data, size_t len, char *out) {
 
 // --- WebSocket Logic ---
 
-WebSocketContext* WS_Init(MemoryArena *arena, int port) {
-    WebSocketContext *ctx = PushStructZero(arena, WebSocketContext);
-    
-    ctx->server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (ctx->server_fd < 0) {
-        perror("WS_Init: socket");
-        return NULL;
+// --- Framing ---
+
+// Server frame header (never masked). Returns its size.
+static size_t WS_FrameHeader(uint8_t header[10], uint8_t opcode, size_t size) {
+    header[0] = 0x80 | opcode; // FIN
+    if (size < 126) {
+        header[1] = (uint8_t)size;
+        return 2;
+    }
+    if (size < 65536) {
+        header[1] = 126;
+        header[2] = (size >> 8) & 0xFF;
+        header[3] = size & 0xFF;
+        return 4;
     }
+    header[1] = 127;
+    for (int i = 0; i < 8; ++i) header[2 + i] = (uint8_t)((uint64_t)size >> ((7 - i) * 8));
+    return 10;
+}
 
-    int opt = 1;
-    setsockopt(ctx->server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Frames `prefix` + `payload` as one message (refs = 1)
+static WSMessage *WS_CreateMessage(uint8_t opcode, uint8_t flags, const void *prefix, size_t prefix_size,
+                                   const void *payload, size_t payload_size) {
+    uint8_t header[10];
+    size_t header_size = WS_FrameHeader(header, opcode, prefix_size + payload_size);
+    size_t size = header_size + prefix_size + payload_size;
+    WSMessage *m = (WSMessage *)malloc(sizeof(WSMessage) + size);
+    if (!m) return NULL;
+    m->next = NULL;
+    m->refs = 1;
+    m->flags = flags;
+    m->size = size;
+    memcpy(m->data, header, header_size);
+    if (prefix_size) memcpy(m->data + header_size, prefix, prefix_size);
+    if (payload_size) memcpy(m->data + header_size + prefix_size, payload, payload_size);
+    return m;
+}
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+// Unframed bytes (HTTP response headers), refs = 1
+static WSMessage *WS_CreateRaw(const void *data, size_t size) {
+    WSMessage *m = (WSMessage *)malloc(sizeof(WSMessage) + size);
+    if (!m) return NULL;
+    m->next = NULL;
+    m->refs = 1;
+    m->flags = WS_MESSAGE_CONTROL;
+    m->size = size;
+    memcpy(m->data, data, size);
+    return m;
+}
 
-    if (bind(ctx->server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("WS_Init: bind");
-        close(ctx->server_fd);
-        return NULL;
+static void WS_ReleaseMessage(WSMessage *m) {
+    if (m && --m->refs == 0) free(m);
+}
+
+typedef struct WSFrame {
+    bool fin;
+    uint8_t opcode;
+    uint8_t *payload; // Unmasked in place
+    size_t size;
+} WSFrame;
+
+#define WS_FRAME_INVALID -1 // Unmasked, reserved bits, long or fragmented control frame
+#define WS_FRAME_TOO_BIG -2 // Over WS_MAX_MESSAGE
+
+// Parses one client frame at the start of `data`. Returns the bytes it
+// spans, 0 if it has not fully arrived, or WS_FRAME_INVALID/WS_FRAME_TOO_BIG.
+static long WS_ParseFrame(uint8_t *data, size_t size, WSFrame *out) {
+    if (size < 2) return 0;
+    out->fin = (data[0] & 0x80) != 0;
+    out->opcode = data[0] & 0x0F;
+    bool masked = (data[1] & 0x80) != 0;
+    uint64_t length = data[1] & 0x7F;
+    size_t pos = 2;
+    if (length == 126) {
+        if (size < 4) return 0;
+        length = ((uint64_t)data[2] << 8) | data[3];
+        pos = 4;
+    } else if (length == 127) {
+        if (size < 10) return 0;
+        length = 0;
+        for (int i = 0; i < 8; ++i) length = (length << 8) | data[2 + i];
+        pos = 10;
     }
+    if (!masked || (data[0] & 0x70)) return WS_FRAME_INVALID;
+    if ((out->opcode & 0x08) && (!out->fin || length > 125)) return WS_FRAME_INVALID;
+    if (length > WS_MAX_MESSAGE) return WS_FRAME_TOO_BIG;
+    if (size < pos + 4 + length) return 0;
 
-    if (listen(ctx->server_fd, 5) < 0) {
-        perror("WS_Init: listen");
-        close(ctx->server_fd);
-        return NULL;
+    const uint8_t *mask = data + pos;
+    out->payload = data + pos + 4;
+    out->size = (size_t)length;
+    for (size_t i = 0; i < out->size; ++i) out->payload[i] ^= mask[i & 3];
+    return (long)(pos + 4 + length);
+}
+
+// --- Client queues (server thread) ---
+
+static void WS_MarkDead(WebSocketContext *ctx, WSClient *c) {
+    if (c->dead) return;
+    c->dead = true;
+    ctx->reap_pending = true;
+}
+
+static inline WSMessage *WS_QueueAt(WSClient *c, int i) {
+    return c->queue[(c->queue_head + i) % WS_QUEUE_MAX_MESSAGES];
+}
+
+static void WS_QueuePush(WSClient *c, WSMessage *m) {
+    m->refs++;
+    c->queue[(c->queue_head + c->queue_count) % WS_QUEUE_MAX_MESSAGES] = m;
+    c->queue_count++;
+    c->queue_bytes += m->size;
+}
+
+// Drops queued video that hasn't started going out. The head stays if it is
+// partly written: cutting a frame short would corrupt the stream.
+static void WS_DropQueuedVideo(WSClient *c) {
+    int kept = 0;
+    for (int i = 0; i < c->queue_count; ++i) {
+        WSMessage *m = WS_QueueAt(c, i);
+        bool in_flight = (i == 0 && c->head_offset > 0);
+        if ((m->flags & WS_MESSAGE_VIDEO) && !in_flight) {
+            c->queue_bytes -= m->size;
+            WS_ReleaseMessage(m);
+            continue;
+        }
+        c->queue[(c->queue_head + kept) % WS_QUEUE_MAX_MESSAGES] = m;
+        kept++;
     }
+    c->queue_count = kept;
+}
 
-    // Set non-blocking
-    int flags = fcntl(ctx->server_fd, F_GETFL, 0);
-    fcntl(ctx->server_fd, F_SETFL, flags | O_NONBLOCK);
+// Queues a control frame; these are never dropped
+static void WS_QueueControl(WSClient *c, uint8_t opcode, const void *payload, size_t size) {
+    if (c->queue_count == WS_QUEUE_MAX_MESSAGES) WS_DropQueuedVideo(c);
+    if (c->queue_count == WS_QUEUE_MAX_MESSAGES) return;
+    WSMessage *m = WS_CreateMessage(opcode, WS_MESSAGE_CONTROL, NULL, 0, payload, size);
+    if (!m) return;
+    WS_QueuePush(c, m);
+    WS_ReleaseMessage(m);
+}
 
-    ctx->mutex = OS_MutexCreate();
+// Applies the backpressure policy to one broadcast message for one client
+static void WS_Enqueue(WSClient *c, WSMessage *m) {
+    bool video = (m->flags & WS_MESSAGE_VIDEO) != 0;
+    bool keyframe = (m->flags & WS_MESSAGE_KEYFRAME) != 0;
 
-    return ctx;
+    if (video && c->awaiting_keyframe) {
+        if (!keyframe) return;
+        c->awaiting_keyframe = false;
+        c->keyframe_requested = false;
+    }
+
+    bool full = c->queue_count == WS_QUEUE_MAX_MESSAGES || c->queue_bytes >= WS_QUEUE_MAX_BYTES;
+    if (!video) {
+        if (!full) WS_QueuePush(c, m); // Audio: a gap beats a disconnect
+        return;
+    }
+    if ((m->flags & WS_MESSAGE_DISCARDABLE) && c->queue_bytes >= WS_QUEUE_SHED_BYTES) {
+        c->frames_shed++;
+        return;
+    }
+    if (full) {
+        // Fallen behind: whatever is queued would arrive late anyway
+        size_t backlog = c->queue_bytes;
+        WS_DropQueuedVideo(c);
+        if (!keyframe) {
+            c->awaiting_keyframe = true;
+            c->resyncs++;
+            printf("WS: %s fell behind (%zu KB queued), skipping to the next keyframe\n", c->name,
+                   backlog / 1024);
+            return;
+        }
+        if (c->queue_count == WS_QUEUE_MAX_MESSAGES) return;
+    }
+    WS_QueuePush(c, m);
+}
+
+static void WS_SetWantWrite(WebSocketContext *ctx, WSClient *c, bool want) {
+    if (c->want_write == want) return;
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0), .data.ptr = c};
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, c->sockfd, &ev);
+    c->want_write = want;
+}
+
+// Writes as much of the queue (then the HTTP body) as the socket takes.
+// Resumes partly written messages; waits for EPOLLOUT when the kernel buffer
+// is full.
+static void WS_Flush(WebSocketContext *ctx, WSClient *c) {
+    while (!c->dead && (c->queue_count > 0 || c->body_remaining > 0)) {
+        struct iovec iov[WS_WRITE_IOV];
+        int n_iov = 0;
+        size_t expected = 0;
+        for (int i = 0; i < c->queue_count && n_iov < WS_WRITE_IOV; ++i) {
+            WSMessage *m = WS_QueueAt(c, i);
+            size_t offset = (i == 0) ? c->head_offset : 0;
+            iov[n_iov++] = (struct iovec){m->data + offset, m->size - offset};
+            expected += m->size - offset;
+        }
+        // The body follows its headers in the same call, straight from the
+        // binary's mapped pages: no file, no copy into a buffer
+        if (n_iov == c->queue_count && n_iov < WS_WRITE_IOV && c->body_remaining > 0) {
+            iov[n_iov++] = (struct iovec){(void *)c->body, c->body_remaining};
+            expected += c->body_remaining;
+        }
+
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)n_iov};
+        ssize_t n = sendmsg(c->sockfd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            printf("WS: Write error (%s), disconnecting %s\n", strerror(errno), c->name);
+            WS_MarkDead(ctx, c);
+            return;
+        }
+
+        size_t written = (size_t)n;
+        while (written > 0 && c->queue_count > 0) {
+            WSMessage *m = WS_QueueAt(c, 0);
+            size_t left = m->size - c->head_offset;
+            if (written < left) {
+                c->head_offset += written;
+                written = 0;
+                break;
+            }
+            written -= left;
+            c->head_offset = 0;
+            c->queue_head = (c->queue_head + 1) % WS_QUEUE_MAX_MESSAGES;
+            c->queue_count--;
+            c->queue_bytes -= m->size;
+            WS_ReleaseMessage(m);
+        }
+        c->body += written;
+        c->body_remaining -= written;
+        if ((size_t)n < expected) break; // Kernel buffer full
+    }
+
+    bool pending = c->queue_count > 0 || c->body_remaining > 0;
+    WS_SetWantWrite(ctx, c, pending);
+    if (!pending && c->hangup_after_flush) WS_MarkDead(ctx, c);
+}
+
+// Queues HTTP response headers and starts sending them
+static void WS_SendText(WebSocketContext *ctx, WSClient *c, const char *text) {
+    WSMessage *m = WS_CreateRaw(text, strlen(text));
+    if (!m) {
+        WS_MarkDead(ctx, c);
+        return;
+    }
+    WS_QueuePush(c, m);
+    WS_ReleaseMessage(m);
+    WS_Flush(ctx, c);
+}
+
+// Starts the closing handshake; the client is dropped once it answers or
+// after WS_CLOSE_TIMEOUT.
+static void WS_Close(WebSocketContext *ctx, WSClient *c, uint16_t code, double now) {
+    if (c->state != WS_STATE_OPEN) {
+        WS_MarkDead(ctx, c);
+        return;
+    }
+    uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+    WS_QueueControl(c, WS_OP_CLOSE, payload, sizeof(payload));
+    WS_Flush(ctx, c);
+    c->state = WS_STATE_CLOSING;
+    c->close_sent_at = now;
+}
+
+// --- HTTP ---
+
+// Value of header `name` in a NUL-terminated request, copied to `out`.
+// Header names are case-insensitive; leading whitespace is skipped.
+static bool WS_FindHeader(const char *request, const char *name, char *out, size_t out_size) {
+    size_t name_len = strlen(name);
+    const char *line = strstr(request, "\r\n");
+    while (line && line[2] != '\r' && line[2] != '\0') {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (!end) break;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *value = line + name_len + 1;
+            while (value < end && (*value == ' ' || *value == '\t')) value++;
+            size_t len = (size_t)(end - value);
+            while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) len--;
+            if (len >= out_size) return false;
+            memcpy(out, value, len);
+            out[len] = '\0';
+            return true;
+        }
+        line = end;
+    }
+    return false;
 }
 
-static void perform_handshake(int fd, const char *key) {
+// Answers with an empty body and hangs up once it is sent
+static void WS_HttpError(WebSocketContext *ctx, WSClient *c, const char *status, const char *extra_headers) {
+    char response[256];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 %s\r\n"
+             "%s"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n\r\n",
+             status, extra_headers);
+    c->hangup_after_flush = true;
+    WS_SendText(ctx, c, response);
+}
+
+// Serves the embedded viewer. It changes with the binary, so browsers
+// revalidate on every load (no-cache) and get a 304 while the ETag matches.
+static void WS_ServePage(WebSocketContext *ctx, WSClient *c, const char *request, bool head, double now) {
+    char match[64], connection[32];
+    bool not_modified = WS_FindHeader(request, "If-None-Match", match, sizeof(match)) &&
+                        strstr(match, ctx->web_etag) != NULL;
+    bool keep_alive = strstr(request, " HTTP/1.1\r\n") != NULL &&
+                      !(WS_FindHeader(request, "Connection", connection, sizeof(connection)) &&
+                        strcasestr(connection, "close") != NULL);
+    size_t size = (size_t)(web_index_html_end - web_index_html);
+
+    char response[512];
+    if (not_modified) {
+        snprintf(response, sizeof(response),
+                 "HTTP/1.1 304 Not Modified\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "ETag: %s\r\n"
+                 "Connection: %s\r\n\r\n",
+                 ctx->web_etag, keep_alive ? "keep-alive" : "close");
+    } else {
+        snprintf(response, sizeof(response),
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/html; charset=utf-8\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "ETag: %s\r\n"
+                 "Connection: %s\r\n\r\n",
+                 size, ctx->web_etag, keep_alive ? "keep-alive" : "close");
+        if (!head) {
+            c->body = web_index_html;
+            c->body_remaining = size;
+        }
+    }
+
+    c->requests++;
+    c->connected_at = now; // Restarts the timeout: idle keep-alive connections are dropped
+    c->hangup_after_flush = !keep_alive;
+    WS_SendText(ctx, c, response);
+}
+
+// Answers one complete request (NUL-terminated, blank line included):
+// WebSocket upgrades on /ws (on any path for pages that predate it), the
+// viewer on / and /index.html
+static void WS_HandleRequest(WebSocketContext *ctx, WSClient *c, char *request, double now) {
+    char method[8], path[WS_MAX_PATH], upgrade[32], key[64], version[8];
+    if (sscanf(request, "%7s %255s", method, path) != 2) {
+        WS_HttpError(ctx, c, "400 Bad Request", "");
+        return;
+    }
+    bool head = strcmp(method, "HEAD") == 0;
+    if (strcmp(method, "GET") != 0 && !head) {
+        WS_HttpError(ctx, c, "405 Method Not Allowed", "Allow: GET, HEAD\r\n");
+        return;
+    }
+    char *query = strchr(path, '?');
+    if (query) *query = '\0';
+
+    bool upgrading = WS_FindHeader(request, "Upgrade", upgrade, sizeof(upgrade)) &&
+                     strcasestr(upgrade, "websocket") != NULL;
+    if (!upgrading) {
+        if (strcmp(path, "/") == 0 || strcmp(path, "/index.html") == 0) {
+            WS_ServePage(ctx, c, request, head, now);
+        } else if (strcmp(path, "/ws") == 0) {
+            WS_HttpError(ctx, c, "400 Bad Request", "");
+        } else {
+            WS_HttpError(ctx, c, "404 Not Found", "");
+        }
+        return;
+    }
+    if (!WS_FindHeader(request, "Sec-WebSocket-Key", key, sizeof(key))) {
+        WS_HttpError(ctx, c, "400 Bad Request", "");
+        return;
+    }
+    if (WS_FindHeader(request, "Sec-WebSocket-Version", version, sizeof(version)) &&
+        strcmp(version, "13") != 0) {
+        WS_HttpError(ctx, c, "426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+        return;
+    }
+
     char combined[128];
     snprintf(combined, sizeof(combined), "%s258EAFA5-E914-47DA-95CA-C5AB0DC85B11", key);
-    
     uint8_t hash[20];
-    sha1((uint8_t*)combined, strlen(combined), hash);
-    
+    sha1((uint8_t *)combined, strlen(combined), hash);
     char encoded[32];
     base64_encode(hash, 20, encoded);
-    
-    char response[512];
+
+    char response[256];
     snprintf(response, sizeof(response),
              "HTTP/1.1 101 Switching Protocols\r\n"
              "Upgrade: websocket\r\n"
              "Connection: Upgrade\r\n"
              "Sec-WebSocket-Accept: %s\r\n\r\n",
              encoded);
-             
-    send(fd, response, strlen(response), 0);
+    WS_SendText(ctx, c, response);
+    if (c->dead) return;
+
+    // A new viewer can only start decoding at a keyframe: the cached one if
+    // there is one, else the host is asked for an IDR
+    c->state = WS_STATE_OPEN;
+    c->last_ping = now;
+    c->awaiting_keyframe = true;
+    c->last_keyframe_request = now;
+    c->keyframe_backoff = WS_RESYNC_BACKOFF_MIN;
+    for (int i = 0; i < ctx->gop_count; ++i) WS_Enqueue(c, ctx->gop[i]);
+    if (c->awaiting_keyframe) {
+        c->keyframe_requested = true;
+        atomic_fetch_add(&ctx->keyframe_requests, 1);
+    }
+    printf("WS: Handshake complete %s (%d connected%s)\n", c->name, ctx->client_count,
+           ctx->gop_count > 0 ? ", replaying cached GOP" : "");
+    WS_Flush(ctx, c);
 }
 
-void WS_Poll(WebSocketContext *ctx) {
-    if (!ctx) return;
+// --- Server thread ---
 
-    OS_MutexLock(ctx->mutex);
+// Makes room for `extra` more bytes in the client's input, up to `limit`
+static bool WS_Reserve(WSClient *c, size_t extra, size_t limit) {
+    size_t needed = c->in_used + extra;
+    if (needed > limit) return false;
+    if (needed <= c->in_capacity) return true;
+    size_t capacity = c->in_capacity ? c->in_capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > limit) capacity = limit;
+    uint8_t *in = (uint8_t *)realloc(c->in, capacity);
+    if (!in) return false;
+    c->in = in;
+    c->in_capacity = capacity;
+    return true;
+}
 
-    // Accept new connections
-    int new_fd = accept(ctx->server_fd, NULL, NULL);
-    if (new_fd >= 0) {
-        int flags = fcntl(new_fd, F_GETFL, 0);
-        fcntl(new_fd, F_SETFL, flags | O_NONBLOCK);
-        
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!ctx->clients[i].active) {
-                ctx->clients[i].sockfd = new_fd;
-                ctx->clients[i].active = true;
-                ctx->clients[i].handshake_complete = false;
-                
-                // Increase send buffer for video frames (e.g. 1MB)
-                int sndbuf = 1024 * 1024;
-                setsockopt(new_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
-                
-                printf("WS: New connection [%d]\n", i);
-                break;
+// A message from the web viewer (see WS_CLIENT_*)
+static void WS_HandleMessage(WSClient *c, const uint8_t *data, size_t size, double now) {
+    if (size == 0) return;
+    switch (data[0]) {
+    case WS_CLIENT_KEYFRAME_REQUEST:
+        // Its decoder is behind and drops deltas until a keyframe: sending
+        // them anyway only delays that keyframe. One already queued will do.
+        if (c->awaiting_keyframe) break;
+        for (int i = 0; i < c->queue_count; ++i) {
+            if (WS_QueueAt(c, i)->flags & WS_MESSAGE_KEYFRAME) return;
+        }
+        WS_DropQueuedVideo(c);
+        c->awaiting_keyframe = true;
+        c->decoder_resyncs++;
+        printf("WS: %s decoder fell behind, skipping to the next keyframe\n", c->name);
+        break;
+    case WS_CLIENT_STATS: {
+        if (size < 1 + WS_STATS_SIZE) break;
+        const uint8_t *p = data + 1;
+        c->viewer_stats = (WSViewerStats){
+            .fps = ((p[0] << 8) | p[1]) / 10.0f,
+            .decode_ms = ((p[2] << 8) | p[3]) / 10.0f,
+            .decode_queue = (p[4] << 8) | p[5],
+            .latency_ms = (p[6] << 8) | p[7],
+            .audio_buffer_ms = (p[8] << 8) | p[9],
+            .frames_dropped = ((uint32_t)p[10] << 24) | ((uint32_t)p[11] << 16) | ((uint32_t)p[12] << 8) | p[13],
+        };
+        c->viewer_stats_at = now;
+        break;
+    }
+    default:
+        break; // From a newer viewer
+    }
+}
+
+// Handles every complete request or frame at the front of the input
+static void WS_ProcessInput(WebSocketContext *ctx, WSClient *c, double now) {
+    size_t consumed = 0;
+    while (!c->dead && consumed < c->in_used) {
+        uint8_t *data = c->in + consumed;
+        size_t size = c->in_used - consumed;
+
+        if (c->state == WS_STATE_HTTP) {
+            // One response at a time: the next request waits for this one
+            if (c->queue_count > 0 || c->body_remaining > 0) break;
+            // The request may arrive in any number of pieces
+            uint8_t *end = memmem(data, size, "\r\n\r\n", 4);
+            if (!end) break;
+            end[2] = '\0'; // Keeps the "\r\n" ending the last header
+            WS_HandleRequest(ctx, c, (char *)data, now);
+            consumed += (size_t)(end - data) + 4;
+            continue;
+        }
+
+        WSFrame frame;
+        long n = WS_ParseFrame(data, size, &frame);
+        if (n == 0) break;
+        if (n < 0) {
+            WS_Close(ctx, c, n == WS_FRAME_TOO_BIG ? WS_CLOSE_TOO_BIG : WS_CLOSE_PROTOCOL_ERROR, now);
+            c->hangup_after_flush = true; // Can't resync the stream after a bad frame
+            WS_Flush(ctx, c);
+            break;
+        }
+        consumed += (size_t)n;
+
+        switch (frame.opcode) {
+        case WS_OP_PING:
+            WS_QueueControl(c, WS_OP_PONG, frame.payload, frame.size);
+            WS_Flush(ctx, c);
+            break;
+        case WS_OP_PONG:
+            break; // last_heard is all a pong is for
+        case WS_OP_CLOSE:
+            if (c->state == WS_STATE_OPEN) {
+                // Echo the status code, then hang up
+                WS_QueueControl(c, WS_OP_CLOSE, frame.payload, frame.size >= 2 ? 2 : 0);
+                printf("WS: %s closed the connection\n", c->name);
             }
+            c->state = WS_STATE_CLOSING;
+            c->hangup_after_flush = true;
+            WS_Flush(ctx, c);
+            break;
+        case WS_OP_BINARY:
+            // The viewer's messages are a few bytes: never fragmented
+            if (frame.fin && c->state == WS_STATE_OPEN) WS_HandleMessage(c, frame.payload, frame.size, now);
+            break;
+        case WS_OP_CONTINUATION:
+        case WS_OP_TEXT:
+            break;
+        default:
+            WS_Close(ctx, c, WS_CLOSE_PROTOCOL_ERROR, now);
+            break;
         }
     }
 
-    // Process clients
-    uint8_t buffer[WS_BUFFER_SIZE];
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!ctx->clients[i].active) continue;
-        
-        ssize_t n = recv(ctx->clients[i].sockfd, buffer, sizeof(buffer) - 1, 0);
+    if (consumed > 0) {
+        memmove(c->in, c->in + consumed, c->in_used - consumed);
+        c->in_used -= consumed;
+    }
+}
+
+static void WS_ReadClient(WebSocketContext *ctx, WSClient *c, double now) {
+    size_t limit = (c->state == WS_STATE_HTTP) ? WS_MAX_REQUEST : WS_MAX_MESSAGE + WS_MAX_FRAME_HEADER;
+    while (!c->dead && !c->hangup_after_flush) {
+        if (!WS_Reserve(c, 1024, limit) && !WS_Reserve(c, 1, limit)) {
+            // Full buffer without a complete request/frame
+            WS_ProcessInput(ctx, c, now);
+            if (c->in_used >= limit) {
+                if (c->state == WS_STATE_HTTP) {
+                    WS_HttpError(ctx, c, "431 Request Header Fields Too Large", "");
+                } else {
+                    WS_Close(ctx, c, WS_CLOSE_TOO_BIG, now);
+                    WS_MarkDead(ctx, c);
+                }
+            }
+            continue;
+        }
+        ssize_t n = recv(c->sockfd, c->in + c->in_used, c->in_capacity - c->in_used, 0);
         if (n > 0) {
-            if (!ctx->clients[i].handshake_complete) {
-                buffer[n] = '\0';
-                char *key_start = strstr((char*)buffer, "Sec-WebSocket-Key: ");
-                if (key_start) {
-                    key_start += 19;
-                    char *key_end = strstr(key_start, "\r\n");
-                    if (key_end) {
-                        *key_end = '\0';
-                        perform_handshake(ctx->clients[i].sockfd, key_start);
-                        ctx->clients[i].handshake_complete = true;
-                        printf("WS: Handshake complete [%d]\n", i);
-                    }
+            c->in_used += (size_t)n;
+            c->last_heard = now;
+            WS_ProcessInput(ctx, c, now);
+        } else if (n == 0) {
+            WS_MarkDead(ctx, c);
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) WS_MarkDead(ctx, c);
+            if (errno != EINTR) break;
+        }
+    }
+}
+
+static void WS_Accept(WebSocketContext *ctx, double now) {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(ctx->server_fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("WS: accept");
+            return;
+        }
+
+        if (ctx->client_count >= WS_MAX_CLIENTS) {
+            static double last_full_log = 0;
+            if (now - last_full_log >= 5.0) {
+                printf("WS: %d clients connected, refusing more\n", ctx->client_count);
+                last_full_log = now;
+            }
+            close(fd);
+            continue;
+        }
+        if (ctx->client_count == ctx->client_capacity) {
+            int capacity = ctx->client_capacity ? ctx->client_capacity * 2 : WS_INITIAL_CLIENTS;
+            WSClient **clients = (WSClient **)realloc(ctx->clients, (size_t)capacity * sizeof(WSClient *));
+            if (!clients) {
+                close(fd);
+                continue;
+            }
+            ctx->clients = clients;
+            ctx->client_capacity = capacity;
+        }
+
+        WSClient *c = (WSClient *)calloc(1, sizeof(WSClient));
+        c->sockfd = fd;
+        c->state = WS_STATE_HTTP;
+        c->connected_at = c->last_heard = now;
+        char ip[16];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        snprintf(c->name, sizeof(c->name), "%s:%d", ip, ntohs(addr.sin_port));
+
+        // Room for a couple of video frames; frames go out as soon as written
+        int sndbuf = 1024 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = c};
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("WS: epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+        ctx->clients[ctx->client_count++] = c;
+        printf("WS: New connection from %s\n", c->name);
+    }
+}
+
+static void WS_ClearGop(WebSocketContext *ctx) {
+    for (int i = 0; i < ctx->gop_count; ++i) WS_ReleaseMessage(ctx->gop[i]);
+    ctx->gop_count = 0;
+    ctx->gop_bytes = 0;
+}
+
+// Keeps what a new client needs to start decoding: discardable frames and
+// audio are left out
+static void WS_CacheVideo(WebSocketContext *ctx, WSMessage *m) {
+    if (!(m->flags & WS_MESSAGE_VIDEO) || (m->flags & WS_MESSAGE_DISCARDABLE)) return;
+    if (m->flags & WS_MESSAGE_KEYFRAME) {
+        WS_ClearGop(ctx);
+    } else if (ctx->gop_count == 0) {
+        return; // Waiting for a keyframe
+    }
+    if (ctx->gop_count == WS_QUEUE_MAX_MESSAGES / 2 || ctx->gop_bytes + m->size > WS_GOP_MAX_BYTES) {
+        WS_ClearGop(ctx); // Too long to replay: new clients wait for an IDR
+        return;
+    }
+    m->refs++;
+    ctx->gop[ctx->gop_count++] = m;
+    ctx->gop_bytes += m->size;
+}
+
+// Takes every pending broadcast and queues it for each open client
+static void WS_DrainOutbox(WebSocketContext *ctx) {
+    OS_MutexLock(ctx->mutex);
+    WSMessage *m = ctx->outbox_head;
+    ctx->outbox_head = ctx->outbox_tail = NULL;
+    ctx->outbox_count = 0;
+    OS_MutexUnlock(ctx->mutex);
+
+    if (!m) return;
+    while (m) {
+        WSMessage *next = m->next;
+        for (int i = 0; i < ctx->client_count; ++i) {
+            WSClient *c = ctx->clients[i];
+            if (c->state == WS_STATE_OPEN && !c->dead) WS_Enqueue(c, m);
+        }
+        WS_CacheVideo(ctx, m);
+        WS_ReleaseMessage(m);
+        m = next;
+    }
+    for (int i = 0; i < ctx->client_count; ++i) {
+        WSClient *c = ctx->clients[i];
+        if (c->queue_count > 0 && !c->want_write) WS_Flush(ctx, c);
+    }
+}
+
+// Handshake and ping timeouts, keepalive pings, keyframe requests for
+// resyncing clients and the viewer stats summary, then frees dead clients
+static void WS_Tick(WebSocketContext *ctx, double now) {
+    WSViewerStats worst = {0};
+    int reporting = 0;
+    for (int i = 0; i < ctx->client_count; ++i) {
+        WSClient *c = ctx->clients[i];
+        if (c->dead) continue;
+        if (c->state == WS_STATE_OPEN && c->viewer_stats_at > 0 && now - c->viewer_stats_at < WS_STATS_TIMEOUT) {
+            const WSViewerStats *s = &c->viewer_stats;
+            if (reporting == 0 || s->fps < worst.fps) worst.fps = s->fps;
+            if (s->decode_ms > worst.decode_ms) worst.decode_ms = s->decode_ms;
+            if (s->decode_queue > worst.decode_queue) worst.decode_queue = s->decode_queue;
+            if (s->latency_ms > worst.latency_ms) worst.latency_ms = s->latency_ms;
+            if (s->audio_buffer_ms > worst.audio_buffer_ms) worst.audio_buffer_ms = s->audio_buffer_ms;
+            worst.frames_dropped += s->frames_dropped;
+            reporting++;
+        }
+        if (c->state == WS_STATE_HTTP && now - c->connected_at >= WS_HANDSHAKE_TIMEOUT) {
+            if (c->requests == 0) printf("WS: %s sent no complete request, dropping\n", c->name);
+            WS_MarkDead(ctx, c);
+        } else if (c->state == WS_STATE_CLOSING && now - c->close_sent_at >= WS_CLOSE_TIMEOUT) {
+            WS_MarkDead(ctx, c);
+        } else if (c->state == WS_STATE_OPEN) {
+            if (now - c->last_heard >= WS_PING_TIMEOUT) {
+                printf("WS: %s silent for %.0f s, dropping\n", c->name, now - c->last_heard);
+                WS_MarkDead(ctx, c);
+                continue;
+            }
+            if (now - c->last_ping >= WS_PING_INTERVAL) {
+                WS_QueueControl(c, WS_OP_PING, NULL, 0);
+                WS_Flush(ctx, c);
+                c->last_ping = now;
+            }
+            // A client that keeps falling behind has its requests spaced out,
+            // so it can't turn everyone's stream into back-to-back IDRs
+            if (c->awaiting_keyframe && !c->keyframe_requested &&
+                now - c->last_keyframe_request >= c->keyframe_backoff) {
+                if (now - c->last_keyframe_request < 2.0 * c->keyframe_backoff) {
+                    c->keyframe_backoff *= 2.0;
+                    if (c->keyframe_backoff > WS_RESYNC_BACKOFF_MAX) c->keyframe_backoff = WS_RESYNC_BACKOFF_MAX;
+                } else {
+                    c->keyframe_backoff = WS_RESYNC_BACKOFF_MIN;
                 }
+                c->keyframe_requested = true;
+                c->last_keyframe_request = now;
+                atomic_fetch_add(&ctx->keyframe_requests, 1);
+            }
+        }
+    }
+
+    OS_MutexLock(ctx->mutex);
+    ctx->viewer_stats = worst;
+    ctx->viewer_stats_count = reporting;
+    OS_MutexUnlock(ctx->mutex);
+
+    if (!ctx->reap_pending) return;
+    ctx->reap_pending = false;
+    for (int i = 0; i < ctx->client_count;) {
+        WSClient *c = ctx->clients[i];
+        if (!c->dead) {
+            i++;
+            continue;
+        }
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, c->sockfd, NULL);
+        close(c->sockfd);
+        ctx->clients[i] = ctx->clients[--ctx->client_count];
+        printf("WS: Client %s disconnected (%d connected, %u resyncs, %u decoder resyncs, %u frames shed)\n",
+               c->name, ctx->client_count, c->resyncs, c->decoder_resyncs, c->frames_shed);
+        for (int q = 0; q < c->queue_count; ++q) WS_ReleaseMessage(WS_QueueAt(c, q));
+        free(c->in);
+        free(c);
+    }
+}
+
+static void WS_ThreadProc(void *data) {
+    WebSocketContext *ctx = (WebSocketContext *)data;
+    struct epoll_event events[WS_EPOLL_EVENTS];
+    double last_tick = 0.0;
+
+    while (atomic_load(&ctx->running)) {
+        int n = epoll_wait(ctx->epoll_fd, events, WS_EPOLL_EVENTS, WS_TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("WS: epoll_wait");
+            break;
+        }
+        double now = OS_GetTime();
+
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == ctx) {
+                WS_Accept(ctx, now);
+            } else if (ptr == &ctx->wake_fd) {
+                uint64_t value;
+                (void)!read(ctx->wake_fd, &value, sizeof(value));
             } else {
-                // Handle control frames if needed (e.g. close)
-                // Minimal: ignore incoming data for now
+                WSClient *c = (WSClient *)ptr;
+                if (events[i].events & EPOLLIN) WS_ReadClient(ctx, c, now);
+                if (events[i].events & EPOLLOUT) {
+                    WS_Flush(ctx, c);
+                    // A pipelined request waited for the previous response
+                    if (c->state == WS_STATE_HTTP && c->in_used > 0) WS_ProcessInput(ctx, c, now);
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) WS_MarkDead(ctx, c);
             }
-        } else if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-            close(ctx->clients[i].sockfd);
-            ctx->clients[i].active = false;
-            printf("WS: Client disconnected [%d]\n", i);
         }
+        WS_DrainOutbox(ctx);
+
+        // Dead clients are freed right away; timers run every tick
+        if (ctx->reap_pending || now - last_tick >= WS_TICK_MS / 1000.0) {
+            WS_Tick(ctx, now);
+            last_tick = now;
+        }
+    }
+}
+
+WebSocketContext* WS_Init(MemoryArena *arena, int port) {
+    WebSocketContext *ctx = PushStructZero(arena, WebSocketContext);
+    ctx->epoll_fd = ctx->wake_fd = -1;
+
+    ctx->server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctx->server_fd < 0) {
+        perror("WS_Init: socket");
+        return NULL;
+    }
+
+    int opt = 1;
+    setsockopt(ctx->server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(ctx->server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("WS_Init: bind");
+        close(ctx->server_fd);
+        return NULL;
+    }
+
+    if (listen(ctx->server_fd, SOMAXCONN) < 0) {
+        perror("WS_Init: listen");
+        close(ctx->server_fd);
+        return NULL;
     }
+
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = ctx};
+    struct epoll_event wake_ev = {.events = EPOLLIN, .data.ptr = &ctx->wake_fd};
+    if (ctx->epoll_fd < 0 || ctx->wake_fd < 0 ||
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->server_fd, &listen_ev) < 0 ||
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->wake_fd, &wake_ev) < 0) {
+        perror("WS_Init: epoll");
+        if (ctx->epoll_fd >= 0) close(ctx->epoll_fd);
+        if (ctx->wake_fd >= 0) close(ctx->wake_fd);
+        close(ctx->server_fd);
+        return NULL;
+    }
+
+    uint8_t hash[20];
+    sha1(web_index_html, (size_t)(web_index_html_end - web_index_html), hash);
+    snprintf(ctx->web_etag, sizeof(ctx->web_etag), "\"%02x%02x%02x%02x%02x%02x%02x%02x\"", hash[0], hash[1],
+             hash[2], hash[3], hash[4], hash[5], hash[6], hash[7]);
+
+    ctx->mutex = OS_MutexCreate();
+    atomic_store(&ctx->running, true);
+    ctx->thread = OS_ThreadCreate(WS_ThreadProc, ctx);
+
+    return ctx;
+}
+
+int WS_Poll(WebSocketContext *ctx) {
+    if (!ctx) return 0;
+    return atomic_exchange(&ctx->keyframe_requests, 0);
+}
+
+int WS_GetViewerStats(WebSocketContext *ctx, WSViewerStats *out) {
+    if (!ctx) return 0;
+    OS_MutexLock(ctx->mutex);
+    int count = ctx->viewer_stats_count;
+    if (count > 0) *out = ctx->viewer_stats;
     OS_MutexUnlock(ctx->mutex);
+    return count;
 }
 
-void WS_Broadcast(WebSocketContext *ctx, uint8_t type, uint32_t frame_id, const void *data, size_t size) {
+void WS_Broadcast(WebSocketContext *ctx, uint8_t type, uint32_t frame_id, uint8_t flags, const void *data, size_t size) {
     if (!ctx) return;
-    
+
+    // Binary frame: [frame_id BE (4)][type (1)][data], framed once for all
+    uint8_t prefix[5] = {(uint8_t)(frame_id >> 24), (uint8_t)(frame_id >> 16), (uint8_t)(frame_id >> 8),
+                         (uint8_t)frame_id, type};
+    WSMessage *m = WS_CreateMessage(WS_OP_BINARY, flags & ~WS_MESSAGE_CONTROL, prefix, sizeof(prefix), data, size);
+    if (!m) return;
+
     OS_MutexLock(ctx->mutex);
-    
-    // Construct WebSocket Frame
-    // FIN=1, Opcode=2 (Binary)
-    uint8_t header[10];
-    int header_len = 2;
-    size_t total_payload_size = size + 4 + 1; // Data + 4 byte frame_id + 1 byte type
-    
-    header[0] = 0x82; 
-    
-    if (total_payload_size < 126) {
-        header[1] = (uint8_t)total_payload_size;
-    } else if (total_payload_size < 65536) {
-        header[1] = 126;
-        header[2] = (total_payload_size >> 8) & 0xFF;
-        header[3] = total_payload_size & 0xFF;
-        header_len = 4;
-    } else {
-        header[1] = 127;
-        header[2] = 0; header[3] = 0; header[4] = 0; header[5] = 0;
-        header[6] = (total_payload_size >> 24) & 0xFF;
-        header[7] = (total_payload_size >> 16) & 0xFF;
-        header[8] = (total_payload_size >> 8) & 0xFF;
-        header[9] = total_payload_size & 0xFF;
-        header_len = 10;
-    }
-
-    // Convert frame_id to net byte order
-    uint32_t net_frame_id = htonl(frame_id);
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ctx->clients[i].active && ctx->clients[i].handshake_complete) {
-            struct iovec iov[4];
-            iov[0].iov_base = header;
-            iov[0].iov_len = header_len;
-            iov[1].iov_base = &net_frame_id;
-            iov[1].iov_len = 4;
-            iov[2].iov_base = &type;
-            iov[2].iov_len = 1;
-            iov[3].iov_base = (void*)data;
-            iov[3].iov_len = size;
-
-            ssize_t total_expected = header_len + 4 + 1 + size;
-            ssize_t n = writev(ctx->clients[i].sockfd, iov, 4);
-            
-            if (n < total_expected) {
-                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                    printf("WS: Send buffer full, disconnecting client [%d]\n", i);
-                } else {
-                    printf("WS: Write error or partial write (%zd/%zd), disconnecting [%d]\n", n, total_expected, i);
-                }
-                close(ctx->clients[i].sockfd);
-                ctx->clients[i].active = false;
-            }
+    bool dropped = ctx->outbox_count >= WS_OUTBOX_MAX;
+    bool wake = !dropped && ctx->outbox_count == 0;
+    if (!dropped) {
+        if (ctx->outbox_tail) {
+            ctx->outbox_tail->next = m;
+        } else {
+            ctx->outbox_head = m;
         }
+        ctx->outbox_tail = m;
+        ctx->outbox_count++;
     }
     OS_MutexUnlock(ctx->mutex);
+
+    if (dropped) {
+        free(m);
+        static double last_drop_log = 0;
+        double now = OS_GetTime();
+        if (now - last_drop_log >= 5.0) {
+            printf("WS: Server thread behind, dropping broadcasts\n");
+            last_drop_log = now;
+        }
+    } else if (wake) {
+        uint64_t one = 1;
+        (void)!write(ctx->wake_fd, &one, sizeof(one));
+    }
 }
 
 void WS_Shutdown(WebSocketContext *ctx) {
     if (!ctx) return;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ctx->clients[i].active) {
-            close(ctx->clients[i].sockfd);
-        }
+    atomic_store(&ctx->running, false);
+    uint64_t one = 1;
+    (void)!write(ctx->wake_fd, &one, sizeof(one));
+    OS_ThreadJoin(ctx->thread);
+
+    // Best effort goodbye: queued media is dropped, a partly sent frame
+    // can't be followed by anything
+    double now = OS_GetTime();
+    for (int i = 0; i < ctx->client_count; i++) {
+        WSClient *c = ctx->clients[i];
+        WS_DropQueuedVideo(c);
+        if (c->state == WS_STATE_OPEN && c->head_offset == 0) WS_Close(ctx, c, WS_CLOSE_GOING_AWAY, now);
+        close(c->sockfd);
+        for (int q = 0; q < c->queue_count; ++q) WS_ReleaseMessage(WS_QueueAt(c, q));
+        free(c->in);
+        free(c);
     }
+    free(ctx->clients);
+    ctx->clients = NULL;
+    ctx->client_count = 0;
+
+    WSMessage *m = ctx->outbox_head;
+    while (m) {
+        WSMessage *next = m->next;
+        free(m);
+        m = next;
+    }
+    ctx->outbox_head = ctx->outbox_tail = NULL;
+    WS_ClearGop(ctx);
+
+    close(ctx->epoll_fd);
+    close(ctx->wake_fd);
     if (ctx->server_fd >= 0) close(ctx->server_fd);
     OS_MutexDestroy(ctx->mutex);
 }
@@ -7,17 +7,52 @@
 
 typedef struct WebSocketContext WebSocketContext;
 
-// Initialize WebSocket server on specified port
+// Initialize the viewer server on specified port: the embedded web viewer
+// on /, its WebSocket stream on /ws. Connections, requests, pings and
+// closes are handled on a server thread started here.
 WebSocketContext* WS_Init(MemoryArena *arena, int port);
 
-// Broadcast binary data to all connected clients
-void WS_Broadcast(WebSocketContext *ctx, uint8_t type, uint32_t frame_id, const void *data, size_t size);
+// WS_Broadcast flags: what a client that falls behind may skip
+#define WS_MESSAGE_VIDEO (1 << 0)       // Video (anything else is kept while possible)
+#define WS_MESSAGE_KEYFRAME (1 << 1)    // A decoder can start here
+#define WS_MESSAGE_DISCARDABLE (1 << 2) // Nothing references it (temporal layer 1)
 
-// Poll for new connections and handle incoming control frames (ping/close)
-// Should be called every frame
-void WS_Poll(WebSocketContext *ctx);
+// Broadcast binary data to all connected clients (any thread). Only copies
+// the message into the server thread's outbox: never blocks on a socket.
+// Each client has a bounded send queue; one that falls behind loses
+// discardable frames first, then skips ahead to the next keyframe.
+void WS_Broadcast(WebSocketContext *ctx, uint8_t type, uint32_t frame_id, uint8_t flags, const void *data, size_t size);
 
-// Cleanup
+// Returns the number of keyframes wanted since the last call: clients that
+// completed their handshake while no keyframe was cached, or are resyncing
+// after falling behind or after their decoder did (with backoff). A client
+// joining mid-GOP is replayed the cached keyframe and the reference frames
+// since instead. Does no I/O, so it can be called from any loop at any rate.
+int WS_Poll(WebSocketContext *ctx);
+
+// Messages from browsers, binary: [type (1)][payload]. Types are numbered
+// like PACKET_TYPE_* (protocol.h).
+#define WS_CLIENT_KEYFRAME_REQUEST 5 // Decoder fell behind or lost its picture
+#define WS_CLIENT_STATS 8            // Playback stats, about once a second
+
+// Playback stats reported by the web viewer. On the wire (big-endian):
+// [fps x10 (2)][decode ms x10 (2)][decode queue (2)][latency ms (2)]
+// [audio buffer ms (2)][frames dropped (4)]
+typedef struct WSViewerStats {
+    float fps;              // Frames painted per second
+    float decode_ms;        // VideoDecoder time per frame, queueing included
+    int decode_queue;       // Frames waiting in the decoder (most seen)
+    int latency_ms;         // Arrival to paint; the network is not included
+    int audio_buffer_ms;    // Decoded audio waiting to play
+    uint32_t frames_dropped; // Skipped to catch up, since it connected
+} WSViewerStats;
+
+// Worst case over the browsers that reported recently, for host-side rate
+// control: lowest fps, highest everything else, drops summed. Returns how
+// many browsers that covers (0: `out` is left untouched). Any thread.
+int WS_GetViewerStats(WebSocketContext *ctx, WSViewerStats *out);
+
+// Stops the server thread and closes every connection
 void WS_Shutdown(WebSocketContext *ctx);
 
 #endif // HARMONY_WEBSOCKET_H
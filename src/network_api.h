@@ -12,6 +12,22 @@ NetworkContext* Net_Init(MemoryArena *arena, int port, bool is_server);
 // Send data to a target
 void Net_Send(NetworkContext *ctx, const char *ip, int port, void *data, size_t size);
 
+typedef struct NetDatagram {
+    const char *ip;
+    int port;
+    const void *data;
+    size_t size;
+} NetDatagram;
+
+// Send several datagrams with a single system call (sendmmsg). Best effort
+// like Net_Send: datagrams the socket cannot take right now are dropped.
+void Net_SendBatch(NetworkContext *ctx, const NetDatagram *datagrams, int count);
+
+// Path MTU probing: send with DF set and never fragment locally, so
+// oversized datagrams are dropped instead (see net/mtu_probe.h). When off,
+// the kernel default applies (DF set, fragments above a learned path MTU).
+void Net_SetPathMtuProbing(NetworkContext *ctx, bool enabled);
+
 // Receive data (non-blocking)
 // Returns size of data read, or 0 if nothing
 int Net_Recv(NetworkContext *ctx, void *buffer, size_t buffer_size, char *out_sender_ip, int *out_sender_port);
@@ -16,6 +16,9 @@ void OS_GetWindowSize(WindowContext *window, int *width, int *height);
 // Time
 double OS_GetTime(); // Seconds since app start
 
+// Cryptographically secure random bytes (key salts). False on failure.
+bool OS_GetRandomBytes(void *buffer, size_t size);
+
 // Input (Simple polling for now)
 typedef struct InputState {
     bool quit_requested;
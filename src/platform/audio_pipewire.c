@@ -5,14 +5,19 @@
 #include <pipewire/pipewire.h>
 #include <spa/param/audio/format-utils.h>
 #include <spa/pod/builder.h>
-#include <pthread.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include "../audio_api.h"
+#include "../core/audio_jitter.h"
+#include "../core/audio_ring.h"
+#include "../os_api.h"
 
 // --- Audio Capture Context ---
 struct AudioCaptureContext {
-    struct pw_main_loop *loop;
+    struct pw_thread_loop *thread_loop; // Runs the stream: nothing to poll
     struct pw_context *context;
     struct pw_core *core;
     struct pw_stream *stream;
@@ -20,12 +25,12 @@ struct AudioCaptureContext {
     
     MemoryArena *arena;
     
-    // Ring buffer for captured audio
-    int16_t *buffer;
-    int buffer_size;      // Total size in samples
-    int write_pos;
-    int read_pos;
-    int available;        // Samples available to read
+    // Captured audio: PipeWire's process callback writes, the audio thread
+    // reads whole frames
+    AudioRing ring;
+    int frame_fd; // eventfd: a whole packet is buffered (Audio_WaitCapture)
+    uint32_t packet_samples; // All channels
+    _Atomic double captured_at; // OS_GetTime of the newest buffered sample
     
     // Frame output
     AudioFrame current_frame;
@@ -49,21 +54,22 @@ static void capture_on_process(void *data) {
     }
     
     int16_t *samples = (int16_t *)buf->datas[0].data;
-    int n_samples = buf->datas[0].chunk->size / sizeof(int16_t);
-    
-    // Copy to ring buffer (overwrite old data if full)
-    for (int i = 0; i < n_samples; i++) {
-        ctx->buffer[ctx->write_pos] = samples[i];
-        ctx->write_pos = (ctx->write_pos + 1) % ctx->buffer_size;
-        if (ctx->available < ctx->buffer_size) {
-            ctx->available++;
-        } else {
-            // Buffer full, advance read pos to drop oldest
-            ctx->read_pos = (ctx->read_pos + 1) % ctx->buffer_size;
-        }
-    }
+    uint32_t n_samples = buf->datas[0].chunk->size / sizeof(int16_t);
+    n_samples -= n_samples % AUDIO_CHANNELS;
+    
+    // If the reader is a full second behind, what doesn't fit is dropped
+    // (and counted): the oldest samples belong to the reader
+    AudioRing_Write(&ctx->ring, samples, n_samples);
+    atomic_store_explicit(&ctx->captured_at, OS_GetTime(), memory_order_release);
     
     pw_stream_queue_buffer(ctx->stream, b);
+    
+    // Wake the audio thread as soon as it has a packet to encode. The
+    // counter coalesces wakeups, and the write never blocks.
+    if (AudioRing_Available(&ctx->ring) >= ctx->packet_samples) {
+        uint64_t one = 1;
+        (void)!write(ctx->frame_fd, &one, sizeof(one));
+    }
 }
 
 static const struct pw_stream_events capture_stream_events = {
@@ -72,18 +78,25 @@ static const struct pw_stream_events capture_stream_events = {
 };
 
 
-AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_id) {
+AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_id, uint32_t packet_size) {
     AudioCaptureContext *ctx = PushStructZero(arena, AudioCaptureContext);
     ctx->arena = arena;
+    ctx->packet_samples = packet_size * AUDIO_CHANNELS;
     
-    // Ring buffer: 1 second of audio
-    ctx->buffer_size = AUDIO_SAMPLE_RATE * AUDIO_CHANNELS;
-    ctx->buffer = ArenaPush(arena, ctx->buffer_size * sizeof(int16_t));
+    // Ring buffer: at least 1 second of audio
+    AudioRing_Init(&ctx->ring, arena, AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
+    ctx->frame_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->frame_fd < 0) {
+        perror("Audio: eventfd");
+        return NULL;
+    }
     
     pw_init(NULL, NULL);
     
-    ctx->loop = pw_main_loop_new(NULL);
-    ctx->context = pw_context_new(pw_main_loop_get_loop(ctx->loop), NULL, 0);
+    // The stream runs on its own thread loop, like playback: samples reach
+    // the ring the moment PipeWire delivers them, whatever our threads do
+    ctx->thread_loop = pw_thread_loop_new("Audio Capture", NULL);
+    ctx->context = pw_context_new(pw_thread_loop_get_loop(ctx->thread_loop), NULL, 0);
     ctx->core = pw_context_connect(ctx->context, NULL, 0);
     
     if (!ctx->core) {
@@ -100,6 +113,13 @@ AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_
     
     printf("Audio: InitCapture (v2-SerialCheck)\n");
 
+    // A quantum no longer than a packet (up to 20 ms): with the graph's
+    // default, short Opus frames would wait on capture, not on encoding
+    char latency[32];
+    snprintf(latency, sizeof(latency), "%u/%u",
+             packet_size < AUDIO_FRAME_SIZE ? packet_size : AUDIO_FRAME_SIZE, AUDIO_SAMPLE_RATE);
+    pw_properties_set(props, PW_KEY_NODE_LATENCY, latency);
+
     if (target_node_id != 0) {
         // Target specific node (Portal/App)
         char target_str[32];
@@ -119,7 +139,7 @@ AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_
 
     // Create capture stream
     ctx->stream = pw_stream_new_simple(
-        pw_main_loop_get_loop(ctx->loop),
+        pw_thread_loop_get_loop(ctx->thread_loop),
         "harmony-audio-capture",
         props,
         &capture_stream_events,
@@ -142,7 +162,7 @@ AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_
         ctx->stream,
         PW_DIRECTION_INPUT,
         PW_ID_ANY,
-        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS,
+        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
         params, 1
     );
     
@@ -151,14 +171,26 @@ AudioCaptureContext* Audio_InitCapture(MemoryArena *arena, uint32_t target_node_
         return NULL;
     }
     
-    printf("Audio: Capture initialized (48kHz stereo S16LE)\n");
+    pw_thread_loop_start(ctx->thread_loop);
+    
+    printf("Audio: Capture initialized (48kHz stereo S16LE, threaded)\n");
     return ctx;
 }
 
-void Audio_PollCapture(AudioCaptureContext *ctx) {
-    if (ctx && ctx->loop) {
-        pw_loop_iterate(pw_main_loop_get_loop(ctx->loop), 0);
+bool Audio_WaitCapture(AudioCaptureContext *ctx, int timeout_ms) {
+    if (!ctx) {
+        usleep(timeout_ms * 1000); // No capture: keep the caller's loop slow
+        return false;
+    }
+    
+    if (AudioRing_Available(&ctx->ring) >= ctx->packet_samples) return true;
+    
+    struct pollfd pfd = {.fd = ctx->frame_fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        uint64_t count;
+        (void)!read(ctx->frame_fd, &count, sizeof(count)); // Re-arm
     }
+    return AudioRing_Available(&ctx->ring) >= ctx->packet_samples;
 }
 
 
@@ -369,35 +401,47 @@ void Audio_EnumerateNodes(MemoryArena *arena, AudioNodeList *out_list) {
 AudioFrame* Audio_GetCapturedFrame(AudioCaptureContext *ctx) {
     if (!ctx) return NULL;
     
-    // Check if we have enough samples for a full frame
-    int frame_samples = AUDIO_FRAME_SIZE * AUDIO_CHANNELS;
-    if (ctx->available >= frame_samples) {
+    // Check if we have enough samples for a full packet
+    uint32_t frame_samples = ctx->packet_samples;
+    double captured_at = atomic_load_explicit(&ctx->captured_at, memory_order_acquire);
+    uint32_t available = AudioRing_Available(&ctx->ring);
+    if (available >= frame_samples) {
         // Ensure we have a buffer for the frame
         if (!ctx->current_frame.samples) {
             ctx->current_frame.samples = ArenaPush(ctx->arena, frame_samples * sizeof(int16_t));
         }
         
-        // Copy samples from ring buffer
-        for (int i = 0; i < frame_samples; i++) {
-            ctx->current_frame.samples[i] = ctx->buffer[ctx->read_pos];
-            ctx->read_pos = (ctx->read_pos + 1) % ctx->buffer_size;
-        }
-        ctx->available -= frame_samples;
+        AudioRing_Read(&ctx->ring, ctx->current_frame.samples, frame_samples);
         
-        ctx->current_frame.sample_count = AUDIO_FRAME_SIZE;
+        ctx->current_frame.sample_count = (int)(frame_samples / AUDIO_CHANNELS);
         ctx->current_frame.channels = AUDIO_CHANNELS;
+        // Everything buffered after its first sample came later, up to the
+        // newest (within a callback, if one ran meanwhile)
+        ctx->current_frame.timestamp = captured_at - (double)available / (AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
         return &ctx->current_frame;
     }
     
     return NULL;
 }
 
+void Audio_GetCaptureStats(AudioCaptureContext *ctx, AudioBufferStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!ctx) return;
+    out->buffered = AudioRing_Available(&ctx->ring);
+    out->overflows = atomic_load(&ctx->ring.overflows);
+    out->underruns = atomic_load(&ctx->ring.underruns);
+}
+
 void Audio_CloseCapture(AudioCaptureContext *ctx) {
     if (ctx) {
+        if (ctx->thread_loop) pw_thread_loop_stop(ctx->thread_loop);
+        
         if (ctx->stream) pw_stream_destroy(ctx->stream);
         if (ctx->core) pw_core_disconnect(ctx->core);
         if (ctx->context) pw_context_destroy(ctx->context);
-        if (ctx->loop) pw_main_loop_destroy(ctx->loop);
+        
+        if (ctx->thread_loop) pw_thread_loop_destroy(ctx->thread_loop);
+        if (ctx->frame_fd >= 0) close(ctx->frame_fd);
     }
 }
 
@@ -411,19 +455,13 @@ struct AudioPlaybackContext {
     
     MemoryArena *arena;
     
-    // Thread safety
-    pthread_mutex_t mutex;
-    
-    // Ring buffer for playback
-    int16_t *buffer;
-    int buffer_size;
-    int write_pos;
-    int read_pos;
-    int available;
+    // Decoded audio: the decoder thread writes, the realtime process
+    // callback reads. Lock-free, so the callback never waits on a decode.
+    AudioRing ring;
     
-    // Jitter Buffer State
-    bool buffering;
-    int target_latency; // Samples to buffer before starting
+    // Jitter Buffer: sized from arrival jitter, held there by resampling
+    AudioJitter jitter;
+    AudioResampler resampler; // Realtime thread only
 };
 
 // Playback stream callback (Runs on dedicated thread)
@@ -443,41 +481,25 @@ static void playback_on_process(void *data) {
     }
     
     int16_t *dst = (int16_t *)buf->datas[0].data;
-    int max_samples = buf->datas[0].maxsize / sizeof(int16_t);
-    int n_written = 0;
-    
-    pthread_mutex_lock(&ctx->mutex);
-    
-    // Jitter Buffer Logic
-    // If we are in buffering state, we output silence until we have enough data
-    if (ctx->buffering) {
-        if (ctx->available >= ctx->target_latency) {
-            ctx->buffering = false;
-        //    printf("Audio: Buffering complete. Starting playback (Available: %d)\n", ctx->available);
-        }
-    } else {
-        // If we run dry, go back to buffering state
-        if (ctx->available == 0) {
-            ctx->buffering = true;
-        //    printf("Audio: Underrun! Re-buffering...\n");
-        }
+    uint32_t max_samples = buf->datas[0].maxsize / sizeof(int16_t);
+    max_samples -= max_samples % AUDIO_CHANNELS;
+    // One graph cycle's worth when the server says how much it wants:
+    // filling the whole buffer would drain the ring several cycles ahead
+    if (b->requested > 0 && b->requested * AUDIO_CHANNELS < max_samples) {
+        max_samples = (uint32_t)b->requested * AUDIO_CHANNELS;
     }
-
-    if (!ctx->buffering) {
-        // Copy from ring buffer
-        while (n_written < max_samples && ctx->available > 0) {
-            dst[n_written++] = ctx->buffer[ctx->read_pos];
-            ctx->read_pos = (ctx->read_pos + 1) % ctx->buffer_size;
-            ctx->available--;
-        }
+    if (max_samples > AUDIO_RESAMPLER_MAX_QUANTUM * AUDIO_CHANNELS) {
+        max_samples = AUDIO_RESAMPLER_MAX_QUANTUM * AUDIO_CHANNELS;
     }
     
-    pthread_mutex_unlock(&ctx->mutex);
+    // Jitter Buffer Logic
+    // Silence until the target depth is buffered, then played at the rate
+    // that holds it there
+    uint32_t frames = AudioJitter_Play(&ctx->jitter, &ctx->resampler, &ctx->ring, dst, max_samples / AUDIO_CHANNELS);
+    uint32_t n_written = frames * AUDIO_CHANNELS;
     
     // Fill remainder with silence
-    while (n_written < max_samples) {
-        dst[n_written++] = 0;
-    }
+    memset(dst + n_written, 0, (max_samples - n_written) * sizeof(int16_t));
     
     buf->datas[0].chunk->offset = 0;
     buf->datas[0].chunk->stride = sizeof(int16_t) * AUDIO_CHANNELS;
@@ -495,16 +517,12 @@ AudioPlaybackContext* Audio_InitPlayback(MemoryArena *arena) {
     AudioPlaybackContext *ctx = PushStructZero(arena, AudioPlaybackContext);
     ctx->arena = arena;
     
-    pthread_mutex_init(&ctx->mutex, NULL);
-    
-    // Ring buffer: 1 second of audio
-    ctx->buffer_size = AUDIO_SAMPLE_RATE * AUDIO_CHANNELS;
-    ctx->buffer = ArenaPush(arena, ctx->buffer_size * sizeof(int16_t));
+    // Ring buffer: at least 1 second of audio
+    AudioRing_Init(&ctx->ring, arena, AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
     
-    // Jitter Buffer Settings
-    // 100ms buffering @ 48kHz = 4800 samples per channel * 2 channels = 9600 samples
-    ctx->target_latency = (AUDIO_SAMPLE_RATE / 10) * AUDIO_CHANNELS; 
-    ctx->buffering = true;
+    // Jitter Buffer: starts at AUDIO_JITTER_START_MS until arrivals are measured
+    AudioJitter_Init(&ctx->jitter);
+    AudioResampler_Init(&ctx->resampler, arena);
     
     pw_init(NULL, NULL);
     
@@ -563,7 +581,7 @@ AudioPlaybackContext* Audio_InitPlayback(MemoryArena *arena) {
     // Start the thread loop
     pw_thread_loop_start(ctx->thread_loop);
     
-    printf("Audio: Playback initialized (Threaded + JitterBuffer 100ms)\n");
+    printf("Audio: Playback initialized (Threaded + Adaptive JitterBuffer)\n");
     return ctx;
 }
 
@@ -576,18 +594,43 @@ void Audio_PollPlayback(AudioPlaybackContext *ctx) {
 void Audio_WritePlayback(AudioPlaybackContext *ctx, AudioFrame *frame) {
     if (!ctx || !frame || !frame->samples) return;
     
-    int n_samples = frame->sample_count * frame->channels;
-    
-    pthread_mutex_lock(&ctx->mutex);
-    
-    // Copy to ring buffer
-    for (int i = 0; i < n_samples && ctx->available < ctx->buffer_size; i++) {
-        ctx->buffer[ctx->write_pos] = frame->samples[i];
-        ctx->write_pos = (ctx->write_pos + 1) % ctx->buffer_size;
-        ctx->available++;
-    }
-    
-    pthread_mutex_unlock(&ctx->mutex);
+    AudioJitter_OnArrival(&ctx->jitter, OS_GetTime(), (uint32_t)frame->sample_count,
+                          atomic_load_explicit(&ctx->ring.underruns, memory_order_relaxed));
+    // Dropped (and counted) if playback is a full second behind
+    AudioRing_Write(&ctx->ring, frame->samples, (uint32_t)(frame->sample_count * frame->channels));
+}
+
+void Audio_WriteConcealed(AudioPlaybackContext *ctx, AudioFrame *frame) {
+    if (!ctx || !frame || !frame->samples) return;
+
+    AudioJitter_OnConcealed(&ctx->jitter, (uint32_t)frame->sample_count);
+    AudioRing_Write(&ctx->ring, frame->samples, (uint32_t)(frame->sample_count * frame->channels));
+}
+
+void Audio_SetPlaybackDelay(AudioPlaybackContext *ctx, float ms) {
+    if (!ctx) return;
+    if (ms < 0.0f) ms = 0.0f;
+    if (ms > AUDIO_JITTER_MAX_MS) ms = AUDIO_JITTER_MAX_MS;
+    atomic_store(&ctx->jitter.sync_frames, (uint32_t)(ms * AUDIO_SAMPLE_RATE / 1000.0f));
+}
+
+void Audio_SetPlaybackPacket(AudioPlaybackContext *ctx, uint32_t packet_size) {
+    if (!ctx) return;
+    AudioJitter_SetPacket(&ctx->jitter, packet_size);
+}
+
+void Audio_GetPlaybackStats(AudioPlaybackContext *ctx, AudioBufferStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!ctx) return;
+    out->buffered = AudioRing_Available(&ctx->ring);
+    out->overflows = atomic_load(&ctx->ring.overflows);
+    out->underruns = atomic_load(&ctx->ring.underruns);
+    // The staged frames are the realtime thread's: the ring is close enough
+    out->depth_ms = (float)out->buffered * 1000.0f / (AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
+    out->target_ms = (float)atomic_load(&ctx->jitter.target_frames) * 1000.0f / AUDIO_SAMPLE_RATE;
+    out->sync_ms = (float)atomic_load(&ctx->jitter.sync_frames) * 1000.0f / AUDIO_SAMPLE_RATE;
+    out->jitter_ms = (float)atomic_load(&ctx->jitter.jitter_us) / 1000.0f;
+    out->drift_ppm = (float)atomic_load(&ctx->jitter.drift_ppm);
 }
 
 void Audio_ClosePlayback(AudioPlaybackContext *ctx) {
@@ -599,7 +642,5 @@ void Audio_ClosePlayback(AudioPlaybackContext *ctx) {
         if (ctx->context) pw_context_destroy(ctx->context);
         
         if (ctx->thread_loop) pw_thread_loop_destroy(ctx->thread_loop);
-        
-        pthread_mutex_destroy(&ctx->mutex);
     }
 }
@@ -55,6 +55,13 @@ bool Config_Load(PersistentConfig *config) {
     strcpy(config->stream_password, "");
     strcpy(config->encoder_preset, "faster"); // Default to 'faster' for good quality/speed balance
     config->fps = 60; // Default to 60 FPS
+    config->intra_refresh = false;
+    config->sliced_encoding = false;
+    config->simulcast_layers = 1;
+    config->temporal_layers = false;
+    config->audio_frame_size = 960;
+    config->audio_frames_per_packet = 1;
+    config->playout_smoothness = 50;
     
     const char *path = GetConfigPath();
     FILE *f = fopen(path, "r");
@@ -100,10 +107,35 @@ bool Config_Load(PersistentConfig *config) {
         } else if (strcmp(key, "fps") == 0) {
             config->fps = (uint32_t)atoi(value);
             if (config->fps == 0) config->fps = 60; // Sanity check
+        } else if (strcmp(key, "intra_refresh") == 0) {
+            config->intra_refresh = (strcmp(value, "true") == 0);
+        } else if (strcmp(key, "sliced_encoding") == 0) {
+            config->sliced_encoding = (strcmp(value, "true") == 0);
+        } else if (strcmp(key, "simulcast_layers") == 0) {
+            config->simulcast_layers = (uint32_t)atoi(value);
+            if (config->simulcast_layers < 1) config->simulcast_layers = 1;
+            if (config->simulcast_layers > 3) config->simulcast_layers = 3;
+        } else if (strcmp(key, "temporal_layers") == 0) {
+            config->temporal_layers = (strcmp(value, "true") == 0);
+        } else if (strcmp(key, "audio_frame_ms") == 0) {
+            config->audio_frame_size = (uint32_t)(atof(value) * 48.0 + 0.5);
+        } else if (strcmp(key, "audio_frames_per_packet") == 0) {
+            config->audio_frames_per_packet = (uint32_t)atoi(value);
+        } else if (strcmp(key, "playout_smoothness") == 0) {
+            config->playout_smoothness = (uint32_t)atoi(value);
+            if (config->playout_smoothness > 100) config->playout_smoothness = 100;
         }
     }
     
     fclose(f);
+
+    // Opus frames of 2.5, 5, 10 or 20 ms; only 20 ms ones are packed
+    uint32_t frame = config->audio_frame_size;
+    if (frame != 120 && frame != 240 && frame != 480 && frame != 960) config->audio_frame_size = 960;
+    if (config->audio_frames_per_packet < 1) config->audio_frames_per_packet = 1;
+    if (config->audio_frames_per_packet > 6) config->audio_frames_per_packet = 6;
+    if (config->audio_frame_size != 960) config->audio_frames_per_packet = 1;
+
     printf("Config: Loaded from %s (is_host=%s, verbose=%s, target_ip=%s, fps=%u)\n", 
            path, config->is_host ? "true" : "false", config->verbose ? "true" : "false", config->target_ip, config->fps);
     return true;
@@ -130,6 +162,20 @@ bool Config_Save(const PersistentConfig *config) {
     fprintf(f, "# encoder_preset: ultrafast, superfast, veryfast, faster, fast, medium (slower = better quality)\n");
     fprintf(f, "encoder_preset=%s\n", config->encoder_preset);
     fprintf(f, "fps=%u\n", config->fps);
+    fprintf(f, "# intra_refresh: spread keyframes over 1s of frames instead of periodic IDR bursts\n");
+    fprintf(f, "intra_refresh=%s\n", config->intra_refresh ? "true" : "false");
+    fprintf(f, "# sliced_encoding: cut frames into packet-sized slices (loss costs one slice, earlier decode)\n");
+    fprintf(f, "sliced_encoding=%s\n", config->sliced_encoding ? "true" : "false");
+    fprintf(f, "# simulcast_layers: 1-3 renditions, each half the size of the one above (viewers pick one)\n");
+    fprintf(f, "simulcast_layers=%u\n", config->simulcast_layers);
+    fprintf(f, "# temporal_layers: every other frame droppable under load (adds one frame of latency)\n");
+    fprintf(f, "temporal_layers=%s\n", config->temporal_layers ? "true" : "false");
+    fprintf(f, "# audio_frame_ms: 2.5, 5, 10 or 20 (shorter = lower latency, more packets)\n");
+    fprintf(f, "audio_frame_ms=%g\n", config->audio_frame_size / 48.0);
+    fprintf(f, "# audio_frames_per_packet: 1-6 frames of 20 ms per packet (fewer packets on constrained links)\n");
+    fprintf(f, "audio_frames_per_packet=%u\n", config->audio_frames_per_packet);
+    fprintf(f, "# playout_smoothness: 0-100, viewer trade-off between lowest latency (0) and smoothest playback (100)\n");
+    fprintf(f, "playout_smoothness=%u\n", config->playout_smoothness);
     
     fclose(f);
     printf("Config: Saved to %s\n", path);
@@ -0,0 +1,18 @@
+#include "../os_api.h"
+#include <errno.h>
+#include <sys/random.h>
+
+bool OS_GetRandomBytes(void *buffer, size_t size) {
+    uint8_t *out = (uint8_t *)buffer;
+    while (size > 0) {
+        ssize_t n = getrandom(out, size, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        out += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
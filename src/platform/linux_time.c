@@ -0,0 +1,8 @@
+#include "../os_api.h"
+#include <time.h>
+
+double OS_GetTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -20,12 +20,6 @@
 #include "generated/xdg-decoration-client-protocol.h"
 #include "../os_api.h"
 
-double OS_GetTime() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
-}
-
 // --- Global Wayland State ---
 static struct wl_display *display;
 static struct wl_registry *registry;
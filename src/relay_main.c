@@ -0,0 +1,76 @@
+#include "net/relay.h"
+#include "network_api.h"
+#include "os_api.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// harmony-relay: headless fan-out of one host stream (see net/relay.h).
+// Point the host at this machine as its viewer, and viewers at it as their
+// host. No window, capture or codec dependencies.
+//
+// Usage: harmony-relay <host_ip> [udp_port] [ws_port] [layer]
+
+#define RELAY_STATS_INTERVAL 10.0
+
+static atomic_bool g_running = true;
+
+static void Relay_OnSignal(int sig) {
+  (void)sig;
+  atomic_store(&g_running, false);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <host_ip> [udp_port] [ws_port] [layer]\n",
+            argv[0]);
+    return 1;
+  }
+  const char *host_ip = argv[1];
+  int udp_port = (argc > 2) ? atoi(argv[2]) : 9999;
+  int ws_port = (argc > 3) ? atoi(argv[3]) : 8080;
+  int layer = (argc > 4) ? atoi(argv[4]) : 0; // Simulcast layer, 0 = full size
+
+  MemoryArena arena;
+  ArenaInit(&arena, 64 * 1024 * 1024);
+
+  NetworkContext *net = Net_Init(&arena, udp_port, true);
+  if (!net)
+    return 1;
+  WebSocketContext *ws = WS_Init(&arena, ws_port);
+
+  // Hosts always stream to port 9999 of their target
+  Relay *relay = Relay_Create(&arena, net, ws, host_ip, 9999);
+  relay->layer = (uint8_t)layer;
+  printf("Relay: Forwarding %s (layer %d) to up to %d UDP viewers on port %d "
+         "(web viewer on http://<this machine>:%d/)\n",
+         host_ip, layer, VIEWER_TABLE_MAX, udp_port, ws_port);
+
+  signal(SIGINT, Relay_OnSignal);
+  signal(SIGTERM, Relay_OnSignal);
+
+  double last_stats = OS_GetTime();
+  uint64_t last_bytes = 0;
+  while (atomic_load(&g_running)) {
+    if (Relay_Poll(relay) == 0)
+      usleep(1000); // 1ms
+
+    double now = OS_GetTime();
+    if (now - last_stats >= RELAY_STATS_INTERVAL) {
+      printf("Relay: %d viewers, %.2f Mbit/s from host\n",
+             relay->viewers.count,
+             (relay->bytes_in - last_bytes) * 8.0 / ((now - last_stats) * 1e6));
+      last_bytes = relay->bytes_in;
+      last_stats = now;
+    }
+  }
+
+  printf("Relay: Shutting down\n");
+  Relay_Destroy(relay);
+  if (ws)
+    WS_Shutdown(ws);
+  Net_Close(net);
+  return 0;
+}
@@ -5,6 +5,8 @@
 #include "../src/codec_api.h"
 #include "../src/codec/codec_ffmpeg.c"
 #include "../src/codec/codec_ffmpeg_decode.c"
+#include "../src/codec/yuv_scale.c"
+#include <time.h>
 
 // Helper: Fill frame with dummy RGBA data (moving box)
 void FillTestFrame(VideoFrame *frame, int frame_idx) {
@@ -113,6 +115,170 @@ int main() {
 
     printf("Test Finished. %d/%d frames successfully round-tripped.\n", success_count, frame_count);
 
+    // Runtime reconfiguration: rate change on the live encoder, then a resolution
+    // change that must reuse the same context.
+    Codec_SetBitrate(encoder, 2000000);
+    VideoFormat small_format = format;
+    small_format.width = 640;
+    small_format.height = 360;
+    small_format.bitrate = 2000000;
+    size_t arena_before = main_arena.used;
+    if (!Codec_Reconfigure(encoder, small_format) || main_arena.used != arena_before) {
+        printf("Reconfigure: FAILED (arena grew by %zu bytes)\n", main_arena.used - arena_before);
+        return 1;
+    }
+
+    input_frame.width = small_format.width;
+    input_frame.height = small_format.height;
+    input_frame.linesize[0] = small_format.width * 4;
+    int small_decoded = 0;
+    for (int i = 0; i < 10; ++i) {
+        ArenaClear(&packet_arena);
+        FillTestFrame(&input_frame, i);
+        EncodedPacket pkt = {0};
+        Codec_EncodeFrame(encoder, &input_frame, &packet_arena, &pkt);
+        if (pkt.size > 0) {
+            VideoFrame decoded_frame = {0};
+            Codec_DecodePacket(decoder, &pkt, &decoded_frame);
+            if (decoded_frame.width == small_format.width) small_decoded++;
+        }
+    }
+    printf("Reconfigure: %d/10 frames decoded at %dx%d.\n", small_decoded, small_format.width, small_format.height);
+    if (small_decoded == 0) return 1;
+
+    // Simulcast: one conversion, then 2:1 downscales. The SSE2 path must match
+    // the scalar box filter exactly, also on widths that leave a scalar tail.
+    {
+        VideoFrame ref = {0}, fast = {0}, src = {0};
+        int sw = 1366, sh = 768, dw, dh;
+        Codec_HalfSize(sw, sh, &dw, &dh);
+        assert(dw == 682 && dh == 384);
+        Codec_LayoutI420(ArenaPush(&main_arena, Codec_I420Size(sw, sh)), sw, sh, &src);
+        Codec_LayoutI420(ArenaPush(&main_arena, Codec_I420Size(dw, dh)), dw, dh, &fast);
+        Codec_LayoutI420(ArenaPush(&main_arena, Codec_I420Size(dw, dh)), dw, dh, &ref);
+        uint32_t seed = 12345;
+        for (int p = 0; p < 3; ++p) {
+            int rows = p ? sh / 2 : sh;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < src.linesize[p]; ++x) {
+                    seed = seed * 1103515245 + 12345;
+                    src.data[p][y * src.linesize[p] + x] = (uint8_t)(seed >> 16);
+                }
+            }
+        }
+        Codec_DownscaleI420(&src, &fast);
+        for (int p = 0; p < 3; ++p) {
+            int w = p ? dw / 2 : dw, h = p ? dh / 2 : dh;
+            for (int y = 0; y < h; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    const uint8_t *r0 = src.data[p] + 2 * y * src.linesize[p];
+                    const uint8_t *r1 = r0 + src.linesize[p];
+                    int left = (r0[2 * x] + r1[2 * x] + 1) >> 1;
+                    int right = (r0[2 * x + 1] + r1[2 * x + 1] + 1) >> 1;
+                    if (fast.data[p][y * fast.linesize[p] + x] != (uint8_t)((left + right + 1) >> 1)) {
+                        printf("Simulcast: DOWNSCALE MISMATCH plane %d at %d,%d\n", p, x, y);
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < 100; ++i) Codec_DownscaleI420(&src, &fast);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ms = ((t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6) / 100.0;
+        printf("Simulcast: %dx%d -> %dx%d downscale in %.3f ms\n", sw, sh, dw, dh, ms);
+
+        // 1280x720 capture converted once, layer 1 (640x360) encoded as I420
+        FrameConverter *converter = Codec_InitConverter(&main_arena);
+        input_frame.width = format.width;
+        input_frame.height = format.height;
+        input_frame.linesize[0] = format.width * 4;
+        VideoFrame full = {0}, half = {0};
+        uint8_t *full_buffer = ArenaPush(&main_arena, Codec_I420Size(format.width, format.height));
+        Codec_HalfSize(format.width, format.height, &dw, &dh);
+        Codec_LayoutI420(ArenaPush(&main_arena, Codec_I420Size(dw, dh)), dw, dh, &half);
+        int layer_decoded = 0;
+        for (int i = 0; i < 10; ++i) {
+            ArenaClear(&packet_arena);
+            FillTestFrame(&input_frame, i);
+            assert(Codec_ConvertToI420(converter, &input_frame, full_buffer, &full));
+            Codec_DownscaleI420(&full, &half);
+            EncodedPacket pkt = {0};
+            Codec_EncodeFrame(encoder, &half, &packet_arena, &pkt);
+            if (pkt.size > 0) {
+                VideoFrame decoded_frame = {0};
+                Codec_DecodePacket(decoder, &pkt, &decoded_frame);
+                if (decoded_frame.width == dw && decoded_frame.height == dh) layer_decoded++;
+            }
+        }
+        Codec_CloseConverter(converter);
+        printf("Simulcast: %d/10 layer frames decoded at %dx%d.\n", layer_decoded, dw, dh);
+        if (layer_decoded == 0) return 1;
+    }
+
+    // Intra refresh: a viewer joining on a sweep start decodes the sweep
+    // without asking for keyframes, and displays from its recovery point
+    {
+        VideoFormat refresh_format = {.width = 320, .height = 240, .fps = 10, .bitrate = 500000, .intra_refresh = true};
+        EncoderContext *refresh_encoder = Codec_InitEncoder(&main_arena, refresh_format);
+        DecoderContext *joiner = Codec_InitDecoder(&main_arena);
+        assert(refresh_encoder != NULL && joiner != NULL);
+        input_frame.width = refresh_format.width;
+        input_frame.height = refresh_format.height;
+        input_frame.linesize[0] = refresh_format.width * 4;
+        bool joined = false, recovered = false;
+        int swept = 0, shown = 0;
+        for (int i = 0; i < 60 && shown < 5; ++i) {
+            ArenaClear(&packet_arena);
+            FillTestFrame(&input_frame, i);
+            EncodedPacket pkt = {0};
+            Codec_EncodeFrame(refresh_encoder, &input_frame, &packet_arena, &pkt);
+            if (pkt.size == 0) continue;
+            pkt.keyframe_known = true;
+            if (!joined && !(pkt.keyframe && !pkt.recovery_point)) continue; // The IDR is before our time
+            joined = true;
+
+            VideoFrame decoded_frame = {0};
+            Codec_DecodePacket(joiner, &pkt, &decoded_frame);
+            recovered = recovered || pkt.recovery_point;
+            if (!recovered) {
+                assert(!Codec_NeedsKeyframe(joiner) && decoded_frame.data[0] == NULL);
+                swept++;
+            } else if (decoded_frame.data[0] != NULL) {
+                shown++;
+            }
+        }
+        printf("Intra refresh: %d sweep frames without keyframe requests, %d shown after recovery.\n", swept, shown);
+        if (swept == 0 || shown == 0) return 1;
+    }
+
+    // Temporal layers: packets trail frames (B frames), yet each carries the
+    // capture time of the frame it holds
+    {
+        VideoFormat layered_format = {.width = 320, .height = 240, .fps = 10, .bitrate = 500000, .temporal_layers = true};
+        EncoderContext *layered_encoder = Codec_InitEncoder(&main_arena, layered_format);
+        assert(layered_encoder != NULL);
+        input_frame.width = layered_format.width;
+        input_frame.height = layered_format.height;
+        input_frame.linesize[0] = layered_format.width * 4;
+        int stamped = 0, reordered = 0;
+        for (int i = 0; i < 20; ++i) {
+            ArenaClear(&packet_arena);
+            FillTestFrame(&input_frame, i);
+            input_frame.timestamp = 100.0 + i * 0.1;
+            EncodedPacket pkt = {0};
+            Codec_EncodeFrame(layered_encoder, &input_frame, &packet_arena, &pkt);
+            if (pkt.size == 0) continue;
+            assert(pkt.timestamp_us == (uint32_t)(uint64_t)((100.0 + pkt.pts * 0.1) * 1e6));
+            if (pkt.pts != i) reordered++;
+            stamped++;
+        }
+        printf("Temporal layers: %d packets stamped with their own capture time, %d behind input.\n", stamped, reordered);
+        if (stamped == 0) return 1;
+    }
+
     if (success_count > 0) return 0;
     return 1;
 }
@@ -3,6 +3,10 @@
 #include <assert.h>
 #include "../src/memory_arena.h"
 #include "../src/net/protocol.h"
+#include "../src/net/mtu_probe.h"
+#include "../src/net/unit_cache.h"
+#include "../src/net/audio_loss.h"
+#include "../src/net/aes.c"
 
 // Mock Sender
 typedef struct MockNetwork {
@@ -35,11 +39,733 @@ void MockSendCallback(void *user_data, void *packet_data, size_t packet_size) {
     }
 }
 
+// --- Sliced frames ---
+typedef struct SlicedMock {
+    Reassembler *receiver;
+    int drop_chunk;           // Chunk index to drop (-1 = none)
+    uint8_t delivered[16384]; // Concatenation of all delivered spans
+    size_t delivered_size;
+    int slices_delivered;
+    bool completed;
+} SlicedMock;
+
+void SlicedMockSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    SlicedMock *m = (SlicedMock *)user_data;
+    PacketHeader *header = (PacketHeader *)packet_data;
+    assert(header->flags & PACKET_FLAG_SLICED);
+    if (header->chunk_id == m->drop_chunk) return;
+
+    void *out = NULL;
+    size_t out_size = 0;
+    ReassemblyResult res = Protocol_HandlePacket(m->receiver, packet_data, packet_size, &out, &out_size, NULL);
+    if (res == RESULT_SLICE || res == RESULT_COMPLETE) {
+        // Every span must start on a NAL
+        uint8_t *d = (uint8_t *)out;
+        assert(out_size >= 4 && d[0] == 0 && d[1] == 0 && (d[2] == 1 || (d[2] == 0 && d[3] == 1)));
+        memcpy(m->delivered + m->delivered_size, out, out_size);
+        m->delivered_size += out_size;
+        m->slices_delivered++;
+        if (res == RESULT_COMPLETE) m->completed = true;
+    }
+}
+
+// Appends a NAL (4-byte start code + payload free of start code emulation)
+static size_t AppendNal(uint8_t *au, size_t pos, size_t payload_size, uint8_t tag) {
+    au[pos++] = 0; au[pos++] = 0; au[pos++] = 0; au[pos++] = 1;
+    au[pos++] = tag;
+    for (size_t i = 1; i < payload_size; ++i) au[pos++] = (uint8_t)((i % 254) + 1);
+    return pos;
+}
+
+// Returns true if the NAL tagged `tag` appears in the delivered stream
+static bool ContainsNal(const uint8_t *data, size_t size, uint8_t tag) {
+    for (size_t i = 0; i + 4 < size; ++i) {
+        if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1 && data[i+3] == tag) return true;
+    }
+    return false;
+}
+
+static void TestSlicedFrames(MemoryArena *arena) {
+    printf("Starting Sliced Frame Test...\n");
+
+    // SPS, PPS, slices of varying size (one larger than a chunk)
+    const size_t nal_sizes[] = {12, 6, 900, 1300, 3000, 500, 700};
+    const int nal_count = sizeof(nal_sizes) / sizeof(nal_sizes[0]);
+    uint8_t au[16384];
+    size_t au_size = 0;
+    for (int i = 0; i < nal_count; ++i) {
+        au_size = AppendNal(au, au_size, nal_sizes[i], (uint8_t)(0x61 + i));
+    }
+
+    SliceLayout *layout = PushStruct(arena, SliceLayout);
+    uint8_t *sparse = ArenaPush(arena, REASSEMBLY_BUFFER_SIZE);
+    size_t sparse_size = Protocol_LayoutSlices(au, au_size, MAX_PACKET_PAYLOAD, sparse, layout);
+    assert(sparse_size > 0);
+    printf("Laid out %zu byte AU into %d chunks.\n", au_size, layout->chunk_count);
+
+    // Lossless: everything arrives, in order, as several spans
+    Packetizer pz = {0};
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    SlicedMock *m = PushStructZero(arena, SlicedMock);
+    m->receiver = &r;
+    m->drop_chunk = -1;
+    Protocol_SendFrameSliced(&pz, sparse, layout, 0, SlicedMockSendCallback, m);
+    assert(m->completed);
+    assert(m->slices_delivered > 1);
+    for (int i = 0; i < nal_count; ++i) assert(ContainsNal(m->delivered, m->delivered_size, (uint8_t)(0x61 + i)));
+    assert(r.frames_lost == 0);
+    printf("Sliced: lossless frame delivered in %d spans.\n", m->slices_delivered);
+
+    // Drop the chunk carrying the 1300 byte slice: only that slice is lost
+    int drop = -1;
+    for (int i = 0; i < layout->chunk_count; ++i) {
+        if (ContainsNal(sparse + i * MAX_PACKET_PAYLOAD, layout->chunk_size[i], 0x64)) drop = i;
+    }
+    assert(drop > 0);
+    Reassembler_Init(&r, arena);
+    memset(m, 0, sizeof(*m));
+    m->receiver = &r;
+    m->drop_chunk = drop;
+    Protocol_SendFrameSliced(&pz, sparse, layout, 0, SlicedMockSendCallback, m);
+    assert(m->completed);
+    for (int i = 0; i < nal_count; ++i) {
+        assert(ContainsNal(m->delivered, m->delivered_size, (uint8_t)(0x61 + i)) == (i != 3));
+    }
+    assert(r.frames_lost == 1);
+    printf("Sliced: DATA VERIFIED, lost chunk %d cost exactly one slice.\n", drop);
+}
+
+// --- Loss-tolerant delivery ---
+typedef struct LossyMock {
+    Reassembler *receiver;
+    int drop_chunk;
+    int completed;
+} LossyMock;
+
+void LossyMockSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    LossyMock *m = (LossyMock *)user_data;
+    PacketHeader *header = (PacketHeader *)packet_data;
+    if (header->chunk_id == m->drop_chunk) return;
+
+    void *out = NULL;
+    size_t out_size = 0;
+    if (Protocol_HandlePacket(m->receiver, packet_data, packet_size, &out, &out_size, NULL) == RESULT_COMPLETE) {
+        m->completed++;
+    }
+}
+
+static void TestPartialDelivery(MemoryArena *arena) {
+    printf("Starting Partial Delivery Test...\n");
+
+    size_t frame_size = 5000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) {
+        frame_data[i] = (uint8_t)(i % 255);
+    }
+
+    Packetizer pz = {0};
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    r.partial_deadline = 0.050;
+    LossyMock m = { .receiver = &r, .drop_chunk = 1 };
+    Protocol_SendFrame(&pz, frame_data, frame_size, PACKET_FLAG_KEYFRAME, LossyMockSendCallback, &m);
+    assert(m.completed == 0);
+
+    void *out = NULL;
+    size_t out_size = 0;
+    uint8_t flags = 0;
+    MissingRange missing[MAX_MISSING_RANGES];
+    int missing_count = 0;
+
+    // Deadline clock starts at the first call, nothing before it passes
+    assert(!Reassembler_TakePartial(&r, 10.0, false, &out, &out_size, &flags, missing, &missing_count));
+    assert(!Reassembler_TakePartial(&r, 10.04, false, &out, &out_size, &flags, missing, &missing_count));
+    assert(Reassembler_TakePartial(&r, 10.06, false, &out, &out_size, &flags, missing, &missing_count));
+
+    assert(out_size == frame_size);
+    assert(flags == PACKET_FLAG_KEYFRAME);
+    assert(missing_count == 1);
+    assert(missing[0].offset == MAX_PACKET_PAYLOAD && missing[0].size == MAX_PACKET_PAYLOAD);
+    uint8_t *data = (uint8_t *)out;
+    for (size_t i = 0; i < out_size; ++i) {
+        bool in_hole = i >= missing[0].offset && i < missing[0].offset + missing[0].size;
+        assert(data[i] == (in_hole ? 0 : (uint8_t)(i % 255)));
+    }
+    assert(r.frames_lost == 1);
+
+    // Handed out once; the late chunk is ignored and not counted again
+    assert(!Reassembler_TakePartial(&r, 11.0, true, &out, &out_size, &flags, missing, &missing_count));
+    m.drop_chunk = -1;
+    Protocol_SendFrame(&pz, frame_data, frame_size, 0, LossyMockSendCallback, &m);
+    assert(m.completed == 1);
+    assert(r.frames_lost == 1);
+    printf("Partial: DATA VERIFIED, hole reported at %u (+%u).\n", missing[0].offset, missing[0].size);
+}
+
+// --- Wire format v2 ---
+typedef struct WireMock {
+    Reassembler *receiver;
+    uint8_t last_packet[PROTOCOL_MAX_PACKET_SIZE];
+    size_t last_size;
+    int packets;
+    int completed;
+    size_t wire_bytes;
+} WireMock;
+
+void WireMockSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    WireMock *m = (WireMock *)user_data;
+    memcpy(m->last_packet, packet_data, packet_size);
+    m->last_size = packet_size;
+    m->packets++;
+    m->wire_bytes += packet_size;
+
+    if (!m->receiver) return;
+    void *out = NULL;
+    size_t out_size = 0;
+    if (Protocol_HandlePacket(m->receiver, packet_data, packet_size, &out, &out_size, NULL) == RESULT_COMPLETE) {
+        const uint8_t *d = (const uint8_t *)out;
+        for (size_t i = 0; i < out_size; ++i) assert(d[i] == (uint8_t)(i % 255));
+        m->completed++;
+    }
+}
+
+static void TestWireFormatV2(MemoryArena *arena) {
+    printf("Starting Wire Format v2 Test...\n");
+
+    size_t frame_size = 5000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame_data[i] = (uint8_t)(i % 255);
+
+    // Negotiation: a current viewer's punch advertises v2, an old one (no payload) does not
+    Packetizer viewer_pz = {0};
+    WireMock punch = {0};
+    Protocol_SendPunch(&viewer_pz, WireMockSendCallback, &punch);
+    PacketInfo info;
+    assert(Protocol_ParseHeader(punch.last_packet, punch.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(info.version == PROTOCOL_WIRE_V1 && info.packet_type == PACKET_TYPE_PUNCH);
+    assert(Protocol_PunchWireVersion(&info) == PROTOCOL_WIRE_V2);
+    info.payload_size = 0;
+    assert(Protocol_PunchWireVersion(&info) == PROTOCOL_WIRE_V1);
+
+    // Round trip: v2 header fields survive, chunks are smaller, frame reassembles
+    Packetizer pz = { .wire_version = PROTOCOL_WIRE_V2, .stream_id = 3, .timestamp_us = 0x89ABCDEF };
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    WireMock m = { .receiver = &r };
+    Protocol_SendFrame(&pz, frame_data, frame_size, PACKET_FLAG_KEYFRAME, WireMockSendCallback, &m);
+    assert(m.completed == 1);
+    assert(r.wire_version == PROTOCOL_WIRE_V2);
+    assert(r.active_buffer.timestamp_us == 0x89ABCDEF);
+    assert(m.wire_bytes == frame_size + (size_t)m.packets * PROTOCOL_V2_HEADER_SIZE);
+
+    assert(Protocol_ParseHeader(m.last_packet, m.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(info.version == PROTOCOL_WIRE_V2);
+    assert(info.packet_type == PACKET_TYPE_VIDEO && info.stream_id == 3);
+    assert(info.frame_id == pz.frame_id_counter);
+    assert(info.chunk_id == m.packets - 1 && info.total_chunks == m.packets);
+    assert(info.flags == (PACKET_FLAG_KEYFRAME | PACKET_FLAG_END_OF_FRAME));
+    assert(info.timestamp_us == 0x89ABCDEF);
+    assert(info.payload_size == frame_size - (size_t)(m.packets - 1) * MAX_PACKET_PAYLOAD);
+
+    // v1 packets that happen to start with the v2 magic still parse as v1
+    Packetizer v1_pz = { .frame_id_counter = (PROTOCOL_V2_MAGIC | PROTOCOL_WIRE_V2) - 1 };
+    WireMock v1 = {0};
+    Protocol_SendFrame(&v1_pz, frame_data, 100, 0, WireMockSendCallback, &v1);
+    assert(v1.last_packet[0] == (PROTOCOL_V2_MAGIC | PROTOCOL_WIRE_V2));
+    assert(Protocol_ParseHeader(v1.last_packet, v1.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(info.version == PROTOCOL_WIRE_V1 && info.payload_size == 100);
+
+    printf("Wire v2: DATA VERIFIED, %d chunks, %zu header bytes saved.\n",
+           m.packets, (size_t)m.packets * (sizeof(PacketHeader) - PROTOCOL_V2_HEADER_SIZE));
+}
+
+// --- Path MTU probing ---
+// Mock path: host -> viewer datagrams above path_mtu - IP/UDP are dropped,
+// probes that arrive are acked straight back to the prober.
+typedef struct MtuPathMock {
+    MtuProber *prober;
+    Reassembler *receiver;
+    size_t path_mtu;
+    bool viewer_acks; // false: viewer predates MTU probing
+    int dropped;
+    int completed;
+    size_t largest_datagram;
+} MtuPathMock;
+
+void MtuPathSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    MtuPathMock *m = (MtuPathMock *)user_data;
+    if (packet_size + 28 > m->path_mtu) {
+        m->dropped++;
+        return;
+    }
+    if (packet_size > m->largest_datagram) m->largest_datagram = packet_size;
+
+    PacketInfo info;
+    assert(Protocol_ParseHeader(packet_data, packet_size, PROTOCOL_WIRE_V1, &info));
+    if (info.packet_type == PACKET_TYPE_MTU_PROBE) {
+        uint16_t probed = Protocol_MtuProbeSize(&info);
+        assert(probed == info.chunk_size);
+        if (m->viewer_acks) MtuProbe_OnAck(m->prober, probed);
+        return;
+    }
+
+    void *out = NULL;
+    size_t out_size = 0;
+    if (Protocol_HandlePacketInfo(m->receiver, &info, &out, &out_size, NULL) == RESULT_COMPLETE) {
+        const uint8_t *d = (const uint8_t *)out;
+        for (size_t i = 0; i < out_size; ++i) assert(d[i] == (uint8_t)(i % 255));
+        m->completed++;
+    }
+}
+
+// Runs a whole search on simulated time and returns the chosen chunk size
+static uint16_t RunMtuSearch(MtuPathMock *m, Packetizer *pz) {
+    MtuProbe_Reset(m->prober);
+    double now = 100.0;
+    while (m->prober->searching) {
+        MtuProbe_Poll(m->prober, now, pz, MtuPathSendCallback, m);
+        now += MTU_PROBE_INTERVAL;
+    }
+    pz->chunk_size = m->prober->chunk_size;
+    return Protocol_ChunkSize(pz);
+}
+
+static void TestPathMtuProbing(MemoryArena *arena) {
+    printf("Starting Path MTU Probing Test...\n");
+
+    size_t frame_size = 100000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame_data[i] = (uint8_t)(i % 255);
+
+    const struct { size_t mtu; bool acks; uint16_t expected; } paths[] = {
+        { 1420, true, 1344 },                 // WireGuard: default 1400 would not fit
+        { 1500, true, 1440 },                 // Ethernet
+        { 9000, true, 8928 },                 // Jumbo frames
+        { 1280, true, 1216 },                 // IPv4 minimum
+        { 1420, false, 1216 },                // Nothing acked: smallest candidate, not the default
+    };
+
+    for (int p = 0; p < (int)(sizeof(paths) / sizeof(paths[0])); ++p) {
+        MtuProber prober;
+        Reassembler r = {0};
+        Reassembler_Init(&r, arena);
+        MtuPathMock m = { .prober = &prober, .receiver = &r, .path_mtu = paths[p].mtu, .viewer_acks = paths[p].acks };
+
+        Packetizer pz = { .wire_version = (p % 2) ? PROTOCOL_WIRE_V2 : PROTOCOL_WIRE_V1 };
+        uint16_t chunk_size = RunMtuSearch(&m, &pz);
+        assert(chunk_size == paths[p].expected);
+
+        m.dropped = 0;
+        m.largest_datagram = 0;
+        Protocol_SendFrame(&pz, frame_data, frame_size, 0, MtuPathSendCallback, &m);
+        assert(m.completed == 1 && m.dropped == 0);
+        printf("MTU %zu: chunk size %u, %zu chunks per 100 KB frame, largest datagram %zu.\n",
+               paths[p].mtu, chunk_size, (frame_size + chunk_size - 1) / chunk_size, m.largest_datagram);
+    }
+    printf("MTU probing: VERIFIED.\n");
+}
+
+// --- Per-chunk decryption and packet authentication ---
+typedef struct AuthMock {
+    AES_Ctx *key; // Viewer's key
+    uint8_t packets[8][PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+    size_t sizes[8];
+    int count;
+} AuthMock;
+
+void AuthMockSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    AuthMock *m = (AuthMock *)user_data;
+    assert(m->count < 8);
+    memcpy(m->packets[m->count], packet_data, packet_size);
+    m->sizes[m->count++] = packet_size;
+}
+
+// Viewer path: verify, decrypt at the chunk's keystream offset, reassemble
+static ReassemblyResult AuthMockReceive(AuthMock *m, Reassembler *r, int i, void **out, size_t *out_size) {
+    PacketInfo info;
+    if (!Protocol_ParseHeader(m->packets[i], m->sizes[i], PROTOCOL_WIRE_V2, &info)) return RESULT_IGNORED;
+    if (!Protocol_VerifyPacket(m->key, m->packets[i], &info)) return RESULT_IGNORED;
+    uint8_t iv[16];
+    Protocol_MakeChunkIV(iv, &info);
+    AES_CTR_XcryptAt(m->key, iv, (uint64_t)info.chunk_id * info.chunk_size, info.payload, info.payload_size);
+    return Protocol_HandlePacketInfo(r, &info, out, out_size, NULL);
+}
+
+static void TestAuthenticatedChunks(MemoryArena *arena) {
+    printf("Starting Packet Authentication Test...\n");
+
+    uint8_t master_key[16], wrong_key[16];
+    AES_DeriveKey("correct horse", master_key);
+    AES_DeriveKey("battery staple", wrong_key);
+    AES_Ctx host_aes, viewer_aes, wrong_aes;
+    AES_Init(&host_aes, master_key);
+    AES_Init(&viewer_aes, master_key);
+    AES_Init(&wrong_aes, wrong_key);
+
+    size_t frame_size = 5000;
+    uint8_t *plain = ArenaPush(arena, frame_size);
+    uint8_t *cipher = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) plain[i] = (uint8_t)(i % 255);
+
+    // Host: one CTR stream per unit, every chunk tagged
+    Packetizer pz = { .wire_version = PROTOCOL_WIRE_V2, .auth = &host_aes };
+    uint8_t iv[16];
+    Protocol_MakeIV(iv, pz.frame_id_counter + 1, PACKET_TYPE_VIDEO, pz.stream_id);
+    memcpy(cipher, plain, frame_size);
+    AES_CTR_Xcrypt(&host_aes, iv, cipher, frame_size);
+    AuthMock m = { .key = &viewer_aes };
+    Protocol_SendFrame(&pz, cipher, frame_size, 0, AuthMockSendCallback, &m);
+    assert(m.count == 4);
+    for (int i = 0; i < m.count; ++i) assert(m.packets[i][2] & PACKET_FLAG_AUTHENTICATED);
+
+    // Forgeries: flipped payload bit, flipped header bit, stripped tag, wrong key
+    AuthMock forged = m;
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    void *out = NULL;
+    size_t out_size = 0;
+    forged.packets[0][PROTOCOL_V2_HEADER_SIZE + 10] ^= 0x01;
+    forged.packets[1][4] ^= 0x80;
+    forged.packets[2][2] &= ~PACKET_FLAG_AUTHENTICATED;
+    for (int i = 0; i < 3; ++i) assert(AuthMockReceive(&forged, &r, i, &out, &out_size) == RESULT_IGNORED);
+    forged = m;
+    forged.key = &wrong_aes;
+    for (int i = 0; i < forged.count; ++i) assert(AuthMockReceive(&forged, &r, i, &out, &out_size) == RESULT_IGNORED);
+    assert(r.active_buffer.received_bytes == 0); // Nothing reached the reassembler
+
+    // Genuine chunks, out of order: each one decrypts on its own
+    ReassemblyResult res = RESULT_IGNORED;
+    for (int i = m.count - 1; i >= 0; --i) res = AuthMockReceive(&m, &r, i, &out, &out_size);
+    assert(res == RESULT_COMPLETE);
+    assert(out_size == frame_size && memcmp(out, plain, frame_size) == 0);
+    printf("Auth: DATA VERIFIED, forged packets dropped, chunks decrypted out of order.\n");
+
+    // A sliced unit is also sent contiguous, so it has its own keystream
+    uint8_t sliced_iv[16];
+    Protocol_MakeIV(iv, 2, PACKET_TYPE_VIDEO, 0);
+    Protocol_MakeSlicedIV(sliced_iv, 2, PACKET_TYPE_VIDEO, 0);
+    assert(memcmp(iv, sliced_iv, 16) != 0);
+    uint8_t au[4096];
+    size_t au_size = 0;
+    au_size = AppendNal(au, au_size, 900, 0x61);
+    au_size = AppendNal(au, au_size, 1300, 0x62);
+    au_size = AppendNal(au, au_size, 500, 0x63);
+    SliceLayout *layout = PushStruct(arena, SliceLayout);
+    uint8_t *sparse = ArenaPush(arena, REASSEMBLY_BUFFER_SIZE);
+    size_t sparse_size = Protocol_LayoutSlices(au, au_size, MAX_PACKET_PAYLOAD, sparse, layout);
+    assert(sparse_size > 0 && layout->chunk_count <= 8);
+    AES_CTR_Xcrypt(&host_aes, sliced_iv, sparse, sparse_size);
+    m.count = 0;
+    Protocol_SendFrameSliced(&pz, sparse, layout, 0, AuthMockSendCallback, &m);
+    uint8_t delivered[4096];
+    size_t delivered_size = 0;
+    for (int i = 0; i < m.count; ++i) {
+        res = AuthMockReceive(&m, &r, i, &out, &out_size);
+        if (res == RESULT_SLICE || res == RESULT_COMPLETE) {
+            memcpy(delivered + delivered_size, out, out_size);
+            delivered_size += out_size;
+        }
+    }
+    assert(res == RESULT_COMPLETE);
+    for (uint8_t tag = 0x61; tag <= 0x63; ++tag) assert(ContainsNal(delivered, delivered_size, tag));
+    printf("Auth: sliced unit decrypted under its own IV.\n");
+}
+
+// --- Per-session keys ---
+static void TestSessionKeys(void) {
+    printf("Starting Session Key Test...\n");
+
+    // Same password, two sessions: different keys, so restarting frame and
+    // chunk IDs don't repeat a keystream or nonce
+    const uint8_t salt_a[AES_SALT_SIZE] = {1}, salt_b[AES_SALT_SIZE] = {2};
+    uint8_t key_a[16], key_a2[16], key_b[16];
+    AES_DeriveSessionKey("correct horse", salt_a, key_a);
+    AES_DeriveSessionKey("correct horse", salt_a, key_a2);
+    AES_DeriveSessionKey("correct horse", salt_b, key_b);
+    assert(memcmp(key_a, key_a2, 16) == 0 && memcmp(key_a, key_b, 16) != 0);
+
+    // The session packet carries the salt, tagged under the key it gives
+    AES_Ctx host_aes;
+    AES_Init(&host_aes, key_a);
+    Packetizer pz = { .wire_version = PROTOCOL_WIRE_V2, .auth = &host_aes };
+    AuthMock m = {0};
+    Protocol_SendSession(&pz, salt_a, AuthMockSendCallback, &m);
+    assert(m.count == 1);
+    PacketInfo info;
+    assert(Protocol_ParseHeader(m.packets[0], m.sizes[0], PROTOCOL_WIRE_V2, &info));
+    uint8_t salt[AES_SALT_SIZE];
+    assert(Protocol_SessionSalt(&info, salt) && memcmp(salt, salt_a, AES_SALT_SIZE) == 0);
+
+    uint8_t key[16];
+    AES_Ctx viewer_aes;
+    AES_DeriveSessionKey("correct horse", salt, key);
+    AES_Init(&viewer_aes, key);
+    assert(Protocol_VerifyPacket(&viewer_aes, m.packets[0], &info));
+    AES_DeriveSessionKey("battery staple", salt, key);
+    AES_Init(&viewer_aes, key);
+    assert(!Protocol_VerifyPacket(&viewer_aes, m.packets[0], &info));
+
+    // A packet of the previous session doesn't verify in this one
+    AES_Init(&viewer_aes, key_b);
+    assert(!Protocol_VerifyPacket(&viewer_aes, m.packets[0], &info));
+    printf("Session keys: Salted per session and authenticated VERIFIED.\n");
+}
+
+// --- Audio framing ---
+static void TestAudioConfig(void) {
+    printf("Starting Audio Config Test...\n");
+
+    // Viewers take metadata of exactly the size they know: it must not grow
+    assert(sizeof(StreamMetadata) == 108);
+
+    Packetizer pz = { .wire_version = PROTOCOL_WIRE_V2 };
+    WireMock m = {0};
+    Protocol_SendAudioConfig(&pz, 960, 3, WireMockSendCallback, &m);
+    PacketInfo info;
+    assert(Protocol_ParseHeader(m.last_packet, m.last_size, PROTOCOL_WIRE_V2, &info));
+    assert(Protocol_AudioPacketSize(&info) == 2880);
+    info.payload_size = 2;
+    assert(Protocol_AudioPacketSize(&info) == 0);
+    printf("Audio config: 3 x 20 ms packets advertised VERIFIED.\n");
+}
+
+// --- Simulcast ---
+static void TestSimulcastLayers(MemoryArena *arena) {
+    printf("Starting Simulcast Layer Test...\n");
+
+    size_t frame_size = 3000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame_data[i] = (uint8_t)(i % 255);
+
+    // Punches carry the wanted layer; older viewers ask for nothing (layer 0)
+    Packetizer viewer_pz = {0};
+    WireMock punch = {0};
+    PacketInfo info;
+    Protocol_SendLayerPunch(&viewer_pz, 2, 0, WireMockSendCallback, &punch);
+    assert(Protocol_ParseHeader(punch.last_packet, punch.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(Protocol_PunchWireVersion(&info) == PROTOCOL_WIRE_V2 && Protocol_PunchLayer(&info) == 2);
+    info.payload_size = 1;
+    assert(Protocol_PunchLayer(&info) == 0);
+
+    // Layers share frame IDs, so the stream id keeps their keystreams apart;
+    // stream 0 keeps the IV hosts used before stream ids
+    uint8_t iv0[16], iv1[16], legacy[16] = {0, 0, 0, 7, PACKET_TYPE_VIDEO};
+    Protocol_MakeIV(iv0, 7, PACKET_TYPE_VIDEO, 0);
+    Protocol_MakeIV(iv1, 7, PACKET_TYPE_VIDEO, 1);
+    assert(memcmp(iv0, legacy, 16) == 0 && memcmp(iv0, iv1, 16) != 0);
+
+    // Receiver follows layer 0, then switches to layer 1 at its IDR even
+    // though layer 0 already delivered a later frame
+    Packetizer layer0 = { .wire_version = PROTOCOL_WIRE_V2, .stream_id = 0 };
+    Packetizer layer1 = { .wire_version = PROTOCOL_WIRE_V2, .stream_id = 1 };
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    WireMock m = { .receiver = &r };
+    for (int f = 0; f < 3; ++f) Protocol_SendFrame(&layer0, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(m.completed == 3 && r.active_buffer.frame_id == 3);
+
+    layer1.frame_id_counter = 1;
+    Protocol_SendFrame(&layer1, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(m.completed == 3); // Delta of another layer: ignored
+    layer1.frame_id_counter = 1;
+    Protocol_SendFrame(&layer1, frame_data, frame_size, PACKET_FLAG_KEYFRAME | PACKET_FLAG_RECOVERY_POINT,
+                       WireMockSendCallback, &m);
+    assert(m.completed == 4 && r.active_buffer.stream_id == 1 && r.active_buffer.frame_id == 2);
+
+    Protocol_SendFrame(&layer0, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(m.completed == 4); // In-flight frame of the old layer: ignored
+    Protocol_SendFrame(&layer1, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(m.completed == 5 && r.active_buffer.frame_id == 3);
+
+    printf("Simulcast: Layer switch at IDR VERIFIED.\n");
+}
+
+static void TestTemporalLayers(MemoryArena *arena) {
+    printf("Starting Temporal Layer Test...\n");
+
+    size_t frame_size = 3000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame_data[i] = (uint8_t)(i % 255);
+
+    // The tag shares byte 1 with the stream id and survives the round trip
+    Packetizer pz = { .wire_version = PROTOCOL_WIRE_V2, .stream_id = 2, .temporal_layer = 1 };
+    WireMock m = {0};
+    PacketInfo info;
+    Protocol_SendFrame(&pz, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(Protocol_ParseHeader(m.last_packet, m.last_size, PROTOCOL_WIRE_V2, &info));
+    assert(info.stream_id == 2 && info.temporal_layer == 1 && info.packet_type == PACKET_TYPE_VIDEO);
+
+    // v1 has no room for it
+    Packetizer v1 = { .temporal_layer = 1 };
+    Protocol_SendFrame(&v1, frame_data, frame_size, 0, WireMockSendCallback, &m);
+    assert(Protocol_ParseHeader(m.last_packet, m.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(info.version == PROTOCOL_WIRE_V1 && info.temporal_layer == 0);
+
+    // Dropping every discardable frame loses nothing the receiver counts
+    Packetizer host = { .wire_version = PROTOCOL_WIRE_V2 };
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    WireMock recv = { .receiver = &r };
+    WireMock dropped = {0};
+    for (int f = 0; f < 8; ++f) {
+        host.temporal_layer = (uint8_t)(f & 1);
+        Protocol_SendFrame(&host, frame_data, frame_size, f == 0 ? PACKET_FLAG_KEYFRAME : 0,
+                           WireMockSendCallback, host.temporal_layer ? &dropped : &recv);
+    }
+    assert(recv.completed == 4 && r.frames_lost == 0 && r.active_buffer.frame_id == 7);
+
+    printf("Temporal Layers: Tagging and whole-frame dropping VERIFIED.\n");
+}
+
+static void TestUnitCache(MemoryArena *arena) {
+    printf("Starting GOP Cache Test...\n");
+
+    MemoryArena cache_arena;
+    ArenaInit(&cache_arena, UNIT_CACHE_SIZE + UNIT_CACHE_MAX_UNITS * sizeof(CachedUnit));
+    UnitCache c;
+    UnitCache_Init(&c, &cache_arena);
+
+    size_t frame_size = 3000;
+    uint8_t *frame_data = ArenaPush(arena, frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame_data[i] = (uint8_t)(i % 255);
+
+    // Nothing is cached before the first keyframe; a keyframe starts over.
+    // Each unit's v2 datagrams are logged as they go out live.
+    Packetizer live = { .wire_version = PROTOCOL_WIRE_V2 };
+    DatagramLog log = { .data = ArenaPush(arena, DATAGRAM_LOG_SIZE) };
+    assert(UnitCache_Add(&c, 1, 0, 0, 0, frame_data, frame_size, NULL, 0) && !c.valid);
+    for (uint32_t id = 2; id <= 6; ++id) {
+        uint8_t flags = (id == 2 || id == 5) ? PACKET_FLAG_KEYFRAME : 0;
+        live.frame_id_counter = id - 1;
+        live.timestamp_us = id * 1000;
+        log.used = 0;
+        Protocol_SendFrame(&live, frame_data, frame_size, flags, DatagramLog_SendCallback, &log);
+        assert(!log.overflow);
+        assert(UnitCache_Add(&c, id, id * 1000, flags, (uint8_t)(id & 1), frame_data, frame_size, log.data, log.used));
+    }
+    assert(c.valid && c.count == 2 && c.units[0].frame_id == 5);
+    assert(UnitCache_Find(&c, 0) == 0 && UnitCache_Find(&c, 6) == 1 && UnitCache_Find(&c, 7) == 2);
+
+    // Replayed to a v2 joiner as logged, with their original IDs, keyframe first
+    Reassembler r = {0};
+    Reassembler_Init(&r, arena);
+    WireMock recv = { .receiver = &r };
+    for (int i = 0; i < c.count; ++i) {
+        DatagramLog_Replay(c.data + c.units[i].datagram_offset, c.units[i].datagram_size,
+                           WireMockSendCallback, &recv);
+    }
+    assert(recv.completed == 2 && r.frames_lost == 0 && r.active_buffer.frame_id == 6);
+
+    // v1 joiners get the contiguous copy packetized again
+    Packetizer joiner = { .wire_version = PROTOCOL_WIRE_V1 };
+    Reassembler_Init(&r, arena);
+    recv = (WireMock){ .receiver = &r };
+    for (int i = 0; i < c.count; ++i) {
+        joiner.frame_id_counter = c.units[i].frame_id - 1;
+        Protocol_SendFrame(&joiner, c.data + c.units[i].offset, c.units[i].size, c.units[i].flags,
+                           WireMockSendCallback, &recv);
+    }
+    assert(recv.completed == 2 && r.frames_lost == 0 && r.active_buffer.frame_id == 6);
+
+    // A GOP that outgrows the cache is dropped until the next keyframe
+    uint32_t id = 7;
+    while (UnitCache_Add(&c, id++, 0, 0, 0, frame_data, frame_size, NULL, 0)) {}
+    assert(!c.valid && id - 7 == UNIT_CACHE_MAX_UNITS - 1);
+    assert(UnitCache_Add(&c, id, 0, 0, 0, frame_data, frame_size, NULL, 0) && !c.valid);
+    assert(UnitCache_Add(&c, id + 1, 0, PACKET_FLAG_KEYFRAME, 0, frame_data, frame_size, NULL, 0) && c.count == 1);
+
+    // Authenticated: a replayed chunk is the live one, tag included (a second
+    // packetization would reuse the unit's IV and nonces over other bytes)
+    uint8_t key[16];
+    AES_DeriveKey("correct horse", key);
+    AES_Ctx host_aes, viewer_aes;
+    AES_Init(&host_aes, key);
+    AES_Init(&viewer_aes, key);
+    uint8_t *cipher = ArenaPush(arena, frame_size);
+    memcpy(cipher, frame_data, frame_size);
+    uint8_t iv[16];
+    Protocol_MakeIV(iv, id + 2, PACKET_TYPE_VIDEO, 0);
+    AES_CTR_Xcrypt(&host_aes, iv, cipher, frame_size);
+    live = (Packetizer){ .wire_version = PROTOCOL_WIRE_V2, .auth = &host_aes, .frame_id_counter = id + 1 };
+    AuthMock sent = { .key = &viewer_aes }, replayed = { .key = &viewer_aes };
+    log = (DatagramLog){ .data = log.data, .next_fn = AuthMockSendCallback, .next_user = &sent };
+    Protocol_SendFrame(&live, cipher, frame_size, PACKET_FLAG_KEYFRAME, DatagramLog_SendCallback, &log);
+    assert(UnitCache_Add(&c, id + 2, 0, PACKET_FLAG_KEYFRAME, 0, cipher, frame_size, log.data, log.used));
+    DatagramLog_Replay(c.data + c.units[0].datagram_offset, c.units[0].datagram_size,
+                       AuthMockSendCallback, &replayed);
+    assert(sent.count == 3 && replayed.count == sent.count);
+    ReassemblyResult res = RESULT_IGNORED;
+    Reassembler_Init(&r, arena);
+    void *out = NULL;
+    size_t out_size = 0;
+    for (int i = 0; i < sent.count; ++i) {
+        assert(replayed.sizes[i] == sent.sizes[i]);
+        assert(memcmp(replayed.packets[i], sent.packets[i], sent.sizes[i]) == 0);
+        res = AuthMockReceive(&replayed, &r, i, &out, &out_size);
+    }
+    assert(res == RESULT_COMPLETE && out_size == frame_size && memcmp(out, frame_data, frame_size) == 0);
+
+    printf("GOP Cache: Keyframe-aligned caching and replay VERIFIED.\n");
+}
+
+// --- Audio loss: concealment gaps and the loss report to the host ---
+static void TestAudioLoss(void) {
+    printf("Starting Audio Loss Test...\n");
+
+    // In order: nothing to conceal. A gap is concealed before the packet that
+    // reveals it; the missing packet arriving afterwards is late.
+    AudioLossTracker t;
+    AudioLoss_Init(&t, 20.0);
+    assert(t.max_gap == 25 && t.window == 50);
+    assert(AudioLoss_OnPacket(&t, 100) == 0 && AudioLoss_OnPacket(&t, 101) == 0);
+    assert(AudioLoss_OnPacket(&t, 104) == 2);
+    assert(AudioLoss_OnPacket(&t, 103) == -1 && AudioLoss_OnPacket(&t, 104) == -1);
+    assert(AudioLoss_OnPacket(&t, 105) == 0);
+    assert(t.received == 4 && t.concealed == 2 && t.late == 2);
+
+    // A jump longer than AUDIO_LOSS_MAX_GAP_MS is a restart, not loss
+    assert(AudioLoss_OnPacket(&t, 105 + t.max_gap + 2) == 0 && t.concealed == 2);
+
+    // The limits are in time: 2.5 ms packets get eight times the packets
+    AudioLossTracker fast;
+    AudioLoss_Init(&fast, 2.5);
+    assert(fast.max_gap == 200 && fast.window == 400);
+    assert(AudioLoss_OnPacket(&fast, 1) == 0 && AudioLoss_OnPacket(&fast, 101) == 99);
+
+    // 10% loss over a window; it falls back slowly once the link is clean
+    AudioLossTracker ten;
+    AudioLoss_Init(&ten, 20.0);
+    uint32_t seq = 0;
+    for (int i = 0; i < (int)ten.window; ++i) {
+        seq += (i % 10 == 9) ? 2 : 1; // Every tenth packet lost
+        AudioLoss_OnPacket(&ten, seq);
+    }
+    assert(ten.loss_percent >= 8 && ten.loss_percent <= 10);
+    uint8_t lossy = ten.loss_percent;
+    for (int i = 0; i < (int)ten.window; ++i) AudioLoss_OnPacket(&ten, ++seq);
+    assert(ten.loss_percent > 0 && ten.loss_percent < lossy);
+    for (int i = 0; i < 20 * (int)ten.window; ++i) AudioLoss_OnPacket(&ten, ++seq);
+    assert(ten.loss_percent == 0);
+
+    // Our punches carry it to the host
+    Packetizer viewer_pz = {0};
+    WireMock punch = {0};
+    PacketInfo info;
+    Protocol_SendLayerPunch(&viewer_pz, 1, lossy, WireMockSendCallback, &punch);
+    assert(Protocol_ParseHeader(punch.last_packet, punch.last_size, PROTOCOL_WIRE_V1, &info));
+    assert(Protocol_PunchLayer(&info) == 1 && Protocol_PunchAudioLoss(&info) == lossy);
+    info.payload_size = 2;
+    assert(Protocol_PunchAudioLoss(&info) == 0);
+
+    printf("Audio Loss: Concealment gaps and loss reports VERIFIED.\n");
+}
+
 int main() {
     printf("Starting Network Protocol Test...\n");
 
     MemoryArena arena;
-    ArenaInit(&arena, 4 * 1024 * 1024);
+    ArenaInit(&arena, 64 * 1024 * 1024);
 
     // Setup
     Packetizer pz = {0};
@@ -58,7 +784,7 @@ int main() {
     printf("Generated Frame of size %zu. Sending...\n", frame_size);
 
     // Send
-    Protocol_SendFrame(&pz, frame_data, frame_size, MockSendCallback, &mock_net);
+    Protocol_SendFrame(&pz, frame_data, frame_size, 0, MockSendCallback, &mock_net);
 
     // Verify
     printf("Sent %d packets.\n", mock_net.packets_sent);
@@ -67,6 +793,18 @@ int main() {
     // In the mock callback we printed success. 
     // We can verify content if we kept the pointer.
     
+    TestSlicedFrames(&arena);
+    TestPartialDelivery(&arena);
+    TestWireFormatV2(&arena);
+    TestPathMtuProbing(&arena);
+    TestAuthenticatedChunks(&arena);
+    TestSessionKeys();
+    TestAudioConfig();
+    TestSimulcastLayers(&arena);
+    TestTemporalLayers(&arena);
+    TestUnitCache(&arena);
+    TestAudioLoss();
+
     // Test Complete
     return 0;
 }
@@ -0,0 +1,255 @@
+#include "../src/net/network_udp.c" // First: needs _GNU_SOURCE before libc headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../src/net/relay.h"
+#include "../src/net/aes.c"
+#include "../src/platform/linux_threading.c"
+#include "../src/platform/linux_time.c"
+
+// Loopback test: synthetic host -> relay -> headless viewers, all real UDP
+// sockets on 127.0.0.1.
+#define HOST_PORT 19900
+#define RELAY_PORT 19901
+#define VIEWER_PORT_BASE 19910
+#define VIEWER_COUNT 8
+#define EARLY_VIEWERS 4
+
+// UDP-only relay (ws = NULL); websocket.c would clash with aes.c's SHA1
+int WS_Poll(WebSocketContext *ctx) { (void)ctx; return 0; }
+void WS_Broadcast(WebSocketContext *ctx, uint8_t type, uint32_t frame_id, uint8_t flags, const void *data, size_t size) {
+    (void)ctx; (void)type; (void)frame_id; (void)flags; (void)data; (void)size;
+}
+
+typedef struct UdpTarget {
+    NetworkContext *net;
+    int port;
+} UdpTarget;
+
+static void UdpSendCallback(void *user_data, void *packet_data, size_t packet_size) {
+    UdpTarget *t = (UdpTarget *)user_data;
+    Net_Send(t->net, "127.0.0.1", t->port, packet_data, packet_size);
+}
+
+// --- Relay thread ---
+typedef struct RelayThread {
+    Relay *relay;
+    atomic_bool running;
+} RelayThread;
+
+static void RelayThreadProc(void *data) {
+    RelayThread *t = (RelayThread *)data;
+    while (atomic_load(&t->running)) {
+        if (Relay_Poll(t->relay) == 0) usleep(200);
+    }
+}
+
+// --- Synthetic host ---
+typedef struct TestHost {
+    NetworkContext *net;
+    Packetizer video, audio, control;
+    int punches;
+    int keyframe_requests;
+    uint16_t mtu_acked;
+} TestHost;
+
+static void TestHost_Poll(TestHost *h) {
+    uint8_t buf[256];
+    char ip[16];
+    int port, n;
+    while ((n = Net_Recv(h->net, buf, sizeof(buf), ip, &port)) > 0) {
+        PacketInfo info;
+        if (!Protocol_ParseHeader(buf, n, PROTOCOL_WIRE_V1, &info)) continue;
+        assert(port == RELAY_PORT);
+        if (info.packet_type == PACKET_TYPE_PUNCH) {
+            assert(Protocol_PunchWireVersion(&info) == PROTOCOL_WIRE_V2);
+            h->punches++;
+        } else if (info.packet_type == PACKET_TYPE_KEYFRAME_REQUEST) {
+            h->keyframe_requests++;
+        } else if (info.packet_type == PACKET_TYPE_MTU_ACK) {
+            h->mtu_acked = Protocol_MtuAckSize(&info);
+        }
+    }
+}
+
+static void TestHost_SendFrame(TestHost *h, bool keyframe, size_t size) {
+    static uint8_t frame[64 * 1024];
+    uint32_t frame_id = h->video.frame_id_counter + 1;
+    for (size_t i = 0; i < size; ++i) frame[i] = (uint8_t)(frame_id + i);
+    UdpTarget relay = { h->net, RELAY_PORT };
+    Protocol_SendFrame(&h->video, frame, size, keyframe ? PACKET_FLAG_KEYFRAME : 0, UdpSendCallback, &relay);
+
+    uint8_t opus[160] = {0};
+    Protocol_SendAudio(&h->audio, opus, sizeof(opus), UdpSendCallback, &relay);
+}
+
+// --- Headless viewers ---
+typedef struct TestViewer {
+    NetworkContext *net;
+    int port;
+    Packetizer pz;
+    Reassembler video;
+    int frames;
+    uint32_t first_frame_id;
+    bool first_was_keyframe;
+    uint32_t last_frame_id;
+    bool intact;
+    int audio;
+    int metadata;
+    int sessions;
+    uint32_t audio_packet_size;
+} TestViewer;
+
+static void TestViewer_Poll(TestViewer *v) {
+    uint8_t buf[PROTOCOL_MAX_PACKET_SIZE + AES_TAG_SIZE];
+    char ip[16];
+    int port, n;
+    while ((n = Net_Recv(v->net, buf, sizeof(buf), ip, &port)) > 0) {
+        assert(port == RELAY_PORT);
+        PacketInfo info;
+        if (!Protocol_ParseHeader(buf, n, PROTOCOL_WIRE_V2, &info)) continue;
+
+        if (info.packet_type == PACKET_TYPE_MTU_PROBE) {
+            UdpTarget back = { v->net, port };
+            Protocol_SendMtuAck(&v->pz, Protocol_MtuProbeSize(&info), UdpSendCallback, &back);
+        } else if (info.packet_type == PACKET_TYPE_METADATA) {
+            v->metadata++;
+        } else if (info.packet_type == PACKET_TYPE_SESSION) {
+            v->sessions++;
+        } else if (info.packet_type == PACKET_TYPE_AUDIO_CONFIG) {
+            v->audio_packet_size = Protocol_AudioPacketSize(&info);
+        } else if (info.packet_type == PACKET_TYPE_AUDIO) {
+            v->audio++;
+        } else if (info.packet_type == PACKET_TYPE_VIDEO) {
+            void *data = NULL;
+            size_t size = 0;
+            if (Protocol_HandlePacketInfo(&v->video, &info, &data, &size, NULL) != RESULT_COMPLETE) continue;
+            if (v->frames == 0) {
+                v->first_frame_id = info.frame_id;
+                v->first_was_keyframe = (info.flags & PACKET_FLAG_KEYFRAME) != 0;
+            }
+            if (v->frames > 0 && info.frame_id != v->last_frame_id + 1) v->intact = false;
+            for (size_t i = 0; i < size; ++i) {
+                if (((uint8_t *)data)[i] != (uint8_t)(info.frame_id + i)) v->intact = false;
+            }
+            v->last_frame_id = info.frame_id;
+            v->frames++;
+        }
+    }
+}
+
+static void TestViewer_Punch(TestViewer *v) {
+    UdpTarget relay = { v->net, RELAY_PORT };
+    Protocol_SendPunch(&v->pz, UdpSendCallback, &relay);
+}
+
+static void Pump(TestHost *h, TestViewer *viewers, int count, double seconds) {
+    double end = OS_GetTime() + seconds;
+    while (OS_GetTime() < end) {
+        TestHost_Poll(h);
+        for (int i = 0; i < count; ++i) TestViewer_Poll(&viewers[i]);
+        usleep(500);
+    }
+}
+
+int main() {
+    printf("Starting Relay Loopback Test...\n");
+
+    MemoryArena arena;
+    ArenaInit(&arena, 96 * 1024 * 1024);
+
+    TestHost host = {0};
+    host.net = Net_Init(&arena, HOST_PORT, true);
+    host.video.wire_version = host.audio.wire_version = host.control.wire_version = PROTOCOL_WIRE_V2;
+    host.audio.stream_id = 1;
+    assert(host.net);
+
+    NetworkContext *relay_net = Net_Init(&arena, RELAY_PORT, true);
+    assert(relay_net);
+    RelayThread rt = { .relay = Relay_Create(&arena, relay_net, NULL, "127.0.0.1", HOST_PORT) };
+    atomic_store(&rt.running, true);
+    OS_Thread *relay_thread = OS_ThreadCreate(RelayThreadProc, &rt);
+
+    TestViewer viewers[VIEWER_COUNT] = {0};
+    for (int i = 0; i < VIEWER_COUNT; ++i) {
+        viewers[i].port = VIEWER_PORT_BASE + i;
+        viewers[i].net = Net_Init(&arena, viewers[i].port, true);
+        viewers[i].intact = true;
+        assert(viewers[i].net);
+        Reassembler_Init(&viewers[i].video, &arena);
+    }
+
+    // 1. The relay registers with the host as a v2 viewer; early viewers join
+    //    before any keyframe exists, so the relay asks the host for one.
+    for (int i = 0; i < EARLY_VIEWERS; ++i) TestViewer_Punch(&viewers[i]);
+    Pump(&host, viewers, VIEWER_COUNT, 0.3);
+    assert(host.punches > 0);
+    if (host.keyframe_requests < 1) {
+        printf("Relay: NO KEYFRAME REQUEST FOR EARLY VIEWERS\n");
+        return 1;
+    }
+
+    // 2. One GOP: keyframe + 9 delta frames, with audio, after the key salt
+    const uint8_t salt[AES_SALT_SIZE] = {1, 2, 3};
+    UdpTarget upstream = { host.net, RELAY_PORT };
+    Protocol_SendSession(&host.control, salt, UdpSendCallback, &upstream);
+    Protocol_SendAudioConfig(&host.control, 960, 2, UdpSendCallback, &upstream);
+    TestHost_SendFrame(&host, true, 40000);
+    for (int f = 0; f < 9; ++f) {
+        Pump(&host, viewers, VIEWER_COUNT, 0.005);
+        TestHost_SendFrame(&host, false, 3000);
+    }
+    Pump(&host, viewers, VIEWER_COUNT, 0.2);
+    for (int i = 0; i < EARLY_VIEWERS; ++i) {
+        TestViewer *v = &viewers[i];
+        if (v->frames != 10 || !v->first_was_keyframe || !v->intact || v->audio != 10 || v->sessions != 1) {
+            printf("Relay: EARLY VIEWER %d got %d frames, %d audio (intact %d)\n", i, v->frames, v->audio, v->intact);
+            return 1;
+        }
+    }
+    printf("Relay: Live fan-out to %d viewers VERIFIED.\n", EARLY_VIEWERS);
+
+    // 3. Late joiners are replayed the cached GOP (no new keyframe from the
+    //    host) and then follow the live stream.
+    int requests_before = host.keyframe_requests;
+    for (int i = EARLY_VIEWERS; i < VIEWER_COUNT; ++i) TestViewer_Punch(&viewers[i]);
+    Pump(&host, viewers, VIEWER_COUNT, 0.3);
+    for (int f = 0; f < 2; ++f) {
+        TestHost_SendFrame(&host, false, 3000);
+        Pump(&host, viewers, VIEWER_COUNT, 0.05);
+    }
+    Pump(&host, viewers, VIEWER_COUNT, 0.2);
+    for (int i = 0; i < VIEWER_COUNT; ++i) {
+        TestViewer *v = &viewers[i];
+        if (v->frames != 12 || v->first_frame_id != 1 || !v->first_was_keyframe || !v->intact ||
+            v->sessions != 1 || v->audio_packet_size != 1920) {
+            printf("Relay: VIEWER %d got %d frames from %u (keyframe %d, intact %d, %d sessions)\n", i,
+                   v->frames, v->first_frame_id, v->first_was_keyframe, v->intact, v->sessions);
+            return 1;
+        }
+    }
+    assert(host.keyframe_requests == requests_before);
+    printf("Relay: Late joiners caught up from the GOP cache (key salt first) VERIFIED.\n");
+
+    // 4. Every viewer loses a picture at once: one request reaches the host
+    requests_before = host.keyframe_requests;
+    for (int i = 0; i < VIEWER_COUNT; ++i) {
+        UdpTarget relay = { viewers[i].net, RELAY_PORT };
+        Protocol_SendKeyframeRequest(&viewers[i].pz, UdpSendCallback, &relay);
+    }
+    Pump(&host, viewers, VIEWER_COUNT, 0.3);
+    printf("Relay: %d viewer keyframe requests -> %d upstream\n", VIEWER_COUNT,
+           host.keyframe_requests - requests_before);
+    assert(host.keyframe_requests - requests_before == 1);
+
+    // 5. MTU probes are acked upstream once every viewer acked them
+    Protocol_SendMtuProbe(&host.control, 1440, UdpSendCallback, &upstream);
+    Pump(&host, viewers, VIEWER_COUNT, 0.2);
+    assert(host.mtu_acked == 1440);
+    printf("Relay: End-to-end MTU probe ack VERIFIED.\n");
+
+    atomic_store(&rt.running, false);
+    OS_ThreadJoin(relay_thread);
+    Relay_Destroy(rt.relay);
+    return 0;
+}
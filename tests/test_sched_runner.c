@@ -0,0 +1,623 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include "../src/net/send_scheduler.h"
+#include "../src/net/viewer_table.h"
+#include "../src/net/aes.c"
+#include "../src/core/audio_ring.h"
+#include "../src/core/audio_jitter.h"
+#include "../src/core/playout_clock.h"
+#include "../src/platform/linux_threading.c"
+
+double OS_GetTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Test packets: first byte is the class, then the enqueue timestamp
+typedef struct TestPayload {
+    uint8_t priority;
+    int seq; // Audio: index into MockSocket.video_at_audio_send
+    double enqueued_at;
+    uint8_t body[];
+} TestPayload;
+
+#define MOCK_MAX_AUDIO 64
+
+// Mock Socket: records send order, audio queueing delay and how many video
+// datagrams went out before each audio one
+typedef struct MockSocket {
+    double wire_time_per_packet; // Simulated send cost (busy wait)
+    double first_send_stall;     // Extra stall on the very first send
+    int sent;
+    atomic_int video_sent; // Counted as a send starts
+    uint8_t order[64];
+    int audio_frames;
+    double audio_delay_min;
+    double audio_delay_max;
+    double audio_delay_sum;
+    int video_at_audio_send[MOCK_MAX_AUDIO];
+} MockSocket;
+
+static void MockSend(void *user_data, const char *dest_ip, int dest_port, const void *data, size_t size) {
+    (void)dest_ip; (void)dest_port; (void)size;
+    MockSocket *sock = (MockSocket *)user_data;
+    const TestPayload *p = (const TestPayload *)data;
+    double now = OS_GetTime();
+
+    if (sock->sent < 64) sock->order[sock->sent] = p->priority;
+    if (p->priority == SEND_PRIORITY_VIDEO) atomic_fetch_add(&sock->video_sent, 1);
+    if (p->priority == SEND_PRIORITY_AUDIO) {
+        if (p->seq >= 0 && p->seq < MOCK_MAX_AUDIO)
+            sock->video_at_audio_send[p->seq] = atomic_load(&sock->video_sent);
+        double delay = now - p->enqueued_at;
+        if (sock->audio_frames == 0 || delay < sock->audio_delay_min) sock->audio_delay_min = delay;
+        if (delay > sock->audio_delay_max) sock->audio_delay_max = delay;
+        sock->audio_delay_sum += delay;
+        sock->audio_frames++;
+    }
+
+    double stall = sock->wire_time_per_packet;
+    if (sock->sent == 0) stall += sock->first_send_stall;
+    sock->sent++;
+    while (OS_GetTime() - now < stall) {}
+}
+
+static void EnqueueSeq(SendScheduler *s, SendPriority priority, int seq, size_t size) {
+    uint8_t buf[1500];
+    TestPayload *p = (TestPayload *)buf;
+    p->priority = (uint8_t)priority;
+    p->seq = seq;
+    p->enqueued_at = OS_GetTime();
+    Scheduler_Enqueue(s, priority, "127.0.0.1", 9999, buf, size);
+}
+
+static void EnqueueTest(SendScheduler *s, SendPriority priority, size_t size) {
+    EnqueueSeq(s, priority, -1, size);
+}
+
+static void WaitForSends(MockSocket *sock, int count) {
+    while (((volatile MockSocket *)sock)->sent < count) usleep(100);
+}
+
+// Mock batch sink: counts system calls and datagrams per destination port
+typedef struct MockBatchSocket {
+    int calls;
+    int datagrams;
+    int per_port[4];
+    int last_seq[4];
+    bool in_order;
+} MockBatchSocket;
+
+static void MockSendBatch(void *user_data, const SchedulerDatagram *datagrams, int count) {
+    MockBatchSocket *sock = (MockBatchSocket *)user_data;
+    for (int i = 0; i < count; ++i) {
+        int d = datagrams[i].dest->port - 10000;
+        int seq = ((const uint8_t *)datagrams[i].data)[0];
+        if (seq != sock->last_seq[d] + 1) sock->in_order = false;
+        sock->last_seq[d] = seq;
+        sock->per_port[d]++;
+    }
+    sock->datagrams += count;
+    sock->calls++;
+}
+
+// --- Audio jitter while keyframes are in flight ---
+typedef struct AudioProducer {
+    SendScheduler *scheduler;
+    MockSocket *sock;
+    int frames;
+    int video_at_enqueue[MOCK_MAX_AUDIO];
+    bool exact[MOCK_MAX_AUDIO]; // No video send started during the enqueue
+} AudioProducer;
+
+static void AudioProducerProc(void *data) {
+    AudioProducer *a = (AudioProducer *)data;
+    for (int i = 0; i < a->frames; ++i) {
+        int before = atomic_load(&a->sock->video_sent);
+        EnqueueSeq(a->scheduler, SEND_PRIORITY_AUDIO, i, 200); // ~20 ms Opus frame
+        a->video_at_enqueue[i] = before;
+        a->exact[i] = atomic_load(&a->sock->video_sent) == before;
+        usleep(20000);
+    }
+}
+
+// --- Audio ring: one writer, one reader, no locks ---
+#define RING_TEST_SAMPLES 2000000
+
+static void RingProducerProc(void *data) {
+    AudioRing *r = (AudioRing *)data;
+    int16_t chunk[962];
+    uint32_t next = 0;
+    while (next < RING_TEST_SAMPLES) {
+        uint32_t count = 2 + (next * 7) % 960; // Odd sizes, so copies wrap anywhere
+        if (count > RING_TEST_SAMPLES - next) count = RING_TEST_SAMPLES - next;
+        for (uint32_t i = 0; i < count; ++i) chunk[i] = (int16_t)(next + i);
+        uint32_t done = 0;
+        while (done < count) done += AudioRing_Write(r, chunk + done, count - done);
+        next += count;
+    }
+}
+
+// --- Audio jitter buffer: simulated link and sound cards ---
+typedef struct JitterSim {
+    AudioRing ring;
+    AudioJitter jitter;
+    AudioResampler resampler;
+    uint32_t seed;
+    uint32_t packet;     // Frames per packet
+    double next_arrival; // Of packet `sent`, on our clock
+    uint32_t sent;
+    double loss;         // Fraction of packets lost, concealed when the next one arrives
+    uint32_t lost;       // Since the last arrival
+} JitterSim;
+
+static double SimRandom(JitterSim *sim) {
+    sim->seed = sim->seed * 1664525u + 1013904223u;
+    return (sim->seed >> 8) / 16777216.0;
+}
+
+// Runs from `start` for `seconds`: packets from a host whose clock is
+// `drift_ppm` fast, each delayed by up to `jitter_ms` (in order, like the
+// decoder queue), and 10 ms playout callbacks on our clock. Returns the
+// underruns counted over the run.
+static uint32_t SimulateJitter(JitterSim *sim, double start, double seconds, double drift_ppm, double jitter_ms) {
+    int16_t packet[AUDIO_FRAME_SIZE * AUDIO_CHANNELS] = {0};
+    double packet_s = (double)sim->packet / AUDIO_SAMPLE_RATE;
+    int16_t out[480 * AUDIO_CHANNELS];
+    uint32_t underruns = atomic_load(&sim->ring.underruns);
+    for (double now = start; now < start + seconds; now += 0.010) {
+        while (sim->next_arrival <= now) {
+            if (SimRandom(sim) < sim->loss) {
+                sim->lost++;
+            } else {
+                for (; sim->lost > 0; --sim->lost) {
+                    AudioJitter_OnConcealed(&sim->jitter, sim->packet);
+                    AudioRing_Write(&sim->ring, packet, sim->packet * AUDIO_CHANNELS);
+                }
+                AudioJitter_OnArrival(&sim->jitter, sim->next_arrival, sim->packet, atomic_load(&sim->ring.underruns));
+                AudioRing_Write(&sim->ring, packet, sim->packet * AUDIO_CHANNELS);
+            }
+            sim->sent++;
+            double sent_at = sim->sent * packet_s * (1.0 - drift_ppm * 1e-6);
+            double arrival = sent_at + 0.005 + SimRandom(sim) * jitter_ms / 1000.0;
+            if (arrival > sim->next_arrival) sim->next_arrival = arrival;
+        }
+        AudioJitter_Play(&sim->jitter, &sim->resampler, &sim->ring, out, 480);
+    }
+    return atomic_load(&sim->ring.underruns) - underruns;
+}
+
+// --- Playout clock: simulated arrivals, sorted like the network delivers them ---
+typedef struct PlayoutEvent {
+    double arrival;
+    uint32_t timestamp_us;
+    PlayoutStreamId stream;
+} PlayoutEvent;
+
+static int ComparePlayoutEvents(const void *a, const void *b) {
+    double d = ((const PlayoutEvent *)a)->arrival - ((const PlayoutEvent *)b)->arrival;
+    return (d > 0) - (d < 0);
+}
+
+// Runs `clock` over 60 s of 60 fps video (up to 15 ms jitter, a 40 ms spike
+// every 2 s) and 20 ms audio packets (up to 3 ms jitter) with a 30 ms
+// transit, capture timestamps starting `first_us` on the host's 32-bit clock.
+// Video decode takes 3 ms and the audio jitter buffer 10 ms. Returns the
+// video frames that arrived too late to be shown when due, after a 10 s
+// warm-up, and checks due times keep the source's cadence.
+#define PLAYOUT_SIM_EVENTS (3600 + 3000)
+static int SimulatePlayout(PlayoutClock *clock, uint32_t first_us) {
+    static PlayoutEvent events[PLAYOUT_SIM_EVENTS];
+    JitterSim rng = {.seed = 7};
+    int count = 0;
+    for (int i = 0; i < 3600; ++i) {
+        double captured = i / 60.0;
+        double jitter = SimRandom(&rng) * 0.015 + ((i % 120) == 0 ? 0.040 : 0.0);
+        events[count++] = (PlayoutEvent){captured + 0.030 + jitter, first_us + (uint32_t)lrint(captured * 1e6), PLAYOUT_VIDEO};
+    }
+    for (int i = 0; i < 3000; ++i) {
+        double captured = i * 0.020;
+        events[count++] = (PlayoutEvent){captured + 0.030 + SimRandom(&rng) * 0.003, first_us + (uint32_t)lrint(captured * 1e6), PLAYOUT_AUDIO};
+    }
+    qsort(events, count, sizeof(events[0]), ComparePlayoutEvents);
+
+    PlayoutClock_SetLatency(clock, PLAYOUT_VIDEO, 0.003);
+    PlayoutClock_SetLatency(clock, PLAYOUT_AUDIO, 0.010);
+    int late = 0;
+    double last_due = 0.0;
+    for (int i = 0; i < count; ++i) {
+        const PlayoutEvent *e = &events[i];
+        PlayoutClock_OnArrival(clock, e->stream, e->timestamp_us, e->arrival);
+        if (e->stream != PLAYOUT_VIDEO) continue;
+        double due = PlayoutClock_DueAt(clock, e->timestamp_us);
+        if (e->arrival < 10.0) continue;
+        if (e->arrival + 0.003 > due) late++;
+        // Due times step by whole frames (more after a frame overtaken by
+        // the next one), give or take the slew since the previous one
+        if (last_due > 0.0 && due > last_due) {
+            double step = due - last_due;
+            assert(fabs(step - lrint(step * 60.0) / 60.0) < 0.002);
+        }
+        if (due > last_due) last_due = due;
+    }
+    return late;
+}
+
+// 60 s of 60 fps video with a B frame between references, so it is sent in
+// decode order I0 P2 B1 P4 B3 ... (up to 5 ms jitter, 30 ms transit), through
+// a decoder that outputs in display order, one picture behind: I0 comes out
+// when P2 goes in, B1 when B1 does, P2 when P4 does. Decoding takes 3 ms.
+// Paces each picture on its own capture time (as the viewer does) or, with
+// `by_packet`, on that of the packet just sent. Returns the pictures shown
+// less than half a frame after the previous one, once the delay has slewed
+// to cover the reordering (15 s).
+static int SimulateReorderedPlayout(bool by_packet) {
+    PlayoutClock clock;
+    PlayoutClock_Init(&clock, 0.5);
+    PlayoutReorder reorder = {0};
+    JitterSim rng = {.seed = 11};
+    int pending = -1, back_to_back = 0;
+    double arrival = 0.0, t = 0.0, last_shown = 0.0;
+    for (int i = 0; i < 3600; ++i) {
+        // Decode order: 0, 2, 1, 4, 3, ... each pair sent once its P frame is captured
+        int frame = (i == 0) ? 0 : ((i % 2) ? i + 1 : i - 1);
+        int sent_at = (i == 0) ? 0 : ((i % 2) ? i + 1 : i);
+        double at = sent_at / 60.0 + 0.030 + SimRandom(&rng) * 0.005;
+        arrival = at > arrival ? at : arrival;
+        uint32_t sent_us = (uint32_t)lrint(frame / 60.0 * 1e6);
+        PlayoutClock_OnArrival(&clock, PLAYOUT_VIDEO, sent_us, arrival);
+
+        t = (t > arrival ? t : arrival) + 0.003;
+        if (pending < 0) {
+            pending = frame;
+            continue;
+        }
+        int out = pending < frame ? pending : frame;
+        pending = pending < frame ? frame : pending;
+        uint32_t out_us = (uint32_t)lrint(out / 60.0 * 1e6);
+
+        double hold = PlayoutReorder_Update(&reorder, sent_us, out_us, t);
+        PlayoutClock_SetLatency(&clock, PLAYOUT_VIDEO, 0.003 + (by_packet ? 0.0 : hold));
+        double due = PlayoutClock_DueAt(&clock, by_packet ? sent_us : out_us);
+        t = due > t ? due : t;
+        if (arrival > 15.0 && t - last_shown < 0.5 / 60.0) back_to_back++;
+        last_shown = t;
+    }
+    return back_to_back;
+}
+
+int main() {
+    printf("Starting Send Scheduler Test...\n");
+
+    // 1. Strict priority: while the sender is stuck on a video packet, later
+    //    control and audio packets overtake the queued video backlog.
+    {
+        MockSocket sock = { .first_send_stall = 0.005 };
+        SendScheduler *s = Scheduler_Create(MockSend, &sock);
+        EnqueueTest(s, SEND_PRIORITY_VIDEO, 1400);
+        usleep(1000); // Sender is now inside the stalled send
+        for (int i = 0; i < 3; ++i) EnqueueTest(s, SEND_PRIORITY_VIDEO, 1400);
+        EnqueueTest(s, SEND_PRIORITY_VIDEO_RETRANSMIT, 1400);
+        EnqueueTest(s, SEND_PRIORITY_AUDIO, 200);
+        EnqueueTest(s, SEND_PRIORITY_CONTROL, 16);
+        WaitForSends(&sock, 7);
+
+        const uint8_t expected[7] = {
+            SEND_PRIORITY_VIDEO, SEND_PRIORITY_CONTROL, SEND_PRIORITY_AUDIO,
+            SEND_PRIORITY_VIDEO_RETRANSMIT, SEND_PRIORITY_VIDEO, SEND_PRIORITY_VIDEO,
+            SEND_PRIORITY_VIDEO
+        };
+        for (int i = 0; i < 7; ++i) {
+            if (sock.order[i] != expected[i]) {
+                printf("Scheduler: ORDER MISMATCH at %d (expected class %d, got %d)\n", i, expected[i], sock.order[i]);
+                return 1;
+            }
+        }
+        Scheduler_Destroy(s);
+        printf("Scheduler: Priority order VERIFIED.\n");
+    }
+
+    // 2. Audio send-time jitter with 1080p-sized keyframes (~300 chunks) queued
+    //    every frame. Serialized behind a keyframe, audio would wait ~10 ms.
+    {
+        MockSocket sock = { .wire_time_per_packet = 0.000010 };
+        SendScheduler *s = Scheduler_Create(MockSend, &sock);
+        AudioProducer producer = { .scheduler = s, .sock = &sock, .frames = 50 };
+        OS_Thread *audio = OS_ThreadCreate(AudioProducerProc, &producer);
+
+        int video_packets = 0;
+        double start = OS_GetTime();
+        while (OS_GetTime() - start < 1.0) {
+            for (int i = 0; i < 300; ++i) EnqueueTest(s, SEND_PRIORITY_VIDEO, 1400);
+            video_packets += 300;
+            usleep(16667);
+        }
+        OS_ThreadJoin(audio);
+        WaitForSends(&sock, video_packets / 2); // Let the backlog drain a bit
+
+        double mean = sock.audio_delay_sum / sock.audio_frames;
+        printf("Scheduler: %d audio frames, delay min %.3f ms, mean %.3f ms, max %.3f ms (jitter %.3f ms)\n",
+               sock.audio_frames, sock.audio_delay_min * 1000.0, mean * 1000.0,
+               sock.audio_delay_max * 1000.0, (sock.audio_delay_max - sock.audio_delay_min) * 1000.0);
+        Scheduler_Destroy(s);
+
+        assert(sock.audio_frames == producer.frames);
+        // Wall-clock delay depends on thread wakeups; what the scheduler
+        // controls is order: audio waits for at most the rest of the video
+        // run already taken off the queue, never for the keyframe backlog
+        int measured = 0, worst = 0;
+        for (int i = 0; i < producer.frames; ++i) {
+            if (!producer.exact[i]) continue;
+            int overtaken = sock.video_at_audio_send[i] - producer.video_at_enqueue[i];
+            if (overtaken > worst) worst = overtaken;
+            measured++;
+        }
+        printf("Scheduler: at most %d video datagrams ahead of an audio frame (%d frames measured)\n",
+               worst, measured);
+        if (measured < producer.frames / 2 || worst > SCHEDULER_VIDEO_BURST) {
+            printf("Scheduler: AUDIO WAITS BEHIND VIDEO\n");
+            return 1;
+        }
+        printf("Scheduler: Audio jitter VERIFIED.\n");
+    }
+
+    // 3. Viewer fan-out: groups by wire version, one batched send per pacing
+    //    burst for all viewers, timeouts, per-viewer keyframe backoff.
+    {
+        ViewerTable table = {0};
+        bool joined;
+        double t = 100.0;
+        Viewer *a = ViewerTable_OnPunch(&table, "10.0.0.2", 10000, PROTOCOL_WIRE_V2, t, &joined);
+        assert(a && joined);
+        Viewer *b = ViewerTable_OnPunch(&table, "10.0.0.2", 10001, PROTOCOL_WIRE_V2, t, &joined);
+        assert(b && joined && b != a); // Same NAT, different port
+        Viewer *c = ViewerTable_OnPunch(&table, "10.0.0.3", 10002, PROTOCOL_WIRE_V1, t, &joined);
+        assert(c && joined && table.count == 3);
+        assert(ViewerTable_OnPunch(&table, "10.0.0.2", 10000, PROTOCOL_WIRE_V2, t, &joined) == a && !joined);
+
+        ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX];
+        int group_count = ViewerTable_Groups(&table, VIEWER_ALL_LAYERS, groups);
+        assert(group_count == 2);
+        assert(groups[0].wire_version == PROTOCOL_WIRE_V1 && groups[0].count == 1);
+        assert(groups[1].wire_version == PROTOCOL_WIRE_V2 && groups[1].count == 2);
+
+        // A v1 viewer pins the default chunk size and rules out probing
+        a->mtu.chunk_size = 1440;
+        b->mtu.chunk_size = 1344;
+        ViewerTable_UpdateChunkSize(&table);
+        assert(table.chunk_size == 0 && !ViewerTable_CanProbe(&table));
+
+        // Viewer c stops punching and times out; the smallest path MTU wins
+        t += VIEWER_TIMEOUT - 1.0;
+        ViewerTable_OnPunch(&table, "10.0.0.2", 10000, PROTOCOL_WIRE_V2, t, &joined);
+        ViewerTable_OnPunch(&table, "10.0.0.2", 10001, PROTOCOL_WIRE_V2, t, &joined);
+        t += 2.0;
+        assert(ViewerTable_Expire(&table, t) == 1 && table.count == 2);
+        assert(table.chunk_size == 1344 && ViewerTable_CanProbe(&table));
+
+        // Both new viewers want a keyframe; one IDR serves them
+        assert(ViewerTable_KeyframeDue(&table, 0, t));
+        ViewerTable_OnKeyframeForced(&table, 0, t);
+        assert(!ViewerTable_KeyframeDue(&table, 0, t));
+
+        // Viewer a is lossy and asks every 100 ms for 20 s; b stays clean
+        int forced = 0;
+        for (int i = 0; i < 200; ++i) {
+            t += 0.1;
+            ViewerTable_OnKeyframeRequest(a);
+            if (ViewerTable_KeyframeDue(&table, 0, t)) {
+                ViewerTable_OnKeyframeForced(&table, 0, t);
+                forced++;
+            }
+        }
+        printf("Scheduler: Lossy viewer asked 200 times, %d keyframes forced\n", forced);
+        assert(a->keyframe_requests == 200 && b->keyframes_served == 1);
+        if (forced > 8) {
+            printf("Scheduler: KEYFRAME BACKOFF NOT APPLIED\n");
+            return 1;
+        }
+
+        // Audio is encoded once: its FEC follows the worst reported loss
+        a->audio_loss_percent = 7;
+        b->audio_loss_percent = 2;
+        assert(ViewerTable_AudioLoss(&table) == 7);
+
+        // One payload queued for every viewer, sent in batched calls
+        MockBatchSocket sock = { .in_order = true };
+        SendScheduler *s = Scheduler_Create(MockSend, &sock);
+        Scheduler_SetBatchSend(s, MockSendBatch);
+        group_count = ViewerTable_Groups(&table, VIEWER_ALL_LAYERS, groups);
+        for (int i = 1; i <= 40; ++i) {
+            uint8_t chunk[1400] = { (uint8_t)i };
+            Scheduler_EnqueueFanout(s, SEND_PRIORITY_VIDEO, groups[0].dests, groups[0].count, chunk, sizeof(chunk));
+        }
+        while (((volatile MockBatchSocket *)&sock)->datagrams < 80) usleep(100);
+        Scheduler_Destroy(s);
+
+        printf("Scheduler: %d datagrams to %d viewers in %d send calls\n", sock.datagrams, groups[0].count, sock.calls);
+        assert(sock.per_port[0] == 40 && sock.per_port[1] == 40 && sock.in_order);
+        assert(sock.calls < 40);
+        printf("Scheduler: Viewer fan-out VERIFIED.\n");
+    }
+
+    // 4. Simulcast: viewers join the layer they ask for (clamped to what the
+    //    host encodes) and move to another one only at its IDR.
+    {
+        ViewerTable table = { .layer_count = 2 };
+        bool joined;
+        double t = 200.0;
+        Viewer *a = ViewerTable_OnPunch(&table, "10.0.0.2", 10000, PROTOCOL_WIRE_V2, t, &joined);
+        ViewerTable_RequestLayer(&table, a, 0, joined);
+        Viewer *b = ViewerTable_OnPunch(&table, "10.0.0.3", 10000, PROTOCOL_WIRE_V2, t, &joined);
+        ViewerTable_RequestLayer(&table, b, 2, joined);
+        assert(a->layer == 0 && b->layer == 1); // No layer 2 on this host
+
+        ViewerGroup groups[PROTOCOL_WIRE_VERSION_MAX];
+        assert(ViewerTable_Groups(&table, 0, groups) == 1 && groups[0].count == 1 && groups[0].dests[0].ip[7] == '2');
+        assert(ViewerTable_Groups(&table, 1, groups) == 1 && groups[0].dests[0].ip[7] == '3');
+        assert(ViewerTable_Groups(&table, VIEWER_ALL_LAYERS, groups) == 1 && groups[0].count == 2);
+        assert(ViewerTable_KeyframeDue(&table, 0, t) && ViewerTable_KeyframeDue(&table, 1, t));
+        ViewerTable_OnKeyframeForced(&table, 0, t);
+        ViewerTable_OnKeyframeForced(&table, 1, t);
+
+        // a asks for layer 1: it keeps getting layer 0 until layer 1's IDR
+        t += 5.0;
+        ViewerTable_RequestLayer(&table, a, 1, false);
+        assert(a->layer == 0 && ViewerTable_SwitchPending(&table, 1) && !ViewerTable_SwitchPending(&table, 0));
+        assert(ViewerTable_KeyframeDue(&table, 1, t) && !ViewerTable_KeyframeDue(&table, 0, t));
+        ViewerTable_OnKeyframeForced(&table, 1, t);
+        assert(ViewerTable_Groups(&table, 0, groups) == 1 && groups[0].count == 1);
+        ViewerTable_OnLayerIDR(&table, 1);
+        assert(a->layer == 1 && !ViewerTable_SwitchPending(&table, 1));
+        assert(ViewerTable_Groups(&table, 0, groups) == 0);
+        assert(ViewerTable_Groups(&table, 1, groups) == 1 && groups[0].count == 2);
+        printf("Scheduler: Simulcast layer switching VERIFIED.\n");
+    }
+
+    // 5. Audio ring: wrapping copies, overflow and underrun counts, then a
+    //    producer and a consumer thread moving 2M samples in odd-sized chunks
+    {
+        MemoryArena arena;
+        ArenaInit(&arena, 1024 * 1024);
+        AudioRing r;
+        AudioRing_Init(&r, &arena, 1000);
+        assert(r.capacity == 1024);
+
+        int16_t in[1024], out[1024];
+        for (int i = 0; i < 1024; ++i) in[i] = (int16_t)i;
+        assert(AudioRing_Write(&r, in, 1000) == 1000);
+        assert(AudioRing_Read(&r, out, 600) == 600 && out[599] == 599);
+        assert(AudioRing_Write(&r, in, 700) == 624); // Wraps, then overflows
+        assert(atomic_load(&r.overflows) == 1 && AudioRing_Available(&r) == 1024);
+        assert(AudioRing_Read(&r, out, 1024) == 1024);
+        assert(out[0] == 600 && out[399] == 999 && out[400] == 0 && out[1023] == 623);
+        assert(AudioRing_Read(&r, out, 2) == 0 && atomic_load(&r.underruns) == 1);
+
+        AudioRing shared;
+        AudioRing_Init(&shared, &arena, 4096);
+        OS_Thread *producer = OS_ThreadCreate(RingProducerProc, &shared);
+        uint32_t next = 0;
+        bool in_order = true;
+        while (next < RING_TEST_SAMPLES) {
+            uint32_t want = 2 + (next * 13) % 1000;
+            uint32_t available = AudioRing_Available(&shared);
+            if (available == 0) continue;
+            uint32_t got = AudioRing_Read(&shared, out, want < available ? want : available);
+            for (uint32_t i = 0; i < got; ++i) in_order &= out[i] == (int16_t)(next + i);
+            next += got;
+        }
+        OS_ThreadJoin(producer);
+        assert(in_order && AudioRing_Available(&shared) == 0);
+        assert(atomic_load(&shared.underruns) == 0);
+        printf("Scheduler: Lock-free audio ring VERIFIED.\n");
+    }
+
+    // 6. Audio jitter buffer: unity-rate resampling is a plain copy; on a LAN
+    //    it settles at 20-30 ms and measures the clock drift; a bad link grows
+    //    it until playout stops running dry, and it shrinks back afterwards
+    {
+        MemoryArena arena;
+        ArenaInit(&arena, 1024 * 1024);
+        JitterSim sim = {.seed = 1, .packet = AUDIO_FRAME_SIZE, .next_arrival = 0.005};
+        AudioRing_Init(&sim.ring, &arena, AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
+        AudioJitter_Init(&sim.jitter);
+        AudioResampler_Init(&sim.resampler, &arena);
+
+        int16_t ramp[100 * AUDIO_CHANNELS], out[60 * AUDIO_CHANNELS];
+        for (int i = 0; i < 100 * AUDIO_CHANNELS; ++i) ramp[i] = (int16_t)i;
+        AudioRing_Write(&sim.ring, ramp, 100 * AUDIO_CHANNELS);
+        assert(AudioResampler_Pull(&sim.resampler, &sim.ring, 1.0, out, 60) == 60);
+        assert(out[0] == 0 && out[119] == 119);
+        assert(AudioResampler_Depth(&sim.resampler, &sim.ring) == 40);
+        AudioResampler_Skip(&sim.resampler, &sim.ring, 40);
+        assert(AudioResampler_Depth(&sim.resampler, &sim.ring) == 0);
+
+        SimulateJitter(&sim, 0.0, 60.0, 150.0, 2.0);
+        uint32_t lan_underruns = SimulateJitter(&sim, 60.0, 180.0, 150.0, 2.0);
+        double lan_target = atomic_load(&sim.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE;
+        int lan_drift = atomic_load(&sim.jitter.drift_ppm);
+        printf("Scheduler: LAN: target %.1f ms, drift %d ppm, %u underruns\n", lan_target, lan_drift, lan_underruns);
+        assert(lan_underruns == 0);
+        assert(lan_target >= 20.0 && lan_target <= 30.0);
+        assert(lan_drift > 75 && lan_drift < 225);
+
+        SimulateJitter(&sim, 240.0, 60.0, -80.0, 60.0);
+        uint32_t bad_underruns = SimulateJitter(&sim, 300.0, 120.0, -80.0, 60.0);
+        double bad_target = atomic_load(&sim.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE;
+        printf("Scheduler: Bad link: target %.1f ms, %u underruns\n", bad_target, bad_underruns);
+        assert(bad_underruns == 0);
+        assert(bad_target > 60.0 && bad_target <= AUDIO_JITTER_MAX_MS);
+
+        SimulateJitter(&sim, 420.0, 120.0, 0.0, 2.0);
+        double recovered = atomic_load(&sim.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE;
+        assert(recovered <= 30.0);
+
+        // Loss is not jitter: concealed packets stretch the interval to the
+        // next arrival, the measured jitter stays the link's (up to 2 ms).
+        // The buffer still grows for the underruns while a lost packet's
+        // successor is awaited.
+        sim.loss = 0.05;
+        uint32_t lossy_underruns = SimulateJitter(&sim, 540.0, 60.0, 0.0, 2.0);
+        sim.loss = 0.0;
+        double lossy_jitter = atomic_load(&sim.jitter.jitter_us) / 1000.0;
+        double lossy_target = atomic_load(&sim.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE;
+        printf("Scheduler: 5%% loss: jitter %.1f ms, target %.1f ms, %u underruns\n", lossy_jitter, lossy_target, lossy_underruns);
+        assert(lossy_jitter < 2.0);
+
+        // 2.5 ms packets: the advertised size restarts the target low, and a
+        // LAN settles below the 20 ms one packet of the default framing took
+        JitterSim fast = {.seed = 2, .packet = 120, .next_arrival = 0.005};
+        AudioRing_Init(&fast.ring, &arena, AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
+        AudioJitter_Init(&fast.jitter);
+        AudioResampler_Init(&fast.resampler, &arena);
+        AudioJitter_SetPacket(&fast.jitter, 120);
+        assert(fabs(atomic_load(&fast.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE - 25.0) < 0.1);
+        SimulateJitter(&fast, 0.0, 30.0, 0.0, 0.5);
+        uint32_t fast_underruns = SimulateJitter(&fast, 30.0, 60.0, 0.0, 0.5);
+        double fast_target = atomic_load(&fast.jitter.target_frames) * 1000.0 / AUDIO_SAMPLE_RATE;
+        printf("Scheduler: 2.5 ms packets: target %.1f ms, %u underruns\n", fast_target, fast_underruns);
+        assert(fast_underruns == 0 && fast_target < 20.0);
+        printf("Scheduler: Adaptive audio jitter buffer VERIFIED.\n");
+    }
+
+    // 7. Playout clock: video is due at the source's cadence a common delay
+    //    after capture, across the 32-bit timestamp wrap; the smoothest
+    //    setting covers the jitter spikes, the lowest-latency one shows them
+    //    late; the delay always covers what audio's jitter buffer needs
+    {
+        PlayoutClock fastest, smoothest;
+        PlayoutClock_Init(&fastest, 0.0);
+        PlayoutClock_Init(&smoothest, 1.0);
+        int fastest_late = SimulatePlayout(&fastest, 0xFFFFFFFFu - 20000000u);
+        int smoothest_late = SimulatePlayout(&smoothest, 0xFFFFFFFFu - 20000000u);
+        printf("Scheduler: Playout delay %.1f ms (%d late frames) lowest latency, %.1f ms (%d late) smoothest\n",
+               fastest.delay * 1000.0, fastest_late, smoothest.delay * 1000.0, smoothest_late);
+        assert(fastest.delay < smoothest.delay);
+        assert(smoothest_late < fastest_late && smoothest_late <= 30);
+        assert(fastest.delay >= 0.010 + PLAYOUT_MARGIN && smoothest.delay <= 0.070);
+
+        PlayoutClock plain;
+        PlayoutClock_Init(&plain, 0.5);
+        PlayoutClock_OnArrival(&plain, PLAYOUT_VIDEO, 0xFFFFFF00u, 1.0);
+        PlayoutClock_OnArrival(&plain, PLAYOUT_VIDEO, 0x00000100u, 1.0005);
+        assert(fabs(PlayoutClock_DueAt(&plain, 0x00000100u) - PlayoutClock_DueAt(&plain, 0xFFFFFF00u) - 0.000512) < 1e-9);
+        printf("Scheduler: A/V playout clock VERIFIED.\n");
+    }
+
+    // 8. Playout with B frames: pictures come out of the decoder in display
+    //    order, behind the packets that went in; paced on their own capture
+    //    times they keep the source's cadence instead of showing in pairs
+    {
+        int by_packet = SimulateReorderedPlayout(true);
+        int by_picture = SimulateReorderedPlayout(false);
+        printf("Scheduler: Reordered playout: %d back-to-back pictures paced by packet, %d by picture\n",
+               by_packet, by_picture);
+        assert(by_packet > 100 && by_picture == 0);
+        printf("Scheduler: Reordered playout VERIFIED.\n");
+    }
+
+    return 0;
+}
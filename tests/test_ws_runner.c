@@ -0,0 +1,409 @@
+#include "../src/net/websocket.c" // First: needs _GNU_SOURCE before libc headers
+#include "../src/net/web_assets.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../src/platform/linux_threading.c"
+#include "../src/platform/linux_time.c"
+
+// Loopback test: real TCP clients against the server thread on 127.0.0.1.
+#define WS_TEST_PORT 19950
+#define WS_TEST_CLIENTS 200
+
+static const char *UPGRADE_REQUEST =
+    "GET /ws HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "upgrade: WebSocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+
+static int ConnectWithBuffer(int rcvbuf) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(WS_TEST_PORT)};
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    struct timeval tv = {.tv_sec = 2};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static int Connect(void) { return ConnectWithBuffer(0); }
+
+static void SendAll(int fd, const void *data, size_t size) {
+    assert(send(fd, data, size, MSG_NOSIGNAL) == (ssize_t)size);
+}
+
+// Reads up to the blank line ending an HTTP response
+static void ReadResponse(int fd, char *out, size_t out_size) {
+    size_t used = 0;
+    while (used + 1 < out_size) {
+        ssize_t n = recv(fd, out + used, 1, 0);
+        if (n <= 0) break;
+        used += (size_t)n;
+        if (used >= 4 && memcmp(out + used - 4, "\r\n\r\n", 4) == 0) break;
+    }
+    out[used] = '\0';
+}
+
+static size_t RecvExact(int fd, uint8_t *out, size_t size) {
+    size_t used = 0;
+    while (used < size) {
+        ssize_t n = recv(fd, out + used, size - used, 0);
+        if (n <= 0) break;
+        used += (size_t)n;
+    }
+    return used;
+}
+
+// Reads one unmasked server frame; returns its opcode, or -1 on EOF
+static int RecvFrame(int fd, uint8_t *payload, size_t *size) {
+    uint8_t h[10];
+    if (RecvExact(fd, h, 2) != 2) return -1;
+    size_t length = h[1] & 0x7F;
+    if (length == 126) {
+        RecvExact(fd, h + 2, 2);
+        length = ((size_t)h[2] << 8) | h[3];
+    } else if (length == 127) {
+        RecvExact(fd, h + 2, 8);
+        length = 0;
+        for (int i = 0; i < 8; ++i) length = (length << 8) | h[2 + i];
+    }
+    assert(RecvExact(fd, payload, length) == length);
+    *size = length;
+    return h[0] & 0x0F;
+}
+
+// Sends a masked client frame
+static void SendFrame(int fd, uint8_t opcode, const void *payload, size_t size) {
+    uint8_t frame[256];
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    assert(size <= 125);
+    frame[0] = 0x80 | opcode;
+    frame[1] = 0x80 | (uint8_t)size;
+    memcpy(frame + 2, mask, 4);
+    for (size_t i = 0; i < size; ++i) frame[6 + i] = ((const uint8_t *)payload)[i] ^ mask[i & 3];
+    SendAll(fd, frame, 6 + size);
+}
+
+// Queue policy without sockets: what a client that falls behind keeps
+static void TestQueuePolicy(void) {
+    static uint8_t frame[100 * 1024];
+    WSClient c = {0};
+    snprintf(c.name, sizeof(c.name), "policy");
+    c.awaiting_keyframe = true;
+
+    WSMessage *key = WS_CreateMessage(WS_OP_BINARY, WS_MESSAGE_VIDEO | WS_MESSAGE_KEYFRAME, NULL, 0, frame, sizeof(frame));
+    WSMessage *ref = WS_CreateMessage(WS_OP_BINARY, WS_MESSAGE_VIDEO, NULL, 0, frame, sizeof(frame));
+    WSMessage *disc = WS_CreateMessage(WS_OP_BINARY, WS_MESSAGE_VIDEO | WS_MESSAGE_DISCARDABLE, NULL, 0, frame, sizeof(frame));
+    WSMessage *audio = WS_CreateMessage(WS_OP_BINARY, 0, NULL, 0, frame, 200);
+
+    // A new client starts at a keyframe
+    WS_Enqueue(&c, ref);
+    WS_Enqueue(&c, audio);
+    assert(c.queue_count == 1 && WS_QueueAt(&c, 0) == audio);
+    WS_Enqueue(&c, key);
+    assert(!c.awaiting_keyframe && c.queue_count == 2);
+
+    // Discardable frames go first once the queue backs up...
+    for (int i = 0; i < 4; ++i) {
+        WS_Enqueue(&c, disc);
+        WS_Enqueue(&c, ref);
+    }
+    assert(c.frames_shed > 0 && c.queue_bytes >= WS_QUEUE_SHED_BYTES);
+    assert(c.resyncs == 0);
+
+    // ...then queued video is dropped and the client waits for a keyframe
+    c.head_offset = 1; // The head (audio) is partly written: it stays
+    while (!c.awaiting_keyframe) WS_Enqueue(&c, ref);
+    assert(c.resyncs == 1 && c.queue_count == 1 && WS_QueueAt(&c, 0) == audio);
+    WS_Enqueue(&c, audio); // Audio keeps flowing
+    WS_Enqueue(&c, ref);
+    WS_Enqueue(&c, disc);
+    assert(c.queue_count == 2);
+    WS_Enqueue(&c, key);
+    assert(!c.awaiting_keyframe && c.queue_count == 3);
+
+    for (int i = 0; i < c.queue_count; ++i) WS_ReleaseMessage(WS_QueueAt(&c, i));
+    assert(key->refs == 1 && ref->refs == 1 && disc->refs == 1 && audio->refs == 1);
+    WS_ReleaseMessage(key);
+    WS_ReleaseMessage(ref);
+    WS_ReleaseMessage(disc);
+    WS_ReleaseMessage(audio);
+    printf("WS: Send queue policy VERIFIED.\n");
+}
+
+static int WaitForHandshakes(WebSocketContext *ws, int expected) {
+    int total = 0;
+    double end = OS_GetTime() + 3.0;
+    while (total < expected && OS_GetTime() < end) {
+        total += WS_Poll(ws);
+        usleep(1000);
+    }
+    return total;
+}
+
+// Value of a response header (case-sensitive, as the server writes them)
+static bool ResponseHeader(const char *response, const char *name, char *out, size_t out_size) {
+    const char *line = strstr(response, name);
+    if (!line) return false;
+    line += strlen(name);
+    size_t len = strcspn(line, "\r");
+    if (len >= out_size) return false;
+    memcpy(out, line, len);
+    out[len] = '\0';
+    return true;
+}
+
+// The viewer page on the same port: keep-alive, ETag revalidation, HEAD,
+// and an upgrade on the connection that fetched the page
+static void TestHttp(WebSocketContext *ws) {
+    FILE *f = fopen("web/index.html", "rb");
+    assert(f);
+    static uint8_t page[256 * 1024], body[256 * 1024];
+    size_t page_size = fread(page, 1, sizeof(page), f);
+    fclose(f);
+    assert(page_size == (size_t)(web_index_html_end - web_index_html));
+
+    int fd = Connect();
+    char response[1024], value[64], etag[64];
+    const char *get = "GET /?host=x HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    SendAll(fd, get, strlen(get));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 200", 12) == 0);
+    assert(ResponseHeader(response, "Content-Length: ", value, sizeof(value)) && (size_t)atol(value) == page_size);
+    assert(ResponseHeader(response, "Content-Type: ", value, sizeof(value)) && strncmp(value, "text/html", 9) == 0);
+    assert(ResponseHeader(response, "Cache-Control: ", value, sizeof(value)) && strcmp(value, "no-cache") == 0);
+    assert(ResponseHeader(response, "ETag: ", etag, sizeof(etag)) && etag[0] == '"');
+    assert(RecvExact(fd, body, page_size) == page_size && memcmp(body, page, page_size) == 0);
+
+    // Same connection: revalidation, then HEAD
+    char request[256];
+    snprintf(request, sizeof(request), "GET /index.html HTTP/1.1\r\nHost: x\r\nIf-None-Match: %s\r\n\r\n", etag);
+    SendAll(fd, request, strlen(request));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 304", 12) == 0 && !strstr(response, "Content-Length"));
+    const char *head = "HEAD / HTTP/1.1\r\nHost: x\r\n\r\n";
+    SendAll(fd, head, strlen(head));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 200", 12) == 0);
+
+    // Then the stream, still on the same connection
+    SendAll(fd, UPGRADE_REQUEST, strlen(UPGRADE_REQUEST));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 101", 12) == 0);
+    assert(WaitForHandshakes(ws, 1) == 1);
+    close(fd);
+
+    // Unknown paths and methods
+    fd = Connect();
+    const char *missing = "GET /favicon.ico HTTP/1.1\r\nHost: x\r\n\r\n";
+    SendAll(fd, missing, strlen(missing));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 404", 12) == 0);
+    close(fd);
+    fd = Connect();
+    const char *post = "POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 0\r\n\r\n";
+    SendAll(fd, post, strlen(post));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 405", 12) == 0);
+    close(fd);
+    printf("WS: Web viewer over HTTP VERIFIED.\n");
+}
+
+int main() {
+    printf("Starting WebSocket Server Test...\n");
+    TestQueuePolicy();
+
+    MemoryArena arena;
+    ArenaInit(&arena, 1024 * 1024);
+    WebSocketContext *ws = WS_Init(&arena, WS_TEST_PORT);
+    assert(ws);
+
+    // 1. Handshake sent in pieces (the server must buffer until the blank line)
+    int fd = Connect();
+    size_t len = strlen(UPGRADE_REQUEST);
+    SendAll(fd, UPGRADE_REQUEST, 20);
+    usleep(50 * 1000);
+    SendAll(fd, UPGRADE_REQUEST + 20, len - 22);
+    usleep(50 * 1000);
+    assert(WS_Poll(ws) == 0);
+    SendAll(fd, UPGRADE_REQUEST + len - 2, 2);
+
+    char response[512];
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 101", 12) == 0);
+    assert(strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")); // RFC 6455 example
+    assert(WaitForHandshakes(ws, 1) == 1);
+    printf("WS: Fragmented handshake VERIFIED.\n");
+    TestHttp(ws);
+
+    // 2. Broadcast framing: [frame_id BE][type][data] (not video: not cached)
+    static uint8_t payload[100000];
+    size_t size;
+    for (size_t i = 0; i < sizeof(payload); ++i) payload[i] = (uint8_t)i;
+    WS_Broadcast(ws, 1, 0x01020304, 0, payload, 70000);
+    static uint8_t received[128 * 1024];
+    assert(RecvFrame(fd, received, &size) == WS_OP_BINARY);
+    assert(size == 70000 + 5);
+    assert(received[0] == 1 && received[1] == 2 && received[2] == 3 && received[3] == 4 && received[4] == 1);
+    assert(memcmp(received + 5, payload, 70000) == 0);
+
+    // 3. Ping is answered with a pong carrying the same payload
+    SendFrame(fd, WS_OP_PING, "hello", 5);
+    assert(RecvFrame(fd, received, &size) == WS_OP_PONG);
+    assert(size == 5 && memcmp(received, "hello", 5) == 0);
+
+    // 4. Close is echoed, then the server hangs up
+    const uint8_t code[2] = {0x03, 0xE8}; // 1000
+    SendFrame(fd, WS_OP_CLOSE, code, 2);
+    assert(RecvFrame(fd, received, &size) == WS_OP_CLOSE);
+    assert(size == 2 && received[0] == 0x03 && received[1] == 0xE8);
+    assert(RecvFrame(fd, received, &size) == -1);
+    close(fd);
+    printf("WS: Ping/pong and close handshake VERIFIED.\n");
+
+    // 5. Plain HTTP on the WebSocket endpoint and unmasked frames are refused
+    fd = Connect();
+    const char *plain = "GET /ws HTTP/1.1\r\nHost: x\r\n\r\n";
+    SendAll(fd, plain, strlen(plain));
+    ReadResponse(fd, response, sizeof(response));
+    assert(strncmp(response, "HTTP/1.1 400", 12) == 0);
+    close(fd);
+
+    fd = Connect();
+    SendAll(fd, UPGRADE_REQUEST, len);
+    ReadResponse(fd, response, sizeof(response));
+    assert(WaitForHandshakes(ws, 1) == 1);
+    const uint8_t unmasked[2] = {0x82, 0x00};
+    SendAll(fd, unmasked, 2);
+    assert(RecvFrame(fd, received, &size) == WS_OP_CLOSE);
+    assert(((received[0] << 8) | received[1]) == WS_CLOSE_PROTOCOL_ERROR);
+    close(fd);
+    printf("WS: Bad requests and frames rejected VERIFIED.\n");
+
+    // 6. Messages from the web viewer: playback stats, and a keyframe
+    // request from a decoder that fell behind
+    fd = Connect();
+    SendAll(fd, UPGRADE_REQUEST, len);
+    ReadResponse(fd, response, sizeof(response));
+    assert(WaitForHandshakes(ws, 1) == 1);
+    WSViewerStats stats;
+    assert(WS_GetViewerStats(ws, &stats) == 0);
+    const uint8_t report[1 + WS_STATS_SIZE] = {WS_CLIENT_STATS, 0x02, 0x55, 0x00, 0x2A, 0x00, 0x03,
+                                               0x00, 0x50, 0x00, 0x3C, 0x00, 0x00, 0x01, 0x02};
+    SendFrame(fd, WS_OP_BINARY, report, sizeof(report));
+    double deadline = OS_GetTime() + 2.0;
+    while (WS_GetViewerStats(ws, &stats) == 0 && OS_GetTime() < deadline) usleep(10 * 1000);
+    assert(stats.fps > 59.6f && stats.fps < 59.8f && stats.decode_ms > 4.1f && stats.decode_ms < 4.3f);
+    assert(stats.decode_queue == 3 && stats.latency_ms == 80 && stats.audio_buffer_ms == 60);
+    assert(stats.frames_dropped == 258);
+
+    WS_Broadcast(ws, 1, 500, WS_MESSAGE_VIDEO | WS_MESSAGE_KEYFRAME, payload, 100);
+    assert(RecvFrame(fd, received, &size) == WS_OP_BINARY && received[3] == (500 & 0xFF));
+    const uint8_t keyframe_request = WS_CLIENT_KEYFRAME_REQUEST;
+    SendFrame(fd, WS_OP_BINARY, &keyframe_request, 1);
+    assert(WaitForHandshakes(ws, 1) == 1); // Forwarded to the host, with backoff
+    WS_Broadcast(ws, 1, 501, WS_MESSAGE_VIDEO, payload, 100);
+    WS_Broadcast(ws, 1, 502, WS_MESSAGE_VIDEO | WS_MESSAGE_KEYFRAME, payload, 100);
+    assert(RecvFrame(fd, received, &size) == WS_OP_BINARY && received[3] == (502 & 0xFF));
+    close(fd);
+    // A GOP too long to replay is dropped: the next client asks for an IDR
+    for (uint32_t id = 503; id < 503 + WS_GOP_MAX_BYTES / sizeof(payload) + 1; ++id)
+        WS_Broadcast(ws, 1, id, WS_MESSAGE_VIDEO, payload, sizeof(payload));
+    deadline = OS_GetTime() + 2.0;
+    while (WS_GetViewerStats(ws, &stats) > 0 && OS_GetTime() < deadline) usleep(10 * 1000);
+    assert(WS_GetViewerStats(ws, &stats) == 0);
+    printf("WS: Viewer stats and decoder keyframe requests VERIFIED.\n");
+
+    // 7. A client that stops reading is not dropped: it loses discardable
+    // frames first, then skips to the next keyframe and asks for one
+    fd = ConnectWithBuffer(64 * 1024);
+    SendAll(fd, UPGRADE_REQUEST, len);
+    ReadResponse(fd, response, sizeof(response));
+    assert(WaitForHandshakes(ws, 1) == 1);
+
+    // Frame 0 is a keyframe, odd frames are discardable: 12 MB in total,
+    // far more than the queue and the socket buffers hold
+    const int stalled_frames = 120;
+    double start = OS_GetTime();
+    for (int i = 0; i < stalled_frames; ++i) {
+        uint8_t flags = WS_MESSAGE_VIDEO | (i == 0 ? WS_MESSAGE_KEYFRAME : 0) | ((i & 1) ? WS_MESSAGE_DISCARDABLE : 0);
+        WS_Broadcast(ws, 1, (uint32_t)i, flags, payload, sizeof(payload));
+    }
+    double elapsed = OS_GetTime() - start;
+    printf("WS: %d broadcasts to a stalled client took %.2f ms\n", stalled_frames, elapsed * 1000.0);
+    assert(elapsed < 0.5);
+    assert(WaitForHandshakes(ws, 1) == 1); // Resync keyframe request
+
+    WS_Broadcast(ws, 1, 1000, WS_MESSAGE_VIDEO | WS_MESSAGE_KEYFRAME, payload, sizeof(payload));
+    WS_Broadcast(ws, 1, 1001, WS_MESSAGE_VIDEO, payload, sizeof(payload));
+
+    int last_reference = -1, shed = 0, skipped_reference = 0;
+    bool resumed_at_keyframe = false;
+    while (true) {
+        assert(RecvFrame(fd, received, &size) == WS_OP_BINARY);
+        assert(size == sizeof(payload) + 5);
+        int id = (received[0] << 24) | (received[1] << 16) | (received[2] << 8) | received[3];
+        if (id >= 1000) {
+            // Nothing after the gap until the keyframe
+            if (id == 1000) resumed_at_keyframe = true;
+            assert(resumed_at_keyframe);
+            if (id == 1001) break;
+            continue;
+        }
+        assert(!(id & 1) || id > last_reference); // In order
+        if (!(id & 1)) {
+            for (int missing = last_reference + 2; missing < id; missing += 2) skipped_reference++;
+            assert(skipped_reference == 0); // References are never skipped mid-stream
+            for (int missing = last_reference + 1; missing < id; missing += 2) shed++;
+            last_reference = id;
+        }
+    }
+    printf("WS: Stalled client got %d reference frames (%d discardable shed), then resumed at the keyframe\n",
+           last_reference / 2 + 1, shed);
+    assert(last_reference < stalled_frames - 2);
+
+    // Still connected
+    SendFrame(fd, WS_OP_PING, "alive", 5);
+    assert(RecvFrame(fd, received, &size) == WS_OP_PONG);
+    close(fd);
+    printf("WS: Backpressure and keyframe resync VERIFIED.\n");
+
+    // 8. Far more clients than the old fixed table. They join mid-GOP, so
+    // each is replayed the cached keyframe and reference frames (not the
+    // discardable one) and nobody asks for an IDR; then one broadcast
+    WS_Broadcast(ws, 1, 1002, WS_MESSAGE_VIDEO | WS_MESSAGE_DISCARDABLE, payload, 1000);
+    WS_Broadcast(ws, 1, 1003, WS_MESSAGE_VIDEO, payload, 1000);
+    static int fds[WS_TEST_CLIENTS];
+    for (int i = 0; i < WS_TEST_CLIENTS; ++i) {
+        fds[i] = Connect();
+        SendAll(fds[i], UPGRADE_REQUEST, len);
+    }
+    for (int i = 0; i < WS_TEST_CLIENTS; ++i) {
+        ReadResponse(fds[i], response, sizeof(response));
+        assert(strncmp(response, "HTTP/1.1 101", 12) == 0);
+    }
+    WS_Broadcast(ws, 2, 7, 0, payload, 1000);
+    const int replayed[] = {1000, 1001, 1003, 7};
+    for (int i = 0; i < WS_TEST_CLIENTS; ++i) {
+        for (int f = 0; f < 4; ++f) {
+            assert(RecvFrame(fds[i], received, &size) == WS_OP_BINARY);
+            int id = (received[0] << 24) | (received[1] << 16) | (received[2] << 8) | received[3];
+            assert(id == replayed[f]);
+        }
+        assert(size == 1005 && received[4] == 2);
+    }
+    assert(WS_Poll(ws) == 0);
+    printf("WS: GOP replay and broadcast to %d clients VERIFIED.\n", WS_TEST_CLIENTS);
+
+    // 9. Shutdown says goodbye to everyone
+    WS_Shutdown(ws);
+    for (int i = 0; i < WS_TEST_CLIENTS; ++i) {
+        assert(RecvFrame(fds[i], received, &size) == WS_OP_CLOSE);
+        close(fds[i]);
+    }
+    printf("WS: Shutdown VERIFIED.\n");
+    return 0;
+}